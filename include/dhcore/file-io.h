@@ -51,9 +51,34 @@ enum seek_mode
 enum file_type
 {
     FILE_TYPE_MEM, /**< file resides in memory */
-    FILE_TYPE_DSK /**< file resides on disk */
+    FILE_TYPE_DSK, /**< file resides on disk */
+    FILE_TYPE_MAP, /**< file is memory-mapped from disk (read-only) */
+    FILE_TYPE_STREAM /**< file is read sequentially from user callbacks (read-only) */
 };
 
+/**
+ * Reads next @e size bytes of a stream file into @e buffer
+ * @return number of bytes that are read, 0 on end of stream or error
+ * @see fio_openstream
+ * @ingroup fileio
+ */
+typedef size_t (*pfn_fio_streamread)(void* param, void* buffer, size_t size);
+
+/**
+ * Restarts the stream from the beginning, used for backward seeks
+ * @return TRUE if successful
+ * @see fio_openstream
+ * @ingroup fileio
+ */
+typedef int (*pfn_fio_streamrewind)(void* param);
+
+/**
+ * Releases stream data, called when the file is closed
+ * @see fio_openstream
+ * @ingroup fileio
+ */
+typedef void (*pfn_fio_streamclose)(void* param);
+
 /**
  * @ingroup fileio
  */
@@ -63,6 +88,29 @@ enum file_mode
     FILE_MODE_READ /**< file is opened for reading */
 };
 
+/**
+ * Memory segment for gather writes
+ * @see fio_writev
+ * @ingroup fileio
+ */
+struct fio_segment
+{
+    const void* buffer;
+    size_t size;
+};
+
+/**
+ * Resolved source of a file in virtual-filesystem
+ * @see fio_resolve
+ * @ingroup fileio
+ */
+struct fio_source
+{
+    struct pak_file* pak; /**< pak that contains the file, NULL if file is on disk */
+    uint file_id; /**< id of the file inside the pak (see pak_findfile) */
+    char path[DH_PATH_MAX]; /**< resolved filepath on disk, if pak is NULL */
+};
+
 /* init/release manager */
 result_t fio_initmgr();
 void fio_releasemgr();
@@ -76,7 +124,7 @@ void fio_releasemgr();
  * @endcode
  * @param directory directory on the disk to add to root directories of virtual-filesystem
  * @param monitor Enables file monitoring for the entire directory files and it's subtree
- * (Requires @e _FILEMON_ compiler preprocessor)
+ * (Requires @e _FILEMON_ compiler preprocessor, linux builds use native inotify backend)
  * @ingroup fileio
  */
 CORE_API int fio_addvdir(const char* directory, int monitor);
@@ -109,6 +157,26 @@ CORE_API void fio_addbundle(const char *bundle_name);
  */
 CORE_API void fio_clearpaks();
 
+/**
+ * Resolves filepath to the actual source of the file, paks are searched first and then
+ * virtual-directories, same as fio_openmem
+ * @param src (out) resolved file source
+ * @param ignore_vfs if true, virtual-filesystems will be ignored and filepath is checked on disk
+ * @return TRUE if file is found
+ * @ingroup fileio
+ */
+CORE_API int fio_resolve(struct fio_source* src, const char* filepath, int ignore_vfs);
+
+/**
+ * Drops cached path resolves of the virtual-filesystem. Resolves (including missing files) are -
+ * cached and flushed automatically when vdirs/paks change, files are created with fio_createdisk -
+ * or monitored directories report changes. Call this if files are added or removed externally -
+ * in unmonitored virtual-directories
+ * @param filepath virtual filepath to invalidate, NULL invalidates the whole cache
+ * @ingroup fileio
+ */
+CORE_API void fio_invalidate(const char* filepath);
+
  /**
   * Create a file in memory
   * @param alloc memory allocator for internal file data
@@ -128,6 +196,27 @@ CORE_API file_t fio_createmem(struct allocator* alloc, const char* name, uint me
   */
 CORE_API file_t fio_openmem(struct allocator* alloc, const char* filepath, int ignore_vfs,
                             uint mem_id);
+/**
+ * Open a list of files into memory together, paths are resolved first and pak items are read -
+ * in order of their offset in the pak, adjacent items are coalesced into large sequential reads
+ * @param filepaths list of filepaths, they are resolved same as fio_openmem
+ * @param cnt number of items in filepaths and files
+ * @param files (out) file handles, same order as filepaths. file is NULL if it's not found or failed
+ * @return number of files that are opened
+ * @ingroup fileio
+ */
+CORE_API uint fio_openmem_batch(struct allocator* alloc, const char** filepaths, uint cnt,
+                                int ignore_vfs, uint mem_id, OUT file_t* files);
+
+/**
+ * Resolves a list of files and hints OS to start reading them into it's cache (readahead),
+ * useful on cold starts before the files are actually opened. Does not block for reading
+ * (Only takes effect on linux)
+ * @return number of files that are resolved
+ * @ingroup fileio
+ */
+CORE_API uint fio_prefetch(const char** filepaths, uint cnt, int ignore_vfs);
+
 /**
  * Attach a memory buffer to the file for reading, attached buffer should not be -
  * managed (deallocated) by caller anymore
@@ -140,6 +229,13 @@ CORE_API file_t fio_openmem(struct allocator* alloc, const char* filepath, int i
 CORE_API file_t fio_attachmem(struct allocator* alloc, void* buffer, size_t size, const char* name,
                               uint mem_id);
 
+/**
+ * Same as fio_attachmem, but buffer must have one extra byte after the data (size+1 bytes), -
+ * which is set to zero. So text parsers can use the data in place (see fio_peektext)
+ * @ingroup fileio
+ */
+CORE_API file_t fio_attachmemz(struct allocator* alloc, void* buffer, size_t size,
+                               const char* name, uint mem_id);
 
 CORE_API char* fio_loadtext(struct allocator *alloc, const char *filepath, int ignore_vfs,
                             uint mem_id, OUT OPTIONAL size_t *size);
@@ -171,6 +267,33 @@ CORE_API file_t fio_createdisk(const char* filepath);
  */
 CORE_API file_t fio_opendisk(const char* filepath, int ignore_vfs);
 
+/**
+ * Opens a file from disk by mapping it into memory (read-only), the file is not read on open and -
+ * it's pages are loaded lazily on access. filepath is resolved same as fio_opendisk
+ * (paks are not searched)
+ * @param ignore_vfs if true, virtual-filesystems will be ignored and file will be mapped directly
+ * @return valid file handle or NULL if failed
+ * @see fio_getptr
+ * @ingroup fileio
+ */
+CORE_API file_t fio_openmap(const char* filepath, int ignore_vfs);
+
+/**
+ * Opens a read-only file that is read sequentially from user callbacks, data is not stored -
+ * and is produced on each read (for example decompressed lazily). Forward seeks skip the data -
+ * by reading it, backward seeks rewind the stream and skip from the beginning
+ * @param name name (path) of the file
+ * @param size total size of the stream data (in bytes)
+ * @param read_fn callback that reads stream data
+ * @param rewind_fn (optional) callback that restarts the stream, backward seeks fail if it's NULL
+ * @param close_fn (optional) callback that is called when file is closed
+ * @param param user parameter that is passed to callbacks
+ * @return valid file handle or NULL if failed
+ * @ingroup fileio
+ */
+CORE_API file_t fio_openstream(const char* name, uint64 size, pfn_fio_streamread read_fn,
+    pfn_fio_streamrewind rewind_fn, pfn_fio_streamclose close_fn, void* param);
+
 /**
  * Close an opened file
  * @ingroup fileio
@@ -185,6 +308,14 @@ CORE_API void fio_close(file_t f);
  */
 CORE_API int fio_seek(file_t f, enum seek_mode seek, int offset);
 
+/**
+ * 64bit version of fio_seek, for files larger than 2gb
+ * @return new position in the file, -1 if failed
+ * @see fio_seek
+ * @ingroup fileio
+ */
+CORE_API int64 fio_seek64(file_t f, enum seek_mode seek, int64 offset);
+
 /**
  * Reads data from file
  * @param buffer output buffer, buffer should have enough size of (item_size*items_cnt)
@@ -205,18 +336,92 @@ CORE_API size_t fio_read(file_t f, void* buffer, size_t item_size, size_t items_
 */
 CORE_API size_t fio_write(file_t f, const void* buffer, size_t item_size, size_t items_cnt);
 
+/**
+ * Gather write, writes a list of memory segments to the file in order, same as calling -
+ * fio_write for each segment. Memory files grow only once for all segments, disk files write -
+ * the segments directly with writev (on posix), without merging them into one buffer
+ * @param segs array of segments to write
+ * @param seg_cnt number of segments
+ * @return number of bytes that are written
+ * @ingroup fileio
+ */
+CORE_API size_t fio_writev(file_t f, const struct fio_segment* segs, uint seg_cnt);
+
+/**
+ * Reserves buffer of a memory file (created by fio_createmem) for writing, to avoid growing -
+ * the buffer when final size is known (or can be estimated)
+ * @param size total buffer size in bytes
+ * @return FALSE if out of memory
+ * @ingroup fileio
+ */
+CORE_API int fio_reservemem(file_t f, size_t size);
+
 /**
  * @return File size in bytes
  * @ingroup fileio
  */
 CORE_API size_t fio_getsize(file_t f);
 
+/**
+ * @return File size in bytes (64bit), for files larger than 4gb on 32bit systems
+ * @ingroup fileio
+ */
+CORE_API uint64 fio_getsize64(file_t f);
+
 /**
  * @return Current position offset in the file (in bytes)
  * @ingroup fileio
  */
 CORE_API size_t fio_getpos(file_t f);
 
+/**
+ * @return Current position offset in the file (64bit)
+ * @ingroup fileio
+ */
+CORE_API uint64 fio_getpos64(file_t f);
+
+/**
+ * Direct pointer to the file data, valid for memory (FILE_TYPE_MEM) and memory-mapped -
+ * (FILE_TYPE_MAP) files until the file is closed
+ * @return pointer to the beginning of file data, NULL for disk files or empty mapped files
+ * @ingroup fileio
+ */
+CORE_API const void* fio_getptr(file_t f);
+
+/**
+ * Zero-copy view of memory and memory-mapped files, returns pointer to the data at current -
+ * position without moving it. Pointer is valid until the file is closed (or written to)
+ * @param psize (out) remaining bytes from the current position
+ * @return pointer to data at current position, NULL for disk files
+ * @ingroup fileio
+ */
+CORE_API const void* fio_peek(file_t f, OUT size_t* psize);
+
+/**
+ * Zero-copy read, same as fio_read but returns pointer to the data instead of copying it -
+ * and advances the position by size bytes
+ * @return pointer to data at current position, NULL if there are less than size bytes remaining -
+ * or the file is a disk file (then fio_read should be used)
+ * @ingroup fileio
+ */
+CORE_API const void* fio_borrow(file_t f, size_t size);
+
+/**
+ * Skips bytes in the file without reading them
+ * @return number of bytes that are actually skipped
+ * @ingroup fileio
+ */
+CORE_API size_t fio_advance(file_t f, size_t size);
+
+/**
+ * Zero-copy view for text parsers, returns a zero-terminated string of the data at current -
+ * position. Memory files opened with fio_openmem (disk, paks and async reads) and most mapped -
+ * files are zero-terminated
+ * @return zero-terminated data at current position, NULL if file data is not zero-terminated
+ * @ingroup fileio
+ */
+CORE_API const char* fio_peektext(file_t f);
+
 /**
  * Returns file-path, the one that is called with fio_openXXX functions
  * @ingroup fileio
@@ -242,6 +447,76 @@ CORE_API enum file_type fio_gettype(file_t f);
  */
 CORE_API enum file_mode fio_getmode(file_t f);
 
+/**
+ * Flags for asynchronous file reads
+ * @see fio_read_async
+ * @ingroup fileio
+ */
+enum fio_async_flags
+{
+    FIO_ASYNC_IGNOREVFS = (1<<0), /**< ignore virtual-filesystem, same as ignore_vfs in fio_openmem */
+    FIO_ASYNC_CALLBACK_IO = (1<<1) /**< call completion callback directly from io thread, instead -
+                                    of fio_async_update */
+};
+
+/**
+ * Completion callback for asynchronous file reads
+ * @param f memory file (read mode) that contains the data, NULL if read is failed.
+ * callback owns the file and should close it when done
+ * @param filepath filepath that is requested in fio_read_async
+ * @param param user defined param submitted by fio_read_async
+ * @see fio_read_async
+ * @ingroup fileio
+ */
+typedef void (*pfn_fio_async_done)(file_t f, const char* filepath, void* param);
+
+/**
+ * Initialize asynchronous file reads, on linux io_uring is used if the kernel supports it,
+ * otherwise a pool of io threads reads the files with blocking calls
+ * @param thread_cnt number of io threads in the fallback pool, 0 for default (2)
+ * @see fio_read_async
+ * @ingroup fileio
+ */
+CORE_API result_t fio_async_init(int thread_cnt);
+
+/**
+ * Release asynchronous file reads, waits for remaining requests to finish and drops their
+ * completions (files are closed without calling the callbacks)
+ * @ingroup fileio
+ */
+CORE_API void fio_async_release();
+
+/**
+ * Reads a file into memory asynchronously, filepath is resolved the same way as fio_openmem.
+ * Completion callback is called from fio_async_update, unless FIO_ASYNC_CALLBACK_IO flag is set\n
+ * **Note** @e alloc should be thread-safe (like mem_heap()), because data is allocated and
+ * decompressed in io or task-mgr threads
+ * @param alloc allocator for file data
+ * @param flags combination of fio_async_flags
+ * @param done_fn completion callback
+ * @param param user defined param which is passed to completion callback
+ * @return RET_OK if request is submitted, RET_FILE_ERROR if file is not found
+ * @see fio_async_update
+ * @ingroup fileio
+ */
+CORE_API result_t fio_read_async(struct allocator* alloc, const char* filepath, uint flags,
+                                 uint mem_id, pfn_fio_async_done done_fn, void* param);
+
+/**
+ * Dispatches finished asynchronous reads to their callbacks, must be called from the main thread.
+ * If task manager is initialized, decompression and callbacks run as a task-mgr job in parallel,
+ * so callbacks should be thread-safe in that case
+ * @return number of requests that are dispatched
+ * @ingroup fileio
+ */
+CORE_API int fio_async_update();
+
+/**
+ * @return number of asynchronous requests that are not yet dispatched to their callbacks
+ * @ingroup fileio
+ */
+CORE_API int fio_async_pending();
+
 /**
  * @ingroup fileio
  */
@@ -260,6 +535,9 @@ CORE_API void fio_mon_reg(const char* filepath, pfn_fio_modify fn, reshandle_t h
 CORE_API void fio_mon_unreg(const char* filepath);
 
 /**
+ * Dispatches changes of registered files to their callbacks, call this once per frame\n
+ * On linux (inotify backend), successive changes to a file are coalesced and dispatched once -
+ * after the file has been quiet for a short period
  * @ingroup fileio
  */
 CORE_API void fio_mon_update();
@@ -318,6 +596,11 @@ public:
         return File(fio_opendisk(filepath, ignore_vfs));
     }
 
+    static File open_map(const char *filepath, bool ignore_vfs = false)
+    {
+        return File(fio_openmap(filepath, ignore_vfs));
+    }
+
     static File attach_mem(void *buff, size_t size, const char *alias,
                              allocator *alloc = mem_heap(), uint mem_id = 0)
     {
@@ -342,6 +625,12 @@ public:
         fio_write(m_file, buff, item_sz, item_cnt);
     }
 
+    size_t writev(const fio_segment *segs, uint seg_cnt)
+    {
+        ASSERT(m_file);
+        return fio_writev(m_file, segs, seg_cnt);
+    }
+
     MemData detach_mem()
     {
         MemData fm;
@@ -373,6 +662,12 @@ public:
         return fio_gettype(m_file);
     }
 
+    const void* ptr() const
+    {
+        ASSERT(m_file);
+        return fio_getptr(m_file);
+    }
+
     void close()
     {
         if (m_file != NULL) {
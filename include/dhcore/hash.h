@@ -121,6 +121,26 @@ CORE_API uint hash_murmur32(const void* key, size_t size_bytes, uint seed);
  */
 CORE_API hash_t hash_murmur128(const void* key, size_t size_bytes, uint seed);
 
+/**
+ * Fast 64bit hash for large buffers, processes data in 64 byte stripes with independent lanes
+ * (uses SSE2 if _SIMD_SSE_ is defined, scalar and SIMD paths produce same results)\n
+ * Much faster than murmur on large data, mainly suitable for data validity checks
+ * @param key buffer containing data to be hashed
+ * @param size_bytes size of buffer (bytes)
+ * @param seed random seed value (must be same between hashes in order to compare
+ * @return 64bit hash value
+ * @see hash_fast128
+ * @ingroup hash
+ */
+CORE_API uint64 hash_fast64(const void* key, size_t size_bytes, uint seed);
+
+/**
+ * Fast 128bit hash for large buffers, same as hash_fast64 but with 128bit output
+ * @see hash_fast64
+ * @ingroup hash
+ */
+CORE_API hash_t hash_fast128(const void* key, size_t size_bytes, uint seed);
+
 /**
  * hash 64bit value to 32bit
  * @param n 64bit value to be hashed
@@ -17,7 +17,11 @@
  /**
  * @defgroup JSON JSON
  * Using cJSON library, this file is basically a wrapper to cjson\n
- * note: library is thread-safe as long as multiple threads do not manipulate same JSON tree
+ * note: library is thread-safe as long as multiple threads do not manipulate same JSON tree\n
+ * Parsed documents are allocated from a single arena per document (structural characters are
+ * found with SSE2), all of their nodes and strings are released at once when the root is destroyed,
+ * so nodes of a parsed document must not be used after it's root is destroyed\n
+ * Documents can also be stored in binary (MessagePack) format, which is loaded without text parsing\n
  * for more JSON information visit: http://www.JSON.org/fatfree.html\n
  * libcjson : http://sourceforge.net/projects/cjson/\n
  */
@@ -88,6 +92,83 @@ CORE_API json_t json_parsefilef(file_t f, struct allocator* tmp_alloc);
  */
 CORE_API json_t json_parsestring(const char* str);
 
+/**
+ * Parse JSON text buffer (not required to be zero-terminated) with a custom allocator
+ * @param text JSON formatted text
+ * @param len size of the text in bytes
+ * @param alloc allocator for the whole document, can be a stack (temp) allocator that is reset
+ * after the document is destroyed, so parsing doesn't touch the heap
+ * @return JSON object, NULL if error occured
+ * @ingroup JSON
+ */
+CORE_API json_t json_parsebuffer(const char* text, size_t len, struct allocator* alloc);
+
+/**
+ * Value that is passed to SAX value callback
+ * @see json_sax
+ * @ingroup JSON
+ */
+struct json_sax_value
+{
+    enum json_type type;
+    const char* s;  /**< JSON_STRING: unescaped zero-terminated string, valid during the callback */
+    uint s_len;
+    fl64 n;         /**< JSON_NUM */
+    int i;          /**< JSON_NUM: integer value (clamped), JSON_BOOL: TRUE/FALSE */
+};
+
+/**
+ * SAX callback for beginning/ending of objects and arrays, return FALSE to stop parsing
+ * @ingroup JSON
+ */
+typedef int (*pfn_json_sax_node)(void* param);
+
+/**
+ * SAX callback for object member names, key is valid during the callback, return FALSE to stop
+ * @ingroup JSON
+ */
+typedef int (*pfn_json_sax_key)(const char* key, uint len, void* param);
+
+/**
+ * SAX callback for values (strings, numbers, bools and nulls), return FALSE to stop parsing
+ * @ingroup JSON
+ */
+typedef int (*pfn_json_sax_value)(const struct json_sax_value* value, void* param);
+
+/**
+ * SAX callbacks, any of them can be NULL
+ * @ingroup JSON
+ */
+struct json_sax
+{
+    pfn_json_sax_node obj_begin_fn;
+    pfn_json_sax_node obj_end_fn;
+    pfn_json_sax_node arr_begin_fn;
+    pfn_json_sax_node arr_end_fn;
+    pfn_json_sax_key key_fn;
+    pfn_json_sax_value value_fn;
+};
+
+/**
+ * Parses JSON file without building the tree, nodes are reported to SAX callbacks as they are read.
+ * File is read in fixed size chunks so memory usage doesn't depend on the file size (only the
+ * largest string is kept), which makes it suitable for files that are too large to be loaded.
+ * Concatenated documents (json-lines logs) are reported one after another
+ * @param f file handle, read from current position to the end
+ * @param sax callbacks
+ * @param param user parameter that is passed to callbacks
+ * @return RET_OK if whole file is parsed, RET_ABORT if a callback stopped parsing
+ * @ingroup JSON
+ */
+CORE_API result_t json_sax_parsef(file_t f, const struct json_sax* sax, void* param);
+
+/**
+ * Parses JSON file on the disk with SAX callbacks
+ * @see json_sax_parsef
+ * @ingroup JSON
+ */
+CORE_API result_t json_sax_parsefile(const char* filepath, const struct json_sax* sax, void* param);
+
 /**
  * Save JSON data to file
  * @param filepath path to the file on the disk
@@ -122,7 +203,71 @@ CORE_API char* json_savetobuffer(json_t j, size_t* outsize, int trim);
 CORE_API void json_deletebuffer(char* buffer);
 
 /**
- * Destroys JSON object and free memory
+ * Parse binary (MessagePack) JSON data, data must hold exactly one root value. Data is read in
+ * place and nodes are built into a single arena, like parsed text documents
+ * @param data binary data, created by json_savetobinf or any other MessagePack writer
+ * (bin and ext types are not supported, map keys must be strings)
+ * @return JSON object, NULL if error occured
+ * @ingroup JSON
+ */
+CORE_API json_t json_parsebin(const void* data, size_t size);
+
+/**
+ * Parse binary JSON file from current position to the end, memory and memory-mapped files -
+ * (pak items, fio_openmap) are parsed in place without copying their data
+ * @param tmp_alloc allocator for reading disk files into a temp buffer
+ * @return JSON object, NULL if error occured
+ * @ingroup JSON
+ */
+CORE_API json_t json_parsebinf(file_t f, struct allocator* tmp_alloc);
+
+/**
+ * Parse binary JSON file on the disk, file is memory-mapped and parsed in place
+ * @return JSON object, NULL if error occured
+ * @ingroup JSON
+ */
+CORE_API json_t json_parsebinfile(const char* filepath);
+
+/**
+ * Save JSON data to file handle in binary (MessagePack) format, integers are stored in the
+ * smallest type that holds them and other numbers as float32 (if it's exact) or float64
+ * @param f file handle that is ready and opened for writing
+ * @ingroup JSON
+ */
+CORE_API result_t json_savetobinf(json_t j, file_t f);
+
+/**
+ * Save JSON data to file on the disk in binary format
+ * @see json_savetobinf
+ * @ingroup JSON
+ */
+CORE_API result_t json_savetobinfile(json_t j, const char* filepath);
+
+/**
+ * Save JSON data to buffer in binary format, user should call @e json_deletebuffer on the result
+ * @param outsize output buffer size
+ * @see json_savetobinf
+ * @ingroup JSON
+ */
+CORE_API char* json_savetobinbuffer(json_t j, size_t* outsize);
+
+/**
+ * Converts JSON text file to binary format
+ * @ingroup JSON
+ */
+CORE_API result_t json_convert_tobin(const char* json_filepath, const char* bin_filepath);
+
+/**
+ * Converts binary JSON file to text format
+ * @param trim trims output JSON data (no formatting)
+ * @ingroup JSON
+ */
+CORE_API result_t json_convert_totext(const char* bin_filepath, const char* json_filepath,
+                                      int trim);
+
+/**
+ * Destroys JSON object and free memory, destroying root of a parsed document frees the whole
+ * document at once
  * @param j JSON object that is allocated previously
  * @ingroup JSON
  */
@@ -210,11 +355,19 @@ CORE_API int json_getarr_count(json_t j);
 CORE_API json_t json_getarr_item(json_t j, int idx);
 
 /**
- * get child item from an JSON object referenced by a name
+ * get child item from an JSON object referenced by a name (case-sensitive), objects with many
+ * members build a lookup index on first use, so lookups in wide objects are O(1)
  * @ingroup JSON
  */
 CORE_API json_t json_getitem(json_t j, const char* name);
 
+/**
+ * get child item from an JSON object referenced by a name, ignoring case of the name
+ * @see json_getitem
+ * @ingroup JSON
+ */
+CORE_API json_t json_getitem_nocase(json_t j, const char* name);
+
 
 /* creating JSON items for different types
  **
@@ -408,6 +561,11 @@ public:
         return JNode(json_getitem(m_j, name));
     }
 
+    JNode child_nocase(const char *name) const
+    {
+        return JNode(json_getitem_nocase(m_j, name));
+    }
+
     const char* child_str(const char *name, const char *def_val = "") const
     {
         return json_gets_child(m_j, name, def_val);
@@ -21,6 +21,7 @@
 #include "core-api.h"
 
 #define LOG_STDOUT_PADDING "50"
+#define LOG_ASYNC_RING_SIZE (64*1024)   /**< Default size of per-thread rings in async mode */
 
 /**
  * @defgroup log Logger
@@ -48,6 +49,17 @@ enum log_progress_result
     LOG_PROGRESS_NONFATAL
 };
 
+/**
+ * What happens to messages when thread's ring is full in async mode
+ * @see log_setasync
+ * @ingroup log
+ */
+enum log_overflow
+{
+    LOG_OVERFLOW_DROP = 0, /**< message is dropped and counted in log_stats::dropped_cnt */
+    LOG_OVERFLOW_BLOCK /**< logging thread waits until writer thread makes room in the ring */
+};
+
 /**
  * @ingroup log
  */
@@ -56,6 +68,7 @@ struct log_stats
     long volatile msgs_cnt;
     long volatile errors_cnt;
     long volatile warnings_cnt;
+    long volatile dropped_cnt;  /**< messages that are dropped by LOG_OVERFLOW_DROP policy */
 };
 
 /**
@@ -109,6 +122,32 @@ CORE_API int log_isdebugger();
  */
 CORE_API int log_isoutputfunc();
 
+/**
+ * enables/disables asynchronous logging, in async mode, each thread pushes messages into it's own
+ * lock-free ring and a background thread writes them to outputs in batches, so logging threads do
+ * not wait for console/file I/O. Custom output functions are called from the background thread.\n
+ * Should not be called while other threads are logging
+ * @param ring_size size of each thread's ring in bytes (0 = LOG_ASYNC_RING_SIZE), total memory is
+ * bounded to ring_size multiplied by number of live threads that log, rings of exited threads are
+ * freed after their messages are written
+ * @param overflow policy for messages that do not fit into a full ring
+ * @ingroup log
+ */
+CORE_API result_t log_setasync(int enable, uint ring_size, enum log_overflow overflow);
+
+/**
+ * checks if logger is in async mode
+ * @ingroup log
+ */
+CORE_API int log_isasync();
+
+/**
+ * blocks until all messages that are logged before the call are written to outputs, and flushes
+ * the log file
+ * @ingroup log
+ */
+CORE_API void log_flush();
+
 /**
  * print text to the logger
  * @param type type of log message (@see log_type)
@@ -138,4 +177,8 @@ CORE_API void log_endprogress(enum log_progress_result res);
 result_t log_init();
 void log_release();
 
+/* switches logger to synchronous mode and writes pending async messages on the calling thread,
+ * called by crash handler before it prints the crash report */
+void log_crashflush();
+
 #endif /*__LOG_H__*/
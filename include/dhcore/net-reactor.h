@@ -0,0 +1,240 @@
+/***********************************************************************************
+ * Copyright (c) 2014, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#ifndef __NETREACTOR_H__
+#define __NETREACTOR_H__
+
+#include "types.h"
+#include "core-api.h"
+#include "net-socket.h"
+
+/**
+ * @defgroup reactor Socket reactor
+ * Waits for readiness of many sockets at once and dispatches them to their callbacks, along with
+ * timers. Uses epoll on linux and poll on other platforms. Timers use the hi-res clock directly, so
+ * the timer manager (CORE_INIT_TIMER) is not required.\n
+ * Registered sockets should be non-blocking (see @e sock_setnonblock).
+ * A reactor is not thread-safe and must be used by a single thread, except @e sock_reactor_wakeup.\n
+ * Example usage:
+ * @code
+ * static void on_client(socket_t sock, uint events, void* param)
+ * {
+ *     struct sock_reactor* r = (struct sock_reactor*)param;
+ *     char buff[1024];
+ *     int n = sock_tcp_recv(sock, buff, sizeof(buff));
+ *     if (n <= 0)  {
+ *         sock_reactor_remove(r, sock);
+ *         sock_tcp_destroy(sock);
+ *     }
+ * }
+ *
+ * static void on_accept(socket_t sock, uint events, void* param)
+ * {
+ *     socket_t client = sock_tcp_accept(sock, NULL);
+ *     sock_setnonblock(client, TRUE);
+ *     sock_reactor_add((struct sock_reactor*)param, client, SOCK_EVENT_READ, 0, on_client, param);
+ * }
+ *
+ * struct sock_reactor* r = sock_reactor_create();
+ * sock_reactor_add(r, listen_sock, SOCK_EVENT_READ, 0, on_accept, r);
+ * while (running)
+ *     sock_reactor_wait(r, 1000);
+ * sock_reactor_destroy(r);
+ * @endcode
+ * @ingroup reactor
+ */
+
+/**
+ * Socket events, used as interest on registration, and reported to callbacks
+ * @ingroup reactor
+ */
+enum sock_event
+{
+    SOCK_EVENT_READ = (1<<0), /**< Socket has data to receive, or a pending connection to accept */
+    SOCK_EVENT_WRITE = (1<<1), /**< Socket can send data */
+    SOCK_EVENT_ERROR = (1<<2) /**< Socket has an error or peer hung up (reported only) */
+};
+
+/**
+ * Socket registration flags
+ * @ingroup reactor
+ */
+enum sock_reactor_flag
+{
+    /**
+     * Edge-triggered, events are reported only when socket's state changes, so the callback must
+     * recv/send until the operation would block. On platforms without epoll, events are reported
+     * level-triggered, which works with the same callbacks
+     */
+    SOCK_REACTOR_EDGE = (1<<0),
+    /**
+     * For sockets that are registered in multiple reactors (like a listening socket that is shared
+     * by multiple threads), only one of the waiting reactors is woken up for each event (epoll only)
+     */
+    SOCK_REACTOR_EXCLUSIVE = (1<<1)
+};
+
+struct sock_reactor;
+
+/**
+ * Socket callback
+ * @param sock Ready socket
+ * @param events Combination of @e sock_event values
+ * @param param User-defined pointer that is passed on registration
+ * @ingroup reactor
+ */
+typedef void (*pfn_sock_event)(socket_t sock, uint events, void* param);
+
+/**
+ * Timer callback
+ * @param timer_id Id of the timer that is returned by @e sock_reactor_addtimer
+ * @param param User-defined pointer that is passed on @e sock_reactor_addtimer
+ * @ingroup reactor
+ */
+typedef void (*pfn_sock_timer)(uint timer_id, void* param);
+
+/**
+ * Creates a reactor
+ * @return Reactor object, or NULL if system objects could not be created
+ * @ingroup reactor
+ */
+CORE_API struct sock_reactor* sock_reactor_create();
+
+/**
+ * Destroys the reactor, registered sockets are not closed
+ * @ingroup reactor
+ */
+CORE_API void sock_reactor_destroy(struct sock_reactor* r);
+
+/**
+ * Registers socket in reactor
+ * @param events Interested events, combination of SOCK_EVENT_READ and SOCK_EVENT_WRITE
+ * @param flags Combination of @e sock_reactor_flag values
+ * @param event_fn Callback that is called when socket is ready
+ * @param param User-defined pointer that is passed to callback
+ * @ingroup reactor
+ */
+CORE_API result_t sock_reactor_add(struct sock_reactor* r, socket_t sock, uint events, uint flags,
+                                   pfn_sock_event event_fn, void* param);
+
+/**
+ * Changes interested events of a registered socket
+ * @ingroup reactor
+ */
+CORE_API result_t sock_reactor_modify(struct sock_reactor* r, socket_t sock, uint events);
+
+/**
+ * Unregisters socket, can be called inside callbacks, even for sockets other than the ready one.
+ * Socket must be removed before it's closed
+ * @ingroup reactor
+ */
+CORE_API void sock_reactor_remove(struct sock_reactor* r, socket_t sock);
+
+/**
+ * Adds a timer that is triggered by @e sock_reactor_wait
+ * @param interval Timer interval in milliseconds
+ * @param repeat Timer is repeated until it's removed, if not, it's removed after first trigger
+ * @return Timer Id, 0 if failed
+ * @ingroup reactor
+ */
+CORE_API uint sock_reactor_addtimer(struct sock_reactor* r, uint interval, int repeat,
+                                    pfn_sock_timer timer_fn, void* param);
+
+/**
+ * Removes a timer, can be called inside callbacks
+ * @ingroup reactor
+ */
+CORE_API void sock_reactor_removetimer(struct sock_reactor* r, uint timer_id);
+
+/**
+ * Waits for socket events or timers, and dispatches them to callbacks
+ * @param timeout Maximum wait time in milliseconds, MT_TIMEOUT_INFINITE (mt.h) waits until an
+ * event, timer or wakeup occurs
+ * @return Number of dispatched sockets and timers, -1 if wait fails
+ * @ingroup reactor
+ */
+CORE_API int sock_reactor_wait(struct sock_reactor* r, uint timeout);
+
+/**
+ * Interrupts @e sock_reactor_wait, can be called from any thread
+ * @ingroup reactor
+ */
+CORE_API void sock_reactor_wakeup(struct sock_reactor* r);
+
+#ifdef __cplusplus
+namespace dh {
+
+class SocketReactor
+{
+private:
+    sock_reactor *m_r = nullptr;
+
+public:
+    SocketReactor()
+    {
+        m_r = sock_reactor_create();
+    }
+
+    ~SocketReactor()
+    {
+        if (m_r != nullptr)
+            sock_reactor_destroy(m_r);
+        m_r = nullptr;
+    }
+
+    bool add(socket_t sock, uint events, pfn_sock_event event_fn, void *param = nullptr,
+             uint flags = 0)
+    {
+        return IS_OK(sock_reactor_add(m_r, sock, events, flags, event_fn, param));
+    }
+
+    bool modify(socket_t sock, uint events)
+    {
+        return IS_OK(sock_reactor_modify(m_r, sock, events));
+    }
+
+    void remove(socket_t sock)
+    {
+        sock_reactor_remove(m_r, sock);
+    }
+
+    uint add_timer(uint interval, bool repeat, pfn_sock_timer timer_fn, void *param = nullptr)
+    {
+        return sock_reactor_addtimer(m_r, interval, repeat ? TRUE : FALSE, timer_fn, param);
+    }
+
+    void remove_timer(uint timer_id)
+    {
+        sock_reactor_removetimer(m_r, timer_id);
+    }
+
+    int wait(uint timeout = UINT32_MAX)
+    {
+        return sock_reactor_wait(m_r, timeout);
+    }
+
+    void wakeup()
+    {
+        sock_reactor_wakeup(m_r);
+    }
+
+    operator sock_reactor*() {   return m_r; }
+    bool is_valid() const   {   return m_r != nullptr;  }
+};
+
+} // dh
+#endif
+
+#endif /* __NETREACTOR_H__ */
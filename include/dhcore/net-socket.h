@@ -18,6 +18,7 @@
 
 #include "types.h"
 #include "core-api.h"
+#include "allocator.h"
 
 /**
  * @defgroup socket Sockets
@@ -38,6 +39,63 @@ typedef int socket_t;
   #define SOCK_ERROR     -1
 #endif
 
+/**
+ * Buffer descriptor for scatter/gather tcp functions, layout matches the system's own descriptor
+ * (iovec/WSABUF), so arrays are passed to the system without conversion
+ * @ingroup socket
+ */
+#if defined(_WIN_)
+struct sock_buf
+{
+    u_long size;    /**< buffer size in bytes */
+    char* data; /**< buffer data */
+};
+#else
+struct sock_buf
+{
+    void* data; /**< buffer data */
+    size_t size;    /**< buffer size in bytes */
+};
+#endif
+
+/**
+ * Binary IPv4 address and port, avoids string conversions of addresses in batched udp functions
+ * @ingroup socket
+ */
+struct sock_addr
+{
+    uint ip;    /**< ip address in network byte order */
+    uint16 port;  /**< port number */
+};
+
+/**
+ * Single udp datagram inside @e sock_udp_batch
+ * @ingroup socket
+ */
+struct sock_packet
+{
+    void* data; /**< points to packet's preallocated buffer inside batch */
+    int size;   /**< data size in bytes */
+    int truncated;  /**< TRUE if received datagram didn't fit packet_size, extra bytes are discarded */
+    struct sock_addr addr;  /**< sender address for received packets, target for sent packets */
+};
+
+/**
+ * Preallocated batch of udp packets, used to receive/send many datagrams with one system call
+ * (recvmmsg/sendmmsg on linux, other platforms fallback to one call per datagram)
+ * @see sock_udp_batch_create
+ * @ingroup socket
+ */
+struct sock_udp_batch
+{
+    struct allocator* alloc;
+    struct sock_packet* packets;  /**< packets, only first 'cnt' items are valid */
+    int cnt;    /**< number of received packets, or packets that are added for sending */
+    int max_cnt;    /**< maximum number of packets */
+    int packet_size;    /**< maximum size of each packet in bytes */
+    void* sys;  /* platform specific message headers */
+};
+
 /* */
 result_t sock_init();
 void sock_release();
@@ -92,6 +150,68 @@ CORE_API int sock_udp_recv(socket_t sock, void* buffer, int size, char* out_send
 CORE_API int sock_udp_send(socket_t sock, const char* ipaddr, int port, const void* buffer, 
     int size);
 
+/**
+ * Fills binary address from ip address string and port number
+ * @ingroup socket
+ */
+CORE_API void sock_addr_set(struct sock_addr* addr, const char* ipaddr, int port);
+
+/**
+ * Converts binary address to ip address string
+ * @param ipaddr Output string, should hold at least 16 characters
+ * @return ipaddr
+ * @ingroup socket
+ */
+CORE_API char* sock_addr_getip(const struct sock_addr* addr, OUT char* ipaddr);
+
+/**
+ * Creates udp packet batch, all buffers are allocated once and reused by batch receive/send calls
+ * @param alloc Allocator for packets and buffers (@e mem_heap for default heap allocator)
+ * @param packet_cnt Maximum number of packets that are received/sent in one call
+ * @param packet_size Maximum packet size in bytes, bigger datagrams are truncated on receive
+ * @ingroup socket
+ */
+CORE_API result_t sock_udp_batch_create(struct allocator* alloc, struct sock_udp_batch* batch,
+    int packet_cnt, int packet_size);
+
+/**
+ * @ingroup socket
+ */
+CORE_API void sock_udp_batch_destroy(struct sock_udp_batch* batch);
+
+/**
+ * Removes all packets from batch
+ * @ingroup socket
+ */
+CORE_API void sock_udp_batch_clear(struct sock_udp_batch* batch);
+
+/**
+ * Receives multiple datagrams into batch packets, blocks until at least one datagram arrives
+ * (if socket is blocking), then receives pending datagrams up to batch's maximum without waiting.
+ * Previous batch contents are discarded. Datagrams bigger than batch's packet_size are cut to
+ * packet_size and have their @e truncated flag set
+ * @return Number of received packets (batch->cnt), <0 if error occured
+ * @ingroup socket
+ */
+CORE_API int sock_udp_batch_recv(socket_t sock, struct sock_udp_batch* batch);
+
+/**
+ * Adds a packet to batch for sending, packet data should be written directly to the returned buffer
+ * @param size Packet size in bytes, must not exceed batch's packet_size
+ * @return Packet buffer, NULL if batch is full or size is too big
+ * @ingroup socket
+ */
+CORE_API void* sock_udp_batch_add(struct sock_udp_batch* batch, const struct sock_addr* addr,
+    int size);
+
+/**
+ * Sends all added packets of the batch, sent packets are removed from the batch and unsent ones
+ * (socket would block, or error) are kept for next call
+ * @return Number of sent packets, <0 if error occured before any packet is sent
+ * @ingroup socket
+ */
+CORE_API int sock_udp_batch_send(socket_t sock, struct sock_udp_batch* batch);
+
 /**
  * create tcp socket, tcp sockets need connection (accept/connect) but are stable and reliable
  * @ingroup socket
@@ -143,6 +263,80 @@ CORE_API int sock_tcp_recv(socket_t sock, void* buffer, int size);
  */
 CORE_API int sock_tcp_send(socket_t sock, const void* buffer, int size);
 
+/**
+ * sends multiple buffers to tcp peer with one call (gather), for example a header and it's payload
+ * without copying them into a contiguous buffer
+ * @param bufs array of buffers that are sent in order
+ * @param cnt number of buffers
+ * @return actual bytes that is sent, may be less than total size. <0 if error occured
+ * @ingroup socket
+ */
+CORE_API int sock_tcp_sendv(socket_t sock, const struct sock_buf* bufs, int cnt);
+
+/**
+ * receives data from tcp peer into multiple buffers with one call (scatter), buffers are filled in
+ * order
+ * @return actual bytes that is received. 0 if peer is disconnected, <0 if error occured
+ * @ingroup socket
+ */
+CORE_API int sock_tcp_recvv(socket_t sock, const struct sock_buf* bufs, int cnt);
+
+/**
+ * sends the whole buffer, partial sends and interrupted calls are retried, and for non-blocking
+ * sockets, waits until socket is ready to send again
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_sendall(socket_t sock, const void* buffer, int size);
+
+/**
+ * gather version of @e sock_tcp_sendall, sends all data of all buffers
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_sendvall(socket_t sock, const struct sock_buf* bufs, int cnt);
+
+/**
+ * receives exactly 'size' bytes, partial receives and interrupted calls are retried, and for
+ * non-blocking sockets, waits until more data arrives
+ * @return RET_OK if buffer is filled, RET_FAIL if peer is disconnected or error occured
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_recvall(socket_t sock, void* buffer, int size);
+
+/**
+ * scatter version of @e sock_tcp_recvall, fills all buffers completely
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_recvvall(socket_t sock, const struct sock_buf* bufs, int cnt);
+
+/**
+ * enables/disables TCP_NODELAY (Nagle's algorithm is disabled), small sends are not delayed
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_setnodelay(socket_t sock, int enable);
+
+/**
+ * enables/disables TCP_CORK (TCP_NOPUSH on BSD/OSX), partial frames are held until cork is removed,
+ * so multiple small sends are sent in full packets
+ * @return RET_NOT_SUPPORTED if platform does not have the option
+ * @ingroup socket
+ */
+CORE_API result_t sock_tcp_setcork(socket_t sock, int enable);
+
+/**
+ * sets kernel buffer sizes of the socket (SO_RCVBUF/SO_SNDBUF)
+ * @param recv_size receive buffer size in bytes, 0 keeps current size
+ * @param send_size send buffer size in bytes, 0 keeps current size
+ * @ingroup socket
+ */
+CORE_API result_t sock_setbuffsize(socket_t sock, int recv_size, int send_size);
+
+/**
+ * switches socket between blocking and non-blocking modes, in non-blocking mode, recv/send/accept
+ * return immediately with an error instead of waiting
+ * @ingroup socket
+ */
+CORE_API result_t sock_setnonblock(socket_t sock, int enable);
+
 /**
  * blocks the program and checks if socket has input packet for receiving buffer
  * @param timeout timeout in milliseconds
@@ -197,6 +391,11 @@ public:
         return sock_tcp_connect(m_sock, addr, port) != RET_FAIL ? true : false;
     }
 
+    bool set_nonblock(bool enable)
+    {
+        return IS_OK(sock_setnonblock(m_sock, enable ? TRUE : FALSE));
+    }
+
     bool poll_recv(uint timeout = UINT32_MAX)
     {
         return static_cast<bool>(sock_poll_recv(m_sock, timeout));
@@ -217,6 +416,51 @@ public:
         return sock_tcp_send(m_sock, buffer, size);
     }
 
+    int sendv(const sock_buf *bufs, int cnt)
+    {
+        return sock_tcp_sendv(m_sock, bufs, cnt);
+    }
+
+    int recvv(const sock_buf *bufs, int cnt)
+    {
+        return sock_tcp_recvv(m_sock, bufs, cnt);
+    }
+
+    bool send_all(const void *buffer, int size)
+    {
+        return IS_OK(sock_tcp_sendall(m_sock, buffer, size));
+    }
+
+    bool sendv_all(const sock_buf *bufs, int cnt)
+    {
+        return IS_OK(sock_tcp_sendvall(m_sock, bufs, cnt));
+    }
+
+    bool recv_all(void *buffer, int size)
+    {
+        return IS_OK(sock_tcp_recvall(m_sock, buffer, size));
+    }
+
+    bool recvv_all(const sock_buf *bufs, int cnt)
+    {
+        return IS_OK(sock_tcp_recvvall(m_sock, bufs, cnt));
+    }
+
+    bool set_nodelay(bool enable)
+    {
+        return IS_OK(sock_tcp_setnodelay(m_sock, enable ? TRUE : FALSE));
+    }
+
+    bool set_cork(bool enable)
+    {
+        return IS_OK(sock_tcp_setcork(m_sock, enable ? TRUE : FALSE));
+    }
+
+    bool set_buffsize(int recv_size, int send_size)
+    {
+        return IS_OK(sock_setbuffsize(m_sock, recv_size, send_size));
+    }
+
     operator socket_t() {   return m_sock;  }
     bool is_open() const    {   return m_sock != SOCK_NULL; }
 };
@@ -245,6 +489,11 @@ public:
         return sock_udp_bind(m_sock, port) != RET_FAIL ? true : false;
     }
 
+    bool set_nonblock(bool enable)
+    {
+        return IS_OK(sock_setnonblock(m_sock, enable ? TRUE : FALSE));
+    }
+
     bool poll_recv(uint timeout = UINT32_MAX)
     {
         return static_cast<bool>(sock_poll_recv(m_sock, timeout));
@@ -265,6 +514,16 @@ public:
         return sock_udp_send(m_sock, addr, port, buffer, size);
     }
 
+    int recv_batch(sock_udp_batch *batch)
+    {
+        return sock_udp_batch_recv(m_sock, batch);
+    }
+
+    int send_batch(sock_udp_batch *batch)
+    {
+        return sock_udp_batch_send(m_sock, batch);
+    }
+
     operator socket_t() {   return m_sock;  }
     bool is_open() const    {   return m_sock != SOCK_NULL; }
 };
@@ -159,6 +159,15 @@ INLINE uint minui(uint n1, uint n2)
     return (n1 < n2) ? n1 : n2;
 }
 
+/**
+ * return minimum of two size_t values
+ * @ingroup num
+ */
+INLINE size_t minsz(size_t n1, size_t n2)
+{
+    return (n1 < n2) ? n1 : n2;
+}
+
 /**
  * return maximum of two float values
  * @ingroup num
@@ -186,6 +195,15 @@ INLINE uint maxui(uint n1, uint n2)
     return (n1 > n2) ? n1 : n2;
 }
 
+/**
+ * return maximum of two size_t values
+ * @ingroup num
+ */
+INLINE size_t maxsz(size_t n1, size_t n2)
+{
+    return (n1 > n2) ? n1 : n2;
+}
+
 /**
  * swap two float values with each other
  * @ingroup num
@@ -30,6 +30,7 @@ struct pak_header
     uint64 items_offset;
     uint64 items_cnt;
     uint compress_mode;
+    uint hash_mode; /* v1.1 */
 };
 
 /* pak file item, for each file in the pak I store one of these */
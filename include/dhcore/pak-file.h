@@ -33,6 +33,30 @@
 
 /* fwd declarations */
 struct file_mgr;
+struct pak_item;
+
+/**
+ * Data validity check policy for fetching files from pak
+ * @see pak_setverify
+ * @ingroup pak
+ */
+enum pak_verify_mode
+{
+    PAK_VERIFY_ALWAYS = 0, /**< check hash of data on every fetch (default) */
+    PAK_VERIFY_FIRSTOPEN, /**< check hash only on the first fetch of each file */
+    PAK_VERIFY_NEVER /**< never check data hash, for trusted (signed) paks */
+};
+
+/**
+ * Hash function that is used for data validity of pak items
+ * @see pak_sethash
+ * @ingroup pak
+ */
+enum pak_hash_mode
+{
+    PAK_HASH_MURMUR = 0, /**< murmur 128bit hash (default) */
+    PAK_HASH_FAST /**< hash_fast128, much faster on large files */
+};
 
 /**
  * pak file - contains zipped archive of multiple files\n
@@ -46,10 +70,24 @@ struct pak_file
     struct hashtable_open table; /* hash-table for referencing pak files */
     struct array items; /* file items in the pak (see pak-file.c) */
     enum compress_mode compress_mode; /* compression mode (see zip.h) */
+    enum pak_hash_mode hash_mode; /* data hash function */
+    enum pak_verify_mode verify_mode; /* data validity check policy for fetching files */
+    struct array verified; /* item: uint8, file items that are already verified */
     int init_create;
     struct allocator table_alloc;
 };
 
+/**
+ * Source/destination pair for building paks in batches
+ * @see pak_putfiles
+ * @ingroup pak
+ */
+struct pak_build_item
+{
+    const char* src_filepath; /**< file on disk to put into the pak (virtual-filesystem is ignored) */
+    const char* dest_path; /**< filepath (alias) which will be saved in pak, see pak_putfile */
+};
+
 /**
  * Create pak file on disk and get it ready for putting files in it
  * @param alloc memory allocator for internal pak_file data
@@ -82,6 +120,22 @@ CORE_API void pak_close(struct pak_file* pak);
  */
 CORE_API int pak_isopen(struct pak_file* pak);
 
+/**
+ * Sets data validity check policy for fetching files from pak, default is PAK_VERIFY_ALWAYS
+ * @see pak_verify_mode
+ * @ingroup pak
+ */
+CORE_API void pak_setverify(struct pak_file* pak, enum pak_verify_mode mode);
+
+/**
+ * Sets hash function for data of newly created pak, default is PAK_HASH_MURMUR\n
+ * Must be called after pak_create and before putting any files into the pak.
+ * Opened paks use the hash function that they are created with.
+ * @see pak_hash_mode
+ * @ingroup pak
+ */
+CORE_API void pak_sethash(struct pak_file* pak, enum pak_hash_mode mode);
+
 /**
  * Compress and put an opened file into pak
  * @param alloc temp-allocator for decompressing buffers inside the routine
@@ -93,6 +147,22 @@ CORE_API int pak_isopen(struct pak_file* pak);
 CORE_API result_t pak_putfile(struct pak_file* pak, struct allocator* tmp_alloc, 
     file_t src_file, const char* dest_path);
 
+/**
+ * Compress and put multiple files into pak\n
+ * Files are read and compressed in parallel by task-manager workers (if task-manager is
+ * initialized), using their temp allocators. Compressed data is written to the pak in the same
+ * order as @e items, so the output is the same regardless of thread count.\n
+ * If @e ref_pak is provided, items that already exist in it with equal data hash are not
+ * compressed again, their compressed data is copied from @e ref_pak instead
+ * @param items array of source/destination files
+ * @param item_cnt number of items in the array
+ * @param ref_pak (optional) previously built version of the pak, opened by pak_open, can be NULL
+ * @see pak_putfile
+ * @ingroup pak
+ */
+CORE_API result_t pak_putfiles(struct pak_file* pak, const struct pak_build_item* items,
+    uint item_cnt, struct pak_file* ref_pak);
+
 /**
  * Find a file in pak
  * @param filepath filepath (case sensitive) of dest_path provided in 'pak_putfile' when -
@@ -113,6 +183,28 @@ CORE_API uint pak_findfile(struct pak_file* pak, const char* filepath);
 CORE_API file_t pak_getfile(struct pak_file* pak, struct allocator* alloc,
                             struct allocator* tmp_alloc, uint file_id, uint mem_id);
 
+/**
+ * Get item description of a file in pak, can be used to read raw (compressed) item data directly
+ * from the pak file, which can be decoded later by pak_decodefile
+ * @param file_id file-id of the file in the pak, must be fetched from 'pak_findfile'
+ * @see pak_decodefile
+ * @ingroup pak
+ */
+CORE_API const struct pak_item* pak_getitem(struct pak_file* pak, uint file_id);
+
+/**
+ * Decompress and verify raw item data that is read directly from the pak file, and attach the
+ * result to a memory file. Does not access the pak file on disk, so it can be called from any thread
+ * @param alloc memory allocator for creating memory file
+ * @param file_id file-id of the file in the pak, must be fetched from 'pak_findfile'
+ * @param data raw item data, should be pak_item::size bytes, which is read from pak_item::offset
+ * @return handle to the opened file in memory, ready to read, NULL if failed
+ * @see pak_getitem
+ * @ingroup pak
+ */
+CORE_API file_t pak_decodefile(struct pak_file* pak, struct allocator* alloc, uint file_id,
+                               const void* data, uint mem_id);
+
 /**
  * Creates/allocates list of files inside pak-file
  * @param alloc memory allocator for the list
@@ -123,4 +215,39 @@ CORE_API file_t pak_getfile(struct pak_file* pak, struct allocator* alloc,
  */
 CORE_API char* pak_createfilelist(struct pak_file* pak, struct allocator* alloc, OUT int* pcnt);
 
+/**
+ * Initializes local content cache for decompressed pak items, shared between all paks\n
+ * Decompressed items are stored as blobs keyed by their content hash (pak_item::hash), so -
+ * later fetches of the same data (in any pak, or in next runs) are read from mapped blobs -
+ * instead of being decompressed again. Least recently used blobs are deleted when the cache -
+ * exceeds @e max_size. Paks without compression are not cached\n
+ * Fetching files only queues new blobs in memory, they are written to disk by pak_flushcache
+ * @param cachedir directory for cache blobs, NULL for default directory under temp directory
+ * @param max_size maximum size of the cache on disk (in bytes)
+ * @see pak_flushcache
+ * @see pak_releasecache
+ * @ingroup pak
+ */
+CORE_API result_t pak_initcache(const char* cachedir, uint64 max_size);
+
+/**
+ * Writes queued blobs of decompressed items into the content cache and saves recently used order
+ * of cached blobs (by their modification times) for next runs. Can be called from any thread,
+ * so it's best to call it from a background thread or at idle times (between level loads)
+ * @ingroup pak
+ */
+CORE_API void pak_flushcache();
+
+/**
+ * Writes queued blobs and releases content cache data, cache blobs remain on disk for next runs
+ * @ingroup pak
+ */
+CORE_API void pak_releasecache();
+
+/**
+ * Deletes all blobs of the content cache
+ * @ingroup pak
+ */
+CORE_API void pak_clearcache();
+
 #endif /*__PAKFILE_H__*/
@@ -0,0 +1,76 @@
+/***********************************************************************************
+ * Copyright (c) 2014, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#ifndef __RPCSERVER_H__
+#define __RPCSERVER_H__
+
+#include "types.h"
+#include "core-api.h"
+
+/**
+ * @defgroup rpcserver JSON-RPC server
+ * TCP server for JSON-RPC commands, connections are multiplexed (see @e sock_reactor) over one or
+ * more loop threads, and each request is passed to @e rpc_process.\n
+ * Messages are framed with a 4 byte (big-endian) size, followed by the message data, requests are
+ * JSON-RPC strings (single or batch) and responses are @e rpc_result data (JSON or binary blob).
+ * Clients can send (pipeline) multiple requests without waiting for responses, responses are sent
+ * in the same order.\n
+ * Commands without @e RPC_CMD_THREADSAFE flag are serialized by @e rpc_process, so the server can
+ * use multiple threads with any registered command.\n
+ * Example usage:
+ * @code
+ * rpc_init();
+ * rpc_registercmd("Foo", rpc_foo, params, 2, result, 1, "Adds two integers", NULL);
+ *
+ * // serve on port 8080 with 2 threads, up to 1024 connections and 1MB requests
+ * struct rpc_server* srv = rpc_server_create(8080, 2, 1024, 1024*1024);
+ * ...
+ * rpc_server_destroy(srv);
+ * rpc_release();
+ * @endcode
+ * @ingroup rpcserver
+ */
+
+#define RPC_SERVER_MSG_SIZE    (1024*1024)    /**< Default maximum request size */
+
+struct rpc_server;
+
+/**
+ * Creates the server socket and starts serving in loop threads
+ * @param port Listening port
+ * @param thread_cnt Number of loop threads, each thread handles it's own connections (0 = 1)
+ * @param max_conns Maximum number of concurrent connections, new connections are closed
+ * immediately after accept when limit is reached (0 = no limit)
+ * @param max_msg_size Maximum request size in bytes, connections that send bigger messages are
+ * dropped (0 = RPC_SERVER_MSG_SIZE)
+ * @return Server object, or NULL if socket or threads could not be created
+ * @ingroup rpcserver
+ */
+CORE_API struct rpc_server* rpc_server_create(int port, int thread_cnt, int max_conns,
+                                              uint max_msg_size);
+
+/**
+ * Stops loop threads, closes all connections and destroys the server
+ * @ingroup rpcserver
+ */
+CORE_API void rpc_server_destroy(struct rpc_server* srv);
+
+/**
+ * Returns number of currently connected clients
+ * @ingroup rpcserver
+ */
+CORE_API int rpc_server_getconns(struct rpc_server* srv);
+
+#endif /* __RPCSERVER_H__ */
@@ -89,7 +89,20 @@
 enum rpc_error_code
 {
     RPC_ERROR_METHODNOTFOUND = -1,
-    RPC_ERROR_INVALIDARGS = -2
+    RPC_ERROR_INVALIDARGS = -2,
+    RPC_ERROR_INVALIDREQUEST = -3
+};
+
+/**
+ * RPC command flags, used in registering commands
+ * @see rpc_registercmd_ex
+ * @ingroup rpc
+ */
+enum rpc_cmd_flag
+{
+    RPC_CMD_THREADSAFE = (1<<0) /**< Command can run in task-mgr workers, see @e rpc_process_batch.
+                                  Commands without this flag never run concurrently, even if
+                                  @e rpc_process is called from multiple threads */
 };
 
 /**
@@ -272,15 +285,31 @@ CORE_API struct rpc_result* rpc_return_error(int id, enum rpc_error_code code, c
 CORE_API struct rpc_result* rpc_make_result_bin(const void* data, size_t data_sz);
 
 /**
- * Process JSON-RPC string, run registered command callback, and make final result
- * @params json_rpc Valid JSON-RPC null-terminated string, normally fetched from webserver
+ * Process JSON-RPC string, run registered command callback, and make final result.\n
+ * Request and value blocks are allocated from a per-thread stack and the result buffer of each
+ * thread is reused once it's freed, so a process/free loop doesn't touch the heap
+ * @params json_rpc Valid JSON-RPC null-terminated string, normally fetched from webserver. Can be
+ * a batch (array of requests), in that case result is an array of responses
  * @see rpc_result
  * @ingroup rpc
  */
 CORE_API struct rpc_result* rpc_process(const char* json_rpc);
 
 /**
- * After a successful call to @e rpc_process, user must call this function to free the result
+ * Same as @e rpc_process, but commands of batch requests that are registered with
+ * @e RPC_CMD_THREADSAFE flag are dispatched to task-mgr workers, the rest of them run in the caller
+ * thread in their original order. Responses are not ordered like requests, clients should match
+ * them by their ids.\n
+ * Falls back to @e rpc_process if task manager is not initialized.\n
+ * @b Note that like @e tsk_dispatch, this function must be called from the main thread only
+ * @see rpc_process
+ * @ingroup rpc
+ */
+CORE_API struct rpc_result* rpc_process_batch(const char* json_rpc);
+
+/**
+ * After a successful call to @e rpc_process, user must call this function to free the result,
+ * results can be freed from any thread
  * @see rpc_process
  * @ingroup rpc
  */
@@ -297,12 +326,23 @@ CORE_API void rpc_freeresult(struct rpc_result* r);
  * @param desc Command description shown in help
  * @param user_param User defined pointer that will be passed to the callback
  * @see pfn_rpc_cmd
+ * @see rpc_registercmd_ex
  * @ingroup rpc
  */
 CORE_API result_t rpc_registercmd(const char* name, pfn_rpc_cmd run_fn, const struct rpc_value* params, 
     uint param_cnt, const struct rpc_value* results, uint result_cnt, const char* desc, 
     void* user_param);
 
+/**
+ * Register an RPC command with extra flags, same as @e rpc_registercmd otherwise
+ * @param flags Combination of @e rpc_cmd_flag values
+ * @see rpc_registercmd
+ * @ingroup rpc
+ */
+CORE_API result_t rpc_registercmd_ex(const char* name, pfn_rpc_cmd run_fn,
+    const struct rpc_value* params, uint param_cnt, const struct rpc_value* results,
+    uint result_cnt, const char* desc, void* user_param, uint flags);
+
 #ifdef __cplusplus
 
 #endif
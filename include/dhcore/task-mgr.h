@@ -104,6 +104,12 @@ CORE_API result_t tsk_initmgr(int thread_cnt, size_t localmem_perthread_sz,
  */
 CORE_API void tsk_releasemgr();
 
+/**
+ * Checks if task manager is initialized
+ * @ingroup taskman
+ */
+CORE_API int tsk_isinit();
+
 /**
  * Dispatch a task (job) to multiple threads, task should be implemented by the user callback function.\n
  * @b Note that this function must be called from the main thread only, task manager does not support 
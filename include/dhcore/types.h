@@ -295,6 +295,15 @@ typedef int iptr_t;
   #define FORCE_INLINE    INLINE
 #endif
 
+/* thread-local storage */
+#if defined(_MSVC_)
+  #define THREAD_LOCAL    __declspec(thread)
+#endif
+
+#if defined(_GNUC_)
+  #define THREAD_LOCAL    __thread
+#endif
+
 /* bitwise operators */
 #define BIT_CHECK(v, b)     (((v)&(b)) != 0)
 #define BIT_ADD(v, b)       ((v) |= (b))
@@ -21,6 +21,7 @@
  * @defgroup util Utility
  */
 
+#include <stdio.h>
 #include "types.h"
 #include "core-api.h"
 #include "allocator.h"
@@ -183,4 +184,50 @@ CORE_API char* util_readtextfile(const char* txt_filepath, struct allocator* all
 
 CORE_API void util_ttyecho();
 
+/**
+ * 64bit version of fseek, for files larger than 2gb
+ * @param origin standard SEEK_SET, SEEK_CUR or SEEK_END
+ * @return 0 if successful
+ * @ingroup util
+ */
+CORE_API int util_fseek64(FILE* f, int64 offset, int origin);
+
+/**
+ * 64bit version of ftell, for files larger than 2gb
+ * @return current position in the file, -1 if failed
+ * @ingroup util
+ */
+CORE_API int64 util_ftell64(FILE* f);
+
+/**
+ * Reads from a specific offset of the file (pread on posix), file position is not changed on -
+ * posix systems, so it can be called from multiple threads on the same file
+ * @return TRUE if all bytes are read
+ * @ingroup util
+ */
+CORE_API int util_freadat(FILE* f, void* buffer, size_t size, uint64 offset);
+
+/**
+ * Callback for util_listfiles
+ * @param filename name of the file (without directory)
+ * @param size size of the file in bytes
+ * @param mtime last modification time of the file (seconds since epoch)
+ * @ingroup util
+ */
+typedef void (*pfn_util_listfile)(const char* filename, uint64 size, uint64 mtime, void* param);
+
+/**
+ * Lists regular files of a directory (not recursive)
+ * @return TRUE if directory is valid and listed
+ * @ingroup util
+ */
+CORE_API int util_listfiles(const char* dir, pfn_util_listfile fn, void* param);
+
+/**
+ * Sets modification time of a file to current time
+ * @return TRUE if successful
+ * @ingroup util
+ */
+CORE_API int util_touchfile(const char* filepath);
+
 #endif /* UTIL_H_ */
@@ -29,6 +29,9 @@
 struct mz_zip_archive_tag;
 typedef struct mz_zip_archive_tag* zip_t;
 
+struct zip_stream;
+typedef struct zip_stream* zipstream_t;
+
 /**
  * @ingroup zip
  */
@@ -40,6 +43,18 @@ enum compress_mode
     COMPRESS_NONE
 };
 
+/**
+ * Result of streaming compression/decompression
+ * @see zip_stream_process
+ * @ingroup zip
+ */
+enum zip_status
+{
+    ZIP_STATUS_ERROR = -1, /**< invalid data or out of memory, stream can't continue */
+    ZIP_STATUS_OK = 0, /**< more input or output space is needed */
+    ZIP_STATUS_END = 1 /**< stream is finished, all output is written */
+};
+
 /**
  * Roughly estimate maximum size of the compressed buffer, it's recommended that you evaluate 
  * and allocated compressed buffer size with this function, then pass it to @e zip_compress
@@ -61,6 +76,46 @@ CORE_API size_t zip_compressedsize(size_t src_size);
 CORE_API size_t zip_compress(void* dest_buffer, size_t dest_size, const void* buffer, size_t size, 
     enum compress_mode mode);
 
+/**
+ * Estimate maximum size of the block compressed buffer, pass this size to @e zip_compress_blocks
+ * @param block_size size of each block, 0 for default (1MB)
+ * @see zip_compress_blocks
+ * @ingroup zip
+ */
+CORE_API size_t zip_compressedsize_blocks(size_t src_size, size_t block_size);
+
+/**
+ * Compress large buffers in parallel: input is split into independent blocks, which are -
+ * compressed on task-manager workers (if initialized) and stored in a framed container\n
+ * Output is not compatible with @e zip_decompress, use @e zip_decompress_blocks instead.
+ * Must be called from the main thread if task-manager is initialized
+ * @param dest_size Maximum size of destination buffer, must be at least the value of -
+ * @e zip_compressedsize_blocks, because blocks are compressed in place
+ * @param block_size size of each block, 0 for default (1MB). Smaller blocks have more -
+ * parallelism but slightly worse compression ratio
+ * @return Size of compressed buffer, 0 if failed
+ * @ingroup zip
+ */
+CORE_API size_t zip_compress_blocks(void* dest_buffer, size_t dest_size, const void* buffer,
+    size_t size, enum compress_mode mode, size_t block_size);
+
+/**
+ * Decompress buffer compressed by @e zip_compress_blocks, blocks are decompressed in parallel -
+ * on task-manager workers (if initialized).
+ * Must be called from the main thread if task-manager is initialized
+ * @param dest_size Uncompressed buffer size, can be fetched by @e zip_blocks_getsize
+ * @return Size of uncompressed buffer, 0 if failed
+ * @ingroup zip
+ */
+CORE_API size_t zip_decompress_blocks(void* dest_buffer, size_t dest_size, const void* buffer,
+    size_t size);
+
+/**
+ * @return Uncompressed size of block compressed buffer, 0 if buffer is not valid
+ * @ingroup zip
+ */
+CORE_API uint64 zip_blocks_getsize(const void* buffer, size_t size);
+
 /**
  * Decompress buffer from memory
  * @param dest_buffer Uncompressed destination buffer 
@@ -70,10 +125,64 @@ CORE_API size_t zip_compress(void* dest_buffer, size_t dest_size, const void* bu
  */
 CORE_API size_t zip_decompress(void* dest_buffer, size_t dest_size, const void* buffer, size_t size);
 
+/**
+ * Creates streaming compressor, data is compressed incrementally on bounded buffers\n
+ * Output is in the same format of @e zip_compress, so it can be decompressed by both -
+ * @e zip_decompress and streaming decompressor
+ * @param alloc allocator for internal compressor state, NULL for heap
+ * @see zip_stream_process
+ * @ingroup zip
+ */
+CORE_API zipstream_t zip_stream_deflate(struct allocator* alloc, enum compress_mode mode);
+
+/**
+ * Creates streaming decompressor
+ * @param alloc allocator for internal decompressor state, NULL for heap
+ * @see zip_stream_process
+ * @ingroup zip
+ */
+CORE_API zipstream_t zip_stream_inflate(struct allocator* alloc);
+
+/**
+ * Destroys streaming compressor/decompressor
+ * @ingroup zip
+ */
+CORE_API void zip_stream_destroy(zipstream_t s);
+
+/**
+ * Resets streaming compressor/decompressor to process a new stream, internal state is reused
+ * @ingroup zip
+ */
+CORE_API result_t zip_stream_reset(zipstream_t s);
+
+/**
+ * Compresses or decompresses next chunk of the stream
+ * @param in input buffer
+ * @param in_size (in/out) size of input buffer, receives number of consumed input bytes
+ * @param out output buffer
+ * @param out_size (in/out) size of output buffer, receives number of written output bytes
+ * @param finish compressor: set to TRUE when all remaining input is provided, then call again -
+ * until ZIP_STATUS_END is returned. ignored by decompressor
+ * @return ZIP_STATUS_END when stream is finished, ZIP_STATUS_OK if more input/output is needed
+ * @ingroup zip
+ */
+CORE_API enum zip_status zip_stream_process(zipstream_t s, const void* in, INOUT size_t* in_size,
+    void* out, INOUT size_t* out_size, int finish);
+
 CORE_API zip_t zip_open(const char *filepath);
 CORE_API zip_t zip_open_mem(const char *buff, size_t buff_sz);
 
 CORE_API void zip_close(zip_t zip);
 CORE_API file_t zip_getfile(zip_t zip, const char *filepath, struct allocator *alloc);
 
+/**
+ * Opens a file in zip archive for lazy reading, data is decompressed on each read with bounded -
+ * buffers, so memory usage is constant regardless of file size (see fio_openstream)\n
+ * Zip archive must remain open until the file is closed
+ * @param alloc allocator for internal decompressor state and buffers, NULL for heap
+ * @return read-only stream file (FILE_TYPE_STREAM), NULL if file is not found
+ * @ingroup zip
+ */
+CORE_API file_t zip_openfile(zip_t zip, const char *filepath, struct allocator *alloc);
+
 #endif /* __ZIP_H__ */
@@ -43,6 +43,7 @@ SOURCES += \
     core.c \
     errors.c \
     file-io.c \
+    file-io-async.c \
     freelist-alloc.c \
     hash.c \
     hash-table.c \
@@ -50,12 +51,14 @@ SOURCES += \
     json.c \
     log.c \
     mem-mgr.c \
+    net-reactor.c \
     net-socket.c \
     numeric.c \
     pak-file.c \
     pool-alloc.c \
     prims.c \
     rpc.c \
+    rpc-server.c \
     stack-alloc.c \
     std-math.c \
     str.c \
@@ -103,7 +106,7 @@ unix:!macx  {
         platform/linux/hwinfo-lnx.c \
         platform/linux/timer-lnx.c \
         platform/linux/util-lnx.c
-    DEFINES += HAVE_MALLOC_H
+    DEFINES += HAVE_MALLOC_H _FILE_OFFSET_BITS=64
 }
 
 # debug
@@ -129,6 +132,7 @@ HEADERS = \
     ../../include/dhcore/log.h \
     ../../include/dhcore/mem-mgr.h \
     ../../include/dhcore/mt.h \
+    ../../include/dhcore/net-reactor.h \
     ../../include/dhcore/net-socket.h \
     ../../include/dhcore/numeric.h \
     ../../include/dhcore/pak-file-fmt.h \
@@ -137,6 +141,7 @@ HEADERS = \
     ../../include/dhcore/prims.h \
     ../../include/dhcore/queue.h \
     ../../include/dhcore/rpc.h \
+    ../../include/dhcore/rpc-server.h \
     ../../include/dhcore/stack-alloc.h \
     ../../include/dhcore/stack.h \
     ../../include/dhcore/std-math.h \
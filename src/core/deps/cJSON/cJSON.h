@@ -38,6 +38,8 @@ extern "C"
 #define cJSON_Object 6
 	
 #define cJSON_IsReference 256
+#define cJSON_IsArena 512		/* item memory is owned by a document arena and is not freed */
+#define cJSON_IsArenaRoot 1024	/* root item of an arena document */
 
 /* The cJSON structure: */
 typedef struct cJSON {
@@ -51,6 +53,8 @@ typedef struct cJSON {
 	double valuedouble;			/* The item's number, if type==cJSON_Number */
 
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
+
+	void *index;				/* Member lookup index of an object, allocated with cJSON_malloc by the owner. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
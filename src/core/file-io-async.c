@@ -0,0 +1,817 @@
+/***********************************************************************************
+ * Copyright (c) 2012, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "dhcore/file-io.h"
+#include "dhcore/pak-file.h"
+#include "dhcore/pak-file-fmt.h"
+#include "dhcore/mem-mgr.h"
+#include "dhcore/pool-alloc.h"
+#include "dhcore/err.h"
+#include "dhcore/log.h"
+#include "dhcore/mt.h"
+#include "dhcore/task-mgr.h"
+#include "dhcore/util.h"
+#include "dhcore/numeric.h"
+
+#if defined(_POSIXLIB_)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_LINUX_) && defined(HAVE_LINUX_IO_URING_H)
+#define _IOURING_
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#define ASYNC_THREAD_CNT 2
+#define ASYNC_REQ_BLOCK 64
+#define URING_ENTRIES 128
+#define URING_READ_MAX (64*1024*1024)   /* maximum size of each read operation */
+
+/*************************************************************************************************
+ * types
+ */
+struct fio_async_req
+{
+    struct fio_async_req* next;
+    char filepath[DH_PATH_MAX];
+    uint flags;
+    struct fio_source src;
+    struct allocator* alloc;
+    uint mem_id;
+    pfn_fio_async_done done_fn;
+    void* param;
+
+    int fd;
+    uint64 offset;  /* offset of data in the file */
+    size_t size;    /* data size */
+    size_t read_sz; /* bytes that are read so far */
+    uint8* buffer;  /* disk files: allocated from 'alloc', pak items: raw data from heap */
+    file_t f;   /* if file is opened directly by io threads (no posix support) */
+    result_t r;
+#if defined(_IOURING_)
+    struct iovec iov;
+#endif
+};
+
+struct fio_async_queue
+{
+    struct fio_async_req* first;
+    struct fio_async_req* last;
+};
+
+#if defined(_IOURING_)
+struct fio_uring
+{
+    int fd;
+    uint* sq_head;
+    uint* sq_tail;
+    uint* sq_array;
+    uint sq_mask;
+    struct io_uring_sqe* sqes;
+    uint* cq_head;
+    uint* cq_tail;
+    uint cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_sz;
+    void* cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+    uint max_inflight;
+};
+#endif
+
+struct fio_async_mgr
+{
+    mt_mutex req_mtx;
+    struct pool_alloc req_pool; /* item: fio_async_req */
+
+    mt_mutex done_mtx;
+    struct fio_async_queue done;    /* finished requests, waiting for fio_async_update */
+    long volatile pending_cnt;
+    long volatile quit;
+
+    /* fallback io threads */
+    mt_mutex queue_mtx;
+    struct fio_async_queue queue;
+    mt_thread* threads;
+    int thread_cnt;
+
+#if defined(_IOURING_)
+    int use_uring;
+    struct fio_uring ring;
+    mt_thread ring_thread;
+    mt_mutex ring_mtx;
+    uint inflight;  /* read operations in the ring (guarded by ring_mtx) */
+    long volatile wait_failed;  /* completion thread can't wait on the ring, it polls instead */
+    struct fio_async_queue backlog; /* requests waiting for room in the ring */
+#endif
+};
+
+struct fio_async_dispatch_params
+{
+    struct fio_async_req** reqs;
+    uint cnt;
+    long volatile next_idx;
+};
+
+/*************************************************************************************************
+ * globals
+ */
+static struct fio_async_mgr* g_aio = NULL;
+
+/* fwd */
+static void fio_async_complete(struct fio_async_req* req);
+static void fio_async_dispatch(struct fio_async_req* req);
+static void fio_async_freereq(struct fio_async_req* req, int drop);
+static result_t fio_async_kernel(mt_thread thread);
+#if defined(_IOURING_)
+static result_t fio_uring_init(struct fio_uring* ring, uint entries);
+static void fio_uring_release(struct fio_uring* ring);
+static void fio_uring_submitreq(struct fio_async_req* req);
+static result_t fio_uring_kernel(mt_thread thread);
+#endif
+
+/*************************************************************************************************/
+INLINE void fio_async_pushreq(struct fio_async_queue* q, struct fio_async_req* req)
+{
+    req->next = NULL;
+    if (q->last != NULL)
+        q->last->next = req;
+    else
+        q->first = req;
+    q->last = req;
+}
+
+INLINE void fio_async_pushfront(struct fio_async_queue* q, struct fio_async_req* req)
+{
+    req->next = q->first;
+    q->first = req;
+    if (q->last == NULL)
+        q->last = req;
+}
+
+INLINE struct fio_async_req* fio_async_popreq(struct fio_async_queue* q)
+{
+    struct fio_async_req* req = q->first;
+    if (req != NULL)    {
+        q->first = req->next;
+        if (q->first == NULL)
+            q->last = NULL;
+        req->next = NULL;
+    }
+    return req;
+}
+
+INLINE void fio_async_dropqueue(struct fio_async_queue* q)
+{
+    struct fio_async_req* req;
+    while ((req = fio_async_popreq(q)) != NULL)
+        fio_async_freereq(req, TRUE);
+}
+
+/*************************************************************************************************/
+result_t fio_async_init(int thread_cnt)
+{
+    if (g_aio != NULL)
+        return RET_FAIL;
+
+    g_aio = (struct fio_async_mgr*)ALLOC(sizeof(struct fio_async_mgr), 0);
+    if (g_aio == NULL)
+        return RET_OUTOFMEMORY;
+    memset(g_aio, 0x00, sizeof(struct fio_async_mgr));
+
+    mt_mutex_init(&g_aio->req_mtx);
+    mt_mutex_init(&g_aio->done_mtx);
+    mt_mutex_init(&g_aio->queue_mtx);
+
+    result_t r = mem_pool_create(mem_heap(), &g_aio->req_pool, sizeof(struct fio_async_req),
+                                 ASYNC_REQ_BLOCK, 0);
+    if (IS_FAIL(r)) {
+        err_printn(__FILE__, __LINE__, r);
+        fio_async_release();
+        return r;
+    }
+
+#if defined(_IOURING_)
+    mt_mutex_init(&g_aio->ring_mtx);
+    if (IS_OK(fio_uring_init(&g_aio->ring, URING_ENTRIES)))   {
+        g_aio->ring_thread = mt_thread_create(fio_uring_kernel, NULL, NULL, MT_THREAD_NORMAL,
+                                              0, 0, NULL, NULL);
+        if (g_aio->ring_thread != NULL) {
+            g_aio->use_uring = TRUE;
+            log_print(LOG_INFO, "  Async file io: io_uring");
+            return RET_OK;
+        }
+        fio_uring_release(&g_aio->ring);
+    }
+#endif
+
+    /* fallback: io threads with blocking reads */
+    if (thread_cnt <= 0)
+        thread_cnt = ASYNC_THREAD_CNT;
+    g_aio->threads = (mt_thread*)ALLOC(sizeof(mt_thread)*thread_cnt, 0);
+    if (g_aio->threads == NULL) {
+        fio_async_release();
+        return RET_OUTOFMEMORY;
+    }
+
+    for (int i = 0; i < thread_cnt; i++)    {
+        g_aio->threads[i] = mt_thread_create(fio_async_kernel, NULL, NULL, MT_THREAD_NORMAL,
+                                             0, 0, NULL, NULL);
+        if (g_aio->threads[i] == NULL)  {
+            err_print(__FILE__, __LINE__, "creating async file io threads failed");
+            fio_async_release();
+            return RET_FAIL;
+        }
+        g_aio->thread_cnt++;
+    }
+
+    log_printf(LOG_INFO, "  Async file io: %d threads", thread_cnt);
+    return RET_OK;
+}
+
+void fio_async_release()
+{
+    if (g_aio == NULL)
+        return;
+
+    MT_ATOMIC_SET(g_aio->quit, TRUE);
+
+#if defined(_IOURING_)
+    if (g_aio->use_uring)   {
+        /* kernel is still writing to buffers of in-flight requests, wait for them */
+        int inflight;
+        do  {
+            mt_mutex_lock(&g_aio->ring_mtx);
+            inflight = g_aio->inflight;
+            mt_mutex_unlock(&g_aio->ring_mtx);
+            if (inflight > 0)
+                util_sleep(1);
+        }   while (inflight > 0);
+
+        /* wake up the completion thread and let it exit */
+        mt_mutex_lock(&g_aio->ring_mtx);
+        struct io_uring_sqe* sqe;
+        uint tail = *g_aio->ring.sq_tail;
+        uint idx = tail & g_aio->ring.sq_mask;
+        sqe = &g_aio->ring.sqes[idx];
+        memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+        sqe->opcode = IORING_OP_NOP;
+        g_aio->ring.sq_array[idx] = idx;
+        __atomic_store_n(g_aio->ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+        /* ring is empty now, so submit can only fail temporarily, completion thread doesn't need
+         * the wake-up if it's polling */
+        while (!g_aio->wait_failed &&
+               syscall(__NR_io_uring_enter, g_aio->ring.fd, 1, 0, 0, NULL, 0) != 1)
+        {
+            util_sleep(1);
+        }
+        mt_mutex_unlock(&g_aio->ring_mtx);
+
+        mt_thread_destroy(g_aio->ring_thread);
+        fio_uring_release(&g_aio->ring);
+        fio_async_dropqueue(&g_aio->backlog);
+    }
+    mt_mutex_release(&g_aio->ring_mtx);
+#endif
+
+    if (g_aio->threads != NULL) {
+        for (int i = 0; i < g_aio->thread_cnt; i++)
+            mt_thread_destroy(g_aio->threads[i]);
+        FREE(g_aio->threads);
+    }
+
+    fio_async_dropqueue(&g_aio->queue);
+    fio_async_dropqueue(&g_aio->done);
+
+    mem_pool_destroy(&g_aio->req_pool);
+    mt_mutex_release(&g_aio->queue_mtx);
+    mt_mutex_release(&g_aio->done_mtx);
+    mt_mutex_release(&g_aio->req_mtx);
+
+    FREE(g_aio);
+    g_aio = NULL;
+}
+
+/* opens file and prepares data buffer for reading (runs in caller thread) */
+static result_t fio_async_prepare(struct fio_async_req* req)
+{
+    req->fd = -1;
+
+#if defined(_POSIXLIB_)
+    if (req->src.pak != NULL)   {
+        const struct pak_item* item = pak_getitem(req->src.pak, req->src.file_id);
+        req->fd = fileno(req->src.pak->f);
+        req->offset = item->offset;
+        req->size = item->size;
+        req->buffer = (uint8*)ALLOC(maxsz(req->size, 1), 0);
+    }   else    {
+        req->fd = open(req->src.path, O_RDONLY);
+        if (req->fd == -1)
+            return RET_FILE_ERROR;
+
+        struct stat s;
+        if (fstat(req->fd, &s) != 0)    {
+            close(req->fd);
+            return RET_FILE_ERROR;
+        }
+        req->offset = 0;
+        req->size = (size_t)s.st_size;
+        /* extra byte for closing text files, same as fio_openmem */
+        req->buffer = (uint8*)A_ALLOC(req->alloc, req->size + 1, req->mem_id);
+    }
+
+    if (req->buffer == NULL)    {
+        if (req->src.pak == NULL)
+            close(req->fd);
+        return RET_OUTOFMEMORY;
+    }
+#endif
+
+    return RET_OK;
+}
+
+/* blocking read of request data (runs in fallback io threads) */
+static void fio_async_readreq(struct fio_async_req* req)
+{
+#if defined(_POSIXLIB_)
+    while (req->read_sz < req->size)    {
+        ssize_t n = pread(req->fd, req->buffer + req->read_sz, req->size - req->read_sz,
+                          (off_t)(req->offset + req->read_sz));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            req->r = RET_FILE_ERROR;
+            return;
+        }
+        req->read_sz += (size_t)n;
+    }
+    req->r = RET_OK;
+#else
+    /* no positional reads, paks share their file handle, so serialize the whole open */
+    mt_mutex_lock(&g_aio->req_mtx);
+    req->f = fio_openmem(req->alloc, req->filepath, BIT_CHECK(req->flags, FIO_ASYNC_IGNOREVFS),
+                         req->mem_id);
+    mt_mutex_unlock(&g_aio->req_mtx);
+    req->r = (req->f != NULL) ? RET_OK : RET_FILE_ERROR;
+#endif
+}
+
+result_t fio_read_async(struct allocator* alloc, const char* filepath, uint flags, uint mem_id,
+                        pfn_fio_async_done done_fn, void* param)
+{
+    ASSERT(g_aio);
+    ASSERT(done_fn);
+
+    struct fio_source src;
+    if (!fio_resolve(&src, filepath, BIT_CHECK(flags, FIO_ASYNC_IGNOREVFS)))
+        return RET_FILE_ERROR;
+
+    mt_mutex_lock(&g_aio->req_mtx);
+    struct fio_async_req* req = (struct fio_async_req*)mem_pool_alloc(&g_aio->req_pool);
+    mt_mutex_unlock(&g_aio->req_mtx);
+    if (req == NULL)
+        return RET_OUTOFMEMORY;
+    memset(req, 0x00, sizeof(struct fio_async_req));
+
+    strcpy(req->filepath, filepath);
+    memcpy(&req->src, &src, sizeof(src));
+    req->flags = flags;
+    req->alloc = alloc;
+    req->mem_id = mem_id;
+    req->done_fn = done_fn;
+    req->param = param;
+
+    result_t r = fio_async_prepare(req);
+    if (IS_FAIL(r)) {
+        mt_mutex_lock(&g_aio->req_mtx);
+        mem_pool_free(&g_aio->req_pool, req);
+        mt_mutex_unlock(&g_aio->req_mtx);
+        return r;
+    }
+
+    MT_ATOMIC_INCR(g_aio->pending_cnt);
+
+#if defined(_POSIXLIB_)
+    /* nothing to read */
+    if (req->size == 0)  {
+        req->r = RET_OK;
+        fio_async_complete(req);
+        return RET_OK;
+    }
+#endif
+
+#if defined(_IOURING_)
+    if (g_aio->use_uring)   {
+        fio_uring_submitreq(req);
+        return RET_OK;
+    }
+#endif
+
+    mt_mutex_lock(&g_aio->queue_mtx);
+    fio_async_pushreq(&g_aio->queue, req);
+    mt_mutex_unlock(&g_aio->queue_mtx);
+
+    for (int i = 0; i < g_aio->thread_cnt; i++)
+        mt_thread_resume(g_aio->threads[i]);
+
+    return RET_OK;
+}
+
+/* data is read (or failed), runs in io threads */
+static void fio_async_complete(struct fio_async_req* req)
+{
+#if defined(_POSIXLIB_)
+    if (req->src.pak == NULL && req->fd != -1)  {
+        close(req->fd);
+        req->fd = -1;
+    }
+#endif
+
+    if (BIT_CHECK(req->flags, FIO_ASYNC_CALLBACK_IO))   {
+        fio_async_dispatch(req);
+    }   else    {
+        mt_mutex_lock(&g_aio->done_mtx);
+        fio_async_pushreq(&g_aio->done, req);
+        mt_mutex_unlock(&g_aio->done_mtx);
+    }
+}
+
+/* creates the file from read data and calls user callback */
+static void fio_async_dispatch(struct fio_async_req* req)
+{
+    file_t f = req->f;
+
+    if (IS_OK(req->r) && f == NULL) {
+        if (req->src.pak != NULL)   {
+            f = pak_decodefile(req->src.pak, req->alloc, req->src.file_id, req->buffer,
+                               req->mem_id);
+        }   else    {
+            f = fio_attachmemz(req->alloc, req->buffer, req->size, req->filepath, req->mem_id);
+            if (f != NULL)
+                req->buffer = NULL; /* owned by the file now */
+        }
+    }
+
+    if (f == NULL)
+        log_printf(LOG_WARNING, "file-mgr: async read failed for '%s'", req->filepath);
+
+    req->f = NULL;
+    fio_async_freereq(req, FALSE);
+    req->done_fn(f, req->filepath, req->param);
+
+    mt_mutex_lock(&g_aio->req_mtx);
+    mem_pool_free(&g_aio->req_pool, req);
+    mt_mutex_unlock(&g_aio->req_mtx);
+    MT_ATOMIC_DECR(g_aio->pending_cnt);
+}
+
+/* frees request resources, if drop is TRUE, request itself is also freed without any callbacks */
+static void fio_async_freereq(struct fio_async_req* req, int drop)
+{
+    if (req->buffer != NULL)    {
+        if (req->src.pak != NULL)
+            FREE(req->buffer);
+        else
+            A_FREE(req->alloc, req->buffer);
+        req->buffer = NULL;
+    }
+
+#if defined(_POSIXLIB_)
+    if (req->src.pak == NULL && req->fd != -1)  {
+        close(req->fd);
+        req->fd = -1;
+    }
+#endif
+
+    if (drop)   {
+        if (req->f != NULL)
+            fio_close(req->f);
+        mt_mutex_lock(&g_aio->req_mtx);
+        mem_pool_free(&g_aio->req_pool, req);
+        mt_mutex_unlock(&g_aio->req_mtx);
+        MT_ATOMIC_DECR(g_aio->pending_cnt);
+    }
+}
+
+static void fio_async_dispatch_task(void* params, void* result, uint thread_id, uint job_id,
+                                    int worker_idx)
+{
+    struct fio_async_dispatch_params* dparams = (struct fio_async_dispatch_params*)params;
+    uint idx;
+    while ((idx = (uint)MT_ATOMIC_INCR(dparams->next_idx) - 1) < dparams->cnt)
+        fio_async_dispatch(dparams->reqs[idx]);
+}
+
+int fio_async_update()
+{
+    ASSERT(g_aio);
+
+    mt_mutex_lock(&g_aio->done_mtx);
+    struct fio_async_req* first = g_aio->done.first;
+    g_aio->done.first = g_aio->done.last = NULL;
+    mt_mutex_unlock(&g_aio->done_mtx);
+
+    uint cnt = 0;
+    for (struct fio_async_req* req = first; req != NULL; req = req->next)
+        cnt++;
+    if (cnt == 0)
+        return 0;
+
+    /* decompress and run callbacks in task-mgr workers */
+    struct fio_async_req** reqs = NULL;
+    if (cnt > 1 && tsk_isinit())
+        reqs = (struct fio_async_req**)ALLOC(sizeof(struct fio_async_req*)*cnt, 0);
+
+    if (reqs != NULL)   {
+        uint i = 0;
+        for (struct fio_async_req* req = first; req != NULL; req = req->next)
+            reqs[i++] = req;
+
+        struct fio_async_dispatch_params params;
+        params.reqs = reqs;
+        params.cnt = cnt;
+        params.next_idx = 0;
+        uint job_id = tsk_dispatch(fio_async_dispatch_task, TSK_CONTEXT_ALL, TSK_THREADS_ALL,
+                                   &params, NULL);
+        if (job_id != 0)    {
+            tsk_wait(job_id);
+            tsk_destroy(job_id);
+        }   else    {
+            fio_async_dispatch_task(&params, NULL, 0, 0, 0);
+        }
+        FREE(reqs);
+    }   else    {
+        struct fio_async_req* req = first;
+        while (req != NULL) {
+            struct fio_async_req* next = req->next;
+            fio_async_dispatch(req);
+            req = next;
+        }
+    }
+
+    return (int)cnt;
+}
+
+int fio_async_pending()
+{
+    return (g_aio != NULL) ? (int)g_aio->pending_cnt : 0;
+}
+
+/* fallback io threads */
+static result_t fio_async_kernel(mt_thread thread)
+{
+    if (g_aio->quit)
+        return RET_ABORT;
+
+    mt_mutex_lock(&g_aio->queue_mtx);
+    struct fio_async_req* req = fio_async_popreq(&g_aio->queue);
+    if (req == NULL)
+        mt_thread_pause(thread);
+    mt_mutex_unlock(&g_aio->queue_mtx);
+
+    if (req != NULL)    {
+        fio_async_readreq(req);
+        fio_async_complete(req);
+    }
+
+    return RET_OK;
+}
+
+/*************************************************************************************************
+ * io_uring (linux)
+ */
+#if defined(_IOURING_)
+static result_t fio_uring_init(struct fio_uring* ring, uint entries)
+{
+    struct io_uring_params p;
+    memset(ring, 0x00, sizeof(struct fio_uring));
+    memset(&p, 0x00, sizeof(p));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return RET_NOT_SUPPORTED;
+
+    ring->sq_sz = p.sq_off.array + p.sq_entries*sizeof(uint);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sq_sz = ring->cq_sz = maxsz(ring->sq_sz, ring->cq_sz);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        return RET_FAIL;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)   {
+        ring->cq_ptr = ring->sq_ptr;
+    }   else    {
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_sz);
+            close(ring->fd);
+            return RET_FAIL;
+        }
+    }
+
+    ring->sqes_sz = p.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_sz, PROT_READ|PROT_WRITE,
+                                            MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)   {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_sz);
+        munmap(ring->sq_ptr, ring->sq_sz);
+        close(ring->fd);
+        return RET_FAIL;
+    }
+
+    uint8* sq = (uint8*)ring->sq_ptr;
+    uint8* cq = (uint8*)ring->cq_ptr;
+    ring->sq_head = (uint*)(sq + p.sq_off.head);
+    ring->sq_tail = (uint*)(sq + p.sq_off.tail);
+    ring->sq_mask = *(uint*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (uint*)(sq + p.sq_off.array);
+    ring->cq_head = (uint*)(cq + p.cq_off.head);
+    ring->cq_tail = (uint*)(cq + p.cq_off.tail);
+    ring->cq_mask = *(uint*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    /* leave room in completion queue for the wake-up (nop) event */
+    ring->max_inflight = mini(p.sq_entries, p.cq_entries - 1);
+    return RET_OK;
+}
+
+static void fio_uring_release(struct fio_uring* ring)
+{
+    munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_sz);
+    munmap(ring->sq_ptr, ring->sq_sz);
+    close(ring->fd);
+}
+
+/* queues next read operation of the request, ring_mtx must be locked
+ * returns FALSE if kernel did not accept the operation (EAGAIN/EBUSY/ENOMEM), nothing is queued */
+static int fio_uring_pushread(struct fio_uring* ring, struct fio_async_req* req)
+{
+    req->iov.iov_base = req->buffer + req->read_sz;
+    req->iov.iov_len = minsz(req->size - req->read_sz, URING_READ_MAX);
+
+    uint tail = *ring->sq_tail;
+    uint idx = tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = req->fd;
+    sqe->off = req->offset + req->read_sz;
+    sqe->addr = (uint64)(uptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->user_data = (uint64)(uptr_t)req;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int r;
+    do  {
+        r = (int)syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+    }   while (r < 0 && errno == EINTR);
+
+    if (r != 1) {
+        /* entry is not consumed by the kernel, take it back */
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return FALSE;
+    }
+
+    g_aio->inflight++;
+    return TRUE;
+}
+
+/* queues the request in the ring, or in the backlog if the ring is full or kernel is out of
+ * resources, in which case it's retried after next completion
+ * returns FALSE if nothing is in flight to retry after, caller should read it synchronously
+ * ring_mtx must be locked */
+static int fio_uring_queuereq(struct fio_async_req* req)
+{
+    if (g_aio->inflight < g_aio->ring.max_inflight && fio_uring_pushread(&g_aio->ring, req))
+        return TRUE;
+
+    if (g_aio->inflight == 0)
+        return FALSE;
+    fio_async_pushreq(&g_aio->backlog, req);
+    return TRUE;
+}
+
+static void fio_uring_submitreq(struct fio_async_req* req)
+{
+    mt_mutex_lock(&g_aio->ring_mtx);
+    int queued = fio_uring_queuereq(req);
+    mt_mutex_unlock(&g_aio->ring_mtx);
+
+    if (!queued)    {
+        fio_async_readreq(req);
+        fio_async_complete(req);
+    }
+}
+
+/* completion thread */
+static result_t fio_uring_kernel(mt_thread thread)
+{
+    struct fio_uring* ring = &g_aio->ring;
+
+    int r = (int)syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (r < 0 && errno != EINTR)    {
+        /* in-flight reads still complete into the mapped queue, keep reaping them, so their
+         * requests finish and fio_async_release doesn't wait forever */
+        if (MT_ATOMIC_CAS(g_aio->wait_failed, 0, 1) == 0)
+            log_printf(LOG_WARNING, "io_uring wait failed (errno: %d), polling completions", errno);
+        util_sleep(1);
+    }
+
+    struct fio_async_queue finished;
+    struct fio_async_queue unqueued;    /* could not be queued, read synchronously */
+    finished.first = finished.last = NULL;
+    unqueued.first = unqueued.last = NULL;
+
+    mt_mutex_lock(&g_aio->ring_mtx);
+    uint head = *ring->cq_head;
+    uint tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        struct fio_async_req* req = (struct fio_async_req*)(uptr_t)cqe->user_data;
+        int res = cqe->res;
+        head++;
+
+        /* wake-up event */
+        if (req == NULL)
+            continue;
+
+        g_aio->inflight--;
+        if (res > 0)
+            req->read_sz += (size_t)res;
+
+        if (res == -EINTR || res == -EAGAIN || (res > 0 && req->read_sz < req->size))  {
+            /* interrupted or partial read, continue reading the rest */
+            if (!fio_uring_queuereq(req))
+                fio_async_pushreq(&unqueued, req);
+        }   else    {
+            req->r = (res > 0) ? RET_OK : RET_FILE_ERROR;
+            fio_async_pushreq(&finished, req);
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    /* submit waiting requests, if kernel does not accept one, the rest wait for next completion,
+     * unless nothing is in flight, then it's read synchronously */
+    struct fio_async_req* req;
+    while (!g_aio->quit && g_aio->inflight < ring->max_inflight &&
+           (req = fio_async_popreq(&g_aio->backlog)) != NULL)
+    {
+        if (!fio_uring_pushread(ring, req)) {
+            if (g_aio->inflight > 0)    {
+                fio_async_pushfront(&g_aio->backlog, req);
+                break;
+            }
+            fio_async_pushreq(&unqueued, req);
+        }
+    }
+    int quit = g_aio->quit && g_aio->inflight == 0;
+    mt_mutex_unlock(&g_aio->ring_mtx);
+
+    while ((req = fio_async_popreq(&unqueued)) != NULL)  {
+        fio_async_readreq(req);
+        fio_async_pushreq(&finished, req);
+    }
+
+    while ((req = fio_async_popreq(&finished)) != NULL)
+        fio_async_complete(req);
+
+    return quit ? RET_ABORT : RET_OK;
+}
+#endif
@@ -12,7 +12,12 @@
  *   and/or other materials provided with the distribution.
  *
  ***********************************************************************************/
+#if defined(_WIN_)
+#include "dhcore/win.h"
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "dhcore/file-io.h"
 #include "dhcore/mem-mgr.h"
@@ -20,22 +25,50 @@
 #include "dhcore/numeric.h"
 #include "dhcore/str.h"
 #include "dhcore/pak-file.h"
+#include "dhcore/pak-file-fmt.h"
 #include "dhcore/log.h"
 #include "dhcore/hash-table.h"
 #include "dhcore/mt.h"
 #include "dhcore/util.h"
 #include "dhcore/path.h"
 
+#if defined(_POSIXLIB_)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
 #if defined(_FILEMON_)
 /* You'll need 3rdparty EFSW library (forked): https://bitbucket.org/sepul/efsw */
 #define EFSW_DYNAMIC
 #include "efsw/efsw.h"
 #undef EFSW_DYNAMIC
+#elif defined(_LINUX_)
+/* native backend, no external dependency */
+#define _FILEMON_INOTIFY_
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
 #endif
 
 #define MEM_BLOCK_SIZE 4096
+#define STREAM_SKIP_SIZE 4096   /* scratch buffer size for skipping stream data in seeks */
+#define WRITEV_MAX 64   /* maximum segments that are passed to each writev call */
 #define MON_BUFFER_SIZE (256*1024)
 #define MON_ITEM_SIZE 200
+#define MON_DIR_SIZE 64
+#define MON_EVENT_BUFFER (16*1024)
+#define MON_DEBOUNCE 50 /* milliseconds that a changed file should be quiet before dispatch */
+#define MON_WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+    IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define BATCH_COALESCE_GAP (64*1024)    /* maximum gap between pak items that are read together */
+#define BATCH_COALESCE_MAX (8*1024*1024)    /* maximum size of each coalesced read */
+#define BATCH_DISK_WINDOW 32    /* maximum disk files that are opened together in batch reads */
+#define PATH_CACHE_SIZE 256 /* initial slots of path cache table */
+#define PATH_CACHE_MAX 8192 /* path cache is flushed after this many entries */
 
 // Fwd declare: IOS
 #ifdef _IOS_
@@ -65,7 +98,7 @@ struct vdir
 #endif
 };
 
-#if defined(_FILEMON_)
+#if defined(_FILEMON_) || defined(_FILEMON_INOTIFY_)
 struct mon_item
 {
     pfn_fio_modify fn;
@@ -75,6 +108,34 @@ struct mon_item
 };
 #endif
 
+#if defined(_FILEMON_INOTIFY_)
+/* watched directory, each directory of monitored vdir trees have their own inotify watch */
+struct mon_dir
+{
+    int wd;
+    char path[DH_PATH_MAX];     /* full path on disk */
+    char relpath[DH_PATH_MAX];  /* path relative to vdir (unix), empty for vdir root */
+};
+
+/* pending change of a registered file, dispatched after it's quiet for MON_DEBOUNCE */
+struct mon_event
+{
+    char filepath[DH_PATH_MAX];
+    uint hash;
+    uint64 tm;  /* last change time (ms) */
+};
+#endif
+
+/* cached resolve result of a virtual filepath (positive or negative) */
+struct path_entry
+{
+    char filepath[DH_PATH_MAX]; /* normalized virtual filepath */
+    struct pak_file* pak;   /* pak that contains the file, NULL if it's not in any pak */
+    uint file_id;
+    int disk;   /* disk resolve state, -1: not resolved yet, FALSE: not found, TRUE: found */
+    char diskpath[DH_PATH_MAX];
+};
+
 /**
  * file manager that handles virtual-filesystems and pool allocators for file io\n
  * virtual-filesystems are either virtual-directories or 'pak' file archives
@@ -84,16 +145,27 @@ struct file_mgr
     mt_mutex diskfile_mtx;
     mt_mutex memfile_mtx;
 
+    mt_mutex mapfile_mtx;
+
     struct pool_alloc diskfile_alloc;
     struct pool_alloc memfile_alloc;
+    struct pool_alloc mapfile_alloc;
     struct array vdirs;   /* item: vdir */
     struct array paks;    /* item: pak_file */
     struct hashtable_open mon_table;    /* key: filepath(hashed), value: pointer to mon_item */
+    mt_mutex path_mtx;
+    struct hashtable_open path_table;   /* key: normalized filepath(hashed), value: path_entry */
+    struct pool_alloc path_alloc;   /* item: path_entry */
+    uint path_cnt;
 #ifdef _MOBILE_
     struct array bundles;
 #endif
 #if defined(_FILEMON_)
     efsw_watcher watcher;
+#elif defined(_FILEMON_INOTIFY_)
+    int inotify_fd; /* -1 if not initialized */
+    struct hashtable_open mon_dirs;  /* key: watch descriptor, value: pointer to mon_dir */
+    struct array mon_events;    /* item: mon_event */
 #endif
 };
 
@@ -101,7 +173,7 @@ struct file_header
 {
     enum file_type type;
     char path[DH_PATH_MAX];
-    size_t size;
+    uint64 size;
     enum file_mode mode;
     pfnio_file_read read_fn;
     pfnio_file_write write_fn;
@@ -121,20 +193,58 @@ struct mem_file
     uint mem_id;
 };
 
+struct map_file
+{
+    uint8* ptr; /* mapped view of the whole file, NULL for empty files */
+    size_t offset;
+    int zeroterm;   /* last page is partial, so there is a zero byte after the data */
+#if defined(_WIN_)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+struct stream_file
+{
+    pfn_fio_streamread read_fn;
+    pfn_fio_streamrewind rewind_fn;
+    pfn_fio_streamclose close_fn;
+    void* param;
+    uint64 offset;
+};
+
+/* resolved file for batch reads, pak items are sorted by their data offset */
+struct fio_batch_item
+{
+    uint idx;   /* index of the file in the requested list */
+    struct fio_source src;
+    uint64 offset;  /* pak items: data offset in the pak */
+    uint size;  /* pak items: data size in the pak */
+};
+
 /*************************************************************************************************/
 /* callbacks for directory monitoring */
 #if defined(_FILEMON_)
 static int fio_vdir_initmon(struct vdir* vd);
 static void fio_vdir_releasemon(struct vdir* vd);
+#elif defined(_FILEMON_INOTIFY_)
+static int fio_vdir_initmon(struct vdir* vd);
+static void fio_mon_clearwatches();
 #endif
 
 static size_t fio_readdisk(file_t f, void* buffer, size_t item_size, size_t items_cnt);
 static size_t fio_writedisk(file_t f, const void* buffer, size_t item_size, size_t items_cnt);
 static size_t fio_readmem(file_t f, void* buffer, size_t item_size, size_t items_cnt);
 static size_t fio_writemem(file_t f, const void* buffer, size_t item_size, size_t items_cnt);
+static size_t fio_readmap(file_t f, void* buffer, size_t item_size, size_t items_cnt);
+static size_t fio_readstream(file_t f, void* buffer, size_t item_size, size_t items_cnt);
 
 /* resolve and open a filepath from the disk */
 static FILE* open_resolvepath(const char* filepath);
+static int resolve_diskpath(char* outpath, const char* filepath);
+static int resolve_vfs(struct fio_source* src, const char* filepath, int disk_only);
+/* load an opened disk file into a memory file, closes 'ff' */
+static file_t fio_loaddisk(struct allocator* alloc, FILE* ff, const char* filepath, uint mem_id);
 
 
 /*************************************************************************************************
@@ -173,6 +283,21 @@ static void fio_free_membuff(uint8 *buff)
     mt_mutex_unlock(&g_fio->memfile_mtx);
 }
 
+static uint8* fio_alloc_mapbuff()
+{
+    mt_mutex_lock(&g_fio->mapfile_mtx);
+    uint8 *ptr = (uint8*)mem_pool_alloc(&g_fio->mapfile_alloc);
+    mt_mutex_unlock(&g_fio->mapfile_mtx);
+    return ptr;
+}
+
+static void fio_free_mapbuff(uint8 *buff)
+{
+    mt_mutex_lock(&g_fio->mapfile_mtx);
+    mem_pool_free(&g_fio->mapfile_alloc, buff);
+    mt_mutex_unlock(&g_fio->mapfile_mtx);
+}
+
 /*************************************************************************************************/
 result_t fio_initmgr()
 {
@@ -187,6 +312,7 @@ result_t fio_initmgr()
 
     mt_mutex_init(&g_fio->memfile_mtx);
     mt_mutex_init(&g_fio->diskfile_mtx);
+    mt_mutex_init(&g_fio->mapfile_mtx);
 
     r = mem_pool_create(mem_heap(), &g_fio->diskfile_alloc,
                         sizeof(struct file_header) + sizeof(struct disk_file), 32, 0);
@@ -202,6 +328,26 @@ result_t fio_initmgr()
         return r;
     }
 
+    r = mem_pool_create(mem_heap(), &g_fio->mapfile_alloc,
+                        sizeof(struct file_header) + sizeof(struct map_file), 16, 0);
+    if (IS_FAIL(r))   {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+
+    mt_mutex_init(&g_fio->path_mtx);
+    r = hashtable_open_create(mem_heap(), &g_fio->path_table, PATH_CACHE_SIZE, PATH_CACHE_SIZE, 0);
+    if (IS_FAIL(r)) {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+
+    r = mem_pool_create(mem_heap(), &g_fio->path_alloc, sizeof(struct path_entry), 64, 0);
+    if (IS_FAIL(r)) {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+
     r = arr_create(mem_heap(), &g_fio->vdirs, sizeof(struct vdir), 5, 5, 0);
     if (IS_FAIL(r))     {
         err_printn(__FILE__, __LINE__, r);
@@ -222,7 +368,7 @@ result_t fio_initmgr()
     }
 #endif
 
-#if defined(_FILEMON_)
+#if defined(_FILEMON_) || defined(_FILEMON_INOTIFY_)
     r = hashtable_open_create(mem_heap(), &g_fio->mon_table, MON_ITEM_SIZE, MON_ITEM_SIZE, 0);
     if (IS_FAIL(r)) {
         err_printn(__FILE__, __LINE__, r);
@@ -230,13 +376,30 @@ result_t fio_initmgr()
     }
 #endif
 
+#if defined(_FILEMON_INOTIFY_)
+    g_fio->inotify_fd = -1;
+    r = hashtable_open_create(mem_heap(), &g_fio->mon_dirs, MON_DIR_SIZE, MON_DIR_SIZE, 0);
+    if (IS_FAIL(r)) {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+
+    r = arr_create(mem_heap(), &g_fio->mon_events, sizeof(struct mon_event), 16, 16, 0);
+    if (IS_FAIL(r)) {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+#endif
+
     return RET_OK;
 }
 
 void fio_releasemgr()
 {
     if (g_fio != NULL)  {
-#if defined(_FILEMON_)
+        fio_async_release();
+
+#if defined(_FILEMON_) || defined(_FILEMON_INOTIFY_)
         /* search for remaining registered monitor items and delete them */
         int cnt = 0;
         for (int i = 0; i < g_fio->mon_table.items_cnt; i++) {
@@ -259,6 +422,11 @@ void fio_releasemgr()
 #if defined(_FILEMON_)
         if (g_fio->watcher != NULL)
             efsw_destroy(g_fio->watcher);
+#elif defined(_FILEMON_INOTIFY_)
+        if (g_fio->inotify_fd != -1)
+            close(g_fio->inotify_fd);
+        hashtable_open_destroy(&g_fio->mon_dirs);
+        arr_destroy(&g_fio->mon_events);
 #endif
 
 #ifdef _MOBILE_
@@ -266,12 +434,17 @@ void fio_releasemgr()
 #endif
 
         hashtable_open_destroy(&g_fio->mon_table);
+        hashtable_open_destroy(&g_fio->path_table);
+        mem_pool_destroy(&g_fio->path_alloc);
+        mt_mutex_release(&g_fio->path_mtx);
         arr_destroy(&g_fio->vdirs);
         arr_destroy(&g_fio->paks);
         mt_mutex_release(&g_fio->memfile_mtx);
         mt_mutex_release(&g_fio->diskfile_mtx);
+        mt_mutex_release(&g_fio->mapfile_mtx);
         mem_pool_destroy(&g_fio->memfile_alloc);
         mem_pool_destroy(&g_fio->diskfile_alloc);
+        mem_pool_destroy(&g_fio->mapfile_alloc);
 
         FREE(g_fio);
         g_fio = NULL;
@@ -299,10 +472,11 @@ int fio_addvdir(const char* directory, int monitor)
     memset(vd, 0x00, sizeof(struct vdir));
     vd->monitor = monitor;
     path_norm(vd->path, dir);
+    fio_invalidate(NULL);
 
-#if defined(_FILEMON_)
-    if (monitor)
-        return fio_vdir_initmon(vd);
+#if defined(_FILEMON_) || defined(_FILEMON_INOTIFY_)
+    if (monitor && !fio_vdir_initmon(vd))
+        return FALSE;
 #else
     if (monitor) {
         log_print(LOG_WARNING, "File monitoring not enabled in this build, use --file-mon flag "
@@ -322,6 +496,7 @@ void fio_addbundle(const char *bundle_name)
     if (id) {
         int *newi = (int*)arr_add(&g_fio->bundles);
         *newi = id;
+        fio_invalidate(NULL);
     }
 #else
     ASSERT(0);
@@ -336,8 +511,11 @@ void fio_clearvdirs()
         if (vd->monitor)
             fio_vdir_releasemon(vd);
     }
+#elif defined(_FILEMON_INOTIFY_)
+    fio_mon_clearwatches();
 #endif
     arr_clear(&g_fio->vdirs);
+    fio_invalidate(NULL);
 }
 
 void fio_addpak(struct pak_file* pak)
@@ -348,11 +526,13 @@ void fio_addpak(struct pak_file* pak)
     struct pak_file** ppaks = (struct pak_file**)arr_add(&g_fio->paks);
     ASSERT(ppaks);
     *ppaks = pak;
+    fio_invalidate(NULL);
 }
 
 void fio_clearpaks()
 {
     arr_clear(&g_fio->paks);
+    fio_invalidate(NULL);
 }
 
 file_t fio_createmem(struct allocator* alloc, const char* name, uint mem_id)
@@ -413,52 +593,55 @@ char* fio_loadtext(struct allocator *alloc, const char *filepath, int ignore_vfs
 
 file_t fio_openmem(struct allocator* alloc, const char* filepath, int ignore_vfs, uint mem_id)
 {
-    /* if memory file is requested and we have pak files, first try loading from paks */
-    if (!ignore_vfs && !arr_isempty(&g_fio->paks))    {
-        struct pak_file** paks = (struct pak_file**)g_fio->paks.buffer;
-        uint paks_cnt = g_fio->paks.item_cnt;
-        for (uint i = 0; i < paks_cnt; i++)   {
-            uint file_id = pak_findfile(paks[i], filepath);
-            if (file_id != 0)
-                return pak_getfile(paks[i], alloc, mem_heap(), file_id, mem_id);
-        }
+    /* if memory file is requested, first try loading from paks */
+    if (!ignore_vfs)    {
+        struct fio_source src;
+        if (!resolve_vfs(&src, filepath, FALSE))
+            return NULL;
+        if (src.pak != NULL)
+            return pak_getfile(src.pak, alloc, mem_heap(), src.file_id, mem_id);
     }
 
     /* continue opening a file from disk and load it into memory */
+    FILE* ff = !ignore_vfs ? open_resolvepath(filepath) : fopen(filepath, "rb");
+    if (ff == NULL)
+        return NULL;
+    return fio_loaddisk(alloc, ff, filepath, mem_id);
+}
+
+static file_t fio_loaddisk(struct allocator* alloc, FILE* ff, const char* filepath, uint mem_id)
+{
     uint8* file_buf = (uint8*)fio_alloc_membuff();
-    if (file_buf == NULL)
+    if (file_buf == NULL)   {
+        fclose(ff);
     	return NULL;
+    }
     memset(file_buf, 0x00, g_fio->memfile_alloc.item_sz);
 
     struct file_header* header = (struct file_header*)file_buf;
     struct mem_file* f = (struct mem_file*)(file_buf + sizeof(struct file_header));
 
-    FILE* ff = !ignore_vfs ? open_resolvepath(filepath) : fopen(filepath, "rb");
-    if (ff == NULL)     {
-        fio_free_membuff(file_buf);
-        return NULL;
-    }
-
     /* header */
     header->type = FILE_TYPE_MEM;
     strcpy(header->path, filepath);
     header->mode = FILE_MODE_READ;
 
-    fseek(ff, 0, SEEK_END);
-    header->size = ftell(ff);
-    fseek(ff, 0, SEEK_SET);
+    util_fseek64(ff, 0, SEEK_END);
+    header->size = (uint64)util_ftell64(ff);
+    util_fseek64(ff, 0, SEEK_SET);
     header->read_fn = fio_readmem;
 
     /* data */
-    f->buffer = (uint8*)A_ALLOC(alloc, header->size+1, mem_id);
+    f->buffer = (uint8*)A_ALLOC(alloc, (size_t)header->size+1, mem_id);
     if (f->buffer == NULL)  {
         fclose(ff);
         fio_free_membuff(file_buf);
         return NULL;
     }
-    fread(f->buffer, header->size, 1, ff);
+    fread(f->buffer, (size_t)header->size, 1, ff);
+    f->buffer[header->size] = 0;
     f->alloc = alloc;
-    f->max_size = header->size;
+    f->max_size = (size_t)header->size + 1;
     f->offset = 0;
     f->mem_id = mem_id;
 
@@ -494,16 +677,29 @@ file_t fio_attachmem(struct allocator* alloc, void* buffer,
     return file_buf;
 }
 
+file_t fio_attachmemz(struct allocator* alloc, void* buffer, size_t size, const char* name,
+                      uint mem_id)
+{
+    file_t f = fio_attachmem(alloc, buffer, size, name, mem_id);
+    if (f != NULL)  {
+        struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+        fdata->buffer[size] = 0;
+        fdata->max_size = size + 1;
+    }
+    return f;
+}
+
 void* fio_detachmem(file_t f, size_t* outsize, struct allocator** palloc)
 {
     struct file_header* header = (struct file_header*)f;
     struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+    ASSERT(header->type == FILE_TYPE_MEM);
 
     if (fdata->buffer == NULL)
         return NULL;
 
     void* buffer = fdata->buffer;
-    *outsize = header->size;
+    *outsize = (size_t)header->size;
 
     if (palloc != NULL)
         *palloc = fdata->alloc;
@@ -514,6 +710,9 @@ void* fio_detachmem(file_t f, size_t* outsize, struct allocator** palloc)
 
 file_t fio_createdisk(const char* filepath)
 {
+    /* new file may be shadowed by a cached negative entry */
+    fio_invalidate(NULL);
+
     uint8* file_buf = (uint8*)fio_alloc_diskbuff();
 
     if (file_buf == NULL)
@@ -565,27 +764,191 @@ file_t fio_opendisk(const char* filepath, int ignore_vfs)
     }
 
     /* size */
-    fseek(f->file, 0, SEEK_END);
-    header->size = ftell(f->file);
-    fseek(f->file, 0, SEEK_SET);
+    util_fseek64(f->file, 0, SEEK_END);
+    header->size = (uint64)util_ftell64(f->file);
+    util_fseek64(f->file, 0, SEEK_SET);
+
+    return file_buf;
+}
+
+/* maps the whole file into memory (read-only) */
+static int fio_mapview(struct map_file* f, const char* path, OUT uint64* psize)
+{
+#if defined(_WIN_)
+    f->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f->file == INVALID_HANDLE_VALUE)    {
+        f->file = NULL;
+        return FALSE;
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(f->file, &size);
+    *psize = (uint64)size.QuadPart;
+    if (*psize == 0)
+        return TRUE;
+
+    f->mapping = CreateFileMapping(f->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (f->mapping == NULL) {
+        CloseHandle(f->file);
+        f->file = NULL;
+        return FALSE;
+    }
+    f->ptr = (uint8*)MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (f->ptr == NULL) {
+        CloseHandle(f->mapping);
+        CloseHandle(f->file);
+        f->mapping = NULL;
+        f->file = NULL;
+        return FALSE;
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    f->zeroterm = (*psize % (uint64)si.dwPageSize) != 0;
+    return TRUE;
+#elif defined(_POSIXLIB_)
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)    {
+        close(fd);
+        return FALSE;
+    }
+    *psize = (uint64)st.st_size;
+
+    /* mapping stays valid after the descriptor is closed */
+    if (*psize > 0) {
+        void* ptr = mmap(NULL, (size_t)*psize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED)  {
+            close(fd);
+            return FALSE;
+        }
+        f->ptr = (uint8*)ptr;
+        f->zeroterm = (*psize % (uint64)sysconf(_SC_PAGESIZE)) != 0;
+    }
+    close(fd);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static void fio_unmapview(struct map_file* f, size_t size)
+{
+#if defined(_WIN_)
+    if (f->ptr != NULL)
+        UnmapViewOfFile(f->ptr);
+    if (f->mapping != NULL)
+        CloseHandle(f->mapping);
+    if (f->file != NULL)
+        CloseHandle(f->file);
+    f->mapping = NULL;
+    f->file = NULL;
+#elif defined(_POSIXLIB_)
+    if (f->ptr != NULL)
+        munmap(f->ptr, size);
+#endif
+    f->ptr = NULL;
+    f->zeroterm = FALSE;
+}
+
+file_t fio_openmap(const char* filepath, int ignore_vfs)
+{
+    uint8* file_buf = (uint8*)fio_alloc_mapbuff();
+    if (file_buf == NULL)
+        return NULL;
+    memset(file_buf, 0x00, g_fio->mapfile_alloc.item_sz);
+
+    struct file_header* header = (struct file_header*)file_buf;
+    struct map_file* f = (struct map_file*)(file_buf + sizeof(struct file_header));
+
+    /* header */
+    header->type = FILE_TYPE_MAP;
+    header->mode = FILE_MODE_READ;
+    strcpy(header->path, filepath);
+    header->read_fn = fio_readmap;
+
+    /* data */
+    int r;
+    if (!ignore_vfs)    {
+        struct fio_source src;
+        r = resolve_vfs(&src, filepath, TRUE);
+        if (r && !fio_mapview(f, src.path, &header->size))  {
+            /* cached entry is stale (file is removed without monitoring), resolve it again */
+            fio_invalidate(filepath);
+            r = resolve_vfs(&src, filepath, TRUE) && fio_mapview(f, src.path, &header->size);
+        }
+    }   else    {
+        r = fio_mapview(f, filepath, &header->size);
+    }
+
+    if (!r) {
+        fio_free_mapbuff(file_buf);
+        return NULL;
+    }
+    return file_buf;
+}
+
+file_t fio_openstream(const char* name, uint64 size, pfn_fio_streamread read_fn,
+                      pfn_fio_streamrewind rewind_fn, pfn_fio_streamclose close_fn, void* param)
+{
+    ASSERT(read_fn);
+
+    uint8* file_buf = (uint8*)ALLOC(sizeof(struct file_header) + sizeof(struct stream_file), 0);
+    if (file_buf == NULL)
+        return NULL;
+    memset(file_buf, 0x00, sizeof(struct file_header) + sizeof(struct stream_file));
+
+    struct file_header* header = (struct file_header*)file_buf;
+    struct stream_file* f = (struct stream_file*)(file_buf + sizeof(struct file_header));
+
+    /* header */
+    header->type = FILE_TYPE_STREAM;
+    header->mode = FILE_MODE_READ;
+    header->size = size;
+    str_safecpy(header->path, sizeof(header->path), name);
+    header->read_fn = fio_readstream;
+
+    /* data */
+    f->read_fn = read_fn;
+    f->rewind_fn = rewind_fn;
+    f->close_fn = close_fn;
+    f->param = param;
 
     return file_buf;
 }
 
 static FILE* open_resolvepath(const char* filepath)
+{
+    struct fio_source src;
+    if (!resolve_vfs(&src, filepath, TRUE))
+        return NULL;
+
+    FILE* f = fopen(src.path, "rb");
+    if (f == NULL)  {
+        /* cached entry is stale (file is removed without monitoring), resolve it again */
+        fio_invalidate(filepath);
+        if (resolve_vfs(&src, filepath, TRUE))
+            f = fopen(src.path, "rb");
+    }
+    return f;
+}
+
+static int resolve_diskpath(char* outpath, const char* filepath)
 {
     ASSERT(g_fio);
-    char testpath[DH_PATH_MAX];
 
 #ifdef _IOS_
     int bundle_cnt = g_fio->bundles.item_cnt;
     int* bundles = (int*)g_fio->bundles.buffer;
     for (int i = 0; i < bundle_cnt; i++)    {
         if (bundles[i])  {
-            fio_ios_resolve_path(testpath, sizeof(testpath), bundles[i], filepath);
-            if (!util_pathisdir(testpath))  {
-                return fopen(testpath, "rb");
-            }
+            fio_ios_resolve_path(outpath, DH_PATH_MAX, bundles[i], filepath);
+            if (!util_pathisdir(outpath))
+                return TRUE;
         }
     }
 #endif
@@ -594,15 +957,375 @@ static FILE* open_resolvepath(const char* filepath)
     uint item_cnt = g_fio->vdirs.item_cnt;
     for (uint i = 0; i < item_cnt; i++)   {
         struct vdir* vd = &vds[i];
-        path_join(testpath, vd->path, filepath, NULL);
-        if (path_exists(testpath) == 1)  {
-            return fopen(testpath, "rb");
-        }
+        path_join(outpath, vd->path, filepath, NULL);
+        if (path_exists(outpath) == 1)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+int fio_resolve(struct fio_source* src, const char* filepath, int ignore_vfs)
+{
+    ASSERT(g_fio);
+    memset(src, 0x00, sizeof(struct fio_source));
+
+    if (ignore_vfs) {
+        strcpy(src->path, filepath);
+        return path_exists(filepath) == 1;
     }
 
+    return resolve_vfs(src, filepath, FALSE);
+}
+
+static struct pak_file* resolve_pak(const char* filepath, OUT uint* pfile_id)
+{
+    struct pak_file** paks = (struct pak_file**)g_fio->paks.buffer;
+    uint paks_cnt = g_fio->paks.item_cnt;
+    for (uint i = 0; i < paks_cnt; i++)   {
+        uint file_id = pak_findfile(paks[i], filepath);
+        if (file_id != 0)   {
+            *pfile_id = file_id;
+            return paks[i];
+        }
+    }
+    *pfile_id = 0;
     return NULL;
 }
 
+/* cache key for virtual filepaths, so different separators map to the same entry */
+static void path_cachekey(char* key, const char* filepath)
+{
+    path_tounix(key, filepath);
+}
+
+static void path_clearcache()
+{
+    hashtable_open_clear(&g_fio->path_table);
+    mem_pool_clear(&g_fio->path_alloc);
+    g_fio->path_cnt = 0;
+}
+
+/* fetch cache entry of the key (see path_cachekey) or create a new one, path_mtx must be locked
+ * returns NULL if filepath can not be cached (hash collision or out of memory) */
+static struct path_entry* path_getcache(const char* key)
+{
+    uint hash = hash_str(key);
+
+    struct hashtable_item* item = hashtable_open_find(&g_fio->path_table, hash);
+    if (item != NULL)   {
+        struct path_entry* e = (struct path_entry*)item->value;
+        return str_isequal(e->filepath, key) ? e : NULL;
+    }
+
+    if (g_fio->path_cnt >= PATH_CACHE_MAX)
+        path_clearcache();
+
+    struct path_entry* e = (struct path_entry*)mem_pool_alloc(&g_fio->path_alloc);
+    if (e == NULL)
+        return NULL;
+    strcpy(e->filepath, key);
+    e->pak = resolve_pak(key, &e->file_id);
+    e->disk = -1;
+    e->diskpath[0] = 0;
+
+    if (IS_FAIL(hashtable_open_add(&g_fio->path_table, hash, (iptr_t)e)))  {
+        mem_pool_free(&g_fio->path_alloc, e);
+        return NULL;
+    }
+    g_fio->path_cnt++;
+    return e;
+}
+
+/* resolves filepath in paks and virtual directories through the path cache
+ * disk_only: ignore paks and only resolve the path on disk (for disk files) */
+static int resolve_vfs(struct fio_source* src, const char* filepath, int disk_only)
+{
+    ASSERT(g_fio);
+    memset(src, 0x00, sizeof(struct fio_source));
+
+    /* paths are resolved by their cache key, so cached and uncached resolves are the same */
+    char key[DH_PATH_MAX];
+    path_cachekey(key, filepath);
+
+    int found;
+    mt_mutex_lock(&g_fio->path_mtx);
+    struct path_entry* e = path_getcache(key);
+    if (e != NULL)  {
+        if (!disk_only && e->pak != NULL)   {
+            src->pak = e->pak;
+            src->file_id = e->file_id;
+            found = TRUE;
+        }   else    {
+            if (e->disk == -1)
+                e->disk = resolve_diskpath(e->diskpath, key);
+            if (e->disk)
+                strcpy(src->path, e->diskpath);
+            found = e->disk;
+        }
+    }   else    {
+        if (!disk_only)
+            src->pak = resolve_pak(key, &src->file_id);
+        found = src->pak != NULL ? TRUE : resolve_diskpath(src->path, key);
+    }
+    mt_mutex_unlock(&g_fio->path_mtx);
+
+    return found;
+}
+
+/* any change in the directory tree may change path resolves (a file that is created or deleted
+ * in one vdir can hide or reveal the same file in the next one), monitors call this on changes */
+void fio_invalidate(const char* filepath)
+{
+    ASSERT(g_fio);
+
+    mt_mutex_lock(&g_fio->path_mtx);
+    if (filepath != NULL)   {
+        char key[DH_PATH_MAX];
+        path_cachekey(key, filepath);
+        struct hashtable_item* item = hashtable_open_find(&g_fio->path_table, hash_str(key));
+        if (item != NULL)   {
+            struct path_entry* e = (struct path_entry*)item->value;
+            hashtable_open_remove(&g_fio->path_table, item);
+            mem_pool_free(&g_fio->path_alloc, e);
+            g_fio->path_cnt--;
+        }
+    }   else    {
+        path_clearcache();
+    }
+    mt_mutex_unlock(&g_fio->path_mtx);
+}
+
+#if defined(_FILEMON_INOTIFY_)
+/* invalidates cached resolves of dirpath and everything under it, empty dirpath flushes all */
+static void path_invalidatetree(const char* dirpath)
+{
+    if (dirpath[0] == 0)    {
+        fio_invalidate(NULL);
+        return;
+    }
+
+    char key[DH_PATH_MAX];
+    path_cachekey(key, dirpath);
+    size_t len = strlen(key);
+
+    mt_mutex_lock(&g_fio->path_mtx);
+    for (int i = 0; i < g_fio->path_table.slots_cnt; i++)   {
+        struct hashtable_item* item = &g_fio->path_table.items[i];
+        if (item->hash == 0)
+            continue;
+        struct path_entry* e = (struct path_entry*)item->value;
+        if (strncmp(e->filepath, key, len) == 0 && (e->filepath[len] == 0 || e->filepath[len] == '/')) {
+            hashtable_open_remove(&g_fio->path_table, item);
+            mem_pool_free(&g_fio->path_alloc, e);
+            g_fio->path_cnt--;
+        }
+    }
+    mt_mutex_unlock(&g_fio->path_mtx);
+}
+#endif
+
+/* sort order for batch items: pak items grouped by pak and ordered by offset, then disk files */
+static int fio_batch_cmp(const void* a, const void* b)
+{
+    const struct fio_batch_item* i1 = (const struct fio_batch_item*)a;
+    const struct fio_batch_item* i2 = (const struct fio_batch_item*)b;
+
+    if (i1->src.pak != i2->src.pak)  {
+        if (i1->src.pak == NULL || i2->src.pak == NULL)
+            return i1->src.pak == NULL ? 1 : -1;
+        return (uptr_t)i1->src.pak < (uptr_t)i2->src.pak ? -1 : 1;
+    }
+
+    if (i1->src.pak != NULL && i1->offset != i2->offset)
+        return i1->offset < i2->offset ? -1 : 1;
+    return (int)i1->idx - (int)i2->idx;
+}
+
+/* resolves all filepaths and sorts them for reading, missing files are skipped */
+static struct fio_batch_item* fio_batch_resolve(const char** filepaths, uint cnt, int ignore_vfs,
+                                                OUT uint* pcnt)
+{
+    *pcnt = 0;
+    if (cnt == 0)
+        return NULL;
+
+    struct fio_batch_item* items = (struct fio_batch_item*)ALLOC(
+        sizeof(struct fio_batch_item)*cnt, 0);
+    if (items == NULL)  {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+
+    uint item_cnt = 0;
+    for (uint i = 0; i < cnt; i++)    {
+        struct fio_batch_item* item = &items[item_cnt];
+        if (!fio_resolve(&item->src, filepaths[i], ignore_vfs))
+            continue;
+
+        item->idx = i;
+        if (item->src.pak != NULL)  {
+            const struct pak_item* pitem = pak_getitem(item->src.pak, item->src.file_id);
+            item->offset = pitem->offset;
+            item->size = pitem->size;
+        }   else    {
+            item->offset = 0;
+            item->size = 0;
+        }
+        item_cnt++;
+    }
+
+    if (item_cnt == 0)  {
+        FREE(items);
+        return NULL;
+    }
+
+    qsort(items, item_cnt, sizeof(struct fio_batch_item), fio_batch_cmp);
+    *pcnt = item_cnt;
+    return items;
+}
+
+/* finds the end of coalesced read that starts from items[start] (pak items only) */
+static uint fio_batch_nextrun(const struct fio_batch_item* items, uint start, uint cnt,
+                              OUT uint64* psize)
+{
+    const struct fio_batch_item* first = &items[start];
+    uint64 end_offset = first->offset + first->size;
+    uint i = start + 1;
+    while (i < cnt && items[i].src.pak == first->src.pak)    {
+        const struct fio_batch_item* item = &items[i];
+        uint64 item_end = item->offset + item->size;
+        if (item_end < end_offset)
+            item_end = end_offset;
+        if (item->offset > end_offset + BATCH_COALESCE_GAP ||
+            item_end - first->offset > BATCH_COALESCE_MAX)
+        {
+            break;
+        }
+        end_offset = item_end;
+        i++;
+    }
+
+    *psize = end_offset - first->offset;
+    return i;
+}
+
+/* hints OS to start reading the range into cache */
+static void fio_readahead(FILE* f, uint64 offset, uint64 size)
+{
+#if defined(_LINUX_)
+    posix_fadvise(fileno(f), (off_t)offset, (off_t)size, POSIX_FADV_WILLNEED);
+#endif
+}
+
+static void fio_batch_readahead(const struct fio_batch_item* items, uint cnt)
+{
+    uint i = 0;
+    while (i < cnt && items[i].src.pak != NULL)  {
+        uint64 run_sz;
+        uint end = fio_batch_nextrun(items, i, cnt, &run_sz);
+        fio_readahead(items[i].src.pak->f, items[i].offset, run_sz);
+        i = end;
+    }
+}
+
+uint fio_openmem_batch(struct allocator* alloc, const char** filepaths, uint cnt, int ignore_vfs,
+                       uint mem_id, OUT file_t* files)
+{
+    memset(files, 0x00, sizeof(file_t)*cnt);
+
+    uint item_cnt;
+    struct fio_batch_item* items = fio_batch_resolve(filepaths, cnt, ignore_vfs, &item_cnt);
+    if (items == NULL)
+        return 0;
+
+    /* hint all coalesced pak reads up front, so the device can queue them together */
+    fio_batch_readahead(items, item_cnt);
+
+    uint opened_cnt = 0;
+    uint i = 0;
+
+    /* pak items: read each coalesced range in one call and decode the items from it */
+    while (i < item_cnt && items[i].src.pak != NULL)  {
+        uint64 run_sz;
+        uint end = fio_batch_nextrun(items, i, item_cnt, &run_sz);
+        struct pak_file* pak = items[i].src.pak;
+
+        uint8* buff = (uint8*)ALLOC((size_t)run_sz, 0);
+        if (buff == NULL)   {
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+            i = end;
+            continue;
+        }
+
+        if (util_freadat(pak->f, buff, (size_t)run_sz, items[i].offset))  {
+            for (uint k = i; k < end; k++)    {
+                file_t f = pak_decodefile(pak, alloc, items[k].src.file_id,
+                                          buff + (items[k].offset - items[i].offset), mem_id);
+                if (f != NULL)  {
+                    files[items[k].idx] = f;
+                    opened_cnt++;
+                }
+            }
+        }   else    {
+            err_printf(__FILE__, __LINE__, "reading %d items from pak failed", end - i);
+        }
+
+        FREE(buff);
+        i = end;
+    }
+
+    /* disk files: open them in small windows and hint the whole window before reading */
+    FILE* ffs[BATCH_DISK_WINDOW];
+    while (i < item_cnt)    {
+        uint end = minui(i + BATCH_DISK_WINDOW, item_cnt);
+        for (uint k = i; k < end; k++)    {
+            ffs[k - i] = fopen(items[k].src.path, "rb");
+            if (ffs[k - i] != NULL)
+                fio_readahead(ffs[k - i], 0, 0);
+        }
+
+        for (uint k = i; k < end; k++)    {
+            if (ffs[k - i] == NULL)
+                continue;
+            file_t f = fio_loaddisk(alloc, ffs[k - i], filepaths[items[k].idx], mem_id);
+            if (f != NULL)  {
+                files[items[k].idx] = f;
+                opened_cnt++;
+            }
+        }
+        i = end;
+    }
+
+    FREE(items);
+    return opened_cnt;
+}
+
+uint fio_prefetch(const char** filepaths, uint cnt, int ignore_vfs)
+{
+    uint item_cnt;
+    struct fio_batch_item* items = fio_batch_resolve(filepaths, cnt, ignore_vfs, &item_cnt);
+    if (items == NULL)
+        return 0;
+
+    fio_batch_readahead(items, item_cnt);
+
+#if defined(_LINUX_)
+    for (uint i = 0; i < item_cnt; i++)   {
+        if (items[i].src.pak == NULL)   {
+            int fd = open(items[i].src.path, O_RDONLY);
+            if (fd != -1)   {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+        }
+    }
+#endif
+
+    FREE(items);
+    return item_cnt;
+}
+
 void fio_close(file_t f)
 {
     ASSERT(f != NULL);
@@ -623,11 +1346,85 @@ void fio_close(file_t f)
             fdata->file = NULL;
         }
         fio_free_diskbuff((uint8*)f);
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        fio_unmapview(fdata, (size_t)header->size);
+        fio_free_mapbuff((uint8*)f);
+    }    else if (header->type == FILE_TYPE_STREAM)    {
+        struct stream_file* fdata = (struct stream_file*)((uint8*)f + sizeof(struct file_header));
+        if (fdata->close_fn != NULL)
+            fdata->close_fn(fdata->param);
+        FREE(f);
     }
 }
 
 
 int fio_seek(file_t f, enum seek_mode seek, int offset)
+{
+    return (int)fio_seek64(f, seek, offset);
+}
+
+/* seek for memory and mapped files, offset is clamped to file size */
+static int64 fio_seekview(size_t* poffset, uint64 size, enum seek_mode seek, int64 offset)
+{
+    int64 new_offset;
+    switch (seek)   {
+        case SEEK_MODE_CUR:
+            new_offset = (int64)*poffset + offset;
+            break;
+        case SEEK_MODE_END:
+            ASSERT(offset > 0);
+            new_offset = (int64)size - offset;
+            break;
+        case SEEK_MODE_START:
+        default:
+            new_offset = offset;
+            break;
+    }
+    new_offset = new_offset < 0 ? 0 : new_offset;
+    new_offset = new_offset > (int64)size ? (int64)size : new_offset;
+    *poffset = (size_t)new_offset;
+    return new_offset;
+}
+
+/* seek for stream files, data is skipped by reading it (and rewinding for backward seeks) */
+static int64 fio_seekstream(struct stream_file* f, uint64 size, enum seek_mode seek, int64 offset)
+{
+    int64 new_offset;
+    switch (seek)   {
+        case SEEK_MODE_CUR:
+            new_offset = (int64)f->offset + offset;
+            break;
+        case SEEK_MODE_END:
+            new_offset = (int64)size - offset;
+            break;
+        case SEEK_MODE_START:
+        default:
+            new_offset = offset;
+            break;
+    }
+    new_offset = new_offset < 0 ? 0 : new_offset;
+    new_offset = new_offset > (int64)size ? (int64)size : new_offset;
+
+    if ((uint64)new_offset < f->offset)   {
+        if (f->rewind_fn == NULL || !f->rewind_fn(f->param))
+            return -1;
+        f->offset = 0;
+    }
+
+    uint8 tmp[STREAM_SKIP_SIZE];
+    while (f->offset < (uint64)new_offset)  {
+        uint64 remain_sz = (uint64)new_offset - f->offset;
+        size_t skip_sz = remain_sz < sizeof(tmp) ? (size_t)remain_sz : sizeof(tmp);
+        size_t r = f->read_fn(f->param, tmp, skip_sz);
+        if (r == 0)
+            break;
+        f->offset += r;
+    }
+    return (int64)f->offset;
+}
+
+int64 fio_seek64(file_t f, enum seek_mode seek, int64 offset)
 {
     ASSERT(f != NULL);
 
@@ -635,20 +1432,7 @@ int fio_seek(file_t f, enum seek_mode seek, int offset)
 
     if (header->type == FILE_TYPE_MEM)   {
         struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
-        switch (seek)   {
-            case SEEK_MODE_CUR:
-                fdata->offset += offset;
-                break;
-            case SEEK_MODE_START:
-                fdata->offset = offset;
-                break;
-            case SEEK_MODE_END:
-                ASSERT(offset > 0);
-                fdata->offset = header->size - offset;
-                break;
-        }
-        fdata->offset = clampsz(fdata->offset, 0, header->size);
-        return (int)fdata->offset;
+        return fio_seekview(&fdata->offset, header->size, seek, offset);
     }    else if (header->type == FILE_TYPE_DSK)    {
         struct disk_file* fdata = (struct disk_file*)((uint8*)f + sizeof(struct file_header));
         int seek_std;
@@ -658,8 +1442,14 @@ int fio_seek(file_t f, enum seek_mode seek, int offset)
             case SEEK_MODE_END:     seek_std = SEEK_END;    break;
             default:				seek_std = SEEK_SET;	break;
         }
-        fseek(fdata->file, offset, seek_std);
-        return (int)ftell(fdata->file);
+        util_fseek64(fdata->file, offset, seek_std);
+        return util_ftell64(fdata->file);
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        return fio_seekview(&fdata->offset, header->size, seek, offset);
+    }    else if (header->type == FILE_TYPE_STREAM)    {
+        struct stream_file* fdata = (struct stream_file*)((uint8*)f + sizeof(struct file_header));
+        return fio_seekstream(fdata, header->size, seek, offset);
     }
 
     return -1;
@@ -707,6 +1497,53 @@ static size_t fio_readmem(file_t f, void* buffer, size_t item_size, size_t items
     return (read_sz/item_size);
 }
 
+static size_t fio_readmap(file_t f, void* buffer, size_t item_size, size_t items_cnt)
+{
+    struct file_header* header = (struct file_header*)f;
+    struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+    size_t read_sz = item_size * items_cnt;
+    if ((read_sz + fdata->offset) > header->size)   {
+        read_sz = header->size - fdata->offset;
+        read_sz -= (read_sz % item_size);
+    }
+    if (read_sz != 0)   {
+        memcpy(buffer, fdata->ptr + fdata->offset, read_sz);
+        fdata->offset += read_sz;
+    }
+    return (read_sz/item_size);
+}
+
+static size_t fio_readstream(file_t f, void* buffer, size_t item_size, size_t items_cnt)
+{
+    struct stream_file* fdata = (struct stream_file*)((uint8*)f + sizeof(struct file_header));
+    size_t size = item_size * items_cnt;
+    size_t read_sz = 0;
+    while (read_sz < size)  {
+        size_t r = fdata->read_fn(fdata->param, (uint8*)buffer + read_sz, size - read_sz);
+        if (r == 0)
+            break;
+        read_sz += r;
+    }
+    fdata->offset += read_sz;
+    return (read_sz/item_size);
+}
+
+/* grows memory file buffer to hold at least 'size' bytes
+ * buffer grows geometrically (x1.5), so sequential writes don't realloc/copy on every call */
+static int fio_growmem(struct mem_file* fdata, size_t size)
+{
+    size_t new_sz = maxsz(fdata->max_size + fdata->max_size/2, size);
+    new_sz = ((new_sz + MEM_BLOCK_SIZE - 1)/MEM_BLOCK_SIZE)*MEM_BLOCK_SIZE;
+
+    uint8* buffer = (uint8*)A_REALLOC(fdata->alloc, fdata->buffer, new_sz, fdata->mem_id);
+    if (buffer == NULL)
+        return FALSE;
+
+    fdata->buffer = buffer;
+    fdata->max_size = new_sz;
+    return TRUE;
+}
+
 static size_t fio_writemem(file_t f, const void* buffer, size_t item_size, size_t items_cnt)
 {
     struct file_header* header = (struct file_header*)f;
@@ -716,17 +1553,8 @@ static size_t fio_writemem(file_t f, const void* buffer, size_t item_size, size_
     size_t offset = fdata->offset;
 
     /* grow buffer if necessary */
-    if ((write_sz + offset) > fdata->max_size)   {
-        size_t grow_sz = write_sz + offset - fdata->max_size;
-        size_t expand_sz = ((grow_sz/MEM_BLOCK_SIZE) + 1)*MEM_BLOCK_SIZE;
-
-        fdata->buffer = (uint8*)A_REALLOC(fdata->alloc, fdata->buffer, expand_sz + fdata->max_size,
-                                          fdata->mem_id);
-        if (fdata->buffer == NULL)
-            return 0;
-
-        fdata->max_size += expand_sz;
-    }
+    if ((write_sz + offset) > fdata->max_size && !fio_growmem(fdata, write_sz + offset))
+        return 0;
 
     if ((offset + write_sz) > header->size)  {
         header->size = offset + write_sz;
@@ -738,12 +1566,23 @@ static size_t fio_writemem(file_t f, const void* buffer, size_t item_size, size_
 }
 
 size_t fio_getsize(file_t f)
+{
+    struct file_header* header = (struct file_header*)f;
+    return (size_t)header->size;
+}
+
+uint64 fio_getsize64(file_t f)
 {
     struct file_header* header = (struct file_header*)f;
     return header->size;
 }
 
 size_t fio_getpos(file_t f)
+{
+    return (size_t)fio_getpos64(f);
+}
+
+uint64 fio_getpos64(file_t f)
 {
     struct file_header* header = (struct file_header*)f;
     if (header->type == FILE_TYPE_MEM)   {
@@ -751,11 +1590,198 @@ size_t fio_getpos(file_t f)
         return fdata->offset;
     }    else if (header->type == FILE_TYPE_DSK)    {
         struct disk_file* fdata = (struct disk_file*)((uint8*)f + sizeof(struct file_header));
-        return ftell(fdata->file);
+        int64 pos = util_ftell64(fdata->file);
+        return pos > 0 ? (uint64)pos : 0;
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        return fdata->offset;
+    }    else if (header->type == FILE_TYPE_STREAM)    {
+        struct stream_file* fdata = (struct stream_file*)((uint8*)f + sizeof(struct file_header));
+        return fdata->offset;
     }
     return 0;
 }
 
+const void* fio_getptr(file_t f)
+{
+    struct file_header* header = (struct file_header*)f;
+    if (header->type == FILE_TYPE_MEM)   {
+        struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+        return fdata->buffer;
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        return fdata->ptr;
+    }
+    return NULL;
+}
+
+/* current read offset of memory and mapped files, NULL for disk files */
+static size_t* fio_viewoffset(file_t f)
+{
+    struct file_header* header = (struct file_header*)f;
+    if (header->type == FILE_TYPE_MEM)
+        return &((struct mem_file*)((uint8*)f + sizeof(struct file_header)))->offset;
+    else if (header->type == FILE_TYPE_MAP)
+        return &((struct map_file*)((uint8*)f + sizeof(struct file_header)))->offset;
+    return NULL;
+}
+
+const void* fio_peek(file_t f, OUT size_t* psize)
+{
+    struct file_header* header = (struct file_header*)f;
+    const uint8* ptr = (const uint8*)fio_getptr(f);
+    if (ptr == NULL)    {
+        *psize = 0;
+        return NULL;
+    }
+
+    size_t offset = *fio_viewoffset(f);
+    *psize = (size_t)header->size - offset;
+    return ptr + offset;
+}
+
+const void* fio_borrow(file_t f, size_t size)
+{
+    size_t avail;
+    const void* ptr = fio_peek(f, &avail);
+    if (ptr == NULL || size > avail)
+        return NULL;
+
+    *fio_viewoffset(f) += size;
+    return ptr;
+}
+
+size_t fio_advance(file_t f, size_t size)
+{
+    struct file_header* header = (struct file_header*)f;
+    size_t* poffset = fio_viewoffset(f);
+    if (poffset == NULL)    {
+        uint64 pos = fio_getpos64(f);
+        if ((uint64)size > header->size - pos)
+            size = (size_t)(header->size - pos);
+        fio_seek64(f, SEEK_MODE_CUR, (int64)size);
+        return size;
+    }
+
+    size = minsz(size, (size_t)header->size - *poffset);
+    *poffset += size;
+    return size;
+}
+
+const char* fio_peektext(file_t f)
+{
+    struct file_header* header = (struct file_header*)f;
+    if (header->type == FILE_TYPE_MEM)   {
+        struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+        if (fdata->buffer != NULL && fdata->max_size > header->size &&
+            fdata->buffer[header->size] == 0)
+        {
+            return (const char*)fdata->buffer + fdata->offset;
+        }
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        if (fdata->zeroterm)
+            return (const char*)fdata->ptr + fdata->offset;
+    }
+    return NULL;
+}
+
+int fio_reservemem(file_t f, size_t size)
+{
+    struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+    ASSERT(fio_gettype(f) == FILE_TYPE_MEM);
+    ASSERT(fio_getmode(f) == FILE_MODE_WRITE);
+
+    if (size <= fdata->max_size)
+        return TRUE;
+
+    uint8* buffer = (uint8*)A_REALLOC(fdata->alloc, fdata->buffer, size, fdata->mem_id);
+    if (buffer == NULL)
+        return FALSE;
+    fdata->buffer = buffer;
+    fdata->max_size = size;
+    return TRUE;
+}
+
+size_t fio_writev(file_t f, const struct fio_segment* segs, uint seg_cnt)
+{
+    ASSERT(f != NULL);
+    struct file_header* header = (struct file_header*)f;
+    ASSERT(header->mode == FILE_MODE_WRITE);
+
+    size_t total_sz = 0;
+    for (uint i = 0; i < seg_cnt; i++)
+        total_sz += segs[i].size;
+    if (total_sz == 0)
+        return 0;
+
+    if (header->type == FILE_TYPE_MEM)   {
+        /* grow once for all segments, then copy them in place */
+        struct mem_file* fdata = (struct mem_file*)((uint8*)f + sizeof(struct file_header));
+        if ((fdata->offset + total_sz) > fdata->max_size &&
+            !fio_growmem(fdata, fdata->offset + total_sz))
+        {
+            return 0;
+        }
+
+        for (uint i = 0; i < seg_cnt; i++)    {
+            memcpy(fdata->buffer + fdata->offset, segs[i].buffer, segs[i].size);
+            fdata->offset += segs[i].size;
+        }
+        if (fdata->offset > header->size)
+            header->size = fdata->offset;
+        return total_sz;
+    }    else if (header->type == FILE_TYPE_DSK)    {
+        struct disk_file* fdata = (struct disk_file*)((uint8*)f + sizeof(struct file_header));
+#if defined(_POSIXLIB_)
+        /* write segments directly with writev, buffered data of the stream goes out first */
+        fflush(fdata->file);
+        int fd = fileno(fdata->file);
+        struct iovec iov[WRITEV_MAX];
+        size_t written_sz = 0;
+        uint i = 0;
+        size_t seg_offset = 0;  /* bytes of segs[i] that are already written */
+        while (i < seg_cnt) {
+            int iov_cnt = 0;
+            for (uint k = i; k < seg_cnt && iov_cnt < WRITEV_MAX; k++)  {
+                size_t skip = (k == i) ? seg_offset : 0;
+                if (segs[k].size == skip)
+                    continue;
+                iov[iov_cnt].iov_base = (uint8*)segs[k].buffer + skip;
+                iov[iov_cnt].iov_len = segs[k].size - skip;
+                iov_cnt++;
+            }
+            if (iov_cnt == 0)
+                break;
+
+            ssize_t r = writev(fd, iov, iov_cnt);
+            if (r <= 0)
+                break;
+            written_sz += (size_t)r;
+
+            /* move to the first segment that is not fully written (short writes) */
+            size_t rem = (size_t)r + seg_offset;
+            while (i < seg_cnt && rem >= segs[i].size)  {
+                rem -= segs[i].size;
+                i++;
+            }
+            seg_offset = rem;
+        }
+        return written_sz;
+#else
+        size_t written_sz = 0;
+        for (uint i = 0; i < seg_cnt; i++)    {
+            if (segs[i].size > 0 && fwrite(segs[i].buffer, segs[i].size, 1, fdata->file) != 1)
+                break;
+            written_sz += segs[i].size;
+        }
+        return written_sz;
+#endif
+    }
+
+    return 0;
+}
+
 const char* fio_getpath(file_t f)
 {
     struct file_header* header = (struct file_header*)f;
@@ -771,6 +1797,11 @@ int fio_isopen(file_t f)
     }    else if (header->type == FILE_TYPE_DSK)    {
         struct disk_file* fdata = (struct disk_file*)((uint8*)f + sizeof(struct file_header));
         return (fdata->file != NULL);
+    }    else if (header->type == FILE_TYPE_MAP)    {
+        struct map_file* fdata = (struct map_file*)((uint8*)f + sizeof(struct file_header));
+        return (fdata->ptr != NULL || header->size == 0);
+    }    else if (header->type == FILE_TYPE_STREAM)    {
+        return TRUE;
     }
     return FALSE;
 }
@@ -797,6 +1828,10 @@ void fio_mon_callback(efsw_watcher watcher,
     efsw_watchid watchid, const char* dir, const char* filename,
     enum efsw_action action, const char* old_filename, void* param)
 {
+    fio_invalidate(filename);
+    if (action == EFSW_MOVED && old_filename != NULL)
+        fio_invalidate(old_filename);
+
     if (action == EFSW_MODIFIED || action == EFSW_MOVED)    {
         struct vdir* vd = (struct vdir*)param;
 
@@ -897,8 +1932,243 @@ void fio_mon_update()
         arr_clear(arr);
     }
 }
+#elif defined(_FILEMON_INOTIFY_)
+static uint64 fio_mon_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec*1000 + (uint64)(ts.tv_nsec/1000000);
+}
+
+/* adds inotify watches to 'path' and all of it's sub-directories */
+static void fio_mon_addwatch(const char* path, const char* relpath)
+{
+    int wd = inotify_add_watch(g_fio->inotify_fd, path, MON_WATCH_MASK);
+    if (wd == -1)   {
+        if (errno == ENOSPC)    {
+            log_printf(LOG_WARNING, "file-mgr: inotify watch limit reached, '%s' is not monitored"
+                " (see /proc/sys/fs/inotify/max_user_watches)", path);
+        }   else    {
+            log_printf(LOG_WARNING, "file-mgr: could not monitor '%s': %s", path, strerror(errno));
+        }
+        return;
+    }
+
+    /* wd is always positive, so it's a valid key. re-adding a watched directory returns the same wd,
+     * even if it's moved, so remap the existing entry to the new path */
+    struct hashtable_item* item = hashtable_open_find(&g_fio->mon_dirs, (uint)wd);
+    struct mon_dir* md;
+    if (item == NULL)   {
+        md = (struct mon_dir*)ALLOC(sizeof(struct mon_dir), 0);
+        ASSERT(md);
+        md->wd = wd;
+        hashtable_open_add(&g_fio->mon_dirs, (uint)wd, (uint64)((uptr_t)md));
+    }   else    {
+        md = (struct mon_dir*)item->value;
+    }
+    str_safecpy(md->path, sizeof(md->path), path);
+    str_safecpy(md->relpath, sizeof(md->relpath), relpath);
+
+    DIR* d = opendir(path);
+    if (d == NULL)
+        return;
+
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL)    {
+        if (str_isequal(e->d_name, ".") || str_isequal(e->d_name, ".."))
+            continue;
+        if (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN)
+            continue;
+
+        char subpath[DH_PATH_MAX];
+        char subrel[DH_PATH_MAX];
+        path_join(subpath, path, e->d_name, NULL);
+        if (!util_pathisdir(subpath))
+            continue;
+        if (relpath[0] != 0)
+            path_join(subrel, relpath, e->d_name, NULL);
+        else
+            str_safecpy(subrel, sizeof(subrel), e->d_name);
+        fio_mon_addwatch(subpath, subrel);
+    }
+    closedir(d);
+}
+
+static void fio_mon_removewatch(struct hashtable_item* item)
+{
+    struct mon_dir* md = (struct mon_dir*)item->value;
+    hashtable_open_remove(&g_fio->mon_dirs, item);
+    FREE(md);
+}
+
+/* removes watches of directory 'path' and all of it's sub-directories (moved away or deleted) */
+static void fio_mon_droptree(const char* path)
+{
+    size_t len = strlen(path);
+    for (int i = 0; i < g_fio->mon_dirs.slots_cnt; i++) {
+        struct hashtable_item* item = &g_fio->mon_dirs.items[i];
+        if (item->hash == 0)
+            continue;
+        struct mon_dir* md = (struct mon_dir*)item->value;
+        if (strncmp(md->path, path, len) == 0 && (md->path[len] == 0 || md->path[len] == '/'))  {
+            /* watch may already be gone with the directory, IN_IGNORED of it is skipped later */
+            inotify_rm_watch(g_fio->inotify_fd, md->wd);
+            fio_mon_removewatch(item);
+        }
+    }
+}
 
+static void fio_mon_clearwatches()
+{
+    for (int i = 0; i < g_fio->mon_dirs.slots_cnt; i++) {
+        struct hashtable_item* item = &g_fio->mon_dirs.items[i];
+        if (item->hash != 0)    {
+            struct mon_dir* md = (struct mon_dir*)item->value;
+            inotify_rm_watch(g_fio->inotify_fd, md->wd);
+            FREE(md);
+        }
+    }
+    hashtable_open_clear(&g_fio->mon_dirs);
+    arr_clear(&g_fio->mon_events);
+}
+
+static int fio_vdir_initmon(struct vdir* vd)
+{
+    if (g_fio->inotify_fd == -1)    {
+        g_fio->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (g_fio->inotify_fd == -1)    {
+            log_printf(LOG_WARNING, "file-mgr: could not init file monitoring: %s",
+                strerror(errno));
+            return FALSE;
+        }
+    }
+
+    fio_mon_addwatch(vd->path, "");
+    return TRUE;
+}
+
+/* queues a change for registered files, successive changes to a file are coalesced */
+static void fio_mon_queue(const char* filepath, uint64 tm)
+{
+    uint hash = hash_str(filepath);
+    if (hashtable_open_find(&g_fio->mon_table, hash) == NULL)
+        return;
+
+    struct mon_event* evs = (struct mon_event*)g_fio->mon_events.buffer;
+    for (int i = 0; i < g_fio->mon_events.item_cnt; i++)    {
+        if (evs[i].hash == hash && str_isequal(evs[i].filepath, filepath))  {
+            evs[i].tm = tm;
+            return;
+        }
+    }
+
+    struct mon_event* ev = (struct mon_event*)arr_add(&g_fio->mon_events);
+    ASSERT(ev);
+    str_safecpy(ev->filepath, sizeof(ev->filepath), filepath);
+    ev->hash = hash;
+    ev->tm = tm;
+}
+
+/* drains all pending inotify events (non-blocking) */
+static void fio_mon_readevents(uint64 tm)
+{
+    uint8 buff[MON_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;)    {
+        ssize_t r = read(g_fio->inotify_fd, buff, sizeof(buff));
+        if (r <= 0)
+            break;
+
+        for (uint8* ptr = buff; ptr < buff + r; )    {
+            const struct inotify_event* e = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW)    {
+                log_print(LOG_WARNING, "file-mgr: inotify event queue overflow");
+                fio_invalidate(NULL);
+                continue;
+            }
+
+            struct hashtable_item* item = hashtable_open_find(&g_fio->mon_dirs, (uint)e->wd);
+            if (item == NULL)
+                continue;
+            if (e->mask & IN_IGNORED)   {
+                fio_mon_removewatch(item);
+                continue;
+            }
+
+            struct mon_dir* md = (struct mon_dir*)item->value;
+            if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF))  {
+                /* watched directory itself is gone, paths of it's sub-tree are no longer valid */
+                path_invalidatetree(md->relpath);
+                char path[DH_PATH_MAX];
+                str_safecpy(path, sizeof(path), md->path);
+                fio_mon_droptree(path);
+                continue;
+            }
+            if (e->len == 0)
+                continue;
+
+            char filepath[DH_PATH_MAX];
+            if (md->relpath[0] != 0)
+                path_join(filepath, md->relpath, e->name, NULL);
+            else
+                str_safecpy(filepath, sizeof(filepath), e->name);
+
+            fio_invalidate(filepath);
+
+            if (e->mask & IN_ISDIR) {
+                char fullpath[DH_PATH_MAX];
+                path_join(fullpath, md->path, e->name, NULL);
+                path_invalidatetree(filepath);
+                if (e->mask & (IN_DELETE | IN_MOVED_FROM))
+                    fio_mon_droptree(fullpath);
+                else if (e->mask & (IN_CREATE | IN_MOVED_TO))
+                    fio_mon_addwatch(fullpath, filepath);
+                continue;
+            }
+
+            if (e->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO))
+                fio_mon_queue(filepath, tm);
+        }
+
+        if (r < (ssize_t)sizeof(buff))
+            break;
+    }
+}
+
+void fio_mon_update()
+{
+    if (g_fio->inotify_fd == -1)
+        return;
+
+    uint64 tm = fio_mon_time();
+    fio_mon_readevents(tm);
+
+    /* dispatch changes that are settled down, callbacks may register/unregister files,
+     * so pull each event out of the pending list before calling */
+    int i = 0;
+    while (i < g_fio->mon_events.item_cnt)  {
+        struct mon_event* evs = (struct mon_event*)g_fio->mon_events.buffer;
+        if (tm - evs[i].tm < MON_DEBOUNCE)  {
+            i++;
+            continue;
+        }
+
+        struct mon_event ev = evs[i];
+        evs[i] = evs[g_fio->mon_events.item_cnt - 1];
+        g_fio->mon_events.item_cnt --;
+
+        struct hashtable_item* item = hashtable_open_find(&g_fio->mon_table, ev.hash);
+        if (item != NULL)   {
+            struct mon_item* mitem = (struct mon_item*)item->value;
+            mitem->fn(ev.filepath, mitem->hdl, mitem->param1, mitem->param2);
+        }
+    }
+}
+#endif
 
+#if defined(_FILEMON_) || defined(_FILEMON_INOTIFY_)
 void fio_mon_reg(const char* filepath, pfn_fio_modify fn, reshandle_t hdl,
     uptr_t param1, uptr_t param2)
 {
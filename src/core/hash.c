@@ -15,6 +15,10 @@
 
 #include "dhcore/hash.h"
 
+#if defined(_SIMD_SSE_)
+#include <emmintrin.h>
+#endif
+
 #define HSEED 98424
 
 #define HASH_M 0x5bd1e995
@@ -285,6 +289,182 @@ hash_t hash_murmur128(const void* key, size_t size_bytes, uint seed)
 
 #endif
 
+/*************************************************************************************************
+ * fast hash: data is consumed in 64 byte stripes by 8 independent 64bit lanes, each lane does a
+ * 32x32->64 multiply of the data mixed with secret key, which maps directly to SSE2 (pmuludq)
+ * lanes are scrambled after each block of stripes, and merged with murmur's fmix64 at the end
+ */
+#define FAST_STRIPE_SIZE 64
+#define FAST_LANES 8
+#define FAST_BLOCK_STRIPES 16
+#define FAST_SECRET_SIZE (FAST_LANES + FAST_BLOCK_STRIPES)
+#define FAST_PRIME32 0x9e3779b1
+#define FAST_PRIME64 BIG_CONSTANT(0x9e3779b185ebca87)
+
+static const uint64 g_fast_secret[FAST_SECRET_SIZE] = {
+    BIG_CONSTANT(0x1ac046dda8e86e2a), BIG_CONSTANT(0xbe2c3b00b1d348c8),
+    BIG_CONSTANT(0x9b1a66a95412ff75), BIG_CONSTANT(0xc448c2b1f05f7e4c),
+    BIG_CONSTANT(0xc111ca6b8f6e73c4), BIG_CONSTANT(0xb54861920d05b01d),
+    BIG_CONSTANT(0x8d61500f4a7bbe16), BIG_CONSTANT(0x5e0c25471f89e02e),
+    BIG_CONSTANT(0x48105a3d28f0e221), BIG_CONSTANT(0x2169f8846b637746),
+    BIG_CONSTANT(0x3d628782e0c0d863), BIG_CONSTANT(0xa5ddb2216078aa40),
+    BIG_CONSTANT(0xc8119d17f0571101), BIG_CONSTANT(0x98e2e2eb8f33280f),
+    BIG_CONSTANT(0x8cd1e28860679cc4), BIG_CONSTANT(0x9dca6189c923aef3),
+    BIG_CONSTANT(0x9d8d3071ba4f04c4), BIG_CONSTANT(0x5d395ada34220c26),
+    BIG_CONSTANT(0xe6de42a441a1e28e), BIG_CONSTANT(0x308fbf68cc864f59),
+    BIG_CONSTANT(0x216a3c81332862f9), BIG_CONSTANT(0xbaceca0a77f3132e),
+    BIG_CONSTANT(0xdf2a2215339ca69c), BIG_CONSTANT(0x3e4c11a103a5d859)
+};
+
+#if defined(_SIMD_SSE_)
+FORCE_INLINE __m128i hash_fast_accum_sse(__m128i acc, const uint8* data, const uint64* key)
+{
+    __m128i d = _mm_loadu_si128((const __m128i*)data);
+    __m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)key));
+    __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+    __m128i dswap = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(prod, dswap));
+}
+
+FORCE_INLINE __m128i hash_fast_scramble_sse(__m128i acc, const uint64* key, __m128i prime)
+{
+    __m128i a = _mm_xor_si128(acc, _mm_srli_epi64(acc, 47));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)key));
+    __m128i lo = _mm_mul_epu32(a, prime);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+static void hash_fast_consume(uint64* acc, const uint8* data, size_t size, const uint64* secret)
+{
+    const __m128i prime = _mm_set1_epi32((int)FAST_PRIME32);
+    const uint64* skey = secret + FAST_BLOCK_STRIPES;
+    uint stripe = 0;
+
+    __m128i acc0 = _mm_loadu_si128((const __m128i*)acc);
+    __m128i acc1 = _mm_loadu_si128((const __m128i*)acc + 1);
+    __m128i acc2 = _mm_loadu_si128((const __m128i*)acc + 2);
+    __m128i acc3 = _mm_loadu_si128((const __m128i*)acc + 3);
+
+    while (size >= FAST_STRIPE_SIZE)  {
+        const uint64* key = secret + stripe;
+        acc0 = hash_fast_accum_sse(acc0, data, key);
+        acc1 = hash_fast_accum_sse(acc1, data + 16, key + 2);
+        acc2 = hash_fast_accum_sse(acc2, data + 32, key + 4);
+        acc3 = hash_fast_accum_sse(acc3, data + 48, key + 6);
+        data += FAST_STRIPE_SIZE;
+        size -= FAST_STRIPE_SIZE;
+
+        /* scramble lanes at the end of each block */
+        if (++stripe == FAST_BLOCK_STRIPES)   {
+            acc0 = hash_fast_scramble_sse(acc0, skey, prime);
+            acc1 = hash_fast_scramble_sse(acc1, skey + 2, prime);
+            acc2 = hash_fast_scramble_sse(acc2, skey + 4, prime);
+            acc3 = hash_fast_scramble_sse(acc3, skey + 6, prime);
+            stripe = 0;
+        }
+    }
+
+    /* tail, last partial stripe is padded with zeros */
+    if (size > 0)   {
+        uint8 last[FAST_STRIPE_SIZE];
+        const uint64* key = secret + stripe;
+        memset(last, 0x00, sizeof(last));
+        memcpy(last, data, size);
+        acc0 = hash_fast_accum_sse(acc0, last, key);
+        acc1 = hash_fast_accum_sse(acc1, last + 16, key + 2);
+        acc2 = hash_fast_accum_sse(acc2, last + 32, key + 4);
+        acc3 = hash_fast_accum_sse(acc3, last + 48, key + 6);
+    }
+
+    _mm_storeu_si128((__m128i*)acc, acc0);
+    _mm_storeu_si128((__m128i*)acc + 1, acc1);
+    _mm_storeu_si128((__m128i*)acc + 2, acc2);
+    _mm_storeu_si128((__m128i*)acc + 3, acc3);
+}
+#else
+static void hash_fast_consume(uint64* acc, const uint8* data, size_t size, const uint64* secret)
+{
+    uint64 d[FAST_LANES];
+    uint stripe = 0;
+
+    while (size > 0)  {
+        /* last partial stripe is padded with zeros */
+        size_t s = (size < FAST_STRIPE_SIZE) ? size : FAST_STRIPE_SIZE;
+        if (s < FAST_STRIPE_SIZE)
+            memset(d, 0x00, sizeof(d));
+        memcpy(d, data, s);
+
+        for (int i = 0; i < FAST_LANES; i++)  {
+            uint64 dk = d[i] ^ secret[stripe + i];
+            acc[i ^ 1] += d[i];
+            acc[i] += (dk & 0xffffffff) * (dk >> 32);
+        }
+        data += s;
+        size -= s;
+
+        /* scramble lanes at the end of each block */
+        if (s == FAST_STRIPE_SIZE && ++stripe == FAST_BLOCK_STRIPES)  {
+            for (int i = 0; i < FAST_LANES; i++)  {
+                uint64 a = acc[i];
+                a ^= a >> 47;
+                a ^= secret[FAST_BLOCK_STRIPES + i];
+                acc[i] = a * FAST_PRIME32;
+            }
+            stripe = 0;
+        }
+    }
+}
+#endif
+
+static void hash_fast(const void* key, size_t size_bytes, uint seed, uint64* ph1, uint64* ph2)
+{
+    const uint64* secret = g_fast_secret;
+    uint64 acc[FAST_LANES];
+
+    /* seed only affects initial state of the lanes */
+    uint64 s = fmix64((uint64)seed + FAST_PRIME64);
+    for (int i = 0; i < FAST_LANES; i++)
+        acc[i] = g_fast_secret[FAST_SECRET_SIZE - i - 1] ^ ROTL64(s, i*8 + 1);
+
+    hash_fast_consume(acc, (const uint8*)key, size_bytes, secret);
+
+    /* merge lanes */
+    uint64 h1 = (uint64)size_bytes * FAST_PRIME64;
+    uint64 h2 = ~h1;
+    for (int i = 0; i < FAST_LANES; i++)  {
+        h1 = ROTL64((h1 ^ acc[i] ^ secret[i + 3]) * FAST_PRIME64, 27);
+        h2 = ROTL64((h2 + (acc[i] ^ secret[i + 11])) * FAST_PRIME64, 31);
+    }
+
+    *ph1 = fmix64(h1 ^ h2);
+    *ph2 = fmix64(h2 + h1);
+}
+
+uint64 hash_fast64(const void* key, size_t size_bytes, uint seed)
+{
+    uint64 h1, h2;
+    hash_fast(key, size_bytes, seed, &h1, &h2);
+    return h1;
+}
+
+hash_t hash_fast128(const void* key, size_t size_bytes, uint seed)
+{
+    hash_t h;
+    uint64 h1, h2;
+    hash_fast(key, size_bytes, seed, &h1, &h2);
+#ifdef _ARCH64_
+    h.h[0] = h1;
+    h.h[1] = h2;
+#else
+    h.h[0] = (uint)h1;
+    h.h[1] = (uint)(h1 >> 32);
+    h.h[2] = (uint)h2;
+    h.h[3] = (uint)(h2 >> 32);
+#endif
+    return h;
+}
+
 uint hash_u64(uint64 n)
 {
     n = (~n) + (n << 18);
@@ -14,16 +14,31 @@
  ***********************************************************************************/
 
 #include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+#include <float.h>
+#include <limits.h>
 
 #include "cJSON/cJSON.h"
 
 #include "dhcore/mem-mgr.h"
 #include "dhcore/json.h"
 #include "dhcore/pool-alloc.h"
+#include "dhcore/stack-alloc.h"
+#include "dhcore/numeric.h"
+#include "dhcore/str.h"
 #include "dhcore/err.h"
 #include "dhcore/util.h"
 #include "dhcore/mt.h"
 
+#if defined(_SIMD_SSE_)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSVC_)
+#include <intrin.h>
+#endif
+
 #define JSON_ALLOC_16    0
 #define JSON_ALLOC_32    1
 #define JSON_ALLOC_64    2
@@ -31,205 +46,2338 @@
 #define JSON_ALLOC_256   4
 #define JSON_ALLOC_CNT   5
 
+#define JSON_DEPTH_MAX   512
+#define JSON_KEYS_MIN    8   /* objects with less members are searched linearly */
+
+/*************************************************************************************************
+ * types/globals
+ */
+struct json_mgr
+{
+    mt_mutex buff_mtx[JSON_ALLOC_CNT];
+    struct pool_alloc buffs[JSON_ALLOC_CNT];
+};
+
+/* member lookup index of an object, it is a single block allocated with json_malloc so that
+ * cJSON_Delete can free it with the object */
+struct json_keyslot
+{
+    uint hash;  /* hash of case-folded name */
+    cJSON* item;
+};
+
+struct json_keys
+{
+    struct json_keys* next; /* indexes of arena objects are chained and freed with the document */
+    cJSON* tail;    /* last member, so appending doesn't walk the list */
+    uint cnt;
+    uint mask;
+    struct json_keyslot slots[1];
+};
+
+static struct json_mgr* g_json = NULL;
+
+/*************************************************************************************************/
+INLINE void* json_alloc_putsize(void* ptr, uint sz)
+{
+    *((uint*)ptr) = sz;
+    return ((uint8*)ptr + sizeof(uint));
+}
+
+INLINE uint json_alloc_getsize(void* ptr, void** preal_ptr)
+{
+    uint8* bptr = (uint8*)ptr - sizeof(uint);
+    uint sz = *((uint*)bptr);
+    *preal_ptr = bptr;
+    return sz;
+}
+
+INLINE int json_choose_alloc(size_t sz)
+{
+    if (sz <= 16)
+        return JSON_ALLOC_16;
+    else if (sz > 16 && sz <= 32)
+        return JSON_ALLOC_32;
+    else if (sz > 32 && sz <=64)
+        return JSON_ALLOC_64;
+    else if (sz > 64 && sz <= 128)
+        return JSON_ALLOC_128;
+    else if (sz > 128 && sz <= 256)
+        return JSON_ALLOC_256;
+    else
+        return -1;
+}
+
+/*************************************************************************************************/
+/* callbacks for memory allocation/deallocation */
+static void* json_malloc(size_t size)
+{
+    ASSERT(size < UINT32_MAX);
+
+    size += sizeof(uint);    /* to keep the size */
+    int a_idx = json_choose_alloc(size);
+    void* ptr;
+    if (a_idx != -1) {
+        mt_mutex_lock(&g_json->buff_mtx[a_idx]);
+        ptr = mem_pool_alloc(&g_json->buffs[a_idx]);
+        mt_mutex_unlock(&g_json->buff_mtx[a_idx]);
+    } else  {
+        ptr = mem_alloc(size, __FILE__, __LINE__, 0);
+    }
+    return json_alloc_putsize(ptr, (uint)size);
+}
+
+static void json_free(void* p)
+{
+    uint sz = json_alloc_getsize(p, &p);
+    int a_idx = json_choose_alloc(sz);
+
+    if (a_idx != -1) {
+        mt_mutex_lock(&g_json->buff_mtx[a_idx]);
+        mem_pool_free(&g_json->buffs[a_idx], p);
+        mt_mutex_unlock(&g_json->buff_mtx[a_idx]);
+    } else  {
+        mem_free(p);
+    }
+}
+
+/* */
+static result_t json_create_buffs()
+{
+    for (int i = 0; i < JSON_ALLOC_CNT; i++)
+        mt_mutex_init(&g_json->buff_mtx[i]);
+
+    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_16], 16, 1024, 0)))
+        return RET_OUTOFMEMORY;
+    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_32], 32, 1024, 0)))
+        return RET_OUTOFMEMORY;
+    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_64], 64, 1024, 0)))
+        return RET_OUTOFMEMORY;
+    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_128], 128, 512, 0)))
+        return RET_OUTOFMEMORY;
+    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_256], 256, 512, 0)))
+        return RET_OUTOFMEMORY;
+
+    return RET_OK;
+}
+
+static void json_destroy_buffs()
+{
+    for (uint i = 0; i < JSON_ALLOC_CNT; i++)   {
+        mem_pool_destroy(&g_json->buffs[i]);
+        mt_mutex_init(&g_json->buff_mtx[i]);
+    }
+}
+
+result_t json_init()
+{
+    if (g_json != NULL)
+        return RET_FAIL;
+    g_json = (struct json_mgr*)ALLOC(sizeof(struct json_mgr), 0);
+    if (g_json == NULL)
+        return RET_OUTOFMEMORY;
+
+    memset(g_json, 0x00, sizeof(struct json_mgr));
+
+    if (IS_FAIL(json_create_buffs()))
+        return RET_OUTOFMEMORY;
+
+    cJSON_Hooks hooks;
+    hooks.malloc_fn = json_malloc;
+    hooks.free_fn = json_free;
+    cJSON_InitHooks(&hooks);
+
+    return RET_OK;
+}
+
+void json_release()
+{
+    if (g_json != NULL) {
+        json_destroy_buffs();
+        cJSON_InitHooks(NULL);
+
+        FREE(g_json);
+        g_json = NULL;
+    }
+}
+
+/*************************************************************************************************
+ * arena parser
+ * parsing is done in two passes: first pass scans the text (16 bytes at a time with SSE2) and
+ * builds an index of structural characters and quotes that are outside of strings, second pass
+ * walks the index and builds the tree. all nodes and strings of the document are allocated from
+ * a single stack allocator that is sized from the index, so the whole document is freed at once
+ */
+struct json_doc
+{
+    struct cJSON root;  /* must be first, document handle is the root node */
+    struct allocator* alloc;    /* document and it's arena are allocated from this */
+    struct stack_alloc arena;
+    int heap_items; /* heap allocated items are attached to document nodes */
+    struct json_keys* keys; /* member indexes of document objects */
+};
+
+struct json_index
+{
+    struct allocator* alloc;
+    uint* pos;  /* offsets of structural characters and quotes */
+    uint cnt;
+    uint max;
+    uint item_cnt;  /* ',', '[' and '{' count, used for estimating number of items */
+    uint quote_cnt;
+};
+
+struct json_parser
+{
+    const char* text;
+    const char* end;
+    const uint* index;
+    uint index_cnt;
+    uint cur;   /* current index position */
+    uint depth;
+    struct json_doc* doc;
+    const char* err;
+};
+
+static const fl64 g_json_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+    1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+INLINE uint json_ctz(uint m)
+{
+#if defined(_MSVC_)
+    unsigned long r;
+    _BitScanForward(&r, m);
+    return (uint)r;
+#else
+    return (uint)__builtin_ctz(m);
+#endif
+}
+
+/* bit i of the result is the parity of the bits 0..i of m (16bit) */
+INLINE uint json_prefix_xor(uint m)
+{
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    return m & 0xffff;
+}
+
+INLINE void json_index_add(struct json_index* idx, const char* text, uint pos)
+{
+    char c = text[pos];
+    idx->pos[idx->cnt++] = pos;
+    idx->item_cnt += (c == ',' || c == '[' || c == '{');
+    idx->quote_cnt += (c == '"');
+}
+
+/* makes room for at least 'cnt' more positions */
+static int json_index_reserve(struct json_index* idx, uint cnt)
+{
+    if (idx->cnt + cnt <= idx->max)
+        return TRUE;
+
+    /* not reallocated in place, stack allocators can't grow their blocks */
+    uint max = maxui(idx->max << 1, idx->cnt + cnt);
+    uint* pos = (uint*)A_ALIGNED_ALLOC(idx->alloc, sizeof(uint)*max, 0);
+    if (pos == NULL)
+        return FALSE;
+    if (idx->pos != NULL)   {
+        memcpy(pos, idx->pos, sizeof(uint)*idx->cnt);
+        A_ALIGNED_FREE(idx->alloc, idx->pos);
+    }
+    idx->pos = pos;
+    idx->max = max;
+    return TRUE;
+}
+
+static void json_index_scalar(struct json_index* idx, const char* text, uint i, uint end,
+                              int* in_str, int* escape)
+{
+    for (; i < end; i++)    {
+        char c = text[i];
+        if (*in_str)    {
+            if (*escape)
+                *escape = FALSE;
+            else if (c == '\\')
+                *escape = TRUE;
+            else if (c == '"')  {
+                *in_str = FALSE;
+                json_index_add(idx, text, i);
+            }
+        }   else if (c == '"')    {
+            *in_str = TRUE;
+            json_index_add(idx, text, i);
+        }   else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')  {
+            json_index_add(idx, text, i);
+        }
+    }
+}
+
+static int json_index_build(struct json_index* idx, const char* text, uint len)
+{
+    int in_str = FALSE;
+    int escape = FALSE;
+    uint i = 0;
+
+    if (!json_index_reserve(idx, (len >> 3) + 64))
+        return FALSE;
+
+#if defined(_SIMD_SSE_)
+    const __m128i vquote = _mm_set1_epi8('"');
+    const __m128i vbslash = _mm_set1_epi8('\\');
+    const __m128i vcomma = _mm_set1_epi8(',');
+    const __m128i vcolon = _mm_set1_epi8(':');
+    const __m128i vcase = _mm_set1_epi8(0x20);
+    const __m128i vopen = _mm_set1_epi8('{');
+    const __m128i vclose = _mm_set1_epi8('}');
+
+    for (; i + 16 <= len; i += 16)  {
+        if (!json_index_reserve(idx, 16))
+            return FALSE;
+
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        uint bs = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vbslash));
+        if (bs != 0 || escape)  {
+            /* escapes are rare, leave them to the scalar path */
+            json_index_scalar(idx, text, i, i + 16, &in_str, &escape);
+            continue;
+        }
+
+        /* '[' and ']' differ from '{' and '}' only in 0x20 bit */
+        __m128i vc = _mm_or_si128(v, vcase);
+        uint q = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vquote));
+        uint s = (uint)_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(vc, vopen), _mm_cmpeq_epi8(vc, vclose)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, vcomma), _mm_cmpeq_epi8(v, vcolon))));
+
+        /* inside-string mask: set from opening quote up to (not including) closing quote */
+        uint inside = json_prefix_xor(q) ^ (in_str ? 0xffff : 0);
+        in_str = (inside >> 15) & 1;
+
+        uint m = (s & ~inside) | q;
+        while (m != 0)  {
+            json_index_add(idx, text, i + json_ctz(m));
+            m &= m - 1;
+        }
+    }
+#endif
+
+    if (!json_index_reserve(idx, len - i))
+        return FALSE;
+    json_index_scalar(idx, text, i, len, &in_str, &escape);
+    return TRUE;
+}
+
+/* allocates from document arena, arena buffer is aligned and allocations are kept multiples of 8
+ * bytes, so they are all 8-byte aligned */
+static void* json_parser_alloc(struct json_parser* p, size_t size)
+{
+    struct stack_alloc* arena = &p->doc->arena;
+    size = (size + 7) & ~((size_t)7);
+
+    /* arena is sized for the whole document, don't let stack allocator fall back to heap */
+    if (arena->offset + size > arena->size)
+        return NULL;
+    return mem_stack_alloc(arena, size, 0);
+}
+
+INLINE const char* json_parser_skipws(const struct json_parser* p, const char* s)
+{
+    while (s < p->end && (uint8)*s <= 32)
+        s++;
+    return s;
+}
+
+/* checks if 's' is the current indexed character and moves to the next one */
+INLINE int json_parser_expect(struct json_parser* p, const char* s)
+{
+    if (p->cur < p->index_cnt && p->text + p->index[p->cur] == s)   {
+        p->cur++;
+        return TRUE;
+    }
+    p->err = s;
+    return FALSE;
+}
+
+INLINE void json_setdoc(cJSON* item, struct json_doc* doc)
+{
+    /* arrays and objects don't use number value, keep the owner document in there */
+    memcpy(&item->valuedouble, &doc, sizeof(doc));
+}
+
+INLINE struct json_doc* json_getdoc(json_t item)
+{
+    struct json_doc* doc;
+    memcpy(&doc, &item->valuedouble, sizeof(doc));
+    return doc;
+}
+
+/* marks the document of an arena node as having heap items, so they are freed on destroy */
+INLINE void json_markheap(json_t parent)
+{
+    if (parent->type & cJSON_IsArena)
+        json_getdoc(parent)->heap_items = TRUE;
+}
+
+static cJSON* json_parser_newitem(struct json_parser* p)
+{
+    cJSON* item = (cJSON*)json_parser_alloc(p, sizeof(cJSON));
+    if (item != NULL)   {
+        memset(item, 0x00, sizeof(cJSON));
+        item->type = cJSON_IsArena;
+    }
+    return item;
+}
+
+static int json_hex4(const char* s, uint* pc)
+{
+    uint c = 0;
+    for (int i = 0; i < 4; i++) {
+        char h = s[i];
+        c <<= 4;
+        if (h >= '0' && h <= '9')       c |= (uint)(h - '0');
+        else if (h >= 'a' && h <= 'f')  c |= (uint)(h - 'a' + 10);
+        else if (h >= 'A' && h <= 'F')  c |= (uint)(h - 'A' + 10);
+        else                            return FALSE;
+    }
+    *pc = c;
+    return TRUE;
+}
+
+/* writes unicode code-point as utf-8 into 'out' (max 4 bytes), returns number of bytes written */
+static uint json_utf8(char* out, uint uc)
+{
+    if (uc < 0x80)  {
+        out[0] = (char)uc;
+        return 1;
+    }   else if (uc < 0x800)    {
+        out[0] = (char)(0xC0 | (uc >> 6));
+        out[1] = (char)(0x80 | (uc & 0x3F));
+        return 2;
+    }   else if (uc < 0x10000)  {
+        out[0] = (char)(0xE0 | (uc >> 12));
+        out[1] = (char)(0x80 | ((uc >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (uc & 0x3F));
+        return 3;
+    }   else    {
+        out[0] = (char)(0xF0 | (uc >> 18));
+        out[1] = (char)(0x80 | ((uc >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((uc >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (uc & 0x3F));
+        return 4;
+    }
+}
+
+/* decodes escaped string between 's' and 'e' (closing quote) into 'out' */
+static char* json_parser_unescape(struct json_parser* p, char* out, const char* s, const char* e)
+{
+    while (s < e)   {
+        const char* bs = (const char*)memchr(s, '\\', e - s);
+        if (bs == NULL)
+            bs = e;
+        memcpy(out, s, bs - s);
+        out += bs - s;
+        s = bs;
+        if (s == e)
+            break;
+
+        s++;
+        switch (*s) {
+        case 'b':   *out++ = '\b';  break;
+        case 'f':   *out++ = '\f';  break;
+        case 'n':   *out++ = '\n';  break;
+        case 'r':   *out++ = '\r';  break;
+        case 't':   *out++ = '\t';  break;
+        case 'u':
+        {
+            uint uc, uc2;
+            if (e - s < 5 || !json_hex4(s + 1, &uc))  {
+                p->err = s;
+                return NULL;
+            }
+            s += 4;
+
+            /* utf-16 surrogate pairs */
+            if (uc >= 0xD800 && uc <= 0xDBFF)   {
+                if (e - s < 7 || s[1] != '\\' || s[2] != 'u' || !json_hex4(s + 3, &uc2) ||
+                    uc2 < 0xDC00 || uc2 > 0xDFFF)
+                {
+                    p->err = s;
+                    return NULL;
+                }
+                s += 6;
+                uc = 0x10000 + (((uc & 0x3FF) << 10) | (uc2 & 0x3FF));
+            }   else if ((uc >= 0xDC00 && uc <= 0xDFFF) || uc == 0)   {
+                break;  /* invalid, skip it like cJSON does */
+            }
+
+            out += json_utf8(out, uc);
+            break;
+        }
+        default:    *out++ = *s;    break;
+        }
+        s++;
+    }
+    return out;
+}
+
+static const char* json_parser_string(struct json_parser* p, const char* s, char** pstr)
+{
+    /* opening quote is the current indexed character, the next one is always the closing quote */
+    if (p->cur + 1 >= p->index_cnt || p->text + p->index[p->cur] != s)  {
+        p->err = s;
+        return NULL;
+    }
+    const char* e = p->text + p->index[p->cur + 1];
+    p->cur += 2;
+
+    size_t len = e - s - 1;
+    char* out = (char*)json_parser_alloc(p, len + 1);
+    if (out == NULL)    {
+        p->err = s;
+        return NULL;
+    }
+
+    char* oe = json_parser_unescape(p, out, s + 1, e);
+    if (oe == NULL)
+        return NULL;
+    *oe = 0;
+    *pstr = out;
+    return e + 1;
+}
+
+/* parses JSON number in [s, end), returns end of the number or NULL if it's malformed */
+static const char* json_parsenum(const char* s, const char* end, fl64* pn)
+{
+    int neg = FALSE;
+    uint64 mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+
+    if (*s == '-')  {
+        neg = TRUE;
+        s++;
+    }
+    if (s >= end || *s < '0' || *s > '9')
+        return NULL;
+
+    /* keep up to 19 significant digits in the mantissa, the rest only scale the exponent */
+    for (; s < end && *s >= '0' && *s <= '9'; s++)   {
+        if (digits < 19)    {
+            mant = mant*10 + (uint64)(*s - '0');
+            digits += (mant != 0);
+        }   else    {
+            exp10++;
+        }
+    }
+
+    if (s + 1 < end && *s == '.' && s[1] >= '0' && s[1] <= '9')  {
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++)    {
+            if (digits < 19)    {
+                mant = mant*10 + (uint64)(*s - '0');
+                digits += (mant != 0);
+                exp10--;
+            }
+        }
+    }
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        int eneg = FALSE;
+        int e = 0;
+        s++;
+        if (s < end && (*s == '+' || *s == '-'))
+            eneg = (*s++ == '-');
+        for (; s < end && *s >= '0' && *s <= '9'; s++)   {
+            if (e < 10000)
+                e = e*10 + (*s - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+
+    /* powers of ten up to 1e22 are exact in fl64, so the result is correctly rounded when the
+     * mantissa fits in 53 bits and off by at most one more rounding when it doesn't */
+    fl64 n;
+    if (exp10 == 0 || mant == 0)
+        n = (fl64)mant;
+    else if (exp10 >= -22 && exp10 <= 22)
+        n = exp10 < 0 ? (fl64)mant / g_json_pow10[-exp10] : (fl64)mant * g_json_pow10[exp10];
+    else
+        n = (fl64)mant * pow(10.0, (fl64)exp10);
+    if (neg)
+        n = -n;
+
+    *pn = n;
+    return s;
+}
+
+INLINE int json_numtoint(fl64 n)
+{
+    if (n >= (fl64)INT32_MAX)
+        return INT32_MAX;
+    else if (n <= (fl64)INT32_MIN)
+        return INT32_MIN;
+    else
+        return (int)n;
+}
+
+static const char* json_parser_number(struct json_parser* p, cJSON* item, const char* s)
+{
+    fl64 n;
+    const char* e = json_parsenum(s, p->end, &n);
+    if (e == NULL)  {
+        p->err = s;
+        return NULL;
+    }
+
+    item->type |= cJSON_Number;
+    item->valuedouble = n;
+    item->valueint = json_numtoint(n);
+    return e;
+}
+
+static const char* json_parser_value(struct json_parser* p, cJSON* item, const char* s);
+
+static const char* json_parser_array(struct json_parser* p, cJSON* item, const char* s)
+{
+    item->type |= cJSON_Array;
+    json_setdoc(item, p->doc);
+
+    s = json_parser_skipws(p, s + 1);
+    if (s < p->end && *s == ']')
+        return json_parser_expect(p, s) ? s + 1 : NULL;
+
+    cJSON* prev = NULL;
+    while (TRUE)    {
+        cJSON* child = json_parser_newitem(p);
+        if (child == NULL)  {
+            p->err = s;
+            return NULL;
+        }
+        if (prev != NULL)   {
+            prev->next = child;
+            child->prev = prev;
+        }   else    {
+            item->child = child;
+        }
+        prev = child;
+
+        s = json_parser_value(p, child, s);
+        if (s == NULL)
+            return NULL;
+        s = json_parser_skipws(p, s);
+        if (s >= p->end)    {
+            p->err = s;
+            return NULL;
+        }
+        if (!json_parser_expect(p, s))
+            return NULL;
+        if (*s == ']')
+            return s + 1;
+        if (*s != ',')  {
+            p->err = s;
+            return NULL;
+        }
+        s = json_parser_skipws(p, s + 1);
+    }
+}
+
+static const char* json_parser_object(struct json_parser* p, cJSON* item, const char* s)
+{
+    item->type |= cJSON_Object;
+    json_setdoc(item, p->doc);
+
+    s = json_parser_skipws(p, s + 1);
+    if (s < p->end && *s == '}')
+        return json_parser_expect(p, s) ? s + 1 : NULL;
+
+    cJSON* prev = NULL;
+    while (TRUE)    {
+        cJSON* child = json_parser_newitem(p);
+        if (child == NULL)  {
+            p->err = s;
+            return NULL;
+        }
+        if (prev != NULL)   {
+            prev->next = child;
+            child->prev = prev;
+        }   else    {
+            item->child = child;
+        }
+        prev = child;
+
+        /* "name" : value */
+        if (s >= p->end || *s != '"')   {
+            p->err = s;
+            return NULL;
+        }
+        s = json_parser_string(p, s, &child->string);
+        if (s == NULL)
+            return NULL;
+        s = json_parser_skipws(p, s);
+        if (s >= p->end || *s != ':' || !json_parser_expect(p, s))   {
+            p->err = s;
+            return NULL;
+        }
+        s = json_parser_value(p, child, json_parser_skipws(p, s + 1));
+        if (s == NULL)
+            return NULL;
+
+        s = json_parser_skipws(p, s);
+        if (s >= p->end)    {
+            p->err = s;
+            return NULL;
+        }
+        if (!json_parser_expect(p, s))
+            return NULL;
+        if (*s == '}')
+            return s + 1;
+        if (*s != ',')  {
+            p->err = s;
+            return NULL;
+        }
+        s = json_parser_skipws(p, s + 1);
+    }
+}
+
+static const char* json_parser_value(struct json_parser* p, cJSON* item, const char* s)
+{
+    size_t left = p->end - s;
+    if (left == 0)  {
+        p->err = s;
+        return NULL;
+    }
+
+    switch (*s) {
+    case '"':
+        item->type |= cJSON_String;
+        return json_parser_string(p, s, &item->valuestring);
+
+    case '[':
+    case '{':
+    {
+        if (++p->depth > JSON_DEPTH_MAX)    {
+            p->err = s;
+            return NULL;
+        }
+        if (!json_parser_expect(p, s))
+            return NULL;
+        s = (*s == '[') ? json_parser_array(p, item, s) : json_parser_object(p, item, s);
+        p->depth--;
+        return s;
+    }
+
+    case 't':
+        if (left >= 4 && strncmp(s, "true", 4) == 0)    {
+            item->type |= cJSON_True;
+            item->valueint = 1;
+            return s + 4;
+        }
+        break;
+
+    case 'f':
+        if (left >= 5 && strncmp(s, "false", 5) == 0)   {
+            item->type |= cJSON_False;
+            return s + 5;
+        }
+        break;
+
+    case 'n':
+        if (left >= 4 && strncmp(s, "null", 4) == 0)    {
+            item->type |= cJSON_NULL;
+            return s + 4;
+        }
+        break;
+
+    default:
+        if (*s == '-' || (*s >= '0' && *s <= '9'))
+            return json_parser_number(p, item, s);
+        break;
+    }
+
+    p->err = s;
+    return NULL;
+}
+
+static void json_destroy_doc(struct json_doc* doc)
+{
+    /* a walk is needed only if user attached heap items to the document */
+    if (doc->heap_items)
+        cJSON_Delete(doc->root.child);
+
+    struct json_keys* keys = doc->keys;
+    while (keys != NULL)    {
+        struct json_keys* next = keys->next;
+        json_free(keys);
+        keys = next;
+    }
+
+    mem_stack_destroy(&doc->arena);
+    A_ALIGNED_FREE(doc->alloc, doc);
+}
+
+/**
+ * parses 'len' bytes of JSON text into an arena document
+ * @param alloc allocator for the document, it's arena and temp index
+ * @param perr receives error position in the text on parse errors, NULL if we are out of memory
+ */
+static json_t json_parse_arena(struct allocator* alloc, const char* text, size_t len,
+                               const char** perr)
+{
+    struct json_index idx;
+    memset(&idx, 0x00, sizeof(idx));
+    idx.alloc = alloc;
+    *perr = NULL;
+
+    if (len >= UINT32_MAX)  {
+        *perr = text;
+        return NULL;
+    }
+
+    if (!json_index_build(&idx, text, (uint)len))   {
+        if (idx.pos != NULL)
+            A_ALIGNED_FREE(alloc, idx.pos);
+        return NULL;
+    }
+
+    /* doc and index are aligned, stack allocators (rpc) don't align their allocations */
+    struct json_doc* doc = (struct json_doc*)A_ALIGNED_ALLOC(alloc, sizeof(struct json_doc), 0);
+    if (doc == NULL)    {
+        A_ALIGNED_FREE(alloc, idx.pos);
+        return NULL;
+    }
+    memset(doc, 0x00, sizeof(struct json_doc));
+    doc->alloc = alloc;
+
+    /* every item except root is preceded by ',', '[' or '{', unescaped strings are never longer
+     * than their source text */
+    size_t item_sz = (sizeof(cJSON) + 7) & ~((size_t)7);
+    size_t arena_sz = (size_t)idx.item_cnt*item_sz + len + 8*((size_t)(idx.quote_cnt >> 1) + 1);
+    if (IS_FAIL(mem_stack_create(alloc, &doc->arena, arena_sz, 0)))   {
+        A_ALIGNED_FREE(alloc, doc);
+        A_ALIGNED_FREE(alloc, idx.pos);
+        return NULL;
+    }
+
+    struct json_parser p;
+    p.text = text;
+    p.end = text + len;
+    p.index = idx.pos;
+    p.index_cnt = idx.cnt;
+    p.cur = 0;
+    p.depth = 0;
+    p.doc = doc;
+    p.err = NULL;
+
+    doc->root.type = cJSON_IsArena | cJSON_IsArenaRoot;
+    const char* r = json_parser_value(&p, &doc->root, json_parser_skipws(&p, text));
+    A_ALIGNED_FREE(alloc, idx.pos);
+
+    if (r == NULL)  {
+        /* arena blocks in the partial tree are released with the arena */
+        *perr = p.err != NULL ? p.err : text;
+        json_destroy_doc(doc);
+        return NULL;
+    }
+
+    return &doc->root;
+}
+
+/*************************************************************************************************
+ * member lookup
+ * objects that are searched beyond JSON_KEYS_MIN members get an open-addressing index of their
+ * members on the first lookup. names are hashed case-folded, so the same index serves both exact
+ * and case-insensitive lookups. the index is kept up to date by json_additem_toobj and
+ * json_replaceitem_inobj, it is dropped and rebuilt on next lookup when it needs to grow
+ */
+INLINE uint json_keyhash(const char* name)
+{
+    uint h = 2166136261u;
+    for (; *name != 0; name++)
+        h = (h ^ (uint)(uint8)tolower(*name)) * 16777619u;
+    return h;
+}
+
+INLINE int json_keyequal(const char* s, const char* name, int icase)
+{
+    if (s == NULL)
+        return FALSE;
+    return icase ? str_isequal_nocase(s, name) : (strcmp(s, name) == 0);
+}
+
+INLINE void json_keys_insert(struct json_keys* keys, cJSON* item)
+{
+    uint h = json_keyhash(item->string != NULL ? item->string : "");
+    uint i = h & keys->mask;
+    while (keys->slots[i].item != NULL)
+        i = (i + 1) & keys->mask;
+    keys->slots[i].hash = h;
+    keys->slots[i].item = item;
+    keys->cnt++;
+}
+
+static struct json_keys* json_keys_create(json_t obj)
+{
+    uint cnt = 0;
+    for (cJSON* c = obj->child; c != NULL; c = c->next)
+        cnt++;
+
+    /* keep load factor under 0.5 */
+    uint slot_cnt = 16;
+    while (slot_cnt < cnt*2)
+        slot_cnt <<= 1;
+
+    size_t sz = sizeof(struct json_keys) + sizeof(struct json_keyslot)*(slot_cnt - 1);
+    struct json_keys* keys = (struct json_keys*)json_malloc(sz);
+    if (keys == NULL)
+        return NULL;
+    memset(keys, 0x00, sz);
+    keys->mask = slot_cnt - 1;
+
+    /* members are inserted in order, so probing finds the first of duplicate names like the list */
+    for (cJSON* c = obj->child; c != NULL; c = c->next)   {
+        json_keys_insert(keys, c);
+        keys->tail = c;
+    }
+    return keys;
+}
+
+static void json_keys_build(json_t obj)
+{
+    struct json_keys* keys = json_keys_create(obj);
+    if (keys == NULL)
+        return; /* lookups stay linear */
+
+    /* concurrent readers may build the index at the same time, first one wins */
+    if (MT_ATOMIC_CASTPTR(obj->index, NULL, keys) != NULL)  {
+        json_free(keys);
+        return;
+    }
+
+    /* cJSON_Delete doesn't free arena items, keep the index with the document instead */
+    if (obj->type & cJSON_IsArena)  {
+        struct json_doc* doc = json_getdoc(obj);
+        struct json_keys* head;
+        do  {
+            head = doc->keys;
+            keys->next = head;
+        }   while (MT_ATOMIC_CASTPTR(doc->keys, head, keys) != head);
+    }
+}
+
+/* detaches index from the object, it will be rebuilt on next lookup */
+static void json_keys_drop(json_t obj)
+{
+    if (obj->index != NULL) {
+        if (!(obj->type & cJSON_IsArena))
+            json_free(obj->index);
+        obj->index = NULL;
+    }
+}
+
+static json_t json_keys_find(const struct json_keys* keys, const char* name, int icase)
+{
+    uint h = json_keyhash(name);
+    for (uint i = h & keys->mask; keys->slots[i].item != NULL; i = (i + 1) & keys->mask)  {
+        const struct json_keyslot* slot = &keys->slots[i];
+        if (slot->hash == h && json_keyequal(slot->item->string, name, icase))
+            return slot->item;
+    }
+    return NULL;
+}
+
+static json_t json_findmember(json_t obj, const char* name, int icase)
+{
+    struct json_keys* keys = (struct json_keys*)obj->index;
+    if (keys != NULL)
+        return json_keys_find(keys, name, icase);
+
+    uint cnt = 0;
+    cJSON* c = obj->child;
+    while (c != NULL && !json_keyequal(c->string, name, icase))  {
+        c = c->next;
+        cnt++;
+    }
+
+    /* object is wide, next lookups go through the index */
+    if (cnt >= JSON_KEYS_MIN && (obj->type & 0xff) == cJSON_Object)
+        json_keys_build(obj);
+    return c;
+}
+
+static char* json_strdup(const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* s = (char*)json_malloc(len);
+    if (s != NULL)
+        memcpy(s, str, len);
+    return s;
+}
+
+INLINE void json_setname(json_t item, const char* name)
+{
+    if (item->string != NULL && !(item->type & cJSON_IsArena))
+        json_free(item->string);
+    item->string = json_strdup(name);
+}
+
+/*************************************************************************************************
+ * SAX reader
+ * reads the file in fixed size chunks and reports nodes as they are parsed, only the current token
+ * (string/number) and the container stack are kept in memory
+ */
+#define JSON_SAX_BUFFER_SIZE    (64*1024)
+#define JSON_SAX_TOKEN_SIZE     256
+
+struct json_sax_reader
+{
+    file_t f;
+    char* buf;
+    size_t pos;
+    size_t len;
+    uint64 offset;  /* file offset of the buffer */
+    int eof;
+    char* tok;  /* current string/number/literal token, zero-terminated */
+    size_t tok_len;
+    size_t tok_max;
+};
+
+static int json_sax_fill(struct json_sax_reader* r)
+{
+    if (r->eof)
+        return FALSE;
+
+    r->offset += r->len;
+    r->pos = 0;
+    r->len = fio_read(r->f, r->buf, 1, JSON_SAX_BUFFER_SIZE);
+    if (r->len == 0)    {
+        r->eof = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* returns current character or -1 on end of file */
+INLINE int json_sax_peek(struct json_sax_reader* r)
+{
+    if (r->pos == r->len && !json_sax_fill(r))
+        return -1;
+    return (uint8)r->buf[r->pos];
+}
+
+INLINE int json_sax_skipws(struct json_sax_reader* r)
+{
+    int c;
+    while ((c = json_sax_peek(r)) != -1 && c <= 32)
+        r->pos++;
+    return c;
+}
+
+static int json_sax_append(struct json_sax_reader* r, const char* s, size_t size)
+{
+    if (r->tok_len + size + 1 > r->tok_max)   {
+        size_t max = r->tok_max << 1;
+        if (max < r->tok_len + size + 1)
+            max = r->tok_len + size + 1;
+        char* tok = (char*)REALLOC(r->tok, max, 0);
+        if (tok == NULL)
+            return FALSE;
+        r->tok = tok;
+        r->tok_max = max;
+    }
+
+    memcpy(r->tok + r->tok_len, s, size);
+    r->tok_len += size;
+    r->tok[r->tok_len] = 0;
+    return TRUE;
+}
+
+static result_t json_sax_error(struct json_sax_reader* r, const char* msg)
+{
+    err_printf(__FILE__, __LINE__, "JSON parse '%s' failed: %s at offset %llu", fio_getpath(r->f),
+        msg, (unsigned long long)(r->offset + r->pos));
+    return RET_FAIL;
+}
+
+/* reads 4 hex digits of an \u escape */
+static int json_sax_hex4(struct json_sax_reader* r, uint* pc)
+{
+    char h[4];
+    for (int i = 0; i < 4; i++) {
+        int c = json_sax_peek(r);
+        if (c == -1)
+            return FALSE;
+        h[i] = (char)c;
+        r->pos++;
+    }
+    return json_hex4(h, pc);
+}
+
+/* reads string token, current character is the opening quote */
+static result_t json_sax_string(struct json_sax_reader* r)
+{
+    r->pos++;
+    r->tok_len = 0;
+    if (!json_sax_append(r, "", 0))
+        return RET_OUTOFMEMORY;
+
+    while (TRUE)    {
+        if (json_sax_peek(r) == -1)
+            return json_sax_error(r, "unterminated string");
+
+        /* copy plain characters in the buffer at once */
+        const char* s = r->buf + r->pos;
+        const char* e = r->buf + r->len;
+        const char* p = s;
+        while (p < e && *p != '"' && *p != '\\')
+            p++;
+        if (p != s && !json_sax_append(r, s, p - s))
+            return RET_OUTOFMEMORY;
+        r->pos += p - s;
+        if (p == e)
+            continue;
+
+        r->pos++;
+        if (*p == '"')
+            return RET_OK;
+
+        /* escape sequence */
+        int c = json_sax_peek(r);
+        char esc[8];
+        uint esc_len = 1;
+        if (c == -1)
+            return json_sax_error(r, "unterminated string");
+        r->pos++;
+        switch (c)  {
+        case 'b':   esc[0] = '\b';  break;
+        case 'f':   esc[0] = '\f';  break;
+        case 'n':   esc[0] = '\n';  break;
+        case 'r':   esc[0] = '\r';  break;
+        case 't':   esc[0] = '\t';  break;
+        case 'u':
+        {
+            uint uc, uc2;
+            if (!json_sax_hex4(r, &uc))
+                return json_sax_error(r, "invalid unicode escape");
+
+            if (uc >= 0xD800 && uc <= 0xDBFF)   {
+                if (json_sax_peek(r) != '\\')
+                    return json_sax_error(r, "invalid surrogate pair");
+                r->pos++;
+                if (json_sax_peek(r) != 'u')
+                    return json_sax_error(r, "invalid surrogate pair");
+                r->pos++;
+                if (!json_sax_hex4(r, &uc2) || uc2 < 0xDC00 || uc2 > 0xDFFF)
+                    return json_sax_error(r, "invalid surrogate pair");
+                uc = 0x10000 + (((uc & 0x3FF) << 10) | (uc2 & 0x3FF));
+            }   else if ((uc >= 0xDC00 && uc <= 0xDFFF) || uc == 0)   {
+                esc_len = 0;    /* invalid, skip it like the DOM parser does */
+                break;
+            }
+            esc_len = json_utf8(esc, uc);
+            break;
+        }
+        default:    esc[0] = (char)c;   break;
+        }
+
+        if (esc_len > 0 && !json_sax_append(r, esc, esc_len))
+            return RET_OUTOFMEMORY;
+    }
+}
+
+/* reads number or literal token (true/false/null) */
+static result_t json_sax_word(struct json_sax_reader* r)
+{
+    r->tok_len = 0;
+    if (!json_sax_append(r, "", 0))
+        return RET_OUTOFMEMORY;
+
+    while (json_sax_peek(r) != -1)  {
+        const char* s = r->buf + r->pos;
+        const char* e = r->buf + r->len;
+        const char* p = s;
+        while (p < e && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || *p == '-' ||
+               *p == '+' || *p == '.' || *p == 'E'))
+        {
+            p++;
+        }
+        if (p != s && !json_sax_append(r, s, p - s))
+            return RET_OUTOFMEMORY;
+        r->pos += p - s;
+        if (p != e)
+            break;
+    }
+    return RET_OK;
+}
+
+static result_t json_sax_value(struct json_sax_reader* r, int c, const struct json_sax* sax,
+                               void* param)
+{
+    struct json_sax_value v;
+    memset(&v, 0x00, sizeof(v));
+
+    result_t res = (c == '"') ? json_sax_string(r) : json_sax_word(r);
+    if (IS_FAIL(res))
+        return res;
+
+    if (c == '"')   {
+        v.type = JSON_STRING;
+        v.s = r->tok;
+        v.s_len = (uint)r->tok_len;
+    }   else if (strcmp(r->tok, "true") == 0)    {
+        v.type = JSON_BOOL;
+        v.i = TRUE;
+    }   else if (strcmp(r->tok, "false") == 0)   {
+        v.type = JSON_BOOL;
+        v.i = FALSE;
+    }   else if (strcmp(r->tok, "null") == 0)    {
+        v.type = JSON_NULL;
+    }   else    {
+        const char* e = json_parsenum(r->tok, r->tok + r->tok_len, &v.n);
+        if (e == NULL || e != r->tok + r->tok_len)
+            return json_sax_error(r, "invalid value");
+        v.type = JSON_NUM;
+        v.i = json_numtoint(v.n);
+    }
+
+    if (sax->value_fn != NULL && !sax->value_fn(&v, param))
+        return RET_ABORT;
+    return RET_OK;
+}
+
+/* reads "key" : of an object member */
+static result_t json_sax_key(struct json_sax_reader* r, const struct json_sax* sax, void* param)
+{
+    if (json_sax_skipws(r) != '"')
+        return json_sax_error(r, "expected member name");
+
+    result_t res = json_sax_string(r);
+    if (IS_FAIL(res))
+        return res;
+    if (json_sax_skipws(r) != ':')
+        return json_sax_error(r, "expected ':'");
+    r->pos++;
+
+    if (sax->key_fn != NULL && !sax->key_fn(r->tok, (uint)r->tok_len, param))
+        return RET_ABORT;
+    return RET_OK;
+}
+
+static result_t json_sax_run(struct json_sax_reader* r, const struct json_sax* sax, void* param)
+{
+    uint8 stack[JSON_DEPTH_MAX];    /* container types (JSON_ARRAY/JSON_OBJECT) */
+    uint depth = 0;
+    int want_value = TRUE;
+    result_t res;
+
+    while (TRUE)    {
+        int c = json_sax_skipws(r);
+
+        if (want_value) {
+            switch (c)  {
+            case -1:
+                /* end of file is fine between top-level documents */
+                if (depth == 0)
+                    return RET_OK;
+                return json_sax_error(r, "unexpected end of file");
+
+            case '{':
+            case '[':
+            {
+                int obj = (c == '{');
+                if (depth == JSON_DEPTH_MAX)
+                    return json_sax_error(r, "maximum depth exceeded");
+                r->pos++;
+                stack[depth++] = (uint8)(obj ? JSON_OBJECT : JSON_ARRAY);
+                pfn_json_sax_node begin_fn = obj ? sax->obj_begin_fn : sax->arr_begin_fn;
+                if (begin_fn != NULL && !begin_fn(param))
+                    return RET_ABORT;
+
+                /* empty containers */
+                if (json_sax_skipws(r) == (obj ? '}' : ']'))  {
+                    r->pos++;
+                    depth--;
+                    pfn_json_sax_node end_fn = obj ? sax->obj_end_fn : sax->arr_end_fn;
+                    if (end_fn != NULL && !end_fn(param))
+                        return RET_ABORT;
+                    want_value = FALSE;
+                }   else if (obj)   {
+                    if ((res = json_sax_key(r, sax, param)) != RET_OK)
+                        return res;
+                }
+                break;
+            }
+
+            default:
+                if (c != '"' && c != '-' && !(c >= '0' && c <= '9') && c != 't' && c != 'f' &&
+                    c != 'n')
+                {
+                    return json_sax_error(r, "unexpected character");
+                }
+                if ((res = json_sax_value(r, c, sax, param)) != RET_OK)
+                    return res;
+                want_value = FALSE;
+                break;
+            }
+        }   else if (depth == 0)    {
+            /* top-level value is finished, concatenated documents (json-lines) may follow */
+            want_value = TRUE;
+        }   else    {
+            int obj = (stack[depth-1] == JSON_OBJECT);
+            if (c == ',')   {
+                r->pos++;
+                want_value = TRUE;
+                if (obj && (res = json_sax_key(r, sax, param)) != RET_OK)
+                    return res;
+            }   else if (c == (obj ? '}' : ']'))    {
+                r->pos++;
+                depth--;
+                pfn_json_sax_node end_fn = obj ? sax->obj_end_fn : sax->arr_end_fn;
+                if (end_fn != NULL && !end_fn(param))
+                    return RET_ABORT;
+            }   else    {
+                return json_sax_error(r, c == -1 ? "unexpected end of file" :
+                    "expected ',' or end of container");
+            }
+        }
+    }
+}
+
+result_t json_sax_parsef(file_t f, const struct json_sax* sax, void* param)
+{
+    ASSERT(f != NULL);
+    ASSERT(sax != NULL);
+
+    struct json_sax_reader r;
+    memset(&r, 0x00, sizeof(r));
+    r.f = f;
+    r.buf = (char*)ALLOC(JSON_SAX_BUFFER_SIZE, 0);
+    r.tok = (char*)ALLOC(JSON_SAX_TOKEN_SIZE, 0);
+    if (r.buf == NULL || r.tok == NULL) {
+        if (r.buf != NULL)  FREE(r.buf);
+        if (r.tok != NULL)  FREE(r.tok);
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return RET_OUTOFMEMORY;
+    }
+    r.tok_max = JSON_SAX_TOKEN_SIZE;
+
+    result_t result = json_sax_run(&r, sax, param);
+    if (result == RET_OUTOFMEMORY)
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+
+    FREE(r.buf);
+    FREE(r.tok);
+    return result;
+}
+
+result_t json_sax_parsefile(const char* filepath, const struct json_sax* sax, void* param)
+{
+    file_t f = fio_opendisk(filepath, TRUE);
+    if (f == NULL)  {
+        err_printf(__FILE__, __LINE__, "JSON parse failed: could not open file '%s'", filepath);
+        return RET_FILE_ERROR;
+    }
+
+    result_t r = json_sax_parsef(f, sax, param);
+    fio_close(f);
+    return r;
+}
+
+/*************************************************************************************************/
+json_t json_parsefile(const char* filepath)
+{
+    ASSERT(g_json);
+    
+    char* buff = util_readtextfile(filepath, mem_heap());
+    if (buff == NULL)   {
+        err_printf(__FILE__, __LINE__, "JSON parse failed: could not open file '%s'", filepath);
+        return NULL;
+    }
+
+    json_t jroot = json_parsestring(buff);
+    FREE(buff);
+
+    return jroot;
+}
+
+static void json_parsefilef_err(file_t f, const char* err)
+{
+    if (err != NULL)
+        err_printf(__FILE__, __LINE__, "JSON parse '%s' failed: '%s'", fio_getpath(f), err);
+    else
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+}
+
+json_t json_parsefilef(file_t f, struct allocator* tmp_alloc)
+{
+    ASSERT(g_json);
+
+    /* parse from current position to the end of file */
+    size_t size = fio_getsize(f) - fio_getpos(f);
+    if (size == 0)         {
+        err_printf(__FILE__, __LINE__, "JSON load failed: zero size file '%s'", fio_getpath(f));
+        return NULL;
+    }
+
+    json_t j;
+    const char* err;
+    const char* text = fio_peektext(f);
+    if (text != NULL)   {
+        /* file data is already zero-terminated, parse it in place */
+        j = json_parse_arena(mem_heap(), text, size, &err);
+        if (j == NULL)
+            json_parsefilef_err(f, err);
+        fio_advance(f, size);
+    }   else    {
+        /* read file and put it's data into a buffer */
+        char* buffer = (char*)A_ALLOC(tmp_alloc, size+1, 0);
+        if (buffer == NULL)    {
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+            return NULL;
+        }
+
+        fio_read(f, buffer, size, 1);
+        buffer[size] = 0;
+        j = json_parse_arena(mem_heap(), buffer, size, &err);
+        if (j == NULL)
+            json_parsefilef_err(f, err);    /* 'err' points into the buffer */
+        A_FREE(tmp_alloc, buffer);
+    }
+
+    return j;
+}
+
+json_t json_parsestring(const char* str)
+{
+    ASSERT(g_json);
+
+    const char* err;
+    json_t j = json_parse_arena(mem_heap(), str, strlen(str), &err);
+    if (j == NULL)     {
+        if (err != NULL)
+            err_printf(__FILE__, __LINE__, "JSON parse failed: %s", err);
+        else
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+
+    return j;
+}
+
+json_t json_parsebuffer(const char* text, size_t len, struct allocator* alloc)
+{
+    ASSERT(g_json);
+
+    const char* err;
+    json_t j = json_parse_arena(alloc, text, len, &err);
+    if (j == NULL)     {
+        /* text is not zero-terminated, so only the position is reported */
+        if (err != NULL)
+            err_printf(__FILE__, __LINE__, "JSON parse failed at offset %u", (uint)(err - text));
+        else
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+
+    return j;
+}
+
+/*************************************************************************************************
+ * writer
+ * writes the tree into a fixed size buffer that is flushed to the target as it fills up, output is
+ * same as cJSON_Print/cJSON_PrintUnformatted
+ */
+#define JSON_WRITER_BUFFER_SIZE (16*1024)
+#define JSON_WRITER_NUM_MAX     64  /* max. size of a formatted number */
+
+struct json_writer;
+typedef int (*pfn_json_flush)(struct json_writer* w, size_t size);
+
+struct json_writer
+{
+    char* buf;
+    size_t pos;
+    size_t size;
+    pfn_json_flush flush_fn;    /* empties (or grows) the buffer to make room for 'size' bytes */
+    void* param;
+    int failed;
+};
+
+static const char g_json_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static int json_flush_file(struct json_writer* w, size_t size)
+{
+    if (fio_write((file_t)w->param, w->buf, 1, w->pos) != w->pos)
+        return FALSE;
+    w->pos = 0;
+    return TRUE;
+}
+
+static int json_flush_std(struct json_writer* w, size_t size)
+{
+    if (fwrite(w->buf, 1, w->pos, (FILE*)w->param) != w->pos)
+        return FALSE;
+    w->pos = 0;
+    return TRUE;
+}
+
+/* memory output grows the buffer instead, the buffer is kept with a json_malloc size header in
+ * front, so it can be freed by json_deletebuffer */
+static int json_flush_grow(struct json_writer* w, size_t size)
+{
+    size_t nsize = w->size << 1;
+    if (nsize < w->pos + size)
+        nsize = w->pos + size;
+    if (nsize + sizeof(uint) > UINT32_MAX)
+        return FALSE;
+
+    uint8* block = (uint8*)REALLOC(w->buf - sizeof(uint), nsize + sizeof(uint), 0);
+    if (block == NULL)
+        return FALSE;
+    json_alloc_putsize(block, (uint)(nsize + sizeof(uint)));
+    w->buf = (char*)block + sizeof(uint);
+    w->size = nsize;
+    return TRUE;
+}
+
+/* makes room for 'size' bytes, size must not exceed JSON_WRITER_BUFFER_SIZE */
+INLINE int json_writer_reserve(struct json_writer* w, size_t size)
+{
+    if (w->pos + size <= w->size)
+        return TRUE;
+    if (w->failed || !w->flush_fn(w, size))   {
+        w->failed = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void json_writer_write(struct json_writer* w, const char* s, size_t len)
+{
+    while (len > 0) {
+        size_t n = w->size - w->pos;
+        if (n == 0) {
+            if (!json_writer_reserve(w, len < JSON_WRITER_BUFFER_SIZE ? len : JSON_WRITER_BUFFER_SIZE))
+                return;
+            n = w->size - w->pos;
+        }
+        if (n > len)
+            n = len;
+        memcpy(w->buf + w->pos, s, n);
+        w->pos += n;
+        s += n;
+        len -= n;
+    }
+}
+
+INLINE void json_writer_putc(struct json_writer* w, char c)
+{
+    if (json_writer_reserve(w, 1))
+        w->buf[w->pos++] = c;
+}
+
+INLINE void json_writer_tabs(struct json_writer* w, int cnt)
+{
+    for (int i = 0; i < cnt; i++)
+        json_writer_putc(w, '\t');
+}
+
+/* writes unsigned integer into 'out' (max 20 chars), returns number of chars */
+static uint json_utoa(char* out, uint64 v)
+{
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+
+    while (v >= 100)    {
+        uint d = (uint)(v % 100) << 1;
+        v /= 100;
+        *--p = g_json_digits[d + 1];
+        *--p = g_json_digits[d];
+    }
+    if (v >= 10)    {
+        uint d = (uint)v << 1;
+        *--p = g_json_digits[d + 1];
+        *--p = g_json_digits[d];
+    }   else    {
+        *--p = (char)('0' + v);
+    }
+
+    uint len = (uint)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, len);
+    return len;
+}
+
+static uint json_itoa(char* out, int64 v)
+{
+    if (v < 0)  {
+        *out = '-';
+        return json_utoa(out + 1, (uint64)0 - (uint64)v) + 1;
+    }
+    return json_utoa(out, (uint64)v);
+}
+
+/* same as sprintf("%f") for 1e-6 <= |d| <= 1e9, returns 0 if it can't tell how printf rounds */
+static uint json_ftoa6(char* out, fl64 d)
+{
+    /* scaled value is below 2^53 in this range, so it rounds correctly unless the fraction is
+     * within a few ulps of half */
+    fl64 a = fabs(d) * 1e6;
+    fl64 ai = floor(a);
+    fl64 frac = a - ai;
+    if (fabs(frac - 0.5) <= a*4.5e-16)
+        return 0;
+
+    uint64 v = (uint64)ai + (frac > 0.5 ? 1 : 0);
+    uint64 fp = v % 1000000;
+    char* p = out;
+    if (d < 0)
+        *p++ = '-';
+    p += json_utoa(p, v / 1000000);
+    *p++ = '.';
+    for (int i = 5; i >= 0; i--)    {
+        p[i] = (char)('0' + fp % 10);
+        fp /= 10;
+    }
+    p += 6;
+    return (uint)(p - out);
+}
+
+static void json_writer_num(struct json_writer* w, json_t item)
+{
+    if (!json_writer_reserve(w, JSON_WRITER_NUM_MAX))
+        return;
+
+    fl64 d = item->valuedouble;
+    char* out = w->buf + w->pos;
+    uint len = 0;
+
+    /* formats are chosen same as cJSON, common cases are formatted without sprintf */
+    if (fabs((fl64)item->valueint - d) <= DBL_EPSILON && d <= INT_MAX && d >= INT_MIN)  {
+        len = json_itoa(out, item->valueint);
+    }   else if (fabs(floor(d) - d) <= DBL_EPSILON && fabs(d) < 1.0e60)   {
+        if (floor(d) == d && fabs(d) < 9.0e18)
+            len = json_itoa(out, (int64)d);
+        else
+            len = (uint)sprintf(out, "%.0f", d);
+    }   else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9)    {
+        len = (uint)sprintf(out, "%e", d);
+    }   else    {
+        if (d == d)
+            len = json_ftoa6(out, d);
+        if (len == 0)
+            len = (uint)sprintf(out, "%f", d);
+    }
+    w->pos += len;
+}
+
+static void json_writer_str(struct json_writer* w, const char* s)
+{
+    json_writer_putc(w, '"');
+    if (s != NULL)  {
+        while (*s != 0) {
+            /* copy runs that don't need escaping at once */
+            const char* p = s;
+            while ((uint8)*p > 31 && *p != '"' && *p != '\\')
+                p++;
+            if (p != s)
+                json_writer_write(w, s, p - s);
+            if (*p == 0)
+                break;
+
+            char esc[8];
+            uint8 c = (uint8)*p;
+            esc[0] = '\\';
+            switch (c)  {
+            case '\\':  esc[1] = '\\';  break;
+            case '"':   esc[1] = '"';   break;
+            case '\b':  esc[1] = 'b';   break;
+            case '\f':  esc[1] = 'f';   break;
+            case '\n':  esc[1] = 'n';   break;
+            case '\r':  esc[1] = 'r';   break;
+            case '\t':  esc[1] = 't';   break;
+            default:
+                sprintf(esc + 1, "u%04x", c);
+                break;
+            }
+            json_writer_write(w, esc, esc[1] == 'u' ? 6 : 2);
+            s = p + 1;
+        }
+    }
+    json_writer_putc(w, '"');
+}
+
+static void json_writer_value(struct json_writer* w, json_t item, int depth, int fmt)
+{
+    switch (item->type & 0xff)  {
+    case cJSON_NULL:
+        json_writer_write(w, "null", 4);
+        break;
+    case cJSON_False:
+        json_writer_write(w, "false", 5);
+        break;
+    case cJSON_True:
+        json_writer_write(w, "true", 4);
+        break;
+    case cJSON_Number:
+        json_writer_num(w, item);
+        break;
+    case cJSON_String:
+        json_writer_str(w, item->valuestring);
+        break;
+
+    case cJSON_Array:
+        json_writer_putc(w, '[');
+        for (json_t c = item->child; c != NULL; c = c->next)  {
+            json_writer_value(w, c, depth + 1, fmt);
+            if (c->next != NULL)    {
+                json_writer_putc(w, ',');
+                if (fmt)
+                    json_writer_putc(w, ' ');
+            }
+        }
+        json_writer_putc(w, ']');
+        break;
+
+    case cJSON_Object:
+        json_writer_putc(w, '{');
+        if (fmt)
+            json_writer_putc(w, '\n');
+        if (item->child == NULL)    {
+            if (fmt)
+                json_writer_tabs(w, depth - 1);
+            json_writer_putc(w, '}');
+            break;
+        }
+
+        for (json_t c = item->child; c != NULL; c = c->next)  {
+            if (fmt)
+                json_writer_tabs(w, depth + 1);
+            json_writer_str(w, c->string);
+            json_writer_putc(w, ':');
+            if (fmt)
+                json_writer_putc(w, '\t');
+            json_writer_value(w, c, depth + 1, fmt);
+            if (c->next != NULL)
+                json_writer_putc(w, ',');
+            if (fmt)
+                json_writer_putc(w, '\n');
+        }
+        if (fmt)
+            json_writer_tabs(w, depth);
+        json_writer_putc(w, '}');
+        break;
+    }
+}
+
 /*************************************************************************************************
- * types/globals
+ * binary writer
+ * binary documents are MessagePack: numbers are written as the smallest integer type that holds
+ * them, or as float32/float64 when they have a fraction, so values are restored exactly
  */
-struct json_mgr
-{
-    mt_mutex buff_mtx[JSON_ALLOC_CNT];
-    struct pool_alloc buffs[JSON_ALLOC_CNT];
-};
+#define JSON_WRITE_FORMAT   0
+#define JSON_WRITE_TRIM     1
+#define JSON_WRITE_BIN      2
 
-static struct json_mgr* g_json = NULL;
+INLINE void json_bin_putbe(uint8* out, uint64 v, uint size)
+{
+    for (uint i = size; i > 0; i--)   {
+        out[i-1] = (uint8)v;
+        v >>= 8;
+    }
+}
 
-/*************************************************************************************************/
-INLINE void* json_alloc_putsize(void* ptr, uint sz)
+/* writes type byte of a value, followed by 'size' bytes of 'v' in big-endian order */
+static void json_binwriter_head(struct json_writer* w, uint8 type, uint64 v, uint size)
 {
-    *((uint*)ptr) = sz;
-    return ((uint8*)ptr + sizeof(uint));
+    if (!json_writer_reserve(w, size + 1))
+        return;
+    uint8* out = (uint8*)w->buf + w->pos;
+    out[0] = type;
+    json_bin_putbe(out + 1, v, size);
+    w->pos += size + 1;
 }
 
-INLINE uint json_alloc_getsize(void* ptr, void** preal_ptr)
+/* header of arrays and maps, 'fix' types hold up to 15 items, 'type16'+1 is the 32-bit type */
+static void json_binwriter_size(struct json_writer* w, uint8 fix, uint8 type16, uint cnt)
 {
-    uint8* bptr = (uint8*)ptr - sizeof(uint);
-    uint sz = *((uint*)bptr);
-    *preal_ptr = bptr;
-    return sz;
+    if (cnt <= 15)
+        json_binwriter_head(w, (uint8)(fix | cnt), 0, 0);
+    else if (cnt <= UINT16_MAX)
+        json_binwriter_head(w, type16, cnt, 2);
+    else
+        json_binwriter_head(w, (uint8)(type16 + 1), cnt, 4);
 }
 
-INLINE int json_choose_alloc(size_t sz)
+static void json_binwriter_str(struct json_writer* w, const char* s)
 {
-    if (sz <= 16)
-        return JSON_ALLOC_16;
-    else if (sz > 16 && sz <= 32)
-        return JSON_ALLOC_32;
-    else if (sz > 32 && sz <=64)
-        return JSON_ALLOC_64;
-    else if (sz > 64 && sz <= 128)
-        return JSON_ALLOC_128;
-    else if (sz > 128 && sz <= 256)
-        return JSON_ALLOC_256;
+    size_t len = s != NULL ? strlen(s) : 0;
+    if (len <= 31)
+        json_binwriter_head(w, (uint8)(0xa0 | len), 0, 0);
+    else if (len <= UINT8_MAX)
+        json_binwriter_head(w, 0xd9, len, 1);
+    else if (len <= UINT16_MAX)
+        json_binwriter_head(w, 0xda, len, 2);
     else
-        return -1;
+        json_binwriter_head(w, 0xdb, len, 4);
+    json_writer_write(w, s, len);
 }
 
-/*************************************************************************************************/
-/* callbacks for memory allocation/deallocation */
-static void* json_malloc(size_t size)
+static void json_binwriter_num(struct json_writer* w, fl64 d)
 {
-    ASSERT(size < UINT32_MAX);
+    /* checked on bits, comparisons with inf/nan are not reliable with fast-math */
+    uint64 bits;
+    memcpy(&bits, &d, sizeof(bits));
+    int finite = (bits & 0x7ff0000000000000ull) != 0x7ff0000000000000ull;
+    int negzero = bits == 0x8000000000000000ull;    /* -0.0 is written as float to keep it's sign */
+
+    if (finite && !negzero && d >= -9223372036854775808.0 && d < 18446744073709551616.0 && d == floor(d))  {
+        if (d >= 0.0)   {
+            uint64 u = (uint64)d;
+            if (u <= 0x7f)
+                json_binwriter_head(w, (uint8)u, 0, 0);
+            else if (u <= UINT8_MAX)
+                json_binwriter_head(w, 0xcc, u, 1);
+            else if (u <= UINT16_MAX)
+                json_binwriter_head(w, 0xcd, u, 2);
+            else if (u <= UINT32_MAX)
+                json_binwriter_head(w, 0xce, u, 4);
+            else
+                json_binwriter_head(w, 0xcf, u, 8);
+        }   else    {
+            int64 i = (int64)d;
+            if (i >= -32)
+                json_binwriter_head(w, (uint8)i, 0, 0);
+            else if (i >= -128)
+                json_binwriter_head(w, 0xd0, (uint64)i, 1);
+            else if (i >= -32768)
+                json_binwriter_head(w, 0xd1, (uint64)i, 2);
+            else if (i >= INT32_MIN)
+                json_binwriter_head(w, 0xd2, (uint64)i, 4);
+            else
+                json_binwriter_head(w, 0xd3, (uint64)i, 8);
+        }
+        return;
+    }
 
-    size += sizeof(uint);    /* to keep the size */
-    int a_idx = json_choose_alloc(size);
-    void* ptr;
-    if (a_idx != -1) {
-        mt_mutex_lock(&g_json->buff_mtx[a_idx]);
-        ptr = mem_pool_alloc(&g_json->buffs[a_idx]);
-        mt_mutex_unlock(&g_json->buff_mtx[a_idx]);
-    } else  {
-        ptr = mem_alloc(size, __FILE__, __LINE__, 0);
+    float f = (float)d;
+    if (finite && (fl64)f == d) {
+        uint fbits;
+        memcpy(&fbits, &f, sizeof(fbits));
+        json_binwriter_head(w, 0xca, fbits, 4);
+    }   else    {
+        json_binwriter_head(w, 0xcb, bits, 8);
     }
-    return json_alloc_putsize(ptr, (uint)size);
 }
 
-static void json_free(void* p)
+static void json_binwriter_value(struct json_writer* w, json_t item)
 {
-    uint sz = json_alloc_getsize(p, &p);
-    int a_idx = json_choose_alloc(sz);
+    uint cnt = 0;
+    switch (item->type & 0xff)  {
+    case cJSON_NULL:
+        json_binwriter_head(w, 0xc0, 0, 0);
+        break;
+    case cJSON_False:
+        json_binwriter_head(w, 0xc2, 0, 0);
+        break;
+    case cJSON_True:
+        json_binwriter_head(w, 0xc3, 0, 0);
+        break;
+    case cJSON_Number:
+        json_binwriter_num(w, item->valuedouble);
+        break;
+    case cJSON_String:
+        json_binwriter_str(w, item->valuestring);
+        break;
+
+    case cJSON_Array:
+        for (json_t c = item->child; c != NULL; c = c->next)
+            cnt++;
+        json_binwriter_size(w, 0x90, 0xdc, cnt);
+        for (json_t c = item->child; c != NULL; c = c->next)
+            json_binwriter_value(w, c);
+        break;
+
+    case cJSON_Object:
+        for (json_t c = item->child; c != NULL; c = c->next)
+            cnt++;
+        json_binwriter_size(w, 0x80, 0xde, cnt);
+        for (json_t c = item->child; c != NULL; c = c->next)  {
+            json_binwriter_str(w, c->string);
+            json_binwriter_value(w, c);
+        }
+        break;
+    }
+}
 
-    if (a_idx != -1) {
-        mt_mutex_lock(&g_json->buff_mtx[a_idx]);
-        mem_pool_free(&g_json->buffs[a_idx], p);
-        mt_mutex_unlock(&g_json->buff_mtx[a_idx]);
-    } else  {
-        mem_free(p);
+/* writes the tree to a flushed target, text output is zero-terminated like the printed strings */
+static result_t json_write(json_t j, pfn_json_flush flush_fn, void* param, int mode)
+{
+    struct json_writer w;
+    memset(&w, 0x00, sizeof(w));
+    w.buf = (char*)ALLOC(JSON_WRITER_BUFFER_SIZE, 0);
+    if (w.buf == NULL)  {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return RET_OUTOFMEMORY;
+    }
+    w.size = JSON_WRITER_BUFFER_SIZE;
+    w.flush_fn = flush_fn;
+    w.param = param;
+
+    if (mode == JSON_WRITE_BIN) {
+        json_binwriter_value(&w, j);
+    }   else    {
+        json_writer_value(&w, j, 0, mode == JSON_WRITE_FORMAT);
+        json_writer_putc(&w, 0);
     }
+    if (!w.failed && w.pos > 0 && !flush_fn(&w, 0))
+        w.failed = TRUE;
+
+    FREE(w.buf);
+    return w.failed ? RET_FILE_ERROR : RET_OK;
 }
 
-/* */
-static result_t json_create_buffs()
+result_t json_savetofile(json_t j, const char* filepath, int trim)
 {
-    for (int i = 0; i < JSON_ALLOC_CNT; i++)
-        mt_mutex_init(&g_json->buff_mtx[i]);
+    ASSERT(g_json);
 
-    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_16], 16, 1024, 0)))
-        return RET_OUTOFMEMORY;
-    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_32], 32, 1024, 0)))
-        return RET_OUTOFMEMORY;
-    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_64], 64, 1024, 0)))
-        return RET_OUTOFMEMORY;
-    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_128], 128, 512, 0)))
-        return RET_OUTOFMEMORY;
-    if (IS_FAIL(mem_pool_create(mem_heap(), &g_json->buffs[JSON_ALLOC_256], 256, 512, 0)))
-        return RET_OUTOFMEMORY;
+    /* open file for writing */
+    FILE* f = fopen(filepath, "wb");
+    if (f == NULL)    {
+        err_printf(__FILE__, __LINE__, "JSON write error: could not open file '%s' for writing.",
+                   filepath);
+        return RET_FILE_ERROR;
+    }
 
-    return RET_OK;
+    result_t r = json_write(j, json_flush_std, f, trim ? JSON_WRITE_TRIM : JSON_WRITE_FORMAT);
+    fclose(f);
+    if (r == RET_FILE_ERROR)
+        err_printf(__FILE__, __LINE__, "JSON write error: writing to file '%s' failed", filepath);
+    return r;
 }
 
-static void json_destroy_buffs()
+result_t json_savetofilef(json_t j, file_t f, int trim)
 {
-    for (uint i = 0; i < JSON_ALLOC_CNT; i++)   {
-        mem_pool_destroy(&g_json->buffs[i]);
-        mt_mutex_init(&g_json->buff_mtx[i]);
+    ASSERT(g_json);
+    ASSERT(fio_isopen(f));
+
+    result_t r = json_write(j, json_flush_file, f, trim ? JSON_WRITE_TRIM : JSON_WRITE_FORMAT);
+    if (r == RET_FILE_ERROR)    {
+        err_printf(__FILE__, __LINE__, "JSON write error: writing to file '%s' failed",
+            fio_getpath(f));
     }
+    return r;
 }
 
-result_t json_init()
+/* memory output is written straight into the growing result, freed by json_deletebuffer */
+static char* json_writebuffer(json_t j, size_t* outsize, int mode)
 {
-    if (g_json != NULL)
-        return RET_FAIL;
-    g_json = (struct json_mgr*)ALLOC(sizeof(struct json_mgr), 0);
-    if (g_json == NULL)
-        return RET_OUTOFMEMORY;
+    struct json_writer w;
+    memset(&w, 0x00, sizeof(w));
+    uint8* block = (uint8*)ALLOC(JSON_WRITER_BUFFER_SIZE + sizeof(uint), 0);
+    if (block == NULL)
+        return NULL;
+    json_alloc_putsize(block, JSON_WRITER_BUFFER_SIZE + sizeof(uint));
+    w.buf = (char*)block + sizeof(uint);
+    w.size = JSON_WRITER_BUFFER_SIZE;
+    w.flush_fn = json_flush_grow;
 
-    memset(g_json, 0x00, sizeof(struct json_mgr));
+    if (mode == JSON_WRITE_BIN) {
+        json_binwriter_value(&w, j);
+    }   else    {
+        json_writer_value(&w, j, 0, mode == JSON_WRITE_FORMAT);
+        json_writer_putc(&w, 0);
+    }
+    if (w.failed)   {
+        FREE(w.buf - sizeof(uint));
+        return NULL;
+    }
 
-    if (IS_FAIL(json_create_buffs()))
-        return RET_OUTOFMEMORY;
+    if (outsize)
+        *outsize = (mode == JSON_WRITE_BIN) ? w.pos : w.pos - 1;
+    return w.buf;
+}
 
-    cJSON_Hooks hooks;
-    hooks.malloc_fn = json_malloc;
-    hooks.free_fn = json_free;
-    cJSON_InitHooks(&hooks);
+char* json_savetobuffer(json_t j, size_t* outsize, int trim)
+{
+    ASSERT(g_json);
 
-    return RET_OK;
+    return json_writebuffer(j, outsize, trim ? JSON_WRITE_TRIM : JSON_WRITE_FORMAT);
 }
 
-void json_release()
+void json_deletebuffer(char* buffer)
 {
-    if (g_json != NULL) {
-        json_destroy_buffs();
-        cJSON_InitHooks(NULL);
+    ASSERT(g_json);
 
-        FREE(g_json);
-        g_json = NULL;
+    json_free(buffer);
+}
+
+/*************************************************************************************************
+ * binary reader
+ * reads MessagePack data in place (memory and memory-mapped files are not copied). first pass
+ * validates the data and sums up node and string sizes, second pass builds the tree into an arena
+ * document of exactly that size. strings are copied into the arena to be zero-terminated
+ */
+INLINE uint64 json_bin_getbe(const uint8* s, uint size)
+{
+    uint64 v = 0;
+    for (uint i = 0; i < size; i++)
+        v = (v << 8) | s[i];
+    return v;
+}
+
+/**
+ * decodes header of the value at 's', moves 's' to the payload
+ * @param pcnt string length, array item count or map member count, TRUE/FALSE for bools
+ * @return json_type of the value, 0 if data is invalid or not supported (bin/ext types)
+ */
+static int json_bin_head(const uint8** ps, const uint8* end, uint64* pcnt, fl64* pn)
+{
+    const uint8* s = *ps;
+    if (s >= end)
+        return 0;
+    uint8 c = *s++;
+    int type;
+    uint size = 0;
+
+    if (c <= 0x7f)  {
+        *ps = s;
+        *pn = (fl64)c;
+        return JSON_NUM;
+    }   else if (c >= 0xe0)  {
+        *ps = s;
+        *pn = (fl64)((int)c - 256);
+        return JSON_NUM;
+    }   else if (c <= 0x8f) {
+        *ps = s;
+        *pcnt = c & 0x0f;
+        return JSON_OBJECT;
+    }   else if (c <= 0x9f) {
+        *ps = s;
+        *pcnt = c & 0x0f;
+        return JSON_ARRAY;
+    }   else if (c <= 0xbf) {
+        *ps = s;
+        *pcnt = c & 0x1f;
+        return JSON_STRING;
+    }
+
+    switch (c)  {
+    case 0xc0:
+        *ps = s;
+        return JSON_NULL;
+    case 0xc2:
+    case 0xc3:
+        *ps = s;
+        *pcnt = c - 0xc2;
+        return JSON_BOOL;
+    case 0xca:  type = JSON_NUM;    size = 4;   break;
+    case 0xcb:  type = JSON_NUM;    size = 8;   break;
+    case 0xcc:  type = JSON_NUM;    size = 1;   break;
+    case 0xcd:  type = JSON_NUM;    size = 2;   break;
+    case 0xce:  type = JSON_NUM;    size = 4;   break;
+    case 0xcf:  type = JSON_NUM;    size = 8;   break;
+    case 0xd0:  type = JSON_NUM;    size = 1;   break;
+    case 0xd1:  type = JSON_NUM;    size = 2;   break;
+    case 0xd2:  type = JSON_NUM;    size = 4;   break;
+    case 0xd3:  type = JSON_NUM;    size = 8;   break;
+    case 0xd9:  type = JSON_STRING; size = 1;   break;
+    case 0xda:  type = JSON_STRING; size = 2;   break;
+    case 0xdb:  type = JSON_STRING; size = 4;   break;
+    case 0xdc:  type = JSON_ARRAY;  size = 2;   break;
+    case 0xdd:  type = JSON_ARRAY;  size = 4;   break;
+    case 0xde:  type = JSON_OBJECT; size = 2;   break;
+    case 0xdf:  type = JSON_OBJECT; size = 4;   break;
+    default:    return 0;
+    }
+
+    if ((size_t)(end - s) < size)
+        return 0;
+    uint64 v = json_bin_getbe(s, size);
+    *ps = s + size;
+
+    if (type != JSON_NUM)   {
+        *pcnt = v;
+        return type;
+    }
+
+    if (c == 0xca)  {
+        uint fbits = (uint)v;
+        float f;
+        memcpy(&f, &fbits, sizeof(f));
+        *pn = (fl64)f;
+    }   else if (c == 0xcb) {
+        memcpy(pn, &v, sizeof(fl64));
+    }   else if (c <= 0xcf) {
+        *pn = (fl64)v;
+    }   else    {
+        /* sign extend */
+        uint shift = 64 - size*8;
+        *pn = (fl64)((int64)(v << shift) >> shift);
     }
+    return type;
 }
 
-json_t json_parsefile(const char* filepath)
+/* validates the value at 's' and adds it's arena size to 'psize' (not including it's own node) */
+static const uint8* json_binparser_scan(struct json_parser* p, const uint8* s, size_t* psize)
 {
-    ASSERT(g_json);
-    
-    char* buff = util_readtextfile(filepath, mem_heap());
-    if (buff == NULL)   {
-        err_printf(__FILE__, __LINE__, "JSON parse failed: could not open file '%s'", filepath);
+    const uint8* end = (const uint8*)p->end;
+    const size_t item_sz = (sizeof(cJSON) + 7) & ~((size_t)7);
+    uint64 cnt = 0;
+    fl64 n;
+    const uint8* v = s;
+    int type = json_bin_head(&v, end, &cnt, &n);
+
+    switch (type)   {
+    case 0:
+        p->err = (const char*)s;
         return NULL;
+
+    case JSON_STRING:
+        if (cnt > (uint64)(end - v))    {
+            p->err = (const char*)s;
+            return NULL;
+        }
+        *psize += ((size_t)cnt + 8) & ~((size_t)7);
+        return v + cnt;
+
+    case JSON_ARRAY:
+    case JSON_OBJECT:
+    {
+        /* every item takes at least a byte, so bogus counts are caught before the walk */
+        if (++p->depth > JSON_DEPTH_MAX || cnt > (uint64)(end - v))   {
+            p->err = (const char*)s;
+            return NULL;
+        }
+        *psize += (size_t)cnt*item_sz;
+
+        for (uint64 i = 0; i < cnt; i++)    {
+            if (type == JSON_OBJECT)    {
+                /* member names must be strings */
+                const uint8* k = v;
+                uint64 klen;
+                if (json_bin_head(&k, end, &klen, &n) != JSON_STRING || klen > (uint64)(end - k)) {
+                    p->err = (const char*)v;
+                    return NULL;
+                }
+                *psize += ((size_t)klen + 8) & ~((size_t)7);
+                v = k + klen;
+            }
+            v = json_binparser_scan(p, v, psize);
+            if (v == NULL)
+                return NULL;
+        }
+        p->depth--;
+        return v;
     }
 
-    json_t jroot = json_parsestring(buff);
-    FREE(buff);
+    default:
+        return v;
+    }
+}
 
-    return jroot;
+static char* json_binparser_str(struct json_parser* p, const uint8* s, size_t len)
+{
+    char* str = (char*)json_parser_alloc(p, len + 1);
+    memcpy(str, s, len);
+    str[len] = 0;
+    return str;
 }
 
-json_t json_parsefilef(file_t f, struct allocator* tmp_alloc)
+/* builds the value at 's' into 'item', data is already validated by json_binparser_scan */
+static const uint8* json_binparser_value(struct json_parser* p, cJSON* item, const uint8* s)
 {
-    ASSERT(g_json);
+    const uint8* end = (const uint8*)p->end;
+    uint64 cnt = 0;
+    fl64 n = 0.0;
+    int type = json_bin_head(&s, end, &cnt, &n);
+
+    switch (type)   {
+    case JSON_NULL:
+        item->type |= cJSON_NULL;
+        return s;
+
+    case JSON_BOOL:
+        item->type |= cnt ? cJSON_True : cJSON_False;
+        item->valueint = (int)cnt;
+        return s;
+
+    case JSON_NUM:
+        item->type |= cJSON_Number;
+        item->valuedouble = n;
+        item->valueint = json_numtoint(n);
+        return s;
+
+    case JSON_STRING:
+        item->type |= cJSON_String;
+        item->valuestring = json_binparser_str(p, s, (size_t)cnt);
+        return s + cnt;
+
+    case JSON_ARRAY:
+    case JSON_OBJECT:
+    {
+        item->type |= (type == JSON_OBJECT) ? cJSON_Object : cJSON_Array;
+        json_setdoc(item, p->doc);
+
+        cJSON* prev = NULL;
+        for (uint64 i = 0; i < cnt; i++)    {
+            cJSON* child = json_parser_newitem(p);
+            if (prev != NULL)   {
+                prev->next = child;
+                child->prev = prev;
+            }   else    {
+                item->child = child;
+            }
+            prev = child;
+
+            if (type == JSON_OBJECT)    {
+                uint64 klen = 0;
+                json_bin_head(&s, end, &klen, &n);
+                child->string = json_binparser_str(p, s, (size_t)klen);
+                s += klen;
+            }
+            s = json_binparser_value(p, child, s);
+        }
+        return s;
+    }
 
-    /* read file and put it's data into a buffer */
-    size_t size = fio_getsize(f);
-    if (size == 0)         {
-        err_printf(__FILE__, __LINE__, "JSON load failed: zero size file '%s'", fio_getpath(f));
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * parses MessagePack data into an arena document, data must contain exactly one value
+ * @param perr receives error position in the data, NULL if we are out of memory
+ */
+static json_t json_parse_binarena(const void* data, size_t size, const char** perr)
+{
+    struct json_parser p;
+    memset(&p, 0x00, sizeof(p));
+    p.text = (const char*)data;
+    p.end = p.text + size;
+    *perr = NULL;
+
+    size_t arena_sz = 8;
+    const uint8* e = json_binparser_scan(&p, (const uint8*)data, &arena_sz);
+    if (e != (const uint8*)p.end)   {
+        /* invalid or trailing data */
+        *perr = (e == NULL) ? p.err : (const char*)e;
         return NULL;
     }
 
-    char* buffer = (char*)A_ALLOC(tmp_alloc, size+1, 0);
+    struct json_doc* doc = (struct json_doc*)A_ALIGNED_ALLOC(mem_heap(), sizeof(struct json_doc), 0);
+    if (doc == NULL)
+        return NULL;
+    memset(doc, 0x00, sizeof(struct json_doc));
+    doc->alloc = mem_heap();
+    if (IS_FAIL(mem_stack_create(mem_heap(), &doc->arena, arena_sz, 0)))   {
+        A_ALIGNED_FREE(mem_heap(), doc);
+        return NULL;
+    }
+
+    p.doc = doc;
+    p.depth = 0;
+    doc->root.type = cJSON_IsArena | cJSON_IsArenaRoot;
+    json_binparser_value(&p, &doc->root, (const uint8*)data);
+    return &doc->root;
+}
+
+static void json_parsebin_err(const char* name, const void* data, const char* err)
+{
+    if (err != NULL)    {
+        err_printf(__FILE__, __LINE__, "JSON binary parse '%s' failed: invalid data at offset %u",
+            name, (uint)(err - (const char*)data));
+    }   else    {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+    }
+}
+
+json_t json_parsebin(const void* data, size_t size)
+{
+    ASSERT(g_json);
+
+    const char* err;
+    json_t j = json_parse_binarena(data, size, &err);
+    if (j == NULL)
+        json_parsebin_err("", data, err);
+    return j;
+}
+
+json_t json_parsebinf(file_t f, struct allocator* tmp_alloc)
+{
+    ASSERT(g_json);
+
+    json_t j;
+    const char* err;
+    size_t size;
+    const void* data = fio_peek(f, &size);
+    if (data != NULL)   {
+        /* memory and mapped files (pak items, fio_openmap) are parsed in place */
+        j = json_parse_binarena(data, size, &err);
+        if (j == NULL)
+            json_parsebin_err(fio_getpath(f), data, err);
+        fio_advance(f, size);
+        return j;
+    }
+
+    size = fio_getsize(f) - fio_getpos(f);
+    void* buffer = A_ALLOC(tmp_alloc, size + 1, 0);
     if (buffer == NULL)    {
         err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
         return NULL;
     }
 
-    fio_read(f, buffer, size, 1);
-    buffer[size] = 0;
-    json_t j = json_parsestring(buffer);
-    A_FREE(tmp_alloc, buffer);
-
-    if (j == NULL) {
-        err_printf(__FILE__, __LINE__, "JSON parse '%s' failed: '%s'", fio_getpath(f),
-            cJSON_GetErrorPtr());
+    if (fio_read(f, buffer, 1, size) != size)   {
+        err_printf(__FILE__, __LINE__, "JSON binary load failed: could not read file '%s'",
+            fio_getpath(f));
+        A_FREE(tmp_alloc, buffer);
         return NULL;
     }
+    j = json_parse_binarena(buffer, size, &err);
+    if (j == NULL)
+        json_parsebin_err(fio_getpath(f), buffer, err);
+    A_FREE(tmp_alloc, buffer);
     return j;
 }
 
-json_t json_parsestring(const char* str)
+json_t json_parsebinfile(const char* filepath)
 {
     ASSERT(g_json);
 
-    json_t j = cJSON_Parse(str);
-    if (j == NULL)     {
-        err_printf(__FILE__, __LINE__, "JSON parse failed: %s", cJSON_GetErrorPtr());
+    file_t f = fio_openmap(filepath, TRUE);
+    if (f == NULL)  {
+        err_printf(__FILE__, __LINE__, "JSON binary load failed: could not open file '%s'",
+            filepath);
         return NULL;
     }
 
+    json_t j = json_parsebinf(f, mem_heap());
+    fio_close(f);
     return j;
 }
 
-result_t json_savetofile(json_t j, const char* filepath, int trim)
+result_t json_savetobinf(json_t j, file_t f)
+{
+    ASSERT(g_json);
+    ASSERT(fio_isopen(f));
+
+    result_t r = json_write(j, json_flush_file, f, JSON_WRITE_BIN);
+    if (r == RET_FILE_ERROR)    {
+        err_printf(__FILE__, __LINE__, "JSON write error: writing to file '%s' failed",
+            fio_getpath(f));
+    }
+    return r;
+}
+
+result_t json_savetobinfile(json_t j, const char* filepath)
 {
     ASSERT(g_json);
 
-    /* open file for writing */
     FILE* f = fopen(filepath, "wb");
     if (f == NULL)    {
         err_printf(__FILE__, __LINE__, "JSON write error: could not open file '%s' for writing.",
@@ -237,51 +2385,44 @@ result_t json_savetofile(json_t j, const char* filepath, int trim)
         return RET_FILE_ERROR;
     }
 
-    char* buffer = trim ? cJSON_PrintUnformatted(j) : cJSON_Print(j);
-    if (buffer == NULL) {
-        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
-        return RET_OUTOFMEMORY;
-    }
-
-    fwrite(buffer, 1, strlen(buffer) + 1, f);
-    json_free(buffer);
-    return RET_OK;
+    result_t r = json_write(j, json_flush_std, f, JSON_WRITE_BIN);
+    fclose(f);
+    if (r == RET_FILE_ERROR)
+        err_printf(__FILE__, __LINE__, "JSON write error: writing to file '%s' failed", filepath);
+    return r;
 }
 
-result_t json_savetofilef(json_t j, file_t f, int trim)
+char* json_savetobinbuffer(json_t j, size_t* outsize)
 {
     ASSERT(g_json);
-    ASSERT(fio_isopen(f));
-
-    char* buffer = trim ? cJSON_PrintUnformatted(j) : cJSON_Print(j);
-    if (buffer == NULL) {
-        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
-        return RET_OUTOFMEMORY;
-    }
 
-    fio_write(f, buffer, 1, strlen(buffer)+1);
-    json_free(buffer);
-    return RET_OK;
+    return json_writebuffer(j, outsize, JSON_WRITE_BIN);
 }
 
-char* json_savetobuffer(json_t j, size_t* outsize, int trim)
+result_t json_convert_tobin(const char* json_filepath, const char* bin_filepath)
 {
     ASSERT(g_json);
 
-    char* buffer = trim ? cJSON_PrintUnformatted(j) : cJSON_Print(j);
-    if (buffer == NULL)
-        return NULL;
+    json_t j = json_parsefile(json_filepath);
+    if (j == NULL)
+        return RET_FAIL;
 
-    if (outsize)
-        *outsize = strlen(buffer);
-    return buffer;
+    result_t r = json_savetobinfile(j, bin_filepath);
+    json_destroy(j);
+    return r;
 }
 
-void json_deletebuffer(char* buffer)
+result_t json_convert_totext(const char* bin_filepath, const char* json_filepath, int trim)
 {
     ASSERT(g_json);
 
-    json_free(buffer);
+    json_t j = json_parsebinfile(bin_filepath);
+    if (j == NULL)
+        return RET_FAIL;
+
+    result_t r = json_savetofile(j, json_filepath, trim);
+    json_destroy(j);
+    return r;
 }
 
 void json_destroy(json_t j)
@@ -289,7 +2430,10 @@ void json_destroy(json_t j)
     ASSERT(g_json);
 
     ASSERT(j != NULL);
-    cJSON_Delete(j);
+    if (j->type & cJSON_IsArenaRoot)
+        json_destroy_doc((struct json_doc*)j);
+    else
+        cJSON_Delete(j);
 }
 
 void json_seti(json_t j, int n)
@@ -374,7 +2518,7 @@ int json_getb(json_t j)
 
 enum json_type json_gettype(json_t j)
 {
-    int t = (j)->type;
+    int t = (j)->type & 0xff;
     if (t == 0)
         return JSON_BOOL;
     return (enum json_type)t;
@@ -392,7 +2536,12 @@ json_t json_getarr_item(json_t j, int idx)
 
 json_t json_getitem(json_t j, const char* name)
 {
-    return cJSON_GetObjectItem(j, name);
+    return json_findmember(j, name, FALSE);
+}
+
+json_t json_getitem_nocase(json_t j, const char* name)
+{
+    return json_findmember(j, name, TRUE);
 }
 
 json_t json_create_null()
@@ -442,12 +2591,35 @@ json_t json_create_arrs(const char** strs, int count)
 
 void json_additem_toarr(json_t arr, json_t item)
 {
+    json_markheap(arr);
+    json_keys_drop(arr);
     cJSON_AddItemToArray(arr, item);
 }
 
 void json_additem_toobj(json_t obj, const char* name, json_t item)
 {
-    cJSON_AddItemToObject(obj, name, item);
+    json_markheap(obj);
+
+    struct json_keys* keys = (struct json_keys*)obj->index;
+    if (keys == NULL)   {
+        cJSON_AddItemToObject(obj, name, item);
+        return;
+    }
+
+    /* indexed objects append after the tail */
+    json_setname(item, name);
+    item->next = NULL;
+    item->prev = keys->tail;
+    if (keys->tail != NULL)
+        keys->tail->next = item;
+    else
+        obj->child = item;
+    keys->tail = item;
+
+    if ((keys->cnt + 1)*2 > keys->mask + 1)
+        json_keys_drop(obj);
+    else
+        json_keys_insert(keys, item);
 }
 
 void json_additem_toobj_nodup(json_t obj, const char* name, json_t item)
@@ -460,10 +2632,43 @@ void json_additem_toobj_nodup(json_t obj, const char* name, json_t item)
 
 void json_replaceitem_inobj(json_t obj, const char* name, json_t item)
 {
-    cJSON_ReplaceItemInObject(obj, name, item);
+    json_markheap(obj);
+
+    json_t old = json_findmember(obj, name, FALSE);
+    if (old == NULL)
+        return;
+
+    json_setname(item, name);
+    item->next = old->next;
+    item->prev = old->prev;
+    if (item->next != NULL)
+        item->next->prev = item;
+    if (obj->child == old)
+        obj->child = item;
+    else
+        item->prev->next = item;
+    old->next = old->prev = NULL;
+
+    /* same name, so the item takes over the slot of the old one */
+    struct json_keys* keys = (struct json_keys*)obj->index;
+    if (keys != NULL)   {
+        uint h = json_keyhash(name);
+        for (uint i = h & keys->mask; keys->slots[i].item != NULL; i = (i + 1) & keys->mask)  {
+            if (keys->slots[i].item == old) {
+                keys->slots[i].item = item;
+                break;
+            }
+        }
+        if (keys->tail == old)
+            keys->tail = item;
+    }
+
+    cJSON_Delete(old);
 }
 
 void json_replaceitem_inarr(json_t obj, int idx, json_t item)
 {
+    json_markheap(obj);
+    json_keys_drop(obj);
     cJSON_ReplaceItemInArray(obj, idx, item);
 }
@@ -26,17 +26,57 @@
 #include "dhcore/mt.h"
 #include "dhcore/util.h"
 #include "dhcore/str.h"
+#include "dhcore/numeric.h"
 
 #define LINE_COUNT_FLUSH    20
+#define LOG_TEXT_MAX    2048
+#define LOG_ASYNC_SLEEP 5   /* writer thread's sleep (ms) when all rings are empty */
+#define LOG_RECORD_HDR  sizeof(uint)  /* (type << 24) | text size (with null-terminator) */
+#define LOG_RECORD_WRAP 0xffffff  /* record header: rest of the ring is empty, continue from start */
+#define LOG_RECORD_SIZE(len)    ((LOG_RECORD_HDR + (len) + 3) & ~3u)
+
+/* full barrier atomic read, ring indexes are only written by one side (see log_ring) */
+#define LOG_ATOMIC_LOAD(v)  MT_ATOMIC_CAS((v), 0, 0)
 
 /* fwd declarations */
 static void log_outputtext(enum log_type type, const char* text);
 
 /* types */
+
+/* single-producer/single-consumer ring, each logging thread has one, and only writer thread reads
+ * them. indexes are free-running and are masked with (size-1) for buffer positions */
+struct log_ring
+{
+    struct log_ring* next;
+    long volatile head; /* written by owner thread */
+    long volatile tail; /* written by writer thread */
+    long volatile orphan;   /* set when owner thread exits, writer thread frees it after draining */
+    uint size;  /* power of two */
+    uint8* buff;
+};
+
+struct log_async
+{
+    mt_thread t;
+    struct log_ring* volatile rings;    /* lock-free list, producers add their rings on first log */
+    uint ring_size;
+    enum log_overflow overflow;
+    uint gen;   /* rings of threads with older generation are freed */
+    long volatile draining; /* lock of rings' read side, writer thread vs. crash flush */
+    long volatile passes;   /* finished drain passes of writer thread */
+    int has_key;    /* thread-exit notification of rings is available */
+#if defined(_WIN_)
+    DWORD key;  /* fiber local storage: owner ring, callback orphans it on thread exit */
+#elif defined(_POSIXLIB_)
+    pthread_key_t key;  /* owner ring, destructor orphans it on thread exit */
+#endif
+};
+
 struct log_mgr
 {
     struct log_stats stats;
     uint outputs;
+    struct log_async* volatile async;
     char log_filepath[DH_PATH_MAX];
     FILE* log_file;
     pfn_log_handler log_fn;
@@ -58,6 +98,270 @@ enum output_mode
 
 /* globals */
 static struct log_mgr* g_log = NULL;
+static uint g_log_gen = 0;
+static THREAD_LOCAL struct log_ring* g_log_ring = NULL;
+static THREAD_LOCAL uint g_log_ringgen = 0;
+static THREAD_LOCAL int g_log_iswriter = FALSE;
+
+/*************************************************************************************************/
+/* returns buffer for a record of 'size' bytes, *skip is set to the bytes that are left empty at the
+ * end of the ring, so the record is contiguous */
+static uint8* log_ring_reserve(struct log_ring* ring, uint size, OUT uint* skip)
+{
+    uint head = (uint)ring->head;
+    uint tail = (uint)LOG_ATOMIC_LOAD(ring->tail);
+    uint free_sz = ring->size - (head - tail);
+    uint pos = head & (ring->size - 1);
+    uint contig = ring->size - pos;
+
+    *skip = (size <= contig) ? 0 : contig;
+    if (*skip + size > free_sz)
+        return NULL;
+    return (*skip == 0) ? (ring->buff + pos) : ring->buff;
+}
+
+static void log_ring_commit(struct log_ring* ring, uint skip, uint size)
+{
+    long cur = ring->head;
+    uint head = (uint)cur;
+    if (skip > 0)
+        *(uint*)(ring->buff + (head & (ring->size - 1))) = LOG_RECORD_WRAP;
+
+    /* CAS is a full barrier, so record is visible before the new head */
+    MT_ATOMIC_CAS(ring->head, cur, (long)(head + skip + size));
+}
+
+/* writes all records of the ring to outputs */
+static int log_ring_drain(struct log_ring* ring)
+{
+    long cur = ring->tail;
+    uint tail = (uint)cur;
+    uint head = (uint)LOG_ATOMIC_LOAD(ring->head);
+    int cnt = 0;
+
+    while (tail != head)    {
+        uint pos = tail & (ring->size - 1);
+        uint hdr = *(const uint*)(ring->buff + pos);
+        uint len = hdr & 0xffffff;
+        if (len == LOG_RECORD_WRAP) {
+            tail += ring->size - pos;
+        }   else    {
+            log_outputtext((enum log_type)(hdr >> 24), (const char*)ring->buff + pos + LOG_RECORD_HDR);
+            tail += LOG_RECORD_SIZE(len);
+            cnt++;
+        }
+
+        /* give space back to producer after each record */
+        MT_ATOMIC_CAS(ring->tail, cur, (long)tail);
+        cur = (long)tail;
+    }
+    return cnt;
+}
+
+/* called on the exiting thread, writer thread frees the ring after writing what's left in it */
+#if defined(_WIN_)
+static void WINAPI log_ring_orphan(void* param)
+#else
+static void log_ring_orphan(void* param)
+#endif
+{
+    struct log_ring* ring = (struct log_ring*)param;
+    if (ring == NULL)
+        return;
+    if (g_log_ring == ring)
+        g_log_ring = NULL;
+    MT_ATOMIC_SET(ring->orphan, 1);
+}
+
+static void log_async_createkey(struct log_async* a)
+{
+#if defined(_WIN_)
+    a->key = FlsAlloc(log_ring_orphan);
+    a->has_key = a->key != FLS_OUT_OF_INDEXES;
+#elif defined(_POSIXLIB_)
+    a->has_key = pthread_key_create(&a->key, log_ring_orphan) == 0;
+#endif
+}
+
+/* FlsFree calls the callback for rings of live threads too, so it's done before rings are freed */
+static void log_async_destroykey(struct log_async* a)
+{
+    if (!a->has_key)
+        return;
+#if defined(_WIN_)
+    FlsFree(a->key);
+#elif defined(_POSIXLIB_)
+    pthread_key_delete(a->key);
+#endif
+}
+
+static void log_async_setkey(struct log_async* a, struct log_ring* ring)
+{
+    if (!a->has_key)
+        return;
+#if defined(_WIN_)
+    FlsSetValue(a->key, ring);
+#elif defined(_POSIXLIB_)
+    pthread_setspecific(a->key, ring);
+#endif
+}
+
+static struct log_ring* log_async_getring(struct log_async* a)
+{
+    if (g_log_ring != NULL && g_log_ringgen == a->gen)
+        return g_log_ring;
+
+    struct log_ring* ring = (struct log_ring*)ALLOC(sizeof(struct log_ring) + a->ring_size, 0);
+    if (ring == NULL)
+        return NULL;
+    memset(ring, 0x00, sizeof(struct log_ring));
+    ring->size = a->ring_size;
+    ring->buff = (uint8*)(ring + 1);
+
+    struct log_ring* next;
+    do  {
+        next = a->rings;
+        ring->next = next;
+    }   while (MT_ATOMIC_CASTPTR(a->rings, next, ring) != next);
+
+    g_log_ring = ring;
+    g_log_ringgen = a->gen;
+    log_async_setkey(a, ring);
+    return ring;
+}
+
+/* reserves ring space for a record, applies overflow policy if ring is full */
+static uint8* log_async_reserve(struct log_async* a, struct log_ring* ring, uint size,
+    OUT uint* skip)
+{
+    uint8* buff;
+    while ((buff = log_ring_reserve(ring, size, skip)) == NULL)  {
+        if (a->overflow == LOG_OVERFLOW_DROP)   {
+            MT_ATOMIC_INCR(g_log->stats.dropped_cnt);
+            return NULL;
+        }
+        util_sleep(1);
+    }
+    return buff;
+}
+
+static void log_async_push(struct log_async* a, enum log_type type, const char* text)
+{
+    struct log_ring* ring = log_async_getring(a);
+    if (ring == NULL)
+        return;
+
+    uint len = minui((uint)strlen(text), LOG_TEXT_MAX - 1) + 1;
+    uint size = LOG_RECORD_SIZE(len);
+    uint skip;
+    uint8* buff = log_async_reserve(a, ring, size, &skip);
+    if (buff == NULL)
+        return;
+
+    *(uint*)buff = ((uint)type << 24) | len;
+    memcpy(buff + LOG_RECORD_HDR, text, len - 1);
+    buff[LOG_RECORD_HDR + len - 1] = 0;
+    log_ring_commit(ring, skip, size);
+}
+
+/* formats message directly into the ring if there is enough contiguous space for the largest
+ * message, returns FALSE if message is not pushed */
+static int log_async_pushf(struct log_async* a, enum log_type type, const char* fmt, va_list args)
+{
+    struct log_ring* ring = log_async_getring(a);
+    if (ring == NULL)
+        return FALSE;
+
+    uint skip;
+    uint8* buff = log_ring_reserve(ring, LOG_RECORD_SIZE(LOG_TEXT_MAX), &skip);
+    if (buff == NULL)
+        return FALSE;
+
+    int r = vsnprintf((char*)buff + LOG_RECORD_HDR, LOG_TEXT_MAX, fmt, args);
+    uint len = (uint)clampi(r, 0, LOG_TEXT_MAX - 1) + 1;
+    buff[LOG_RECORD_HDR + len - 1] = 0;
+    *(uint*)buff = ((uint)type << 24) | len;
+    log_ring_commit(ring, skip, LOG_RECORD_SIZE(len));
+    return TRUE;
+}
+
+static int log_async_drain(struct log_async* a)
+{
+    if (MT_ATOMIC_CAS(a->draining, 0, 1) != 0)
+        return 0;
+
+    /* producers only push new rings to the head of the list, so orphans after the head can be
+     * unlinked directly, the head itself is unlinked only if no ring is pushed meanwhile */
+    int cnt = 0;
+    struct log_ring* prev = NULL;
+    struct log_ring* ring = a->rings;
+    while (ring != NULL)    {
+        struct log_ring* next = ring->next;
+        /* owner has committed all of it's records before it's orphaned */
+        int orphan = (int)LOG_ATOMIC_LOAD(ring->orphan);
+        cnt += log_ring_drain(ring);
+
+        if (orphan) {
+            if (prev != NULL)   {
+                prev->next = next;
+                FREE(ring);
+                ring = next;
+                continue;
+            }   else if (MT_ATOMIC_CASTPTR(a->rings, ring, next) == ring)   {
+                FREE(ring);
+                ring = next;
+                continue;
+            }
+        }
+        prev = ring;
+        ring = next;
+    }
+
+    /* file is flushed once for each batch, instead of each message */
+    if (cnt > 0 && g_log->log_file != NULL)
+        fflush(g_log->log_file);
+
+    MT_ATOMIC_SET(a->draining, 0);
+    return cnt;
+}
+
+static result_t log_async_init(mt_thread thread)
+{
+    g_log_iswriter = TRUE;
+    return RET_OK;
+}
+
+static result_t log_async_kernel(mt_thread thread)
+{
+    struct log_async* a = (struct log_async*)mt_thread_getparam1(thread);
+    int cnt = log_async_drain(a);
+    MT_ATOMIC_INCR(a->passes);
+    if (cnt == 0)
+        util_sleep(LOG_ASYNC_SLEEP);
+    return RET_OK;
+}
+
+static void log_async_destroy(struct log_async* a)
+{
+    log_async_destroykey(a);
+    struct log_ring* ring = a->rings;
+    while (ring != NULL)    {
+        struct log_ring* next = ring->next;
+        FREE(ring);
+        ring = next;
+    }
+    FREE(a);
+}
+
+/* routes message to async rings or writes it directly */
+static void log_dispatch(enum log_type type, const char* text)
+{
+    struct log_async* a = g_log->async;
+    if (a != NULL && !g_log_iswriter)
+        log_async_push(a, type, text);
+    else
+        log_outputtext(type, text);
+}
 
 /*************************************************************************************************/
 result_t log_init()
@@ -75,6 +379,7 @@ result_t log_init()
 void log_release()
 {
     if (g_log != NULL)  {
+        log_setasync(FALSE, 0, LOG_OVERFLOW_DROP);
         if (g_log->log_file != NULL)
             fclose(g_log->log_file);
 
@@ -154,6 +459,86 @@ result_t log_outputfunc(int enable, pfn_log_handler log_fn, void* param)
     return RET_OK;
 }
 
+result_t log_setasync(int enable, uint ring_size, enum log_overflow overflow)
+{
+    struct log_async* a = g_log->async;
+    if (a != NULL)  {
+        /* stop writer thread and write whatever is left on this thread */
+        g_log->async = NULL;
+        mt_thread_destroy(a->t);
+        log_async_drain(a);
+        log_async_destroy(a);
+    }
+
+    if (!enable)
+        return RET_OK;
+
+    a = (struct log_async*)ALLOC(sizeof(struct log_async), 0);
+    if (a == NULL)
+        return RET_OUTOFMEMORY;
+    memset(a, 0x00, sizeof(struct log_async));
+
+    /* ring must hold at least two records of maximum size, one may be skipped at the end */
+    ring_size = (ring_size != 0) ? ring_size : LOG_ASYNC_RING_SIZE;
+    ring_size = maxui(ring_size, 2*LOG_RECORD_SIZE(LOG_TEXT_MAX));
+    a->ring_size = 1;
+    while (a->ring_size < ring_size)
+        a->ring_size <<= 1;
+    a->overflow = overflow;
+    a->gen = ++g_log_gen;
+    log_async_createkey(a);
+
+    a->t = mt_thread_create(log_async_kernel, log_async_init, NULL, MT_THREAD_LOW, 0, 0, a, NULL);
+    if (a->t == NULL)   {
+        log_async_destroykey(a);
+        FREE(a);
+        return RET_FAIL;
+    }
+
+    g_log->async = a;
+    return RET_OK;
+}
+
+int log_isasync()
+{
+    return g_log->async != NULL;
+}
+
+void log_flush()
+{
+    struct log_async* a = g_log->async;
+    if (a != NULL && !g_log_iswriter)    {
+        /* the second pass that finishes after this point, has started after the call, so it has
+         * written everything that is logged before */
+        long passes = a->passes;
+        while (a->passes - passes < 2)
+            util_sleep(1);
+    }
+
+    if (g_log->log_file != NULL)
+        fflush(g_log->log_file);
+}
+
+void log_crashflush()
+{
+    if (g_log == NULL || g_log->async == NULL)
+        return;
+
+    struct log_async* a = g_log->async;
+    g_log->async = NULL;
+
+    /* writer thread may be in the middle of a pass, wait for it a little, but if it's stuck (or it
+     * is the crashing thread itself), records are written anyway */
+    for (int i = 0; i < 100 && MT_ATOMIC_CAS(a->draining, 0, 1) != 0; i++)
+        util_sleep(1);
+
+    for (struct log_ring* ring = a->rings; ring != NULL; ring = ring->next)
+        log_ring_drain(ring);
+    if (g_log->log_file != NULL)
+        fflush(g_log->log_file);
+    fflush(stdout);
+}
+
 int log_isconsole()
 {
     return BIT_CHECK(g_log->outputs, OUTPUT_CONSOLE);
@@ -176,20 +561,31 @@ int log_isoutputfunc()
 
 void log_print(enum log_type type, const char* text)
 {
-    log_outputtext(type, text);
+    log_dispatch(type, text);
 }
 
 void log_printf(enum log_type type, const char* fmt, ...)
 {
-    char text[2048];
+    va_list args;
+
+    /* async: format straight into the ring, without the intermediate buffer */
+    struct log_async* a = g_log->async;
+    if (a != NULL && !g_log_iswriter)   {
+        va_start(args, fmt);
+        int pushed = log_async_pushf(a, type, fmt, args);
+        va_end(args);
+        if (pushed)
+            return;
+    }
+
+    char text[LOG_TEXT_MAX];
     text[0] = 0;
 
-    va_list args;
     va_start(args, fmt);
     vsnprintf(text, sizeof(text), fmt, args);
     va_end(args);
 
-    log_outputtext(type, text);
+    log_dispatch(type, text);
 }
 
 void log_getstats(struct log_stats* stats)
@@ -216,14 +612,14 @@ void log_endprogress(enum log_progress_result res)
         text = "";
         break;
     }
-    log_outputtext(LOG_PROGRESS_RESULT, text);
+    log_dispatch(LOG_PROGRESS_RESULT, text);
 #endif
 }
 
 static void log_outputtext(enum log_type type, const char* text)
 {
     const char* prefix;
-    char msg[2048];
+    char msg[LOG_TEXT_MAX];
 
     switch (type)   {
         case LOG_ERROR:
@@ -319,7 +715,9 @@ static void log_outputtext(enum log_type type, const char* text)
 
     if (BIT_CHECK(g_log->outputs, OUTPUT_FILE))  {
         fputs(msg, g_log->log_file);
-        fflush(g_log->log_file);
+        /* writer thread flushes once for each batch */
+        if (!g_log_iswriter)
+            fflush(g_log->log_file);
     }
 
 #if defined(_MSVC_) && defined(_DEBUG_)
@@ -0,0 +1,577 @@
+/***********************************************************************************
+ * Copyright (c) 2014, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#if defined(_WIN_)
+#include "dhcore/win.h"
+#endif
+
+#include <math.h>
+
+#include "dhcore/net-reactor.h"
+#include "dhcore/core.h"
+#include "dhcore/pool-alloc.h"
+#include "dhcore/hash-table.h"
+#include "dhcore/linked-list.h"
+#include "dhcore/timer.h"
+#include "dhcore/mt.h"
+
+#if defined(_LINUX_)
+  #define SOCK_REACTOR_EPOLL
+#endif
+
+#if defined(SOCK_REACTOR_EPOLL)
+  #include <errno.h>
+  #include <unistd.h>
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+  #ifndef EPOLLEXCLUSIVE
+    #define EPOLLEXCLUSIVE (1u << 28)
+  #endif
+#elif defined(_WIN_)
+  #define poll WSAPoll
+  typedef int socklen_t;
+#else
+  #include <errno.h>
+  #include <poll.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+#endif
+
+#define SOCK_REACTOR_MAX_EVENTS 64
+#define SOCK_REACTOR_BLOCK  32
+
+/* fwd: timer.c, tick frequency is queried here too, reactors don't need the timer manager */
+void timer_queryfreq();
+
+/* types */
+struct sock_reg
+{
+    socket_t sock;
+    uint events;
+    uint flags;
+    pfn_sock_event event_fn;
+    void* param;
+    int removed;
+    struct linked_list node;    /* in 'regs', or in 'dead' if it's removed while dispatching */
+};
+
+struct sock_timer
+{
+    uint id;
+    fl64 interval;  /* seconds */
+    fl64 deadline;
+    int repeat;
+    int removed;
+    pfn_sock_timer timer_fn;
+    void* param;
+    struct linked_list node;
+};
+
+struct sock_reactor
+{
+    struct pool_alloc reg_pool; /* item: sock_reg */
+    struct pool_alloc timer_pool;   /* item: sock_timer */
+    struct hashtable_open reg_tbl;  /* key: socket, value: sock_reg */
+    struct linked_list* regs;
+    struct linked_list* dead;   /* registrations are freed after dispatch */
+    struct linked_list* timers;
+    uint last_timer_id;
+    uint64 start_tick;
+    int dispatching;
+
+#if defined(SOCK_REACTOR_EPOLL)
+    int epfd;
+    int wake_fd;    /* eventfd */
+#else
+    socket_t wake_sock; /* loopback udp socket, wakeups are sent to itself */
+    struct sockaddr_in wake_addr;
+    struct pollfd* pfds;    /* first one is wake_sock */
+    struct sock_reg** pfd_regs;
+    int pfd_cnt;
+    int pfd_max;
+    int pfd_dirty;  /* registrations are changed, poll array is rebuilt on next wait */
+#endif
+};
+
+/*************************************************************************************************/
+INLINE fl64 sock_reactor_now(struct sock_reactor* r)
+{
+    return timer_calctm(r->start_tick, timer_querytick());
+}
+
+static struct sock_reg* sock_reactor_findreg(struct sock_reactor* r, socket_t sock)
+{
+    struct hashtable_item* item = hashtable_open_find(&r->reg_tbl, (uint)sock);
+    return (item != NULL) ? (struct sock_reg*)item->value : NULL;
+}
+
+#if defined(SOCK_REACTOR_EPOLL)
+static result_t sock_reactor_initsys(struct sock_reactor* r)
+{
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->epfd == -1 || r->wake_fd == -1)
+        return RET_FAIL;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    return (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wake_fd, &ev) == 0) ? RET_OK : RET_FAIL;
+}
+
+static void sock_reactor_releasesys(struct sock_reactor* r)
+{
+    if (r->wake_fd != -1)
+        close(r->wake_fd);
+    if (r->epfd != -1)
+        close(r->epfd);
+}
+
+static result_t sock_reactor_ctl(struct sock_reactor* r, struct sock_reg* reg, int op)
+{
+    struct epoll_event ev;
+    ev.events = 0;
+    if (BIT_CHECK(reg->events, SOCK_EVENT_READ))
+        ev.events |= EPOLLIN;
+    if (BIT_CHECK(reg->events, SOCK_EVENT_WRITE))
+        ev.events |= EPOLLOUT;
+    if (BIT_CHECK(reg->flags, SOCK_REACTOR_EDGE))
+        ev.events |= EPOLLET;
+    if (BIT_CHECK(reg->flags, SOCK_REACTOR_EXCLUSIVE) && op == EPOLL_CTL_ADD)
+        ev.events |= EPOLLEXCLUSIVE;
+    ev.data.ptr = reg;
+
+    if (epoll_ctl(r->epfd, op, reg->sock, &ev) == 0)
+        return RET_OK;
+
+    /* kernels before 4.5 don't know about exclusive wakeups */
+    if (op == EPOLL_CTL_ADD && errno == EINVAL && (ev.events & EPOLLEXCLUSIVE))   {
+        ev.events &= ~EPOLLEXCLUSIVE;
+        if (epoll_ctl(r->epfd, op, reg->sock, &ev) == 0)
+            return RET_OK;
+    }
+    return RET_FAIL;
+}
+
+static void sock_reactor_unregister(struct sock_reactor* r, struct sock_reg* reg)
+{
+    struct epoll_event ev;
+    memset(&ev, 0x00, sizeof(ev));
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, reg->sock, &ev);
+}
+
+static int sock_reactor_waitsys(struct sock_reactor* r, int timeout_ms)
+{
+    struct epoll_event events[SOCK_REACTOR_MAX_EVENTS];
+    int cnt = epoll_wait(r->epfd, events, SOCK_REACTOR_MAX_EVENTS, timeout_ms);
+    if (cnt < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    int dispatched = 0;
+    for (int i = 0; i < cnt; i++)   {
+        struct sock_reg* reg = (struct sock_reg*)events[i].data.ptr;
+        if (reg == NULL)    {
+            uint64 v;
+            while (read(r->wake_fd, &v, sizeof(v)) > 0)  {}
+            continue;
+        }
+        if (reg->removed)
+            continue;
+
+        uint e = events[i].events;
+        uint sevents = 0;
+        if (e & EPOLLIN)
+            sevents |= SOCK_EVENT_READ;
+        if (e & EPOLLOUT)
+            sevents |= SOCK_EVENT_WRITE;
+        if (e & (EPOLLERR | EPOLLHUP))
+            sevents |= SOCK_EVENT_ERROR;
+
+        reg->event_fn(reg->sock, sevents, reg->param);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+void sock_reactor_wakeup(struct sock_reactor* r)
+{
+    uint64 v = 1;
+    while (write(r->wake_fd, &v, sizeof(v)) < 0 && errno == EINTR)   {}
+}
+
+#else
+static result_t sock_reactor_initsys(struct sock_reactor* r)
+{
+    r->wake_sock = sock_udp_create();
+    if (r->wake_sock == SOCK_NULL)
+        return RET_FAIL;
+
+    /* bind to a random loopback port and send wakeups to that */
+    socklen_t addr_len = sizeof(r->wake_addr);
+    memset(&r->wake_addr, 0x00, sizeof(r->wake_addr));
+    r->wake_addr.sin_family = AF_INET;
+    r->wake_addr.sin_port = 0;
+    r->wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(r->wake_sock, (struct sockaddr*)&r->wake_addr, sizeof(r->wake_addr)) == SOCK_ERROR ||
+        getsockname(r->wake_sock, (struct sockaddr*)&r->wake_addr, &addr_len) == SOCK_ERROR ||
+        IS_FAIL(sock_setnonblock(r->wake_sock, TRUE)))
+    {
+        return RET_FAIL;
+    }
+
+    r->pfd_dirty = TRUE;
+    return RET_OK;
+}
+
+static void sock_reactor_releasesys(struct sock_reactor* r)
+{
+    if (r->wake_sock != SOCK_NULL)
+        sock_udp_destroy(r->wake_sock);
+    if (r->pfds != NULL)
+        FREE(r->pfds);
+    if (r->pfd_regs != NULL)
+        FREE(r->pfd_regs);
+}
+
+static result_t sock_reactor_ctl(struct sock_reactor* r, struct sock_reg* reg, int op)
+{
+    r->pfd_dirty = TRUE;
+    return RET_OK;
+}
+
+static void sock_reactor_unregister(struct sock_reactor* r, struct sock_reg* reg)
+{
+    r->pfd_dirty = TRUE;
+}
+
+static result_t sock_reactor_buildpfds(struct sock_reactor* r)
+{
+    int cnt = 1;
+    for (struct linked_list* node = r->regs; node != NULL; node = node->next)
+        cnt++;
+
+    if (cnt > r->pfd_max)   {
+        int max = maxi(cnt, r->pfd_max << 1);
+        struct pollfd* pfds = (struct pollfd*)ALLOC(sizeof(struct pollfd)*max, 0);
+        struct sock_reg** pfd_regs = (struct sock_reg**)ALLOC(sizeof(struct sock_reg*)*max, 0);
+        if (pfds == NULL || pfd_regs == NULL)   {
+            if (pfds != NULL)
+                FREE(pfds);
+            if (pfd_regs != NULL)
+                FREE(pfd_regs);
+            return RET_OUTOFMEMORY;
+        }
+        if (r->pfds != NULL)
+            FREE(r->pfds);
+        if (r->pfd_regs != NULL)
+            FREE(r->pfd_regs);
+        r->pfds = pfds;
+        r->pfd_regs = pfd_regs;
+        r->pfd_max = max;
+    }
+
+    r->pfds[0].fd = r->wake_sock;
+    r->pfds[0].events = POLLIN;
+    r->pfd_regs[0] = NULL;
+
+    int i = 1;
+    for (struct linked_list* node = r->regs; node != NULL; node = node->next, i++) {
+        struct sock_reg* reg = (struct sock_reg*)node->data;
+        r->pfds[i].fd = reg->sock;
+        r->pfds[i].events = 0;
+        if (BIT_CHECK(reg->events, SOCK_EVENT_READ))
+            r->pfds[i].events |= POLLIN;
+        if (BIT_CHECK(reg->events, SOCK_EVENT_WRITE))
+            r->pfds[i].events |= POLLOUT;
+        r->pfd_regs[i] = reg;
+    }
+
+    r->pfd_cnt = cnt;
+    r->pfd_dirty = FALSE;
+    return RET_OK;
+}
+
+static int sock_reactor_waitsys(struct sock_reactor* r, int timeout_ms)
+{
+    if (r->pfd_dirty && IS_FAIL(sock_reactor_buildpfds(r)))
+        return -1;
+
+    int cnt = poll(r->pfds, r->pfd_cnt, timeout_ms);
+    if (cnt < 0)    {
+#if !defined(_WIN_)
+        if (errno == EINTR)
+            return 0;
+#endif
+        return -1;
+    }
+
+    int dispatched = 0;
+    for (int i = 0; i < r->pfd_cnt && cnt > 0; i++)    {
+        short e = r->pfds[i].revents;
+        if (e == 0)
+            continue;
+        cnt--;
+
+        struct sock_reg* reg = r->pfd_regs[i];
+        if (reg == NULL)    {
+            char buff[64];
+            while (recv(r->wake_sock, buff, sizeof(buff), 0) > 0)    {}
+            continue;
+        }
+        if (reg->removed)
+            continue;
+
+        uint sevents = 0;
+        if (e & POLLIN)
+            sevents |= SOCK_EVENT_READ;
+        if (e & POLLOUT)
+            sevents |= SOCK_EVENT_WRITE;
+        if (e & (POLLERR | POLLHUP | POLLNVAL))
+            sevents |= SOCK_EVENT_ERROR;
+
+        reg->event_fn(reg->sock, sevents, reg->param);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+void sock_reactor_wakeup(struct sock_reactor* r)
+{
+    char c = 0;
+    sendto(r->wake_sock, &c, 1, 0, (struct sockaddr*)&r->wake_addr, sizeof(r->wake_addr));
+}
+#endif
+
+struct sock_reactor* sock_reactor_create()
+{
+    struct sock_reactor* r = (struct sock_reactor*)ALLOC(sizeof(struct sock_reactor), 0);
+    if (r == NULL)  {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+    memset(r, 0x00, sizeof(struct sock_reactor));
+#if defined(SOCK_REACTOR_EPOLL)
+    r->epfd = -1;
+    r->wake_fd = -1;
+#else
+    r->wake_sock = SOCK_NULL;
+#endif
+    timer_queryfreq();
+    r->start_tick = timer_querytick();
+
+    if (IS_FAIL(mem_pool_create(mem_heap(), &r->reg_pool, sizeof(struct sock_reg),
+            SOCK_REACTOR_BLOCK, 0)) ||
+        IS_FAIL(mem_pool_create(mem_heap(), &r->timer_pool, sizeof(struct sock_timer),
+            SOCK_REACTOR_BLOCK, 0)) ||
+        IS_FAIL(hashtable_open_create(mem_heap(), &r->reg_tbl, SOCK_REACTOR_BLOCK,
+            SOCK_REACTOR_BLOCK, 0)))
+    {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        sock_reactor_destroy(r);
+        return NULL;
+    }
+
+    if (IS_FAIL(sock_reactor_initsys(r)))   {
+        err_print(__FILE__, __LINE__, "reactor: could not create system objects");
+        sock_reactor_destroy(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void sock_reactor_destroy(struct sock_reactor* r)
+{
+    sock_reactor_releasesys(r);
+    hashtable_open_destroy(&r->reg_tbl);
+    mem_pool_destroy(&r->timer_pool);
+    mem_pool_destroy(&r->reg_pool);
+    FREE(r);
+}
+
+result_t sock_reactor_add(struct sock_reactor* r, socket_t sock, uint events, uint flags,
+                          pfn_sock_event event_fn, void* param)
+{
+    ASSERT(event_fn);
+    if (sock_reactor_findreg(r, sock) != NULL)
+        return RET_INVALIDARG;
+
+    struct sock_reg* reg = (struct sock_reg*)mem_pool_alloc(&r->reg_pool);
+    if (reg == NULL)
+        return RET_OUTOFMEMORY;
+    memset(reg, 0x00, sizeof(struct sock_reg));
+    reg->sock = sock;
+    reg->events = events;
+    reg->flags = flags;
+    reg->event_fn = event_fn;
+    reg->param = param;
+
+#if defined(SOCK_REACTOR_EPOLL)
+    if (IS_FAIL(sock_reactor_ctl(r, reg, EPOLL_CTL_ADD)) ||
+#else
+    if (IS_FAIL(sock_reactor_ctl(r, reg, 0)) ||
+#endif
+        IS_FAIL(hashtable_open_add(&r->reg_tbl, (uint)sock, (iptr_t)reg)))
+    {
+        mem_pool_free(&r->reg_pool, reg);
+        return RET_FAIL;
+    }
+
+    list_add(&r->regs, &reg->node, reg);
+    return RET_OK;
+}
+
+result_t sock_reactor_modify(struct sock_reactor* r, socket_t sock, uint events)
+{
+    struct sock_reg* reg = sock_reactor_findreg(r, sock);
+    if (reg == NULL)
+        return RET_INVALIDARG;
+    if (reg->events == events)
+        return RET_OK;
+
+    reg->events = events;
+#if defined(SOCK_REACTOR_EPOLL)
+    return sock_reactor_ctl(r, reg, EPOLL_CTL_MOD);
+#else
+    return sock_reactor_ctl(r, reg, 0);
+#endif
+}
+
+void sock_reactor_remove(struct sock_reactor* r, socket_t sock)
+{
+    struct hashtable_item* item = hashtable_open_find(&r->reg_tbl, (uint)sock);
+    if (item == NULL)
+        return;
+    struct sock_reg* reg = (struct sock_reg*)item->value;
+    hashtable_open_remove(&r->reg_tbl, item);
+
+    sock_reactor_unregister(r, reg);
+    list_remove(&r->regs, &reg->node);
+
+    /* events of this round may still point to the registration */
+    if (r->dispatching) {
+        reg->removed = TRUE;
+        list_add(&r->dead, &reg->node, reg);
+    }   else    {
+        mem_pool_free(&r->reg_pool, reg);
+    }
+}
+
+uint sock_reactor_addtimer(struct sock_reactor* r, uint interval, int repeat,
+                           pfn_sock_timer timer_fn, void* param)
+{
+    ASSERT(timer_fn);
+    struct sock_timer* t = (struct sock_timer*)mem_pool_alloc(&r->timer_pool);
+    if (t == NULL)
+        return 0;
+    memset(t, 0x00, sizeof(struct sock_timer));
+
+    if (++r->last_timer_id == 0)
+        r->last_timer_id = 1;
+    t->id = r->last_timer_id;
+    t->interval = (fl64)interval / 1000.0;
+    t->deadline = sock_reactor_now(r) + t->interval;
+    t->repeat = repeat;
+    t->timer_fn = timer_fn;
+    t->param = param;
+    list_add(&r->timers, &t->node, t);
+    return t->id;
+}
+
+void sock_reactor_removetimer(struct sock_reactor* r, uint timer_id)
+{
+    for (struct linked_list* node = r->timers; node != NULL; node = node->next)    {
+        struct sock_timer* t = (struct sock_timer*)node->data;
+        if (t->id == timer_id && !t->removed)   {
+            if (r->dispatching) {
+                t->removed = TRUE;
+            }   else    {
+                list_remove(&r->timers, &t->node);
+                mem_pool_free(&r->timer_pool, t);
+            }
+            return;
+        }
+    }
+}
+
+/* triggers expired timers, and returns time to the next one (seconds, <0 if there is none) */
+static fl64 sock_reactor_runtimers(struct sock_reactor* r, int* pdispatched)
+{
+    if (r->timers == NULL)
+        return -1.0;
+
+    fl64 now = sock_reactor_now(r);
+    fl64 next = -1.0;
+
+    struct linked_list* node = r->timers;
+    while (node != NULL)    {
+        struct linked_list* next_node = node->next;
+        struct sock_timer* t = (struct sock_timer*)node->data;
+        if (!t->removed && t->deadline <= now)  {
+            t->timer_fn(t->id, t->param);
+            (*pdispatched)++;
+            if (t->repeat)  {
+                /* skip missed intervals instead of triggering them all at once */
+                t->deadline += t->interval;
+                if (t->deadline <= now)
+                    t->deadline = now + t->interval;
+            }   else    {
+                t->removed = TRUE;
+            }
+        }
+
+        if (t->removed) {
+            list_remove(&r->timers, &t->node);
+            mem_pool_free(&r->timer_pool, t);
+        }   else if (next < 0.0 || t->deadline - now < next)    {
+            next = (t->deadline > now) ? (t->deadline - now) : 0.0;
+        }
+        node = next_node;
+    }
+
+    return next;
+}
+
+int sock_reactor_wait(struct sock_reactor* r, uint timeout)
+{
+    int dispatched = 0;
+    r->dispatching = TRUE;
+
+    /* wait until the next timer if it's sooner than timeout */
+    fl64 next_timer = sock_reactor_runtimers(r, &dispatched);
+    int timeout_ms = (timeout == MT_TIMEOUT_INFINITE) ? -1 : (int)minui(timeout, INT32_MAX);
+    if (dispatched > 0) {
+        timeout_ms = 0;
+    }   else if (next_timer >= 0.0)   {
+        int timer_ms = (int)ceil(next_timer*1000.0);
+        if (timeout_ms < 0 || timer_ms < timeout_ms)
+            timeout_ms = timer_ms;
+    }
+
+    int cnt = sock_reactor_waitsys(r, timeout_ms);
+    if (cnt > 0)
+        dispatched += cnt;
+    sock_reactor_runtimers(r, &dispatched);
+
+    r->dispatching = FALSE;
+    while (r->dead != NULL) {
+        struct sock_reg* reg = (struct sock_reg*)r->dead->data;
+        list_remove(&r->dead, &reg->node);
+        mem_pool_free(&r->reg_pool, reg);
+    }
+
+    return (cnt >= 0) ? dispatched : -1;
+}
@@ -13,6 +13,10 @@
  *
  ***********************************************************************************/
 
+#if defined(_LINUX_) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE   /* recvmmsg/sendmmsg */
+#endif
+
 #if defined(_WIN_)
 #include "dhcore/win.h"
 #endif
@@ -20,18 +24,47 @@
 #include "dhcore/net-socket.h"
 #include "dhcore/str.h"
 #include "dhcore/err.h"
+#include "dhcore/numeric.h"
+
+#include <stdio.h>
+#include <errno.h>
 
 #if !defined(_WIN_)
   #include <sys/socket.h>
+  #include <sys/uio.h>
   #include <netinet/in.h>
+  #include <netinet/tcp.h>
   #include <arpa/inet.h>
   #include <unistd.h>
   #include <netdb.h>
+  #include <fcntl.h>
+  #include <poll.h>
   #define closesocket close
 #else
+  #define poll WSAPoll
   typedef int socklen_t;
 #endif
 
+#if defined(_LINUX_) && defined(MSG_WAITFORONE)
+  #define SOCK_UDP_MMSG
+#endif
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0
+#endif
+
+#define SOCK_BUF_CHUNK  16  /* buffers that are passed to each system call in sock_tcp_*all */
+
+/* types */
+#if defined(SOCK_UDP_MMSG)
+/* message data that mmsghdr of each packet points to */
+struct sock_udp_msg
+{
+    struct iovec iov;
+    struct sockaddr_in addr;
+};
+#endif
+
 /* globals */
 static int sock_isinit = FALSE;
 
@@ -174,6 +207,240 @@ int sock_udp_send(socket_t sock, const char* ipaddr, int port, const void* buffe
     return sent_bytes;
 }
 
+void sock_addr_set(struct sock_addr* addr, const char* ipaddr, int port)
+{
+    addr->ip = (uint)inet_addr(ipaddr);
+    addr->port = (uint16)port;
+}
+
+char* sock_addr_getip(const struct sock_addr* addr, char* ipaddr)
+{
+    const uint8* b = (const uint8*)&addr->ip;
+    sprintf(ipaddr, "%d.%d.%d.%d", b[0], b[1], b[2], b[3]);
+    return ipaddr;
+}
+
+INLINE void sock_addr_tosys(const struct sock_addr* addr, struct sockaddr_in* saddr)
+{
+    memset(saddr, 0x00, sizeof(struct sockaddr_in));
+    saddr->sin_family = AF_INET;
+    saddr->sin_port = htons(addr->port);
+    saddr->sin_addr.s_addr = addr->ip;
+}
+
+INLINE void sock_addr_fromsys(struct sock_addr* addr, const struct sockaddr_in* saddr)
+{
+    addr->ip = (uint)saddr->sin_addr.s_addr;
+    addr->port = ntohs(saddr->sin_port);
+}
+
+result_t sock_udp_batch_create(struct allocator* alloc, struct sock_udp_batch* batch,
+    int packet_cnt, int packet_size)
+{
+    ASSERT(packet_cnt > 0);
+    ASSERT(packet_size > 0);
+    memset(batch, 0x00, sizeof(struct sock_udp_batch));
+
+    /* packets, their buffers and system headers are allocated in one block */
+    size_t packets_sz = sizeof(struct sock_packet)*packet_cnt;
+    size_t buff_sz = (size_t)packet_size*packet_cnt;
+    size_t sys_sz = 0;
+#if defined(SOCK_UDP_MMSG)
+    sys_sz = (sizeof(struct mmsghdr) + sizeof(struct sock_udp_msg))*packet_cnt;
+#endif
+
+    uint8* buff = (uint8*)A_ALIGNED_ALLOC(alloc, sys_sz + packets_sz + buff_sz, 0);
+    if (buff == NULL)
+        return RET_OUTOFMEMORY;
+
+    batch->alloc = alloc;
+    batch->max_cnt = packet_cnt;
+    batch->packet_size = packet_size;
+    batch->packets = (struct sock_packet*)(buff + sys_sz);
+
+    uint8* data = buff + sys_sz + packets_sz;
+    for (int i = 0; i < packet_cnt; i++)    {
+        batch->packets[i].data = data + (size_t)packet_size*i;
+        batch->packets[i].size = 0;
+        batch->packets[i].truncated = FALSE;
+    }
+
+#if defined(SOCK_UDP_MMSG)
+    struct mmsghdr* hdrs = (struct mmsghdr*)buff;
+    struct sock_udp_msg* msgs = (struct sock_udp_msg*)(hdrs + packet_cnt);
+    memset(buff, 0x00, sys_sz);
+    for (int i = 0; i < packet_cnt; i++)    {
+        hdrs[i].msg_hdr.msg_name = &msgs[i].addr;
+        hdrs[i].msg_hdr.msg_iov = &msgs[i].iov;
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+    batch->sys = buff;
+
+    return RET_OK;
+}
+
+void sock_udp_batch_destroy(struct sock_udp_batch* batch)
+{
+    if (batch->sys != NULL)
+        A_ALIGNED_FREE(batch->alloc, batch->sys);
+    memset(batch, 0x00, sizeof(struct sock_udp_batch));
+}
+
+void sock_udp_batch_clear(struct sock_udp_batch* batch)
+{
+    batch->cnt = 0;
+}
+
+#if !defined(SOCK_UDP_MMSG)
+/* receives one datagram into packet's buffer and sets it's truncated flag
+ * returns number of bytes written to buffer, <0 if error occured */
+static int sock_udp_recvone(socket_t sock, struct sock_packet* p, int packet_size,
+                            struct sockaddr_in* addr)
+{
+#if defined(_WIN_)
+    socklen_t addrlen = sizeof(struct sockaddr_in);
+    int r = (int)recvfrom(sock, (char*)p->data, packet_size, 0, (struct sockaddr*)addr, &addrlen);
+    /* winsock fails oversized datagrams, but still fills the buffer with the first part */
+    p->truncated = (r < 0 && WSAGetLastError() == WSAEMSGSIZE);
+    return p->truncated ? packet_size : r;
+#else
+    struct iovec iov;
+    struct msghdr h;
+    iov.iov_base = p->data;
+    iov.iov_len = (size_t)packet_size;
+    memset(&h, 0x00, sizeof(h));
+    h.msg_name = addr;
+    h.msg_namelen = sizeof(struct sockaddr_in);
+    h.msg_iov = &iov;
+    h.msg_iovlen = 1;
+
+    int r = (int)recvmsg(sock, &h, 0);
+    p->truncated = (r >= 0 && (h.msg_flags & MSG_TRUNC) != 0);
+    return r;
+#endif
+}
+#endif
+
+int sock_udp_batch_recv(socket_t sock, struct sock_udp_batch* batch)
+{
+    if (sock == SOCK_NULL)      return -1;
+    batch->cnt = 0;
+
+#if defined(SOCK_UDP_MMSG)
+    struct mmsghdr* hdrs = (struct mmsghdr*)batch->sys;
+    for (int i = 0; i < batch->max_cnt; i++)    {
+        struct msghdr* h = &hdrs[i].msg_hdr;
+        h->msg_iov->iov_base = batch->packets[i].data;
+        h->msg_iov->iov_len = (size_t)batch->packet_size;
+        h->msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    /* MSG_WAITFORONE: only waits for the first datagram */
+    int r;
+    do  {
+        r = recvmmsg(sock, hdrs, (uint)batch->max_cnt, MSG_WAITFORONE, NULL);
+    }   while (r < 0 && errno == EINTR);
+    if (r <= 0)
+        return r;
+
+    for (int i = 0; i < r; i++) {
+        struct sock_packet* p = &batch->packets[i];
+        p->size = (int)hdrs[i].msg_len;
+        p->truncated = (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+        sock_addr_fromsys(&p->addr, (const struct sockaddr_in*)hdrs[i].msg_hdr.msg_name);
+    }
+    batch->cnt = r;
+#else
+    for (int i = 0; i < batch->max_cnt; i++)    {
+        /* after first datagram, only receive what is already pending */
+        if (i > 0 && !sock_poll_recv(sock, 0))
+            break;
+
+        struct sock_packet* p = &batch->packets[i];
+        struct sockaddr_in addr;
+        int r = sock_udp_recvone(sock, p, batch->packet_size, &addr);
+        if (r < 0)  {
+            if (i == 0)
+                return r;
+            break;
+        }
+        p->size = r;
+        sock_addr_fromsys(&p->addr, &addr);
+        batch->cnt++;
+    }
+#endif
+
+    return batch->cnt;
+}
+
+void* sock_udp_batch_add(struct sock_udp_batch* batch, const struct sock_addr* addr, int size)
+{
+    if (batch->cnt == batch->max_cnt || size > batch->packet_size)
+        return NULL;
+
+    struct sock_packet* p = &batch->packets[batch->cnt++];
+    p->addr = *addr;
+    p->size = size;
+    p->truncated = FALSE;
+    return p->data;
+}
+
+int sock_udp_batch_send(socket_t sock, struct sock_udp_batch* batch)
+{
+    if (sock == SOCK_NULL)      return -1;
+    int sent = 0;
+    int err = FALSE;
+
+#if defined(SOCK_UDP_MMSG)
+    struct mmsghdr* hdrs = (struct mmsghdr*)batch->sys;
+    for (int i = 0; i < batch->cnt; i++)    {
+        struct msghdr* h = &hdrs[i].msg_hdr;
+        h->msg_iov->iov_base = batch->packets[i].data;
+        h->msg_iov->iov_len = (size_t)batch->packets[i].size;
+        h->msg_namelen = sizeof(struct sockaddr_in);
+        sock_addr_tosys(&batch->packets[i].addr, (struct sockaddr_in*)h->msg_name);
+    }
+
+    while (sent < batch->cnt)   {
+        int r = sendmmsg(sock, hdrs + sent, (uint)(batch->cnt - sent), 0);
+        if (r < 0)  {
+            if (errno == EINTR)
+                continue;
+            err = TRUE;
+            break;
+        }
+        sent += r;
+    }
+#else
+    for (int i = 0; i < batch->cnt; i++)    {
+        struct sock_packet* p = &batch->packets[i];
+        struct sockaddr_in addr;
+        sock_addr_tosys(&p->addr, &addr);
+        if (sendto(sock, (const char*)p->data, (size_t)p->size, 0, (struct sockaddr*)&addr,
+            sizeof(addr)) < 0)
+        {
+            err = TRUE;
+            break;
+        }
+        sent++;
+    }
+#endif
+
+    /* move unsent packets to front, buffers are swapped along with packets so none is lost */
+    int remain = batch->cnt - sent;
+    if (sent > 0)   {
+        for (int i = 0; i < remain; i++)  {
+            struct sock_packet tmp = batch->packets[i];
+            batch->packets[i] = batch->packets[sent + i];
+            batch->packets[sent + i] = tmp;
+        }
+    }
+    batch->cnt = remain;
+
+    return (sent == 0 && err) ? -1 : sent;
+}
+
 /*************************************************************************************************/
 /* TCP socket */
 socket_t sock_tcp_create()
@@ -245,29 +512,212 @@ int sock_tcp_send(socket_t sock, const void* buffer, int size)
     return (size_t)send(sock, (const char*)buffer, (size_t)size, 0);
 }
 
+/* last socket call failed because socket is non-blocking and operation would block */
+INLINE int sock_wouldblock()
+{
+#if defined(_WIN_)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
 
-int sock_poll_recv(socket_t sock, uint timeout)
+/* last socket call is interrupted by a signal before transferring any data */
+INLINE int sock_interrupted()
 {
-    struct timeval tmout = {timeout/1000, (timeout%1000)*1000};
-    fd_set readset;
-    FD_ZERO(&readset);
-    FD_SET(sock, &readset);
+#if defined(_WIN_)
+    return WSAGetLastError() == WSAEINTR;
+#else
+    return errno == EINTR;
+#endif
+}
 
-    if (select((int)(sock+1), &readset, NULL, NULL, &tmout) > 0 && FD_ISSET(sock, &readset)) 
-        return TRUE;
+int sock_tcp_sendv(socket_t sock, const struct sock_buf* bufs, int cnt)
+{
+    if (sock == SOCK_NULL)
+        return -1;
+#if defined(_WIN_)
+    DWORD sent;
+    if (WSASend(sock, (LPWSABUF)bufs, (DWORD)cnt, &sent, 0, NULL, NULL) != 0)
+        return -1;
+    return (int)sent;
+#else
+    struct msghdr msg;
+    memset(&msg, 0x00, sizeof(msg));
+    msg.msg_iov = (struct iovec*)bufs;
+    msg.msg_iovlen = cnt;
+    return (int)sendmsg(sock, &msg, MSG_NOSIGNAL);
+#endif
+}
 
-    return FALSE;
+int sock_tcp_recvv(socket_t sock, const struct sock_buf* bufs, int cnt)
+{
+    if (sock == SOCK_NULL)
+        return -1;
+#if defined(_WIN_)
+    DWORD recvd;
+    DWORD flags = 0;
+    if (WSARecv(sock, (LPWSABUF)bufs, (DWORD)cnt, &recvd, &flags, NULL, NULL) != 0)
+        return -1;
+    return (int)recvd;
+#else
+    return (int)readv(sock, (const struct iovec*)bufs, cnt);
+#endif
 }
 
-int sock_poll_send(socket_t sock, uint timeout)
+/* sends or receives all data of the buffers, buffers are passed to system in chunks and the first
+ * one is adjusted for partially transferred data */
+static result_t sock_tcp_transferall(socket_t sock, const struct sock_buf* bufs, int cnt,
+    int sending)
+{
+    struct sock_buf chunk[SOCK_BUF_CHUNK];
+    int idx = 0;
+    size_t offset = 0;  /* transferred bytes of bufs[idx] */
+
+    while (idx < cnt)   {
+        if (offset == (size_t)bufs[idx].size)   {
+            idx++;
+            offset = 0;
+            continue;
+        }
+
+        int n = mini(cnt - idx, SOCK_BUF_CHUNK);
+        memcpy(chunk, bufs + idx, sizeof(struct sock_buf)*n);
+        chunk[0].data = (char*)chunk[0].data + offset;
+        chunk[0].size = bufs[idx].size - offset;
+
+        int r = sending ? sock_tcp_sendv(sock, chunk, n) : sock_tcp_recvv(sock, chunk, n);
+        if (r < 0)  {
+            if (sock_interrupted())
+                continue;
+            if (sock_wouldblock())  {
+                if (sending)
+                    sock_poll_send(sock, UINT32_MAX);
+                else
+                    sock_poll_recv(sock, UINT32_MAX);
+                continue;
+            }
+            return RET_FAIL;
+        }
+        if (r == 0)
+            return RET_FAIL;    /* peer is disconnected */
+
+        size_t left = (size_t)r;
+        while (left > 0)    {
+            size_t avail = (size_t)bufs[idx].size - offset;
+            if (left < avail)   {
+                offset += left;
+                left = 0;
+            }   else    {
+                left -= avail;
+                idx++;
+                offset = 0;
+            }
+        }
+    }
+
+    return RET_OK;
+}
+
+result_t sock_tcp_sendall(socket_t sock, const void* buffer, int size)
+{
+    struct sock_buf buf;
+    buf.data = (char*)buffer;
+    buf.size = size;
+    return sock_tcp_transferall(sock, &buf, 1, TRUE);
+}
+
+result_t sock_tcp_sendvall(socket_t sock, const struct sock_buf* bufs, int cnt)
 {
-    struct timeval tmout = {timeout/1000, (timeout%1000)*1000};
-    fd_set writeset;
-    FD_ZERO(&writeset);
-    FD_SET(sock, &writeset);
+    return sock_tcp_transferall(sock, bufs, cnt, TRUE);
+}
 
-    if (select((int)(sock+1), NULL, &writeset, NULL, &tmout) > 0 && FD_ISSET(sock, &writeset))
-        return TRUE;
+result_t sock_tcp_recvall(socket_t sock, void* buffer, int size)
+{
+    struct sock_buf buf;
+    buf.data = (char*)buffer;
+    buf.size = size;
+    return sock_tcp_transferall(sock, &buf, 1, FALSE);
+}
 
-    return FALSE;
+result_t sock_tcp_recvvall(socket_t sock, const struct sock_buf* bufs, int cnt)
+{
+    return sock_tcp_transferall(sock, bufs, cnt, FALSE);
+}
+
+result_t sock_tcp_setnodelay(socket_t sock, int enable)
+{
+    int opt = enable ? 1 : 0;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&opt, sizeof(opt)) == SOCK_ERROR)
+        return RET_FAIL;
+    return RET_OK;
+}
+
+result_t sock_tcp_setcork(socket_t sock, int enable)
+{
+    int opt = enable ? 1 : 0;
+#if defined(TCP_CORK)
+    if (setsockopt(sock, IPPROTO_TCP, TCP_CORK, (const char*)&opt, sizeof(opt)) == SOCK_ERROR)
+        return RET_FAIL;
+    return RET_OK;
+#elif defined(TCP_NOPUSH)
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, (const char*)&opt, sizeof(opt)) == SOCK_ERROR)
+        return RET_FAIL;
+    return RET_OK;
+#else
+    return RET_NOT_SUPPORTED;
+#endif
+}
+
+result_t sock_setbuffsize(socket_t sock, int recv_size, int send_size)
+{
+    if (recv_size > 0 &&
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&recv_size, sizeof(int)) == SOCK_ERROR)
+    {
+        return RET_FAIL;
+    }
+    if (send_size > 0 &&
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&send_size, sizeof(int)) == SOCK_ERROR)
+    {
+        return RET_FAIL;
+    }
+    return RET_OK;
+}
+
+result_t sock_setnonblock(socket_t sock, int enable)
+{
+#if defined(_WIN_)
+    u_long mode = enable ? 1 : 0;
+    return (ioctlsocket(sock, FIONBIO, &mode) == 0) ? RET_OK : RET_FAIL;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1)
+        return RET_FAIL;
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return (fcntl(sock, F_SETFL, flags) == 0) ? RET_OK : RET_FAIL;
+#endif
+}
+
+/* waits for events on a single socket, poll is used instead of select, because fd_set can't hold
+ * descriptors above FD_SETSIZE, which are common on servers with many connections */
+static int sock_poll(socket_t sock, short events, uint timeout)
+{
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    /* timeouts that don't fit in poll's int are practically infinite */
+    int r = poll(&pfd, 1, (timeout > INT32_MAX) ? -1 : (int)timeout);
+    return r > 0 && (pfd.revents & (events | POLLERR | POLLHUP)) != 0;
+}
+
+int sock_poll_recv(socket_t sock, uint timeout)
+{
+    return sock_poll(sock, POLLIN, timeout);
+}
+
+int sock_poll_send(socket_t sock, uint timeout)
+{
+    return sock_poll(sock, POLLOUT, timeout);
 }
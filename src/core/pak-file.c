@@ -15,18 +15,113 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include "dhcore/pak-file.h"
+#include "dhcore/util.h"
 #include "dhcore/err.h"
 #include "dhcore/pak-file-fmt.h"
 #include "dhcore/str.h"
 #include "dhcore/numeric.h"
+#include "dhcore/task-mgr.h"
+#include "dhcore/mt.h"
+#include "dhcore/mem-mgr.h"
+#include "dhcore/pool-alloc.h"
+#include "dhcore/linked-list.h"
+#include "dhcore/path.h"
+#include "dhcore/log.h"
+
+#if defined(_WIN_)
+#include "dhcore/win.h"
+#elif defined(_POSIXLIB_)
+#include <unistd.h>
+#endif
 
 #define ITEM_BLOCK_SIZE     100
 #define PAK_MAJOR_VERSION   1
-#define PAK_MINOR_VERSION   0
+#define PAK_MINOR_VERSION   1
 #define HSEED           8263
+#define BUILD_BATCH_SIZE    64  /* maximum number of items that are compressed in each dispatch */
+#define CACHE_TABLE_SIZE    512
+#define CACHE_BLOB_EXT      ".blob"
+#define CACHE_TMP_EXT       ".tmp"
+#define CACHE_TMP_EXPIRE    (60*60)   /* seconds, older temp files are leftovers of dead writers */
+#define CACHE_DEFAULT_DIR   "dhcore-pakcache"
+#define CACHE_PENDING_MAX   (32*1024*1024)  /* maximum data that waits to be written by flush */
+
+/*************************************************************************************************
+ * types
+ */
+struct pak_build_result
+{
+    result_t r;
+    void* data; /* compressed data (or raw data if compress mode is COMPRESS_NONE) */
+    struct allocator* alloc;    /* allocator that 'data' is allocated from */
+    size_t size;
+    size_t unzip_size;
+    hash_t hash;
+    uint ref_id;    /* file_id in reference pak, if item is unchanged (data is not compressed) */
+};
+
+struct pak_build_params
+{
+    struct pak_file* pak;
+    struct pak_file* ref_pak;
+    const struct pak_build_item* items;
+    struct pak_build_result* results;
+    uint item_cnt;
+    long volatile next_idx; /* atomic counter, next item in the batch to be compressed */
+};
+
+/* cached blob of decompressed item data, blobs are named by their content hash */
+struct pak_cache_entry
+{
+    hash_t hash;
+    uint size;
+    struct linked_list lnode;   /* lru list */
+    int touched;    /* used since last flush, blob's mtime is updated by pak_flushcache */
+    struct pak_cache_entry* next;   /* next entry with the same (folded) table key */
+};
+
+/* decompressed item data that is queued to be written by pak_flushcache, data follows the struct */
+struct pak_cache_pending
+{
+    hash_t hash;
+    uint size;
+    struct pak_cache_pending* next;
+};
+
+/* local content cache for decompressed items, shared between all paks */
+struct pak_cache
+{
+    char dir[DH_PATH_MAX];
+    uint64 max_size;
+    uint64 size;    /* total size of cached blobs */
+    mt_mutex mtx;
+    struct hashtable_open table;    /* key: folded content hash, value: pak_cache_entry chain */
+    struct pool_alloc entry_alloc;  /* item: pak_cache_entry */
+    struct linked_list* lru;    /* most recently used entry first */
+    struct linked_list* lru_last;   /* least recently used entry, next to be evicted */
+    uint touched_cnt;   /* number of entries that are touched since last flush */
+    struct pak_cache_pending* pending;  /* blobs that are not written yet */
+    uint64 pending_size;
+};
+
+static struct pak_cache* g_pakcache = NULL;
 
 /*************************************************************************************************/
+/* decompress and verify raw item data, without looking up the content cache */
+static file_t pak_decodeitem(struct pak_file* pak, struct allocator* alloc, uint file_id,
+                             const void* data, uint mem_id);
+
+static hash_t pak_hashdata(const struct pak_file* pak, const void* data, size_t size)
+{
+    if (pak->hash_mode == PAK_HASH_FAST)
+        return hash_fast128(data, size, HSEED);
+    else
+        return hash_murmur128(data, size, HSEED);
+}
+
 static void pak_finalize(struct pak_file* pak)
 {
     ASSERT(pak->f != NULL);
@@ -40,13 +135,14 @@ static void pak_finalize(struct pak_file* pak)
     strcpy(header.sig, PAK_SIGN);
     header.version = (PAK_MAJOR_VERSION<<16) | (PAK_MINOR_VERSION&0xffff);
     header.items_cnt = pak->items.item_cnt;
-    header.items_offset = ftell(pak->f);
+    header.items_offset = (uint64)util_ftell64(pak->f);
     header.compress_mode = (uint)pak->compress_mode;
+    header.hash_mode = (uint)pak->hash_mode;
 
-    fseek(pak->f, 0, SEEK_SET);
+    util_fseek64(pak->f, 0, SEEK_SET);
     fwrite(&header, sizeof(header), 1, pak->f);
 
-    fseek(pak->f, (long)header.items_offset, SEEK_SET);
+    util_fseek64(pak->f, (int64)header.items_offset, SEEK_SET);
     fwrite(pak->items.buffer, pak->items.item_sz, pak->items.item_cnt, pak->f);
 }
 
@@ -80,7 +176,7 @@ result_t pak_create(struct pak_file* pak, struct allocator* alloc,
     }
 
     /* reserve size for the header */
-    fseek(pak->f, sizeof(struct pak_header), SEEK_SET);
+    util_fseek64(pak->f, sizeof(struct pak_header), SEEK_SET);
     pak->compress_mode = mode;
     pak->init_create = TRUE;
 
@@ -108,7 +204,7 @@ result_t pak_open(struct pak_file* pak, struct allocator* alloc, const char* pak
     int minor = (header.version) & 0xffff;
 
     if (!str_isequal(header.sig, PAK_SIGN) ||
-        (major != PAK_MAJOR_VERSION || minor != PAK_MINOR_VERSION) ||
+        (major != PAK_MAJOR_VERSION || minor > PAK_MINOR_VERSION) ||
         header.items_cnt == 0)
     {
         err_printf(__FILE__, __LINE__, "opening pak-file failed: file '%s' is an invalid pak",
@@ -130,18 +226,29 @@ result_t pak_open(struct pak_file* pak, struct allocator* alloc, const char* pak
         return r;
     }
 
+    r = arr_create(alloc, &pak->verified, sizeof(uint8), (uint)header.items_cnt, ITEM_BLOCK_SIZE,
+                   mem_id);
+    if (IS_FAIL(r))     {
+        err_printn(__FILE__, __LINE__, r);
+        return r;
+    }
+    memset(pak->verified.buffer, 0x00, (size_t)header.items_cnt);
+    pak->verified.item_cnt = (uint)header.items_cnt;
+
     /* load items */
-    fseek(pak->f, (long)header.items_offset, SEEK_SET);
-    fread(pak->items.buffer, sizeof(struct pak_item), (size_t)header.items_cnt, pak->f);
+    util_freadat(pak->f, pak->items.buffer, sizeof(struct pak_item)*(size_t)header.items_cnt,
+                 header.items_offset);
     pak->items.item_cnt = (uint)header.items_cnt;
 
     struct pak_item* items = (struct pak_item*)pak->items.buffer;
     for (uint i = 0; i < header.items_cnt; i++)   {
         struct pak_item* item = &items[i];
-        hashtable_open_add(&pak->table, hash_str(item->filepath), i);
+        hashtable_open_add(&pak->table, hash_str(item->filepath), i + 1);
     }
 
     pak->compress_mode = (enum compress_mode)header.compress_mode;
+    /* v1.0 paks don't have hash_mode in their header, and are always murmur */
+    pak->hash_mode = (minor > 0) ? (enum pak_hash_mode)header.hash_mode : PAK_HASH_MURMUR;
 
     return RET_OK;
 }
@@ -156,6 +263,7 @@ void pak_close(struct pak_file* pak)
 
     hashtable_open_destroy(&pak->table);
     arr_destroy(&pak->items);
+    arr_destroy(&pak->verified);
 
     memset(pak, 0x00, sizeof(struct pak_file));
 }
@@ -165,6 +273,39 @@ int pak_isopen(struct pak_file* pak)
     return (pak->f != NULL);
 }
 
+void pak_setverify(struct pak_file* pak, enum pak_verify_mode mode)
+{
+    pak->verify_mode = mode;
+}
+
+void pak_sethash(struct pak_file* pak, enum pak_hash_mode mode)
+{
+    ASSERT(pak->init_create);
+    ASSERT(pak->items.item_cnt == 0);
+    pak->hash_mode = mode;
+}
+
+static void pak_additem(struct pak_file* pak, const char* dest_path, uint64 offset,
+                        size_t size, size_t unzip_size, hash_t hash)
+{
+    const char* rpath = (dest_path[0] == '/') ? (dest_path + 1) : dest_path;
+
+    if (arr_needexpand(&pak->items))
+        arr_expand(&pak->items);
+    struct pak_item* items = (struct pak_item*)pak->items.buffer;
+    struct pak_item* item = &items[pak->items.item_cnt];
+    memset(item, 0x00, sizeof(struct pak_item));
+    strcpy(item->filepath, rpath);
+    item->offset = offset;
+    item->size = (uint)size;
+    item->unzip_size = (uint)unzip_size;
+    hash_set(&item->hash, hash);
+
+    /* Add ID to hash-table */
+    uint file_id = ++pak->items.item_cnt;
+    hashtable_open_add(&pak->table, hash_str(rpath), file_id);
+}
+
 result_t pak_putfile(struct pak_file* pak, struct allocator* tmp_alloc, file_t src_file,
                      const char* dest_path)
 {
@@ -183,21 +324,28 @@ result_t pak_putfile(struct pak_file* pak, struct allocator* tmp_alloc, file_t s
         return RET_FAIL;
     }
 
-    /* compress/copy the file data into the pak file */
-    void* file_buffer = A_ALLOC(tmp_alloc, size, 0);
+    /* compress/copy the file data into the pak file
+     * memory and mapped files are used in place, disk files are read into a temp buffer */
+    void* read_buffer = NULL;
+    const void* file_buffer = fio_borrow(src_file, size);
     if (file_buffer == NULL)    {
-        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
-        return RET_OUTOFMEMORY;
+        read_buffer = A_ALLOC(tmp_alloc, size, 0);
+        if (read_buffer == NULL)    {
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+            return RET_OUTOFMEMORY;
+        }
+        fio_read(src_file, read_buffer, size, 1);
+        file_buffer = read_buffer;
     }
-    fio_read(src_file, file_buffer, size, 1);
-    hash_t file_hash = hash_murmur128(file_buffer, size, HSEED);
+    hash_t file_hash = pak_hashdata(pak, file_buffer, size);
 
     if (pak->compress_mode != COMPRESS_NONE)    {
         /* compress the buffer, then write it into the pak-file */
         compress_size = zip_compressedsize(size);
         void* compress_buffer = A_ALLOC(tmp_alloc, compress_size, 0);
         if (compress_buffer == NULL)    {
-            A_FREE(tmp_alloc, file_buffer);
+            if (read_buffer != NULL)
+                A_FREE(tmp_alloc, read_buffer);
             err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
             return RET_OUTOFMEMORY;
         }
@@ -211,26 +359,199 @@ result_t pak_putfile(struct pak_file* pak, struct allocator* tmp_alloc, file_t s
         fwrite(file_buffer, size, 1, pak->f);
         compress_size = size;
     }
-    A_FREE(tmp_alloc, file_buffer);
+    if (read_buffer != NULL)
+        A_FREE(tmp_alloc, read_buffer);
 
     /* add file item description */
-    if (arr_needexpand(&pak->items))
-        arr_expand(&pak->items);
-    struct pak_item* items = (struct pak_item*)pak->items.buffer;
-    struct pak_item* item = &items[pak->items.item_cnt];
-    strcpy(item->filepath, (dest_path[0] == '/') ? (dest_path + 1) : (dest_path));
-    item->offset = ftell(pak->f) - compress_size;
-    item->size = (uint)compress_size;
-    item->unzip_size = (uint)size;
-    hash_set(&item->hash, file_hash);
+    pak_additem(pak, dest_path, (uint64)util_ftell64(pak->f) - compress_size, compress_size, size,
+                file_hash);
 
-    /* Add ID to hash-table */
-    uint file_id = ++pak->items.item_cnt;
-    hashtable_open_add(&pak->table, hash_str(dest_path), file_id);
+    return RET_OK;
+}
+
+/* runs in task-mgr workers (or the caller thread), reads and compresses single build item */
+static result_t pak_build_compress(const struct pak_build_params* params,
+                                   const struct pak_build_item* bitem,
+                                   struct pak_build_result* res, struct allocator* alloc)
+{
+    res->alloc = alloc;
+
+    /* source is memory-mapped, so it's hashed and compressed without an extra copy */
+    file_t f = fio_openmap(bitem->src_filepath, TRUE);
+    if (f == NULL)
+        return RET_FILE_ERROR;
+
+    size_t size = fio_getsize(f);
+    if (size == 0)  {
+        fio_close(f);
+        return RET_OK;
+    }
+
+    if (size > UINT32_MAX)  {
+        fio_close(f);
+        return RET_NOT_SUPPORTED;
+    }
+
+    const void* file_data = fio_getptr(f);
+    hash_t file_hash = pak_hashdata(params->pak, file_data, size);
+    hash_set(&res->hash, file_hash);
+    res->unzip_size = size;
+
+    /* check the reference pak, if the item is unchanged, we can copy compressed data from it */
+    struct pak_file* ref_pak = params->ref_pak;
+    if (ref_pak != NULL && ref_pak->compress_mode == params->pak->compress_mode &&
+        ref_pak->hash_mode == params->pak->hash_mode)
+    {
+        uint ref_id = pak_findfile(ref_pak, bitem->dest_path);
+        if (ref_id != 0)    {
+            const struct pak_item* ref_item = &((struct pak_item*)ref_pak->items.buffer)[ref_id-1];
+            if (ref_item->unzip_size == size && hash_isequal(ref_item->hash, file_hash)) {
+                fio_close(f);
+                res->ref_id = ref_id;
+                res->size = ref_item->size;
+                return RET_OK;
+            }
+        }
+    }
+
+    if (params->pak->compress_mode == COMPRESS_NONE) {
+        void* file_buffer = A_ALLOC(alloc, size, 0);
+        if (file_buffer == NULL)    {
+            fio_close(f);
+            return RET_OUTOFMEMORY;
+        }
+        memcpy(file_buffer, file_data, size);
+        fio_close(f);
+        res->data = file_buffer;
+        res->size = size;
+        return RET_OK;
+    }
 
+    size_t compress_size = zip_compressedsize(size);
+    void* compress_buffer = A_ALLOC(alloc, compress_size, 0);
+    if (compress_buffer == NULL)    {
+        fio_close(f);
+        return RET_OUTOFMEMORY;
+    }
+
+    res->size = zip_compress(compress_buffer, compress_size, file_data, size,
+                             params->pak->compress_mode);
+    res->data = compress_buffer;
+    fio_close(f);
+    return (res->size != 0) ? RET_OK : RET_FAIL;
+}
+
+static void pak_build_task(void* params, void* result, uint thread_id, uint job_id,
+                           int worker_idx)
+{
+    struct pak_build_params* bparams = (struct pak_build_params*)params;
+    struct allocator* alloc = tsk_isinit() ? tsk_get_tmpalloc(thread_id) : mem_heap();
+
+    /* workers pick items one by one, so large files don't stall a single worker's share */
+    uint idx;
+    while ((idx = (uint)MT_ATOMIC_INCR(bparams->next_idx) - 1) < bparams->item_cnt)    {
+        struct pak_build_result* res = &bparams->results[idx];
+        res->r = pak_build_compress(bparams, &bparams->items[idx], res, alloc);
+    }
+}
+
+static result_t pak_copyitem(struct pak_file* pak, struct pak_file* ref_pak, uint ref_id,
+                             const char* dest_path)
+{
+    const struct pak_item* ref_item = &((struct pak_item*)ref_pak->items.buffer)[ref_id-1];
+    void* buffer = ALLOC(ref_item->size, 0);
+    if (buffer == NULL)
+        return RET_OUTOFMEMORY;
+
+    if (!util_freadat(ref_pak->f, buffer, ref_item->size, ref_item->offset)) {
+        FREE(buffer);
+        return RET_FILE_ERROR;
+    }
+
+    uint64 offset = (uint64)util_ftell64(pak->f);
+    fwrite(buffer, ref_item->size, 1, pak->f);
+    FREE(buffer);
+
+    pak_additem(pak, dest_path, offset, ref_item->size, ref_item->unzip_size, ref_item->hash);
     return RET_OK;
 }
 
+result_t pak_putfiles(struct pak_file* pak, const struct pak_build_item* items, uint item_cnt,
+                      struct pak_file* ref_pak)
+{
+    ASSERT(pak->init_create);
+    ASSERT(ref_pak == NULL || !ref_pak->init_create);
+
+    struct pak_build_result* results = (struct pak_build_result*)
+        ALLOC(sizeof(struct pak_build_result)*mini(item_cnt, BUILD_BATCH_SIZE), 0);
+    if (results == NULL)    {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return RET_OUTOFMEMORY;
+    }
+
+    struct allocator* main_alloc = tsk_isinit() ? tsk_get_tmpalloc(0) : NULL;
+    result_t r = RET_OK;
+
+    for (uint i = 0; i < item_cnt && IS_OK(r); i += BUILD_BATCH_SIZE)   {
+        uint batch_cnt = mini(item_cnt - i, BUILD_BATCH_SIZE);
+        memset(results, 0x00, sizeof(struct pak_build_result)*batch_cnt);
+
+        struct pak_build_params params;
+        params.pak = pak;
+        params.ref_pak = ref_pak;
+        params.items = items + i;
+        params.results = results;
+        params.item_cnt = batch_cnt;
+        params.next_idx = 0;
+
+        /* main thread temp allocator is not reset by task-mgr, so save/load it for each batch */
+        if (main_alloc != NULL)  {
+            A_SAVE(main_alloc);
+        }
+
+        uint job_id = tsk_isinit() ?
+            tsk_dispatch(pak_build_task, TSK_CONTEXT_ALL, TSK_THREADS_ALL, &params, NULL) : 0;
+        if (job_id != 0)    {
+            tsk_wait(job_id);
+            tsk_destroy(job_id);
+        }   else    {
+            pak_build_task(&params, NULL, 0, 0, 0);
+        }
+
+        /* write the results in their original order */
+        for (uint k = 0; k < batch_cnt; k++)    {
+            struct pak_build_result* res = &results[k];
+            const char* dest_path = items[i + k].dest_path;
+
+            if (IS_OK(r) && IS_FAIL(res->r))  {
+                err_printf(__FILE__, __LINE__, "put file into pak failed: could not put '%s'",
+                           items[i + k].src_filepath);
+                r = res->r;
+            }
+
+            if (IS_OK(r))   {
+                if (res->ref_id != 0)   {
+                    r = pak_copyitem(pak, ref_pak, res->ref_id, dest_path);
+                }   else if (res->data != NULL)    {
+                    uint64 offset = (uint64)util_ftell64(pak->f);
+                    fwrite(res->data, res->size, 1, pak->f);
+                    pak_additem(pak, dest_path, offset, res->size, res->unzip_size, res->hash);
+                }
+            }
+
+            if (res->data != NULL)
+                A_FREE(res->alloc, res->data);
+        }
+
+        if (main_alloc != NULL)  {
+            A_LOAD(main_alloc);
+        }
+    }
+
+    FREE(results);
+    return r;
+}
+
 uint pak_findfile(struct pak_file* pak, const char* filepath)
 {
     /* if path starts with '/' ignore the first char */
@@ -241,6 +562,401 @@ uint pak_findfile(struct pak_file* pak, const char* filepath)
     else                   return 0;
 }
 
+/*************************************************************************************************
+ * content cache
+ */
+static uint pak_cache_key(hash_t hash)
+{
+    uint w[sizeof(hash_t)/sizeof(uint)];
+    uint key = 0;
+    memcpy(w, &hash, sizeof(hash_t));
+    for (uint i = 0; i < sizeof(hash_t)/sizeof(uint); i++)
+        key ^= w[i];
+    return key != 0 ? key : 1;  /* zero is reserved for empty slots */
+}
+
+static char* pak_cache_blobpath(char* outpath, hash_t hash)
+{
+    char name[sizeof(hash_t)*2 + sizeof(CACHE_BLOB_EXT)];
+    const uint8* b = (const uint8*)&hash;
+    for (uint i = 0; i < sizeof(hash_t); i++)
+        sprintf(name + i*2, "%02x", b[i]);
+    strcat(name, CACHE_BLOB_EXT);
+    return path_join(outpath, g_pakcache->dir, name, NULL);
+}
+
+/* parses blob filename back to content hash, returns FALSE if it's not a blob */
+static int pak_cache_parsename(const char* filename, OUT hash_t* hash)
+{
+    if (strlen(filename) != sizeof(hash_t)*2 + sizeof(CACHE_BLOB_EXT) - 1 ||
+        !str_isequal(filename + sizeof(hash_t)*2, CACHE_BLOB_EXT))
+    {
+        return FALSE;
+    }
+
+    uint8* b = (uint8*)hash;
+    for (uint i = 0; i < sizeof(hash_t); i++)   {
+        uint v;
+        if (sscanf(filename + i*2, "%2x", &v) != 1)
+            return FALSE;
+        b[i] = (uint8)v;
+    }
+    return TRUE;
+}
+
+static void pak_cache_touch(struct pak_cache_entry* e)
+{
+    if (!e->touched)    {
+        e->touched = TRUE;
+        g_pakcache->touched_cnt++;
+    }
+
+    if (g_pakcache->lru == &e->lnode)
+        return;
+    if (g_pakcache->lru_last == &e->lnode)
+        g_pakcache->lru_last = e->lnode.prev;
+    list_remove(&g_pakcache->lru, &e->lnode);
+    list_add(&g_pakcache->lru, &e->lnode, e);
+}
+
+static struct pak_cache_entry* pak_cache_add(hash_t hash, uint size)
+{
+    struct pak_cache_entry* e = (struct pak_cache_entry*)mem_pool_alloc(&g_pakcache->entry_alloc);
+    if (e == NULL)
+        return NULL;
+    memset(e, 0x00, sizeof(struct pak_cache_entry));
+    e->hash = hash;
+    e->size = size;
+
+    /* different hashes may fold into the same key, chain them in the same table item */
+    uint key = pak_cache_key(hash);
+    struct hashtable_item* item = hashtable_open_find(&g_pakcache->table, key);
+    if (item != NULL)   {
+        e->next = (struct pak_cache_entry*)item->value;
+        item->value = (uint64)((uptr_t)e);
+    }   else if (IS_FAIL(hashtable_open_add(&g_pakcache->table, key, (uint64)((uptr_t)e))))  {
+        mem_pool_free(&g_pakcache->entry_alloc, e);
+        return NULL;
+    }
+
+    if (g_pakcache->lru == NULL)
+        g_pakcache->lru_last = &e->lnode;
+    list_add(&g_pakcache->lru, &e->lnode, e);
+    g_pakcache->size += size;
+    return e;
+}
+
+static void pak_cache_remove(struct pak_cache_entry* e, int delete_blob)
+{
+    if (delete_blob)    {
+        char blobpath[DH_PATH_MAX];
+        util_delfile(pak_cache_blobpath(blobpath, e->hash));
+    }
+
+    struct hashtable_item* item = hashtable_open_find(&g_pakcache->table, pak_cache_key(e->hash));
+    if (item != NULL)   {
+        struct pak_cache_entry* head = (struct pak_cache_entry*)item->value;
+        if (head == e)  {
+            if (e->next != NULL)
+                item->value = (uint64)((uptr_t)e->next);
+            else
+                hashtable_open_remove(&g_pakcache->table, item);
+        }   else    {
+            struct pak_cache_entry* prev = head;
+            while (prev->next != NULL && prev->next != e)
+                prev = prev->next;
+            if (prev->next == e)
+                prev->next = e->next;
+        }
+    }
+    if (g_pakcache->lru_last == &e->lnode)
+        g_pakcache->lru_last = e->lnode.prev;
+    list_remove(&g_pakcache->lru, &e->lnode);
+    g_pakcache->size -= e->size;
+    if (e->touched)
+        g_pakcache->touched_cnt--;
+    mem_pool_free(&g_pakcache->entry_alloc, e);
+}
+
+static struct pak_cache_entry* pak_cache_find(hash_t hash)
+{
+    struct hashtable_item* item = hashtable_open_find(&g_pakcache->table, pak_cache_key(hash));
+    if (item == NULL)
+        return NULL;
+    for (struct pak_cache_entry* e = (struct pak_cache_entry*)item->value; e != NULL; e = e->next)  {
+        if (hash_isequal(e->hash, hash))
+            return e;
+    }
+    return NULL;
+}
+
+/* deletes least recently used blobs until the cache fits into it's size limit */
+static void pak_cache_evict()
+{
+    while (g_pakcache->size > g_pakcache->max_size && g_pakcache->lru_last != NULL)
+        pak_cache_remove((struct pak_cache_entry*)g_pakcache->lru_last->data, TRUE);
+}
+
+/* loads decompressed data of an item from the cache (mapped), returns NULL if it's not cached */
+static void* pak_cache_load(const struct pak_item* item, struct allocator* alloc)
+{
+    char blobpath[DH_PATH_MAX];
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    struct pak_cache_entry* e = pak_cache_find(item->hash);
+    if (e == NULL || e->size != item->unzip_size)   {
+        mt_mutex_unlock(&g_pakcache->mtx);
+        return NULL;
+    }
+    pak_cache_touch(e);
+    pak_cache_blobpath(blobpath, item->hash);
+    mt_mutex_unlock(&g_pakcache->mtx);
+
+    file_t f = fio_openmap(blobpath, TRUE);
+    if (f == NULL || fio_getsize64(f) != item->unzip_size)   {
+        /* blob is deleted or changed by another process */
+        if (f != NULL)
+            fio_close(f);
+        mt_mutex_lock(&g_pakcache->mtx);
+        e = pak_cache_find(item->hash);
+        if (e != NULL)
+            pak_cache_remove(e, FALSE);
+        mt_mutex_unlock(&g_pakcache->mtx);
+        return NULL;
+    }
+
+    /* extra zero byte, so text files can be parsed in place (see fio_attachmemz) */
+    uint8* buffer = (uint8*)A_ALLOC(alloc, item->unzip_size + 1, 0);
+    if (buffer != NULL)  {
+        if (item->unzip_size > 0)
+            memcpy(buffer, fio_getptr(f), item->unzip_size);
+        buffer[item->unzip_size] = 0;
+    }
+    fio_close(f);
+    return buffer;
+}
+
+/* checks if the blob is cached or waiting to be written, cache mutex must be locked */
+static int pak_cache_exists(hash_t hash)
+{
+    if (pak_cache_find(hash) != NULL)
+        return TRUE;
+    for (struct pak_cache_pending* p = g_pakcache->pending; p != NULL; p = p->next)  {
+        if (hash_isequal(p->hash, hash))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* queues a copy of decompressed data of an item, blobs are written later by pak_flushcache, so
+ * fetching files never waits for cache writes */
+static void pak_cache_store(const struct pak_item* item, const void* data)
+{
+    if ((uint64)item->unzip_size > g_pakcache->max_size)
+        return;
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    int skip = pak_cache_exists(item->hash) ||
+        g_pakcache->pending_size + item->unzip_size > CACHE_PENDING_MAX;
+    mt_mutex_unlock(&g_pakcache->mtx);
+    if (skip)
+        return;
+
+    struct pak_cache_pending* p = (struct pak_cache_pending*)ALLOC(
+        sizeof(struct pak_cache_pending) + item->unzip_size, 0);
+    if (p == NULL)
+        return;
+    p->hash = item->hash;
+    p->size = item->unzip_size;
+    memcpy(p + 1, data, item->unzip_size);
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    if (!pak_cache_exists(item->hash) &&
+        g_pakcache->pending_size + item->unzip_size <= CACHE_PENDING_MAX)
+    {
+        p->next = g_pakcache->pending;
+        g_pakcache->pending = p;
+        g_pakcache->pending_size += item->unzip_size;
+        p = NULL;
+    }
+    mt_mutex_unlock(&g_pakcache->mtx);
+
+    if (p != NULL)
+        FREE(p);
+}
+
+/* writes a queued blob into the cache directory and indexes it */
+static void pak_cache_write(const struct pak_cache_pending* p)
+{
+    mt_mutex_lock(&g_pakcache->mtx);
+    int exists = pak_cache_find(p->hash) != NULL;
+    mt_mutex_unlock(&g_pakcache->mtx);
+    if (exists)
+        return;
+
+    /* write to a temp file and rename it, so other processes never see incomplete blobs */
+    char blobpath[DH_PATH_MAX];
+    char tmppath[DH_PATH_MAX + 16];
+    pak_cache_blobpath(blobpath, p->hash);
+#if defined(_WIN_)
+    snprintf(tmppath, sizeof(tmppath), "%s.%u" CACHE_TMP_EXT, blobpath,
+             (uint)GetCurrentProcessId());
+#else
+    snprintf(tmppath, sizeof(tmppath), "%s.%u" CACHE_TMP_EXT, blobpath, (uint)getpid());
+#endif
+
+    FILE* f = fopen(tmppath, "wb");
+    if (f == NULL)
+        return;
+    size_t written = fwrite(p + 1, 1, p->size, f);
+    fclose(f);
+    if (written != p->size || !util_movefile(blobpath, tmppath))  {
+        util_delfile(tmppath);
+        return;
+    }
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    if (pak_cache_find(p->hash) == NULL && pak_cache_add(p->hash, p->size) != NULL)
+        pak_cache_evict();
+    mt_mutex_unlock(&g_pakcache->mtx);
+}
+
+/* updates modification time of blobs that are used since last flush, so next runs index them in
+ * the same recently used order (see pak_initcache) */
+static void pak_cache_flushtouched()
+{
+    hash_t* hashes = NULL;
+    uint cnt = 0;
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    if (g_pakcache->touched_cnt > 0)
+        hashes = (hash_t*)ALLOC(sizeof(hash_t)*g_pakcache->touched_cnt, 0);
+    if (hashes != NULL) {
+        /* least recently used first, so later touches get newer times */
+        for (struct linked_list* l = g_pakcache->lru_last; l != NULL; l = l->prev)   {
+            struct pak_cache_entry* e = (struct pak_cache_entry*)l->data;
+            if (e->touched) {
+                e->touched = FALSE;
+                hashes[cnt++] = e->hash;
+            }
+        }
+        g_pakcache->touched_cnt = 0;
+    }
+    mt_mutex_unlock(&g_pakcache->mtx);
+
+    char blobpath[DH_PATH_MAX];
+    for (uint i = 0; i < cnt; i++)
+        util_touchfile(pak_cache_blobpath(blobpath, hashes[i]));
+
+    if (hashes != NULL)
+        FREE(hashes);
+}
+
+/* detaches all queued blobs in the order they are queued, cache mutex must be locked */
+static struct pak_cache_pending* pak_cache_takepending()
+{
+    struct pak_cache_pending* list = NULL;
+    struct pak_cache_pending* p = g_pakcache->pending;
+    while (p != NULL)   {
+        struct pak_cache_pending* next = p->next;
+        p->next = list;
+        list = p;
+        p = next;
+    }
+    g_pakcache->pending = NULL;
+    g_pakcache->pending_size = 0;
+    return list;
+}
+
+/* checks decompressed data of an item with it's hash, according to verify mode of the pak */
+static int pak_verifyitem(struct pak_file* pak, uint file_id, const void* data)
+{
+    const struct pak_item* item = &((struct pak_item*)pak->items.buffer)[file_id-1];
+    uint8* verified = (uint8*)pak->verified.buffer + file_id - 1;
+    if (pak->verify_mode == PAK_VERIFY_ALWAYS ||
+        (pak->verify_mode == PAK_VERIFY_FIRSTOPEN && !(*verified)))
+    {
+        hash_t h = pak_hashdata(pak, data, item->unzip_size);
+        if (!hash_isequal(h, item->hash))
+            return FALSE;
+        *verified = TRUE;
+    }
+    return TRUE;
+}
+
+/* fetches a file from content cache, returns NULL if the item is not cached */
+static file_t pak_getcached(struct pak_file* pak, struct allocator* alloc, uint file_id,
+                            uint mem_id)
+{
+    if (g_pakcache == NULL || pak->compress_mode == COMPRESS_NONE)
+        return NULL;
+
+    const struct pak_item* item = &((struct pak_item*)pak->items.buffer)[file_id-1];
+    void* buffer = pak_cache_load(item, alloc);
+    if (buffer == NULL)
+        return NULL;
+
+    if (!pak_verifyitem(pak, file_id, buffer))  {
+        /* corrupted blob, drop it and decompress the item again */
+        A_FREE(alloc, buffer);
+        mt_mutex_lock(&g_pakcache->mtx);
+        struct pak_cache_entry* e = pak_cache_find(item->hash);
+        if (e != NULL)
+            pak_cache_remove(e, TRUE);
+        mt_mutex_unlock(&g_pakcache->mtx);
+        return NULL;
+    }
+
+    return fio_attachmemz(alloc, buffer, item->unzip_size, item->filepath, mem_id);
+}
+
+struct pak_cache_scanitem
+{
+    hash_t hash;
+    uint64 size;
+    uint64 mtime;
+};
+
+/* checks if the file is a temp blob of pak_cache_write ("<hash>.blob.<pid>.tmp") */
+static int pak_cache_istmp(const char* filename)
+{
+    size_t len = strlen(filename);
+    return len > sizeof(CACHE_TMP_EXT) &&
+        str_isequal(filename + len - sizeof(CACHE_TMP_EXT) + 1, CACHE_TMP_EXT) &&
+        strstr(filename, CACHE_BLOB_EXT ".") != NULL;
+}
+
+static void pak_cache_scanfile(const char* filename, uint64 size, uint64 mtime, void* param)
+{
+    /* temp blobs are left behind by processes that died while writing them, recent ones may
+     * still be written by another process */
+    if (pak_cache_istmp(filename))  {
+        if ((uint64)time(NULL) > mtime + CACHE_TMP_EXPIRE)  {
+            char tmppath[DH_PATH_MAX];
+            util_delfile(path_join(tmppath, g_pakcache->dir, filename, NULL));
+        }
+        return;
+    }
+
+    struct pak_cache_scanitem item;
+    if (!pak_cache_parsename(filename, &item.hash) || size > UINT32_MAX)
+        return;
+    item.size = size;
+    item.mtime = mtime;
+
+    struct pak_cache_scanitem* pitem = (struct pak_cache_scanitem*)arr_add((struct array*)param);
+    if (pitem != NULL)
+        *pitem = item;
+}
+
+static int pak_cache_cmpscan(const void* a, const void* b)
+{
+    uint64 ta = ((const struct pak_cache_scanitem*)a)->mtime;
+    uint64 tb = ((const struct pak_cache_scanitem*)b)->mtime;
+    return (ta < tb) ? -1 : ((ta > tb) ? 1 : 0);
+}
+
+/*************************************************************************************************/
 file_t pak_getfile(struct pak_file* pak, struct allocator* alloc, struct allocator* tmp_alloc,
                    uint file_id, uint mem_id)
 {
@@ -250,34 +966,77 @@ file_t pak_getfile(struct pak_file* pak, struct allocator* alloc, struct allocat
     struct pak_item* items = (struct pak_item*)pak->items.buffer;
     struct pak_item* item = &items[file_id-1];
 
+    file_t cf = pak_getcached(pak, alloc, file_id, mem_id);
+    if (cf != NULL)
+        return cf;
+
     void* file_buffer = A_ALLOC(tmp_alloc, item->size, 0);
-    void* unzip_buffer = A_ALLOC(alloc, item->unzip_size, 0);
+    if (file_buffer == NULL)    {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
 
-    if (file_buffer == NULL || unzip_buffer == NULL)    {
+    if (!util_freadat(pak->f, file_buffer, item->size, item->offset))   {
+        err_printf(__FILE__, __LINE__, "pak get-file failed: could not read '%s'", item->filepath);
+        A_FREE(tmp_alloc, file_buffer);
+        return NULL;
+    }
+
+    file_t f = pak_decodeitem(pak, alloc, file_id, file_buffer, mem_id);
+    A_FREE(tmp_alloc, file_buffer);
+    return f;
+}
+
+const struct pak_item* pak_getitem(struct pak_file* pak, uint file_id)
+{
+    ASSERT(file_id != 0);
+    ASSERT(file_id < (uint)pak->items.item_cnt+1);
+
+    return &((struct pak_item*)pak->items.buffer)[file_id-1];
+}
+
+file_t pak_decodefile(struct pak_file* pak, struct allocator* alloc, uint file_id,
+                      const void* data, uint mem_id)
+{
+    ASSERT(file_id != 0);
+    ASSERT(file_id < (uint)pak->items.item_cnt+1);
+
+    file_t cf = pak_getcached(pak, alloc, file_id, mem_id);
+    if (cf != NULL)
+        return cf;
+    return pak_decodeitem(pak, alloc, file_id, data, mem_id);
+}
+
+static file_t pak_decodeitem(struct pak_file* pak, struct allocator* alloc, uint file_id,
+                             const void* data, uint mem_id)
+{
+    struct pak_item* item = &((struct pak_item*)pak->items.buffer)[file_id-1];
+
+    /* extra zero byte, so text files can be parsed in place (see fio_attachmemz) */
+    void* unzip_buffer = A_ALLOC(alloc, item->unzip_size + 1, 0);
+    if (unzip_buffer == NULL)    {
         err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
         return NULL;
     }
 
-    fseek(pak->f, (long)item->offset, SEEK_SET);
-    fread(file_buffer, item->size, 1, pak->f);
     if (pak->compress_mode != COMPRESS_NONE)
-        zip_decompress(unzip_buffer, item->unzip_size, file_buffer, item->size);
+        zip_decompress(unzip_buffer, item->unzip_size, data, item->size);
     else
-        memcpy(unzip_buffer, file_buffer, item->unzip_size);
-
-    A_FREE(tmp_alloc, file_buffer);
+        memcpy(unzip_buffer, data, item->unzip_size);
 
     /* check hash validity */
-    hash_t h = hash_murmur128(unzip_buffer, item->unzip_size, HSEED);
-    if (!hash_isequal(h, item->hash))   {
+    if (!pak_verifyitem(pak, file_id, unzip_buffer))    {
         err_printf(__FILE__, __LINE__, "pak get-file failed: data validity error for '%s'",
                    item->filepath);
         A_FREE(alloc, unzip_buffer);
-        return RET_FAIL;
+        return NULL;
     }
 
+    if (g_pakcache != NULL && pak->compress_mode != COMPRESS_NONE)
+        pak_cache_store(item, unzip_buffer);
+
     /* attach it to a file and return */
-    return fio_attachmem(alloc, unzip_buffer, item->unzip_size, item->filepath, mem_id);
+    return fio_attachmemz(alloc, unzip_buffer, item->unzip_size, item->filepath, mem_id);
 }
 
 char* pak_createfilelist(struct pak_file* pak, struct allocator* alloc, OUT int* pcnt)
@@ -301,3 +1060,112 @@ char* pak_createfilelist(struct pak_file* pak, struct allocator* alloc, OUT int*
 	return filelist;
 }
 
+
+result_t pak_initcache(const char* cachedir, uint64 max_size)
+{
+    ASSERT(max_size > 0);
+    if (g_pakcache != NULL)
+        return RET_FAIL;
+
+    struct pak_cache* cache = (struct pak_cache*)ALLOC(sizeof(struct pak_cache), 0);
+    if (cache == NULL)
+        return RET_OUTOFMEMORY;
+    memset(cache, 0x00, sizeof(struct pak_cache));
+
+    if (cachedir != NULL)   {
+        path_norm(cache->dir, cachedir);
+    }   else    {
+        char tmpdir[DH_PATH_MAX];
+        path_join(cache->dir, util_gettempdir(tmpdir), CACHE_DEFAULT_DIR, NULL);
+    }
+
+    if (!util_pathisdir(cache->dir) && !util_makedir(cache->dir))  {
+        err_printf(__FILE__, __LINE__, "pak cache failed: could not create directory '%s'",
+                   cache->dir);
+        FREE(cache);
+        return RET_FILE_ERROR;
+    }
+
+    cache->max_size = max_size;
+    mt_mutex_init(&cache->mtx);
+    if (IS_FAIL(hashtable_open_create(mem_heap(), &cache->table, CACHE_TABLE_SIZE,
+                                      CACHE_TABLE_SIZE, 0)) ||
+        IS_FAIL(mem_pool_create(mem_heap(), &cache->entry_alloc, sizeof(struct pak_cache_entry),
+                                CACHE_TABLE_SIZE, 0)))
+    {
+        hashtable_open_destroy(&cache->table);
+        mt_mutex_release(&cache->mtx);
+        FREE(cache);
+        return RET_OUTOFMEMORY;
+    }
+    g_pakcache = cache;
+
+    /* index blobs from previous runs, oldest (least recently used) first */
+    struct array scan;
+    if (IS_OK(arr_create(mem_heap(), &scan, sizeof(struct pak_cache_scanitem), 256, 256, 0))) {
+        util_listfiles(cache->dir, pak_cache_scanfile, &scan);
+        qsort(scan.buffer, scan.item_cnt, sizeof(struct pak_cache_scanitem), pak_cache_cmpscan);
+
+        struct pak_cache_scanitem* items = (struct pak_cache_scanitem*)scan.buffer;
+        for (int i = 0; i < scan.item_cnt; i++)  {
+            if (pak_cache_find(items[i].hash) == NULL)
+                pak_cache_add(items[i].hash, (uint)items[i].size);
+        }
+        arr_destroy(&scan);
+    }
+    pak_cache_evict();
+
+    log_printf(LOG_INFO, "  Pak content cache: %s (%dkb used)", cache->dir,
+               (int)(cache->size/1024));
+    return RET_OK;
+}
+
+void pak_flushcache()
+{
+    if (g_pakcache == NULL)
+        return;
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    struct pak_cache_pending* p = pak_cache_takepending();
+    mt_mutex_unlock(&g_pakcache->mtx);
+
+    while (p != NULL)   {
+        struct pak_cache_pending* next = p->next;
+        pak_cache_write(p);
+        FREE(p);
+        p = next;
+    }
+
+    pak_cache_flushtouched();
+}
+
+void pak_releasecache()
+{
+    if (g_pakcache == NULL)
+        return;
+
+    pak_flushcache();
+    hashtable_open_destroy(&g_pakcache->table);
+    mem_pool_destroy(&g_pakcache->entry_alloc);
+    mt_mutex_release(&g_pakcache->mtx);
+    FREE(g_pakcache);
+    g_pakcache = NULL;
+}
+
+void pak_clearcache()
+{
+    if (g_pakcache == NULL)
+        return;
+
+    mt_mutex_lock(&g_pakcache->mtx);
+    struct pak_cache_pending* p = pak_cache_takepending();
+    while (g_pakcache->lru != NULL)
+        pak_cache_remove((struct pak_cache_entry*)g_pakcache->lru->data, TRUE);
+    mt_mutex_unlock(&g_pakcache->mtx);
+
+    while (p != NULL)   {
+        struct pak_cache_pending* next = p->next;
+        FREE(p);
+        p = next;
+    }
+}
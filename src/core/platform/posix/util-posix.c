@@ -27,6 +27,8 @@
 #include <pwd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <dirent.h>
+#include <utime.h>
 
 #if defined(_LINUX_)
 #include <sys/sendfile.h>
@@ -177,4 +179,50 @@ int util_delfile(const char* filepath)
     return unlink(filepath);
 }
 
+int util_fseek64(FILE* f, int64 offset, int origin)
+{
+    return fseeko(f, (off_t)offset, origin);
+}
+
+int64 util_ftell64(FILE* f)
+{
+    return (int64)ftello(f);
+}
+
+int util_freadat(FILE* f, void* buffer, size_t size, uint64 offset)
+{
+    int fd = fileno(f);
+    size_t read_sz = 0;
+    while (read_sz < size)  {
+        ssize_t r = pread(fd, (uint8*)buffer + read_sz, size - read_sz, (off_t)(offset + read_sz));
+        if (r <= 0)
+            return FALSE;
+        read_sz += (size_t)r;
+    }
+    return TRUE;
+}
+
+int util_listfiles(const char* dir, pfn_util_listfile fn, void* param)
+{
+    DIR* d = opendir(dir);
+    if (d == NULL)
+        return FALSE;
+
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL)    {
+        char filepath[DH_PATH_MAX];
+        struct stat s;
+        path_join(filepath, dir, e->d_name, NULL);
+        if (stat(filepath, &s) == 0 && S_ISREG(s.st_mode))
+            fn(e->d_name, (uint64)s.st_size, (uint64)s.st_mtime, param);
+    }
+    closedir(d);
+    return TRUE;
+}
+
+int util_touchfile(const char* filepath)
+{
+    return utime(filepath, NULL) == 0;
+}
+
 #endif /* _POSIX_ */
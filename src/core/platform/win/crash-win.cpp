@@ -287,6 +287,8 @@ void crash_handler(int signum)
         name = "[unknown]";
     }
 
+    /* crash report is written directly, after pending async messages */
+    log_crashflush();
 
     if (!log_isconsole())   {
         printf("Fatal Error: %s\n", name);
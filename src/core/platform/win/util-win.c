@@ -99,4 +99,63 @@ int util_delfile(const char* filepath)
     return DeleteFile(filepath);
 }
 
+int util_fseek64(FILE* f, int64 offset, int origin)
+{
+    return _fseeki64(f, offset, origin);
+}
+
+int64 util_ftell64(FILE* f)
+{
+    return _ftelli64(f);
+}
+
+int util_freadat(FILE* f, void* buffer, size_t size, uint64 offset)
+{
+    if (_fseeki64(f, (int64)offset, SEEK_SET) != 0)
+        return FALSE;
+    return fread(buffer, size, 1, f) == 1;
+}
+
+/* FILETIME is 100ns intervals since 1601, convert it to seconds since epoch */
+static uint64 util_filetime_tounix(const FILETIME* ft)
+{
+    uint64 t = ((uint64)ft->dwHighDateTime << 32) | (uint64)ft->dwLowDateTime;
+    return (t - 116444736000000000ULL) / 10000000ULL;
+}
+
+int util_listfiles(const char* dir, pfn_util_listfile fn, void* param)
+{
+    char filter[DH_PATH_MAX];
+    WIN32_FIND_DATA fd;
+    path_join(filter, dir, "*", NULL);
+
+    HANDLE h = FindFirstFile(filter, &fd);
+    if (h == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    do  {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        fn(fd.cFileName, ((uint64)fd.nFileSizeHigh << 32) | (uint64)fd.nFileSizeLow,
+            util_filetime_tounix(&fd.ftLastWriteTime), param);
+    }   while (FindNextFile(h, &fd));
+
+    FindClose(h);
+    return TRUE;
+}
+
+int util_touchfile(const char* filepath)
+{
+    HANDLE h = CreateFile(filepath, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    BOOL r = SetFileTime(h, NULL, NULL, &ft);
+    CloseHandle(h);
+    return r;
+}
+
 #endif /* _WIN_ */
@@ -0,0 +1,463 @@
+/***********************************************************************************
+ * Copyright (c) 2014, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#include "dhcore/rpc-server.h"
+#include "dhcore/core.h"
+
+#if !defined(_WIN_)
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "dhcore/net-socket.h"
+#include "dhcore/net-reactor.h"
+#include "dhcore/pool-alloc.h"
+#include "dhcore/linked-list.h"
+#include "dhcore/mt.h"
+#include "dhcore/rpc.h"
+
+#define RPC_SERVER_BUFFER_SIZE  4096    /* pooled connection buffers, bigger ones come from heap */
+#define RPC_SERVER_POOL_BLOCK   64
+#define RPC_SERVER_HEADER_SIZE  4
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0    /* SO_NOSIGPIPE is set on connections instead */
+#endif
+
+struct rpc_loop;
+
+/* types */
+struct rpc_conn
+{
+    socket_t sock;
+    struct rpc_loop* loop;
+    struct linked_list node;
+    uint events;    /* registered reactor events */
+    char* in;   /* received data, may contain multiple or partial messages */
+    uint in_size;
+    uint in_pos;
+    char* out;  /* framed responses that are not sent yet */
+    uint out_size;
+    uint out_pos;
+    uint out_len;
+};
+
+/* each loop has it's own thread, reactor and connections */
+struct rpc_loop
+{
+    struct rpc_server* srv;
+    struct sock_reactor* r;
+    mt_thread t;
+    struct pool_alloc conn_pool;    /* item: rpc_conn */
+    struct pool_alloc buff_pool;    /* item: RPC_SERVER_BUFFER_SIZE bytes */
+    struct linked_list* conns;
+};
+
+struct rpc_server
+{
+    socket_t sock;
+    atom_t quit;
+    int max_conns;
+    uint max_msg_size;
+    atom_t conn_cnt;
+    int loop_cnt;
+    struct rpc_loop* loops;
+};
+
+/*************************************************************************************************/
+static void rpc_buff_free(struct rpc_loop* loop, char** pbuf, uint* psize)
+{
+    if (*pbuf != NULL)  {
+        if (*psize == RPC_SERVER_BUFFER_SIZE)
+            mem_pool_free(&loop->buff_pool, *pbuf);
+        else
+            FREE(*pbuf);
+        *pbuf = NULL;
+        *psize = 0;
+    }
+}
+
+/* grows the buffer to hold 'size' bytes, first 'keep' bytes are preserved */
+static int rpc_buff_reserve(struct rpc_loop* loop, char** pbuf, uint* psize, uint keep, uint size)
+{
+    if (size <= *psize)
+        return TRUE;
+
+    char* buf;
+    uint nsize;
+    if (size <= RPC_SERVER_BUFFER_SIZE) {
+        buf = (char*)mem_pool_alloc(&loop->buff_pool);
+        nsize = RPC_SERVER_BUFFER_SIZE;
+    }   else    {
+        nsize = maxui(size, *psize << 1);
+        buf = (char*)ALLOC(nsize, 0);
+    }
+    if (buf == NULL)
+        return FALSE;
+
+    if (keep > 0)
+        memcpy(buf, *pbuf, keep);
+    rpc_buff_free(loop, pbuf, psize);
+    *pbuf = buf;
+    *psize = nsize;
+    return TRUE;
+}
+
+static void rpc_conn_close(struct rpc_loop* loop, struct rpc_conn* c)
+{
+    sock_reactor_remove(loop->r, c->sock);
+    sock_tcp_destroy(c->sock);
+    rpc_buff_free(loop, &c->in, &c->in_size);
+    rpc_buff_free(loop, &c->out, &c->out_size);
+    list_remove(&loop->conns, &c->node);
+    mem_pool_free(&loop->conn_pool, c);
+    MT_ATOMIC_DECR(loop->srv->conn_cnt);
+}
+
+static int rpc_conn_setevents(struct rpc_loop* loop, struct rpc_conn* c, uint events)
+{
+    if (c->events == events)
+        return TRUE;
+    if (IS_FAIL(sock_reactor_modify(loop->r, c->sock, events)))
+        return FALSE;
+    c->events = events;
+    return TRUE;
+}
+
+/* sends pending responses, reading is stopped until client receives all of them */
+static int rpc_conn_flush(struct rpc_loop* loop, struct rpc_conn* c)
+{
+    while (c->out_pos < c->out_len) {
+        ssize_t r = send(c->sock, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+        if (r > 0)  {
+            c->out_pos += (uint)r;
+        }   else if (r < 0 && errno == EINTR)   {
+            continue;
+        }   else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return rpc_conn_setevents(loop, c, SOCK_EVENT_WRITE);
+        }   else    {
+            return FALSE;
+        }
+    }
+
+    c->out_pos = c->out_len = 0;
+    rpc_buff_free(loop, &c->out, &c->out_size);
+    return rpc_conn_setevents(loop, c, SOCK_EVENT_READ);
+}
+
+static int rpc_conn_respond(struct rpc_loop* loop, struct rpc_conn* c, const void* data, uint size)
+{
+    if (!rpc_buff_reserve(loop, &c->out, &c->out_size, c->out_len,
+        c->out_len + RPC_SERVER_HEADER_SIZE + size))
+    {
+        return FALSE;
+    }
+
+    uint8* h = (uint8*)c->out + c->out_len;
+    h[0] = (uint8)(size >> 24);
+    h[1] = (uint8)(size >> 16);
+    h[2] = (uint8)(size >> 8);
+    h[3] = (uint8)size;
+    memcpy(h + RPC_SERVER_HEADER_SIZE, data, size);
+    c->out_len += RPC_SERVER_HEADER_SIZE + size;
+    return TRUE;
+}
+
+static int rpc_conn_process(struct rpc_loop* loop, struct rpc_conn* c, const char* msg)
+{
+    struct rpc_result* r = rpc_process(msg);
+    if (r == NULL)
+        r = rpc_return_error(-1, RPC_ERROR_INVALIDREQUEST, "invalid request");
+    if (r == NULL)
+        return FALSE;
+
+    int ok;
+    if (r->type == RPC_RESULT_JSONRPC)
+        ok = rpc_conn_respond(loop, c, r->data.json.json, (uint)r->data.json.json_sz);
+    else
+        ok = rpc_conn_respond(loop, c, r->data.bin.bin, (uint)r->data.bin.bin_sz);
+    rpc_freeresult(r);
+    return ok;
+}
+
+/* receives data and processes all complete messages, responses are sent together */
+static int rpc_conn_read(struct rpc_loop* loop, struct rpc_conn* c)
+{
+    /* one extra byte is always kept to null-terminate messages in place */
+    if (!rpc_buff_reserve(loop, &c->in, &c->in_size, c->in_pos, c->in_pos + 2))
+        return FALSE;
+
+    ssize_t r;
+    do  {
+        r = recv(c->sock, c->in + c->in_pos, c->in_size - c->in_pos - 1, 0);
+    }   while (r < 0 && errno == EINTR);
+    if (r == 0)
+        return FALSE;
+    if (r < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK);
+    c->in_pos += (uint)r;
+
+    uint pos = 0;
+    while (c->in_pos - pos >= RPC_SERVER_HEADER_SIZE)    {
+        const uint8* h = (const uint8*)c->in + pos;
+        uint size = ((uint)h[0] << 24) | ((uint)h[1] << 16) | ((uint)h[2] << 8) | (uint)h[3];
+        if (size > loop->srv->max_msg_size)
+            return FALSE;
+
+        uint msg_end = pos + RPC_SERVER_HEADER_SIZE + size;
+        if (msg_end > c->in_pos)    {
+            /* partial message, make room for the rest of it */
+            if (pos > 0)    {
+                memmove(c->in, c->in + pos, c->in_pos - pos);
+                c->in_pos -= pos;
+                pos = 0;
+            }
+            if (!rpc_buff_reserve(loop, &c->in, &c->in_size, c->in_pos,
+                RPC_SERVER_HEADER_SIZE + size + 1))
+            {
+                return FALSE;
+            }
+            break;
+        }
+
+        char* msg = c->in + pos + RPC_SERVER_HEADER_SIZE;
+        char term = msg[size];
+        msg[size] = 0;
+        int ok = rpc_conn_process(loop, c, msg);
+        msg[size] = term;
+        if (!ok)
+            return FALSE;
+        pos = msg_end;
+    }
+
+    if (pos > 0)    {
+        c->in_pos -= pos;
+        if (c->in_pos > 0)
+            memmove(c->in, c->in + pos, c->in_pos);
+    }
+    if (c->in_pos == 0)
+        rpc_buff_free(loop, &c->in, &c->in_size);
+
+    return (c->out_len > 0) ? rpc_conn_flush(loop, c) : TRUE;
+}
+
+static void rpc_conn_event(socket_t sock, uint events, void* param)
+{
+    struct rpc_conn* c = (struct rpc_conn*)param;
+    struct rpc_loop* loop = c->loop;
+    int ok = TRUE;
+
+    /* errors are detected by the failing send/recv */
+    if (c->out_len > 0) {
+        if (BIT_CHECK(events, SOCK_EVENT_WRITE | SOCK_EVENT_ERROR))
+            ok = rpc_conn_flush(loop, c);
+    }   else if (BIT_CHECK(events, SOCK_EVENT_READ | SOCK_EVENT_ERROR))   {
+        ok = rpc_conn_read(loop, c);
+    }
+
+    if (!ok)
+        rpc_conn_close(loop, c);
+}
+
+static void rpc_loop_accept(socket_t sock, uint events, void* param)
+{
+    struct rpc_loop* loop = (struct rpc_loop*)param;
+    struct rpc_server* srv = loop->srv;
+    socket_t csock;
+
+    while ((csock = sock_tcp_accept(sock, NULL)) != SOCK_NULL)   {
+        if (MT_ATOMIC_INCR(srv->conn_cnt) > srv->max_conns && srv->max_conns > 0) {
+            MT_ATOMIC_DECR(srv->conn_cnt);
+            sock_tcp_destroy(csock);
+            continue;
+        }
+
+        struct rpc_conn* c = (struct rpc_conn*)mem_pool_alloc(&loop->conn_pool);
+        if (c == NULL)  {
+            MT_ATOMIC_DECR(srv->conn_cnt);
+            sock_tcp_destroy(csock);
+            continue;
+        }
+        memset(c, 0x00, sizeof(struct rpc_conn));
+        c->sock = csock;
+        c->loop = loop;
+        c->events = SOCK_EVENT_READ;
+
+        /* responses are small and should not wait for more data */
+        sock_tcp_setnodelay(csock, TRUE);
+#if defined(SO_NOSIGPIPE)
+        int opt = 1;
+        setsockopt(csock, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+
+        if (IS_FAIL(sock_setnonblock(csock, TRUE)) ||
+            IS_FAIL(sock_reactor_add(loop->r, csock, c->events, 0, rpc_conn_event, c)))
+        {
+            mem_pool_free(&loop->conn_pool, c);
+            MT_ATOMIC_DECR(srv->conn_cnt);
+            sock_tcp_destroy(csock);
+            continue;
+        }
+        list_add(&loop->conns, &c->node, c);
+    }
+}
+
+static result_t rpc_loop_kernel(mt_thread thread)
+{
+    struct rpc_loop* loop = (struct rpc_loop*)mt_thread_getparam1(thread);
+    sock_reactor_wait(loop->r, MT_TIMEOUT_INFINITE);
+    return loop->srv->quit ? RET_ABORT : RET_OK;
+}
+
+static result_t rpc_loop_init(struct rpc_loop* loop, struct rpc_server* srv)
+{
+    loop->srv = srv;
+    loop->r = sock_reactor_create();
+    if (loop->r == NULL)
+        return RET_FAIL;
+
+    if (IS_FAIL(mem_pool_create(mem_heap(), &loop->conn_pool, sizeof(struct rpc_conn),
+            RPC_SERVER_POOL_BLOCK, 0)) ||
+        IS_FAIL(mem_pool_create(mem_heap(), &loop->buff_pool, RPC_SERVER_BUFFER_SIZE,
+            RPC_SERVER_POOL_BLOCK, 0)))
+    {
+        return RET_OUTOFMEMORY;
+    }
+
+    /* all loops accept from the same socket, but only one of them is woken up for each client */
+    return sock_reactor_add(loop->r, srv->sock, SOCK_EVENT_READ, SOCK_REACTOR_EXCLUSIVE,
+        rpc_loop_accept, loop);
+}
+
+static void rpc_loop_release(struct rpc_loop* loop)
+{
+    if (loop->t != NULL)
+        mt_thread_destroy(loop->t);
+
+    while (loop->conns != NULL)
+        rpc_conn_close(loop, (struct rpc_conn*)loop->conns->data);
+
+    mem_pool_destroy(&loop->buff_pool);
+    mem_pool_destroy(&loop->conn_pool);
+    if (loop->r != NULL)
+        sock_reactor_destroy(loop->r);
+}
+
+struct rpc_server* rpc_server_create(int port, int thread_cnt, int max_conns, uint max_msg_size)
+{
+    struct rpc_server* srv = (struct rpc_server*)ALLOC(sizeof(struct rpc_server), 0);
+    if (srv == NULL)    {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+    memset(srv, 0x00, sizeof(struct rpc_server));
+    srv->sock = SOCK_NULL;
+    srv->max_conns = max_conns;
+    srv->max_msg_size = (max_msg_size != 0) ? max_msg_size : RPC_SERVER_MSG_SIZE;
+    thread_cnt = maxi(thread_cnt, 1);
+
+    /* listening socket, sock_tcp_listen only keeps one pending connection */
+    struct sockaddr_in addr;
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int reuse = 1;
+    srv->sock = sock_tcp_create();
+    if (srv->sock == SOCK_NULL ||
+        setsockopt(srv->sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(srv->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(srv->sock, SOMAXCONN) != 0 ||
+        IS_FAIL(sock_setnonblock(srv->sock, TRUE)))
+    {
+        err_printf(__FILE__, __LINE__, "rpc-server: could not listen on port %d", port);
+        rpc_server_destroy(srv);
+        return NULL;
+    }
+
+    srv->loops = (struct rpc_loop*)ALLOC(sizeof(struct rpc_loop)*thread_cnt, 0);
+    if (srv->loops == NULL)   {
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        rpc_server_destroy(srv);
+        return NULL;
+    }
+    memset(srv->loops, 0x00, sizeof(struct rpc_loop)*thread_cnt);
+
+    for (int i = 0; i < thread_cnt; i++)    {
+        struct rpc_loop* loop = &srv->loops[i];
+        srv->loop_cnt++;
+        if (IS_FAIL(rpc_loop_init(loop, srv)))  {
+            err_print(__FILE__, __LINE__, "rpc-server: could not initialize event loop");
+            rpc_server_destroy(srv);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < thread_cnt; i++)    {
+        struct rpc_loop* loop = &srv->loops[i];
+        loop->t = mt_thread_create(rpc_loop_kernel, NULL, NULL, MT_THREAD_NORMAL, 0, 0, loop, NULL);
+        if (loop->t == NULL)    {
+            err_print(__FILE__, __LINE__, "rpc-server: could not create threads");
+            rpc_server_destroy(srv);
+            return NULL;
+        }
+    }
+
+    return srv;
+}
+
+void rpc_server_destroy(struct rpc_server* srv)
+{
+    MT_ATOMIC_SET(srv->quit, TRUE);
+    for (int i = 0; i < srv->loop_cnt; i++) {
+        if (srv->loops[i].r != NULL)
+            sock_reactor_wakeup(srv->loops[i].r);
+    }
+
+    for (int i = 0; i < srv->loop_cnt; i++)
+        rpc_loop_release(&srv->loops[i]);
+    if (srv->loops != NULL)
+        FREE(srv->loops);
+
+    if (srv->sock != SOCK_NULL)
+        sock_tcp_destroy(srv->sock);
+    FREE(srv);
+}
+
+int rpc_server_getconns(struct rpc_server* srv)
+{
+    return (int)srv->conn_cnt;
+}
+
+#else
+
+struct rpc_server* rpc_server_create(int port, int thread_cnt, int max_conns, uint max_msg_size)
+{
+    err_print(__FILE__, __LINE__, "rpc-server: not supported on this platform");
+    return NULL;
+}
+
+void rpc_server_destroy(struct rpc_server* srv)
+{
+}
+
+int rpc_server_getconns(struct rpc_server* srv)
+{
+    return 0;
+}
+
+#endif
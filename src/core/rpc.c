@@ -8,15 +8,22 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
 
 #include "dhcore/core.h"
 #include "dhcore/stack-alloc.h"
 #include "dhcore/array.h"
 #include "dhcore/json.h"
+#include "dhcore/mt.h"
+#include "dhcore/task-mgr.h"
 
 #include "dhcore/rpc.h"
 
 #define MAX_COMMAND_LIST    128
+#define RPC_CTX_MEM_SIZE    (64*1024)   /* per-thread memory for requests and value blocks */
+#define RPC_OUT_SIZE        1024
 
 /* types */
 struct rpc_cmd
@@ -29,16 +36,79 @@ struct rpc_cmd
     void* user_param;
     pfn_rpc_cmd run_fn;
     char desc[256];
+    uint flags; /* combination of rpc_cmd_flag */
+
+    /* resolved on registration, shared by value blocks of all calls */
+    struct hashtable_fixed param_tbl;   /* key: name(hash), value: index to value */
+    struct hashtable_fixed result_tbl;
+    uint param_buffsz;
+    uint result_buffsz;
+};
+
+struct rpc_ctx;
+
+/* results are allocated with their owner, results of rpc_process are reused by each thread */
+struct rpc_resultblock
+{
+    struct rpc_result r;    /* must be first */
+    struct rpc_ctx* ctx;    /* owner context, NULL if it's allocated from heap */
+};
+
+/* per-thread context, rpc_process doesn't touch the heap after it's created */
+struct rpc_ctx
+{
+    struct rpc_ctx* next;
+    struct stack_alloc stack;   /* parsed requests and value blocks, reset after each call */
+    struct allocator alloc;
+    struct rpc_resultblock result;
+    atom_t result_used;  /* result is given to the user and not freed yet */
+    char* out;  /* result buffer, kept between calls */
+    size_t out_size;
+};
+
+/* result writer */
+struct rpc_out
+{
+    char* buf;
+    size_t pos;
+    size_t size;
+    int failed;
+};
+
+/* single request, resolved before it runs */
+struct rpc_request
+{
+    const char* method; /* NULL if request is not an object */
+    struct rpc_cmd* cmd;    /* NULL if method is not found */
+    json_t jparams;
+    int id;
+    struct rpc_result* r;   /* result of thread-safe commands, filled by workers */
+};
+
+/* batch request, thread-safe commands are pulled by task-mgr workers */
+struct rpc_batch
+{
+    struct rpc_request* reqs;
+    int* mt_idxs;   /* index to thread-safe requests */
+    int mt_cnt;
+    atom_t mt_next; /* next thread-safe request to run */
 };
 
 struct rpc_mgr
 {
     struct array cmds;  /* item: rpc_cmd */
     struct hashtable_open cmd_tbl;  /* key: name, value: cmd_id */
+    mt_mutex ctx_mtx;
+    struct rpc_ctx* ctxs;   /* contexts of all threads, released with the manager */
+    mt_mutex cmd_mtx;   /* serializes commands that are not thread-safe */
 };
 
 /* globals */
 static struct rpc_mgr* g_rpc = NULL;
+static uint g_rpc_gen = 0;  /* incremented on init, invalidates thread contexts of previous runs */
+static THREAD_LOCAL struct rpc_ctx* g_rpc_ctx = NULL;
+static THREAD_LOCAL uint g_rpc_ctx_gen = 0;
+static THREAD_LOCAL int g_rpc_cmd_locked = FALSE;  /* thread holds cmd_mtx (nested calls) */
 
 /*************************************************************************************************/
 INLINE struct rpc_cmd* rpc_cmd_get(uint id)
@@ -193,6 +263,31 @@ struct rpc_vblock* rpc_vblock_create(const struct rpc_value* values, uint value_
     return vb;
 }
 
+/* creates value block of a call from command's resolved table, table is shared and not copied */
+static struct rpc_vblock* rpc_vblock_createfrom(struct allocator* alloc,
+    const struct rpc_value* values, uint value_cnt, const struct hashtable_fixed* vtbl,
+    uint buff_sz)
+{
+    size_t values_sz = sizeof(struct rpc_value)*value_cnt;
+    uint8* block = (uint8*)A_ALIGNED_ALLOC(alloc,
+        sizeof(struct rpc_vblock) + values_sz + buff_sz, 0);
+    if (block == NULL)
+        return NULL;
+
+    struct rpc_vblock* vb = (struct rpc_vblock*)block;
+    vb->alloc = alloc;
+    vb->value_cnt = value_cnt;
+    vb->values = (struct rpc_value*)(block + sizeof(struct rpc_vblock));
+    if (value_cnt > 0)
+        memcpy(vb->values, values, values_sz);
+    vb->vtbl = *vtbl;
+    vb->buff_size = buff_sz;
+    vb->buff = block + sizeof(struct rpc_vblock) + values_sz;
+    memset(vb->buff, 0x00, buff_sz);
+
+    return vb;
+}
+
 void rpc_vblock_destroy(struct rpc_vblock* vb)
 {
     A_ALIGNED_FREE(vb->alloc, vb);
@@ -425,6 +520,288 @@ void rpc_vblock_set_arrcnt(struct rpc_vblock* vb, uint name_hash, int cnt)
     }
 }
 
+/*************************************************************************************************/
+/* returns context of the calling thread, NULL if it's not created yet */
+static struct rpc_ctx* rpc_ctx_get()
+{
+    return (g_rpc_ctx_gen == g_rpc_gen) ? g_rpc_ctx : NULL;
+}
+
+static struct rpc_ctx* rpc_ctx_create()
+{
+    struct rpc_ctx* ctx = (struct rpc_ctx*)ALLOC(sizeof(struct rpc_ctx), 0);
+    if (ctx == NULL)
+        return NULL;
+    memset(ctx, 0x00, sizeof(struct rpc_ctx));
+
+    if (IS_FAIL(mem_stack_create(mem_heap(), &ctx->stack, RPC_CTX_MEM_SIZE, 0)))   {
+        FREE(ctx);
+        return NULL;
+    }
+    mem_stack_bindalloc(&ctx->stack, &ctx->alloc);
+    ctx->result.ctx = ctx;
+
+    mt_mutex_lock(&g_rpc->ctx_mtx);
+    ctx->next = g_rpc->ctxs;
+    g_rpc->ctxs = ctx;
+    mt_mutex_unlock(&g_rpc->ctx_mtx);
+
+    g_rpc_ctx = ctx;
+    g_rpc_ctx_gen = g_rpc_gen;
+    return ctx;
+}
+
+static void rpc_ctx_destroy(struct rpc_ctx* ctx)
+{
+    if (ctx->out != NULL)
+        FREE(ctx->out);
+    mem_stack_destroy(&ctx->stack);
+    FREE(ctx);
+}
+
+static int rpc_out_reserve(struct rpc_out* o, size_t size)
+{
+    if (o->pos + size <= o->size)
+        return TRUE;
+    if (o->failed)
+        return FALSE;
+
+    size_t nsize = maxsz(maxsz(o->size << 1, RPC_OUT_SIZE), o->pos + size);
+    char* buf = (char*)REALLOC(o->buf, nsize, 0);
+    if (buf == NULL)    {
+        o->failed = TRUE;
+        return FALSE;
+    }
+    o->buf = buf;
+    o->size = nsize;
+    return TRUE;
+}
+
+static void rpc_out_write(struct rpc_out* o, const char* s, size_t len)
+{
+    if (rpc_out_reserve(o, len))    {
+        memcpy(o->buf + o->pos, s, len);
+        o->pos += len;
+    }
+}
+
+INLINE void rpc_out_putc(struct rpc_out* o, char c)
+{
+    if (rpc_out_reserve(o, 1))
+        o->buf[o->pos++] = c;
+}
+
+static void rpc_out_int(struct rpc_out* o, int n)
+{
+    char num[16];
+    rpc_out_write(o, num, (size_t)snprintf(num, sizeof(num), "%d", n));
+}
+
+/* same formatting as JSON numbers that are written by json_savetobuffer */
+static void rpc_out_float(struct rpc_out* o, float f)
+{
+    char num[64];
+    fl64 d = (fl64)f;
+    int len;
+    if (d <= INT_MAX && d >= INT_MIN && fabs((fl64)(int)d - d) <= DBL_EPSILON)
+        len = snprintf(num, sizeof(num), "%d", (int)d);
+    else if (fabs(floor(d) - d) <= DBL_EPSILON && fabs(d) < 1.0e60)
+        len = snprintf(num, sizeof(num), "%.0f", d);
+    else if (fabs(d) < 1.0e-6 || fabs(d) > 1.0e9)
+        len = snprintf(num, sizeof(num), "%e", d);
+    else
+        len = snprintf(num, sizeof(num), "%f", d);
+    rpc_out_write(o, num, (size_t)len);
+}
+
+/* writes quoted string, value strings are not zero-terminated if they fill their whole stride */
+static void rpc_out_str(struct rpc_out* o, const char* s, size_t max_len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    rpc_out_putc(o, '"');
+    for (size_t i = 0; i < max_len && s[i] != 0; i++)  {
+        uint8 c = (uint8)s[i];
+        if (c > 31 && c != '"' && c != '\\')  {
+            rpc_out_putc(o, (char)c);
+            continue;
+        }
+
+        char esc[6] = {'\\', 0, 0, 0, 0, 0};
+        size_t len = 2;
+        switch (c)  {
+        case '\\':  esc[1] = '\\';  break;
+        case '"':   esc[1] = '"';   break;
+        case '\b':  esc[1] = 'b';   break;
+        case '\f':  esc[1] = 'f';   break;
+        case '\n':  esc[1] = 'n';   break;
+        case '\r':  esc[1] = 'r';   break;
+        case '\t':  esc[1] = 't';   break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            len = 6;
+            break;
+        }
+        rpc_out_write(o, esc, len);
+    }
+    rpc_out_putc(o, '"');
+}
+
+/* writes a value of the block as JSON, values are accessed by their offsets (no name lookups) */
+static void rpc_out_value(struct rpc_out* o, const struct rpc_vblock* vb,
+                          const struct rpc_value* value)
+{
+    const uint8* data = vb->buff + value->offset;
+    int cnt = 0;
+
+    switch (value->type)    {
+    case RPC_VALUE_INT:
+    case RPC_VALUE_BOOL:
+        if (value->type == RPC_VALUE_BOOL)  {
+            if (*((const int*)data))
+                rpc_out_write(o, "true", 4);
+            else
+                rpc_out_write(o, "false", 5);
+        }   else    {
+            rpc_out_int(o, *((const int*)data));
+        }
+        return;
+    case RPC_VALUE_FLOAT:
+        rpc_out_float(o, *((const float*)data));
+        return;
+    case RPC_VALUE_STRING:
+        rpc_out_str(o, (const char*)data, value->stride);
+        return;
+
+    case RPC_VALUE_INT2:
+    case RPC_VALUE_INT3:
+    case RPC_VALUE_INT4:
+        cnt = 2 + (int)(value->type - RPC_VALUE_INT2);
+        rpc_out_putc(o, '[');
+        for (int i = 0; i < cnt; i++)   {
+            if (i != 0)
+                rpc_out_putc(o, ',');
+            rpc_out_int(o, ((const int*)data)[i]);
+        }
+        rpc_out_putc(o, ']');
+        return;
+
+    case RPC_VALUE_FLOAT2:
+    case RPC_VALUE_FLOAT3:
+    case RPC_VALUE_FLOAT4:
+        cnt = 2 + (int)(value->type - RPC_VALUE_FLOAT2);
+        rpc_out_putc(o, '[');
+        for (int i = 0; i < cnt; i++)   {
+            if (i != 0)
+                rpc_out_putc(o, ',');
+            rpc_out_float(o, ((const float*)data)[i]);
+        }
+        rpc_out_putc(o, ']');
+        return;
+
+    case RPC_VALUE_INT_ARRAY:
+    case RPC_VALUE_STRING_ARRAY:
+        rpc_out_putc(o, '[');
+        for (int i = 0; i < value->array_cnt; i++)   {
+            if (i != 0)
+                rpc_out_putc(o, ',');
+            if (value->type == RPC_VALUE_INT_ARRAY)
+                rpc_out_int(o, *((const int*)(data + value->stride*i)));
+            else
+                rpc_out_str(o, (const char*)(data + value->stride*i), value->stride);
+        }
+        rpc_out_putc(o, ']');
+        return;
+
+    default:
+        rpc_out_write(o, "null", 4);
+        return;
+    }
+}
+
+/* writes response object of the call */
+static void rpc_out_result(struct rpc_out* o, const struct rpc_vblock* ret, int id,
+                           const struct rpc_error* err)
+{
+    rpc_out_write(o, "{\"id\":", 6);
+    rpc_out_int(o, id);
+    if (ret != NULL)    {
+        rpc_out_write(o, ",\"result\":{", 11);
+        for (uint i = 0; i < ret->value_cnt; i++)   {
+            const struct rpc_value* value = &ret->values[i];
+            if (i != 0)
+                rpc_out_putc(o, ',');
+            rpc_out_str(o, value->name, strlen(value->name));
+            rpc_out_putc(o, ':');
+            rpc_out_value(o, ret, value);
+        }
+        rpc_out_write(o, "},\"error\":null}", 15);
+    }   else    {
+        rpc_out_write(o, ",\"result\":null,\"error\":{\"code\":", 31);
+        rpc_out_int(o, (int)err->code);
+        rpc_out_write(o, ",\"description\":", 15);
+        rpc_out_str(o, err->desc, sizeof(err->desc));
+        rpc_out_write(o, "}}", 2);
+    }
+}
+
+/* reads JSON parameter into it's value, values are accessed by their offsets (no name lookups) */
+static void rpc_in_value(struct rpc_vblock* vb, struct rpc_value* value, json_t jp)
+{
+    uint8* data = vb->buff + value->offset;
+    int cnt;
+
+    switch (value->type)    {
+    case RPC_VALUE_INT:
+    case RPC_VALUE_BOOL:
+        *((int*)data) = json_geti(jp);
+        break;
+    case RPC_VALUE_FLOAT:
+        *((float*)data) = json_getf(jp);
+        break;
+    case RPC_VALUE_STRING:
+        if (value->stride > 0)
+            str_safecpy((char*)data, value->stride, json_gets(jp));
+        break;
+
+    case RPC_VALUE_INT2:
+    case RPC_VALUE_INT3:
+    case RPC_VALUE_INT4:
+        cnt = mini(json_getarr_count(jp), 2 + (int)(value->type - RPC_VALUE_INT2));
+        for (int i = 0; i < cnt; i++)
+            ((int*)data)[i] = json_geti(json_getarr_item(jp, i));
+        break;
+
+    case RPC_VALUE_FLOAT2:
+    case RPC_VALUE_FLOAT3:
+    case RPC_VALUE_FLOAT4:
+        cnt = mini(json_getarr_count(jp), 2 + (int)(value->type - RPC_VALUE_FLOAT2));
+        for (int i = 0; i < cnt; i++)
+            ((float*)data)[i] = json_getf(json_getarr_item(jp, i));
+        break;
+
+    case RPC_VALUE_INT_ARRAY:
+    case RPC_VALUE_STRING_ARRAY:
+        cnt = mini(json_getarr_count(jp), value->array_cnt);
+        for (int i = 0; i < cnt; i++)   {
+            uint8* item = data + value->stride*i;
+            if (value->type == RPC_VALUE_INT_ARRAY)
+                *((int*)item) = json_geti(json_getarr_item(jp, i));
+            else if (value->stride > 0)
+                str_safecpy((char*)item, value->stride, json_gets(json_getarr_item(jp, i)));
+        }
+        value->array_cnt = cnt;
+        break;
+
+    default:
+        break;
+    }
+}
+
 result_t rpc_init()
 {
     if (g_rpc != NULL) 
@@ -446,6 +823,10 @@ result_t rpc_init()
     if (IS_FAIL(r))
         return err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
 
+    mt_mutex_init(&g_rpc->ctx_mtx);
+    mt_mutex_init(&g_rpc->cmd_mtx);
+    g_rpc_gen++;
+
     /* register help method */
     const struct rpc_value help_params[] = {
         {"Name", RPC_VALUE_STRING, 0, 32, 1, FALSE}
@@ -465,8 +846,8 @@ result_t rpc_init()
     const struct rpc_value list_result[] = {
         {"Methods", RPC_VALUE_STRING_ARRAY, 0, 32, MAX_COMMAND_LIST, FALSE}
     };
-    rpc_registercmd("ListMethods", rpc_method_listmethods, NULL, 0, list_result, 1, 
-        "", NULL);
+    rpc_registercmd_ex("ListMethods", rpc_method_listmethods, NULL, 0, list_result, 1, 
+        "", NULL, RPC_CMD_THREADSAFE);
 
     return RET_OK;
 }
@@ -482,9 +863,22 @@ void rpc_release()
                 FREE(c->params);
             if (c->results != NULL)
                 FREE(c->results);
+            hashtable_fixed_destroy(&c->param_tbl);
+            hashtable_fixed_destroy(&c->result_tbl);
         }
         arr_destroy(&g_rpc->cmds);
 
+        /* contexts of other threads are invalidated by the next init */
+        struct rpc_ctx* ctx = g_rpc->ctxs;
+        while (ctx != NULL) {
+            struct rpc_ctx* next = ctx->next;
+            rpc_ctx_destroy(ctx);
+            ctx = next;
+        }
+        g_rpc_ctx = NULL;
+        mt_mutex_release(&g_rpc->ctx_mtx);
+        mt_mutex_release(&g_rpc->cmd_mtx);
+
         FREE(g_rpc);
         g_rpc = NULL;
 
@@ -510,276 +904,359 @@ struct rpc_result* rpc_return_error(int id, enum rpc_error_code code, const char
     return rpc_make_result(NULL, id, &err);
 }
 
-struct rpc_result* rpc_process(const char* json_rpc)
+/* parses params into value blocks of the call and runs the command */
+static struct rpc_result* rpc_runcmd(struct rpc_cmd* cmd, json_t jparams, int id,
+                                     struct allocator* alloc)
 {
-    /* parse json */
-    json_t jroot = json_parsestring(json_rpc);
-    if (jroot == NULL)  {
-        err_printf(__FILE__, __LINE__, "JSON-RPC: parsing json '%s' failed", json_rpc);
+    struct rpc_vblock* vbparams = rpc_vblock_createfrom(alloc, cmd->params, cmd->param_cnt,
+        &cmd->param_tbl, cmd->param_buffsz);
+    struct rpc_vblock* vbres = rpc_vblock_createfrom(alloc, cmd->results, cmd->result_cnt,
+        &cmd->result_tbl, cmd->result_buffsz);
+    if (vbparams == NULL || vbres == NULL)  {
+        if (vbres != NULL)
+            rpc_vblock_destroy(vbres);
+        if (vbparams != NULL)
+            rpc_vblock_destroy(vbparams);
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
         return NULL;
     }
-    
-    /* get method and ID */
-    const char* method = json_gets_child(jroot, "method", "");
-    int id = json_geti_child(jroot, "id", -1);
-    json_t jparams = json_getitem(jroot, "params");
-
-    uint cmd_id = rpc_cmd_find(method);
-    if (cmd_id == 0)    {
-        json_destroy(jroot);
-        return rpc_return_error(id, RPC_ERROR_METHODNOTFOUND, "method '%s' not found", method);
-    }
-    struct rpc_cmd* cmd = rpc_cmd_get(cmd_id);
 
-    /* create and parse params */
-    struct rpc_vblock* vbparams = NULL;
-
-    vbparams = rpc_vblock_create(cmd->params, cmd->param_cnt, mem_heap());
-    ASSERT(vbparams);
+    struct rpc_result* r = NULL;
     if (jparams != NULL)    {
         for (int i = 0; i < cmd->param_cnt; i++)    {
-            struct rpc_value* p = &cmd->params[i];
+            struct rpc_value* p = &vbparams->values[i];
 
             json_t jp = json_getitem(jparams, p->name);
             if (jp != NULL) {
-                enum rpc_value_type type = rpc_vblock_gettype(vbparams, hash_str(p->name));
-                if (type == RPC_VALUE_NULL) {
-                    json_destroy(jroot);
-                    rpc_vblock_destroy(vbparams);
-                    return rpc_return_error(id, RPC_ERROR_INVALIDARGS, "parameter '%s' doesn't exist"
+                if (p->type == RPC_VALUE_NULL) {
+                    r = rpc_return_error(id, RPC_ERROR_INVALIDARGS, "parameter '%s' doesn't exist"
                         " in method signature", p->name);
-                }
-                switch (type)   {
-                    case RPC_VALUE_INT:
-                    rpc_vblock_seti(vbparams, hash_str(p->name), json_geti(jp));
-                    break;
-                    case RPC_VALUE_INT2:
-                    {
-                        struct vec2i v;
-                        for (int i = 0, c = mini(json_getarr_count(jp), 2); i < c; i++)
-                            v.n[i] = json_geti(json_getarr_item(jp, i));
-                        rpc_vblock_set2i(vbparams, hash_str(p->name), &v);
-                    }
-                    break;
-                    case RPC_VALUE_INT3:
-                    case RPC_VALUE_INT4:
-                    ASSERT(0);
-                    break;
-                    case RPC_VALUE_INT_ARRAY:
-                    {
-                        int max_cnt = p->array_cnt;
-                        uint name_hash = hash_str(p->name);
-                        int c = mini(json_getarr_count(jp), max_cnt);
-                        for (int i = 0; i < c; i++)   {
-                            rpc_vblock_seti_idx(vbparams, name_hash, i,
-                                json_geti(json_getarr_item(jp, i)));
-                        }
-                        rpc_vblock_set_arrcnt(vbparams, name_hash, c);
-                    }
-                    break;
-                    case RPC_VALUE_FLOAT:
-                    rpc_vblock_setf(vbparams, hash_str(p->name), json_getf(jp));
-                    break;
-                    case RPC_VALUE_FLOAT2:
-                    {
-                        struct vec2f v;
-                        for (int i = 0, c = mini(json_getarr_count(jp), 2); i < c; i++)
-                            v.f[i] = json_getf(json_getarr_item(jp, i));
-                        rpc_vblock_set2f(vbparams, hash_str(p->name), &v);
-                    }
-                    break;
-                    case RPC_VALUE_FLOAT3:
-                    {
-                        struct vec3f v;
-                        for (int i = 0, c = mini(json_getarr_count(jp), 3); i < c; i++)
-                            v.f[i] = json_getf(json_getarr_item(jp, i));
-                        rpc_vblock_set3f(vbparams, hash_str(p->name), &v);
-                    }
-                    break;
-                    case RPC_VALUE_FLOAT4:
-                    {
-                        struct vec4f v;
-                        for (int i = 0, c = mini(json_getarr_count(jp), 4); i < c; i++)
-                            v.f[i] = json_getf(json_getarr_item(jp, i));
-                        rpc_vblock_set3f(vbparams, hash_str(p->name), &v);
-                    }
-                    break;
-                    case RPC_VALUE_BOOL:
-                    rpc_vblock_setb(vbparams, hash_str(p->name), json_geti(jp));
-                    break;
-                    case RPC_VALUE_STRING:
-                    rpc_vblock_sets(vbparams, hash_str(p->name), json_gets(jp));
-                    break;
-
-                    case RPC_VALUE_STRING_ARRAY:
-                    {
-                        int max_cnt = p->array_cnt;
-                        uint name_hash = hash_str(p->name);
-                        int c = mini(json_getarr_count(jp), max_cnt);
-                        for (int i = 0; i < c; i++)   {
-                            rpc_vblock_sets_idx(vbparams, name_hash, i, 
-                                json_gets(json_getarr_item(jp, i)));
-                        }
-                        rpc_vblock_set_arrcnt(vbparams, name_hash, c);
-                    }
-                    break;                    
-                    default:
                     break;
                 }
+                rpc_in_value(vbparams, p, jp);
             }   else if (!p->optional)  {
-                json_destroy(jroot);
-                rpc_vblock_destroy(vbparams);
-                return rpc_return_error(id, RPC_ERROR_INVALIDARGS, "missing paramter '%s'", p->name);
+                r = rpc_return_error(id, RPC_ERROR_INVALIDARGS, "missing paramter '%s'", p->name);
+                break;
             }
         }
     }   /*endif: jparams != NULL */
 
-    /* run method */
-    struct rpc_vblock* vbres = rpc_vblock_create(cmd->results, cmd->result_cnt, mem_heap());
-    ASSERT(vbres);
-    struct rpc_result* r = cmd->run_fn(vbres, vbparams, id, cmd->user_param);
+    /* run method, commands that are not thread-safe never run at the same time */
+    if (r == NULL)  {
+        if (!BIT_CHECK(cmd->flags, RPC_CMD_THREADSAFE) && !g_rpc_cmd_locked)  {
+            mt_mutex_lock(&g_rpc->cmd_mtx);
+            g_rpc_cmd_locked = TRUE;
+            r = cmd->run_fn(vbres, vbparams, id, cmd->user_param);
+            g_rpc_cmd_locked = FALSE;
+            mt_mutex_unlock(&g_rpc->cmd_mtx);
+        }   else    {
+            r = cmd->run_fn(vbres, vbparams, id, cmd->user_param);
+        }
+    }
     rpc_vblock_destroy(vbres);
     rpc_vblock_destroy(vbparams);
 
     return r;
 }
 
-struct rpc_result* rpc_make_result(struct rpc_vblock* ret, int id, struct rpc_error* err)
+/* get method, ID and params of the request */
+static void rpc_request_resolve(struct rpc_request* req, json_t jreq)
 {
-    json_t jroot = json_create_obj();    
-    json_additem_toobj(jroot, "id", json_create_num(id));
-    if (ret != NULL)    {
-        json_t jresult = json_create_obj();
+    memset(req, 0x00, sizeof(struct rpc_request));
+    req->id = -1;
+    if (json_gettype(jreq) != JSON_OBJECT)
+        return;
+
+    req->method = json_gets_child(jreq, "method", "");
+    req->id = json_geti_child(jreq, "id", -1);
+    req->jparams = json_getitem(jreq, "params");
+
+    uint cmd_id = rpc_cmd_find(req->method);
+    if (cmd_id != 0)
+        req->cmd = rpc_cmd_get(cmd_id);
+}
 
-        for (uint i = 0; i < ret->value_cnt; i++)   {
-            struct rpc_value* value = &ret->values[i];
-            switch (value->type)    {
-                case RPC_VALUE_INT:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_num(rpc_vblock_geti(ret, hash_str(value->name))));
-                break;
-                case RPC_VALUE_INT_ARRAY:
-                {
-                    uint name_hash = hash_str(value->name);
-                    json_t jints = json_create_arr();
-                    for (int k = 0; k< value->array_cnt; k++)    {
-                        json_additem_toarr(jints, 
-                            json_create_num(rpc_vblock_geti_idx(ret, name_hash, k)));
-                    }
-                    json_additem_toobj(jresult, value->name, jints);
-                }
-                break;
-                case RPC_VALUE_INT2:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_arri(rpc_vblock_get2i(ret, hash_str(value->name)).n, 2));
-                break;
-                case RPC_VALUE_INT3:
-                case RPC_VALUE_INT4:
-                ASSERT(0);
-                case RPC_VALUE_FLOAT:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_num(rpc_vblock_getf(ret, hash_str(value->name))));
-                break;
-                case RPC_VALUE_FLOAT2:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_arrf(rpc_vblock_get2f(ret, hash_str(value->name)).f, 2));
-                break;
-                case RPC_VALUE_FLOAT3:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_arrf(rpc_vblock_get3f(ret, hash_str(value->name)).f, 3));
-                break;
-                case RPC_VALUE_FLOAT4:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_arrf(rpc_vblock_get4f(ret, hash_str(value->name)).f, 4));
-                break;
-                case RPC_VALUE_BOOL:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_bool(rpc_vblock_getb(ret, hash_str(value->name))));
-                break;
-                case RPC_VALUE_STRING:
-                json_additem_toobj(jresult, value->name, 
-                    json_create_str(rpc_vblock_gets(ret, hash_str(value->name))));
-                break;
-                case RPC_VALUE_STRING_ARRAY:
-                {
-                    uint name_hash = hash_str(value->name);
-                    json_t jstrs = json_create_arr();
-                    for (int k = 0; k< value->array_cnt; k++)    {
-                        json_additem_toarr(jstrs, 
-                            json_create_str(rpc_vblock_gets_idx(ret, name_hash, k)));
-                    }
-                    json_additem_toobj(jresult, value->name, jstrs);
-                }
-                break;
-                default:
-                ASSERT(0);
-            }
-        }
-        json_additem_toobj(jroot, "result", jresult);
-        json_additem_toobj(jroot, "error", json_create_null());
-    }   else if (err != NULL)   {
-        json_additem_toobj(jroot, "result", json_create_null());
-        json_t jerr = json_create_obj();
-        json_additem_toobj(jerr, "code", json_create_num((fl64)err->code));
-        json_additem_toobj(jerr, "description", json_create_str(err->desc));
-        json_additem_toobj(jroot, "error", jerr);
+static struct rpc_result* rpc_request_run(const struct rpc_request* req, struct allocator* alloc)
+{
+    if (req->cmd != NULL)
+        return rpc_runcmd(req->cmd, req->jparams, req->id, alloc);
+    else if (req->method != NULL)
+        return rpc_return_error(req->id, RPC_ERROR_METHODNOTFOUND, "method '%s' not found", req->method);
+    else
+        return rpc_return_error(req->id, RPC_ERROR_INVALIDREQUEST, "invalid request");
+}
+
+/* adds result of a batch item to the response array, and frees the result */
+static void rpc_batch_addresult(struct rpc_out* o, struct rpc_result* r, int id)
+{
+    if (o->pos > 1)
+        rpc_out_putc(o, ',');
+
+    if (r->type == RPC_RESULT_JSONRPC)  {
+        rpc_out_write(o, r->data.json.json, r->data.json.json_sz);
     }   else    {
-        json_destroy(jroot);
-        ASSERT(0);
+        struct rpc_error err;
+        err.code = RPC_ERROR_INVALIDREQUEST;
+        str_safecpy(err.desc, sizeof(err.desc), "binary results are not supported in batch requests");
+        rpc_out_result(o, NULL, id, &err);
     }
-    struct rpc_result* r = (struct rpc_result*)ALLOC(sizeof(struct rpc_result), 0);
+    rpc_freeresult(r);
+}
+
+/* runs in task-mgr workers and the caller, each one pulls thread-safe requests until they are done */
+static void rpc_batch_task(void* params, void* result, uint thread_id, uint job_id, int worker_idx)
+{
+    struct rpc_batch* b = (struct rpc_batch*)params;
+    struct rpc_ctx* ctx = rpc_ctx_get();
+    if (ctx == NULL)
+        ctx = rpc_ctx_create();
 
-    if (r != NULL)  {
-        r->type = RPC_RESULT_JSONRPC;
-        r->data.json.json_sz = 0;
-#ifdef _DEBUG_
-        int trim = FALSE;
-#else
-        int trim = TRUE;
-#endif
-        r->data.json.json = json_savetobuffer(jroot, &r->data.json.json_sz, trim);
+    int i;
+    while ((i = (int)MT_ATOMIC_INCR(b->mt_next) - 1) < b->mt_cnt)  {
+        struct rpc_request* req = &b->reqs[b->mt_idxs[i]];
+        if (ctx != NULL)    {
+            mem_stack_save(&ctx->stack);
+            req->r = rpc_request_run(req, &ctx->alloc);
+            mem_stack_load(&ctx->stack);
+        }   else    {
+            req->r = rpc_request_run(req, mem_heap());
+        }
+    }
+}
+
+/* responses of batch are written in the order they are finished, which is allowed by JSON-RPC */
+static struct rpc_result* rpc_process_batchreq(json_t jroot, struct rpc_ctx* ctx, int parallel)
+{
+    int cnt = json_getarr_count(jroot);
+    if (cnt == 0)
+        return rpc_return_error(-1, RPC_ERROR_INVALIDREQUEST, "empty batch request");
+
+    struct rpc_batch b;
+    memset(&b, 0x00, sizeof(b));
+    b.reqs = (struct rpc_request*)A_ALLOC(&ctx->alloc, sizeof(struct rpc_request)*cnt, 0);
+    b.mt_idxs = (int*)A_ALLOC(&ctx->alloc, sizeof(int)*cnt, 0);
+    struct rpc_resultblock* rb = (struct rpc_resultblock*)ALLOC(sizeof(struct rpc_resultblock), 0);
+    if (b.reqs == NULL || b.mt_idxs == NULL || rb == NULL) {
+        if (rb != NULL)
+            FREE(rb);
+        if (b.mt_idxs != NULL)
+            A_FREE(&ctx->alloc, b.mt_idxs);
+        if (b.reqs != NULL)
+            A_FREE(&ctx->alloc, b.reqs);
+        err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+        return NULL;
+    }
+    memset(rb, 0x00, sizeof(struct rpc_resultblock));
+
+    for (int i = 0; i < cnt; i++)   {
+        struct rpc_request* req = &b.reqs[i];
+        rpc_request_resolve(req, json_getarr_item(jroot, i));
+        if (parallel && req->cmd != NULL && BIT_CHECK(req->cmd->flags, RPC_CMD_THREADSAFE))
+            b.mt_idxs[b.mt_cnt++] = i;
+    }
+
+    /* thread-safe commands go to workers, caller keeps one of them for itself */
+    uint job_id = 0;
+    if (b.mt_cnt > 1)
+        job_id = tsk_dispatch(rpc_batch_task, TSK_CONTEXT_ALL_NO_MAIN, b.mt_cnt - 1, &b, NULL);
+
+    struct rpc_out o;
+    memset(&o, 0x00, sizeof(o));
+    rpc_out_putc(&o, '[');
+
+    /* caller runs the rest of the commands in order, then helps the workers */
+    int mt_idx = 0;
+    for (int i = 0; i < cnt; i++)   {
+        if (mt_idx < b.mt_cnt && b.mt_idxs[mt_idx] == i)    {
+            mt_idx++;
+            continue;
+        }
+
+        struct rpc_request* req = &b.reqs[i];
+        mem_stack_save(&ctx->stack);
+        struct rpc_result* r = rpc_request_run(req, &ctx->alloc);
+        mem_stack_load(&ctx->stack);
+        if (r != NULL)
+            rpc_batch_addresult(&o, r, req->id);
+    }
+
+    rpc_batch_task(&b, NULL, 0, job_id, -1);
+    if (job_id != 0)    {
+        tsk_wait(job_id);
+        tsk_destroy(job_id);
+    }
+
+    for (int i = 0; i < b.mt_cnt; i++)  {
+        struct rpc_request* req = &b.reqs[b.mt_idxs[i]];
+        if (req->r != NULL)
+            rpc_batch_addresult(&o, req->r, req->id);
     }
-    json_destroy(jroot);
 
+    rpc_out_putc(&o, ']');
+    rpc_out_putc(&o, 0);
+
+    A_FREE(&ctx->alloc, b.mt_idxs);
+    A_FREE(&ctx->alloc, b.reqs);
+
+    if (o.failed)   {
+        if (o.buf != NULL)
+            FREE(o.buf);
+        FREE(rb);
+        return NULL;
+    }
+
+    rb->r.type = RPC_RESULT_JSONRPC;
+    rb->r.data.json.json = o.buf;
+    rb->r.data.json.json_sz = o.pos - 1;
+    return &rb->r;
+}
+
+static struct rpc_result* rpc_process_json(const char* json_rpc, int parallel)
+{
+    /* request and value blocks are allocated from thread's stack memory, which is restored
+     * when we are done (calls can be nested) */
+    struct rpc_ctx* ctx = rpc_ctx_get();
+    if (ctx == NULL)    {
+        ctx = rpc_ctx_create();
+        if (ctx == NULL)    {
+            err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+            return NULL;
+        }
+    }
+    mem_stack_save(&ctx->stack);
+
+    /* parse json */
+    json_t jroot = json_parsebuffer(json_rpc, strlen(json_rpc), &ctx->alloc);
+    if (jroot == NULL)  {
+        mem_stack_load(&ctx->stack);
+        err_printf(__FILE__, __LINE__, "JSON-RPC: parsing json '%s' failed", json_rpc);
+        return NULL;
+    }
+
+    struct rpc_result* r;
+    if (json_gettype(jroot) == JSON_ARRAY)  {
+        r = rpc_process_batchreq(jroot, ctx, parallel && tsk_isinit());
+    }   else    {
+        struct rpc_request req;
+        rpc_request_resolve(&req, jroot);
+        r = rpc_request_run(&req, &ctx->alloc);
+    }
+
+    json_destroy(jroot);
+    mem_stack_load(&ctx->stack);
     return r;
 }
 
+struct rpc_result* rpc_process(const char* json_rpc)
+{
+    return rpc_process_json(json_rpc, FALSE);
+}
+
+struct rpc_result* rpc_process_batch(const char* json_rpc)
+{
+    return rpc_process_json(json_rpc, TRUE);
+}
+
+struct rpc_result* rpc_make_result(struct rpc_vblock* ret, int id, struct rpc_error* err)
+{
+    ASSERT(ret != NULL || err != NULL);
+
+    /* reuse thread's result if the previous one is freed, results are written straight into
+     * the result buffer */
+    struct rpc_resultblock* rb;
+    struct rpc_out o;
+    memset(&o, 0x00, sizeof(o));
+
+    struct rpc_ctx* ctx = rpc_ctx_get();
+    if (ctx != NULL && !ctx->result_used)   {
+        ctx->result_used = TRUE;
+        rb = &ctx->result;
+        o.buf = ctx->out;
+        o.size = ctx->out_size;
+    }   else    {
+        rb = (struct rpc_resultblock*)ALLOC(sizeof(struct rpc_resultblock), 0);
+        if (rb == NULL)
+            return NULL;
+        memset(rb, 0x00, sizeof(struct rpc_resultblock));
+    }
+
+    rpc_out_result(&o, ret, id, err);
+    rpc_out_putc(&o, 0);
+
+    if (rb->ctx != NULL)    {
+        ctx->out = o.buf;
+        ctx->out_size = o.size;
+    }
+
+    if (o.failed)   {
+        if (rb->ctx != NULL)    {
+            ctx->result_used = FALSE;
+        }   else    {
+            if (o.buf != NULL)
+                FREE(o.buf);
+            FREE(rb);
+        }
+        return NULL;
+    }
+
+    rb->r.type = RPC_RESULT_JSONRPC;
+    rb->r.data.json.json = o.buf;
+    rb->r.data.json.json_sz = o.pos - 1;
+    return &rb->r;
+}
+
 struct rpc_result* rpc_make_result_bin(const void* data, size_t data_sz)
 {
     if (data_sz == 0)
         return NULL;
 
-    struct rpc_result* r = (struct rpc_result*)ALLOC(sizeof(struct rpc_result), 0);
-
-    if (r != NULL)  {
-        r->type = RPC_RESULT_BINARY;
+    struct rpc_resultblock* rb = (struct rpc_resultblock*)ALLOC(sizeof(struct rpc_resultblock), 0);
+    if (rb == NULL)
+        return NULL;
+    memset(rb, 0x00, sizeof(struct rpc_resultblock));
 
-        r->data.bin.bin_sz = data_sz;
-        r->data.bin.bin = ALLOC(data_sz, 0);
-        memcpy(r->data.bin.bin, data, data_sz);
-    }
+    struct rpc_result* r = &rb->r;
+    r->type = RPC_RESULT_BINARY;
+    r->data.bin.bin_sz = data_sz;
+    r->data.bin.bin = ALLOC(data_sz, 0);
+    memcpy(r->data.bin.bin, data, data_sz);
 
     return r;
 }
 
 void rpc_freeresult(struct rpc_result* r)
 {
+    struct rpc_resultblock* rb = (struct rpc_resultblock*)r;
+    if (rb->ctx != NULL)    {
+        /* buffer is kept for the next result of the thread, result may be freed by any thread */
+        MT_ATOMIC_SET(rb->ctx->result_used, FALSE);
+        return;
+    }
+
     switch (r->type)    {
         case RPC_RESULT_JSONRPC:
         if (r->data.json.json != NULL)
-            json_deletebuffer(r->data.json.json);
+            FREE(r->data.json.json);
         break;
         case RPC_RESULT_BINARY:
         if (r->data.bin.bin != NULL)
             FREE(r->data.bin.bin);
         break;
     }
-    FREE(r);
+    FREE(rb);
 }
 
 result_t rpc_registercmd(const char* name, pfn_rpc_cmd run_fn, const struct rpc_value* params, 
     uint param_cnt, const struct rpc_value* results, uint result_cnt, const char* desc, 
     void* user_param)
+{
+    return rpc_registercmd_ex(name, run_fn, params, param_cnt, results, result_cnt, desc,
+        user_param, 0);
+}
+
+result_t rpc_registercmd_ex(const char* name, pfn_rpc_cmd run_fn,
+    const struct rpc_value* params, uint param_cnt, const struct rpc_value* results,
+    uint result_cnt, const char* desc, void* user_param, uint flags)
 {
     ASSERT(run_fn);
     ASSERT(name);
@@ -792,6 +1269,7 @@ result_t rpc_registercmd(const char* name, pfn_rpc_cmd run_fn, const struct rpc_
     str_safecpy(cmd->name, sizeof(cmd->name), name);
     cmd->user_param = user_param;
     cmd->run_fn = run_fn;
+    cmd->flags = flags;
     uint id = g_rpc->cmds.item_cnt;
 
     if (param_cnt > 0)  {
@@ -827,6 +1305,23 @@ result_t rpc_registercmd(const char* name, pfn_rpc_cmd run_fn, const struct rpc_
 
     str_safecpy(cmd->desc, sizeof(cmd->desc), desc);
 
+    /* resolve value names and buffer sizes once, so calls don't hash them */
+    if (IS_FAIL(hashtable_fixed_create(mem_heap(), &cmd->param_tbl, param_cnt, 0)) ||
+        IS_FAIL(hashtable_fixed_create(mem_heap(), &cmd->result_tbl, result_cnt, 0)))
+    {
+        return err_printn(__FILE__, __LINE__, RET_OUTOFMEMORY);
+    }
+    for (uint i = 0; i < param_cnt; i++)    {
+        struct rpc_value* v = &cmd->params[i];
+        hashtable_fixed_add(&cmd->param_tbl, hash_str(v->name), i);
+        cmd->param_buffsz = maxui(cmd->param_buffsz, v->offset + v->stride*v->array_cnt);
+    }
+    for (uint i = 0; i < result_cnt; i++)    {
+        struct rpc_value* v = &cmd->results[i];
+        hashtable_fixed_add(&cmd->result_tbl, hash_str(v->name), i);
+        cmd->result_buffsz = maxui(cmd->result_buffsz, v->offset + v->stride*v->array_cnt);
+    }
+
     /* add to hash-table */
     return hashtable_open_add(&g_rpc->cmd_tbl, hash_str(name), id);    
 }
@@ -223,6 +223,11 @@ void tsk_releasemgr()
     }
 }
 
+int tsk_isinit()
+{
+    return g_tsk != NULL;
+}
+
 static void tsk_thread_release(struct tsk_thread* thread)
 {
     if (thread->t != NULL)
@@ -399,7 +404,10 @@ static void tsk_queuejob(uint job_id, const int* thread_idxs, int thread_cnt, pf
 void tsk_wait(uint job_id)
 {
     struct tsk_job* job = tsk_job_get(job_id);
-    mt_event_waitforall(job->finish_event, MT_TIMEOUT_INFINITE);
+
+    /* jobs that only run in the main thread have no finish event, they are already done */
+    if (job->finish_event != NULL)
+        mt_event_waitforall(job->finish_event, MT_TIMEOUT_INFINITE);
 }
 
 int tsk_check_finished(uint job_id)
@@ -16,8 +16,74 @@
 #include "dhcore/err.h"
 #include "dhcore/mem-mgr.h"
 #include "dhcore/zip.h"
+#include "dhcore/numeric.h"
+#include "dhcore/task-mgr.h"
+#include "dhcore/mt.h"
 #include "miniz/miniz.h"
 
+#define STREAM_CHUNK_MAX 0x40000000  /* maximum bytes that are passed to miniz on each call */
+#define FILE_BUFFER_SIZE (64*1024)  /* compressed data buffer of zip files that are read lazily */
+#define ZIP_LOCALHEADER_SIZE 30
+#define ZIP_LOCALHEADER_SIG 0x04034b50
+#define BLOCKS_SIGN "ZBLK"
+#define BLOCKS_DEFAULT_SIZE (1024*1024)
+
+/*************************************************************************************************
+ * types
+ */
+struct zip_stream
+{
+    mz_stream s;
+    struct allocator* alloc;
+    int deflate;    /* compressor, otherwise it's decompressor */
+    int window_bits;    /* negative for raw deflate streams (zip archive files) */
+    int level;
+};
+
+/* block compressed buffer layout: header, compressed size of each block (uint), blocks data
+ * each block is an independent zlib stream, blocks that can't be compressed are stored raw
+ * (their compressed size equals to their size) */
+#pragma pack(push, 1)
+struct zip_blocks_header
+{
+    char sig[4];
+    uint block_size;
+    uint block_cnt;
+    uint64 size;    /* uncompressed size */
+};
+#pragma pack(pop)
+
+struct zip_blocks_params
+{
+    const uint8* src;
+    uint8* dest;
+    size_t size;    /* uncompressed size */
+    size_t block_size;
+    size_t block_maxsize;   /* compression: maximum compressed size of each block */
+    const size_t* offsets;  /* decompression: offset of each block in 'src' */
+    uint* comp_sizes;
+    uint block_cnt;
+    int level;
+    long volatile next_idx; /* atomic counter, next block to process */
+    long volatile failed;
+};
+
+/* zip archive file that is decompressed on read (see zip_openfile) */
+struct zip_filestream
+{
+    zip_t zip;
+    struct allocator* alloc;
+    zipstream_t inflater;   /* NULL for stored (uncompressed) files */
+    uint64 data_offset; /* offset of file data in the archive */
+    uint64 comp_size;
+    uint64 comp_offset; /* bytes of compressed data that are read from the archive */
+    uint8* buff;    /* compressed data buffer */
+    size_t buff_offset;
+    size_t buff_size;
+};
+
+static int zip_getlevel(enum compress_mode mode);
+
 /* */
 size_t zip_compressedsize(size_t src_size)
 {
@@ -27,15 +93,7 @@ size_t zip_compressedsize(size_t src_size)
 size_t zip_compress(void* dest_buffer, size_t dest_size,
                     const void* buffer, size_t size, enum compress_mode mode)
 {
-    int c_level;
-    switch (mode)   {
-        case COMPRESS_NORMAL:   c_level = Z_DEFAULT_COMPRESSION;    break;
-        case COMPRESS_FAST:     c_level = Z_BEST_SPEED;             break;
-        case COMPRESS_BEST:     c_level = Z_BEST_COMPRESSION;       break;
-        case COMPRESS_NONE:     c_level = Z_NO_COMPRESSION;         break;
-        default:				c_level = Z_DEFAULT_COMPRESSION;	break;
-    }
-
+    int c_level = zip_getlevel(mode);
     uLongf dsize = (uLongf)dest_size;
     int r = compress2((Bytef*)dest_buffer, &dsize, (const Bytef*)buffer, (uLongf)size, c_level);
     return (r == Z_OK) ? (size_t)dsize : 0;
@@ -48,6 +106,332 @@ size_t zip_decompress(void* dest_buffer, size_t dest_size, const void* buffer, s
     return (r == Z_OK) ? (size_t)dsize : 0;
 }
 
+/*************************************************************************************************/
+static size_t zip_blocks_tablesize(uint block_cnt)
+{
+    return sizeof(struct zip_blocks_header) + sizeof(uint)*block_cnt;
+}
+
+static uint zip_blocks_count(size_t size, size_t block_size)
+{
+    return (uint)((size + block_size - 1)/block_size);
+}
+
+static void zip_blocks_compress_task(void* params, void* result, uint thread_id, uint job_id,
+                                     int worker_idx)
+{
+    struct zip_blocks_params* bparams = (struct zip_blocks_params*)params;
+
+    /* each block is written to it's worst case offset, they are packed after all are finished */
+    uint idx;
+    while ((idx = (uint)MT_ATOMIC_INCR(bparams->next_idx) - 1) < bparams->block_cnt)    {
+        size_t offset = idx*bparams->block_size;
+        size_t size = minsz(bparams->block_size, bparams->size - offset);
+        uint8* dest = bparams->dest + idx*bparams->block_maxsize;
+
+        mz_ulong dsize = (mz_ulong)bparams->block_maxsize;
+        int r = mz_compress2(dest, &dsize, bparams->src + offset, (mz_ulong)size, bparams->level);
+        if (r != MZ_OK || dsize >= size)    {
+            memcpy(dest, bparams->src + offset, size);
+            dsize = (mz_ulong)size;
+        }
+        bparams->comp_sizes[idx] = (uint)dsize;
+    }
+}
+
+static void zip_blocks_decompress_task(void* params, void* result, uint thread_id, uint job_id,
+                                       int worker_idx)
+{
+    struct zip_blocks_params* bparams = (struct zip_blocks_params*)params;
+
+    uint idx;
+    while ((idx = (uint)MT_ATOMIC_INCR(bparams->next_idx) - 1) < bparams->block_cnt)    {
+        size_t offset = idx*bparams->block_size;
+        size_t size = minsz(bparams->block_size, bparams->size - offset);
+        const uint8* src = bparams->src + bparams->offsets[idx];
+        uint comp_size = bparams->comp_sizes[idx];
+
+        if (comp_size == size)  {
+            memcpy(bparams->dest + offset, src, size);
+        }   else    {
+            mz_ulong dsize = (mz_ulong)size;
+            if (mz_uncompress(bparams->dest + offset, &dsize, src, comp_size) != MZ_OK ||
+                dsize != size)
+            {
+                MT_ATOMIC_SET(bparams->failed, TRUE);
+            }
+        }
+    }
+}
+
+/* runs block task on all task-manager threads, or in the caller thread if it's not initialized */
+static void zip_blocks_run(pfn_tsk_run run_fn, struct zip_blocks_params* params)
+{
+    uint job_id = (tsk_isinit() && params->block_cnt > 1) ?
+        tsk_dispatch(run_fn, TSK_CONTEXT_ALL, TSK_THREADS_ALL, params, NULL) : 0;
+    if (job_id != 0)    {
+        tsk_wait(job_id);
+        tsk_destroy(job_id);
+    }   else    {
+        run_fn(params, NULL, 0, 0, 0);
+    }
+}
+
+size_t zip_compressedsize_blocks(size_t src_size, size_t block_size)
+{
+    if (block_size == 0)
+        block_size = BLOCKS_DEFAULT_SIZE;
+    uint block_cnt = zip_blocks_count(src_size, block_size);
+    if (block_cnt == 0)
+        return zip_blocks_tablesize(0);
+
+    /* last block may be smaller */
+    return zip_blocks_tablesize(block_cnt) + (block_cnt - 1)*zip_compressedsize(block_size) +
+        zip_compressedsize(src_size - (block_cnt - 1)*block_size);
+}
+
+size_t zip_compress_blocks(void* dest_buffer, size_t dest_size, const void* buffer, size_t size,
+                           enum compress_mode mode, size_t block_size)
+{
+    if (block_size == 0)
+        block_size = BLOCKS_DEFAULT_SIZE;
+    ASSERT(block_size <= UINT32_MAX);
+
+    uint block_cnt = zip_blocks_count(size, block_size);
+    size_t table_sz = zip_blocks_tablesize(block_cnt);
+    if (dest_size < zip_compressedsize_blocks(size, block_size))
+        return 0;
+
+    uint* comp_sizes = (uint*)ALLOC(sizeof(uint)*(block_cnt + 1), 0);
+    if (comp_sizes == NULL)
+        return 0;
+
+    struct zip_blocks_params params;
+    memset(&params, 0x00, sizeof(params));
+    params.src = (const uint8*)buffer;
+    params.dest = (uint8*)dest_buffer + table_sz;
+    params.size = size;
+    params.block_size = block_size;
+    params.block_maxsize = zip_compressedsize(minsz(block_size, size));
+    params.comp_sizes = comp_sizes;
+    params.block_cnt = block_cnt;
+    params.level = zip_getlevel(mode);
+    zip_blocks_run(zip_blocks_compress_task, &params);
+
+    /* pack compressed blocks, they only move backwards so it's safe to do it in order */
+    uint8* dest = (uint8*)dest_buffer;
+    size_t offset = table_sz;
+    for (uint i = 0; i < block_cnt; i++)    {
+        memmove(dest + offset, params.dest + i*params.block_maxsize, comp_sizes[i]);
+        offset += comp_sizes[i];
+    }
+
+    struct zip_blocks_header header;
+    memcpy(header.sig, BLOCKS_SIGN, sizeof(header.sig));
+    header.block_size = (uint)block_size;
+    header.block_cnt = block_cnt;
+    header.size = size;
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), comp_sizes, sizeof(uint)*block_cnt);
+
+    FREE(comp_sizes);
+    return offset;
+}
+
+static int zip_blocks_readheader(const void* buffer, size_t size,
+                                 OUT struct zip_blocks_header* header)
+{
+    if (size < sizeof(struct zip_blocks_header))
+        return FALSE;
+    memcpy(header, buffer, sizeof(struct zip_blocks_header));
+    return memcmp(header->sig, BLOCKS_SIGN, sizeof(header->sig)) == 0 &&
+        header->block_size != 0 &&
+        size >= zip_blocks_tablesize(header->block_cnt) &&
+        zip_blocks_count((size_t)header->size, header->block_size) == header->block_cnt;
+}
+
+uint64 zip_blocks_getsize(const void* buffer, size_t size)
+{
+    struct zip_blocks_header header;
+    return zip_blocks_readheader(buffer, size, &header) ? header.size : 0;
+}
+
+size_t zip_decompress_blocks(void* dest_buffer, size_t dest_size, const void* buffer, size_t size)
+{
+    struct zip_blocks_header header;
+    if (!zip_blocks_readheader(buffer, size, &header) || header.size > dest_size ||
+        header.block_cnt == 0)
+    {
+        return 0;
+    }
+    size_t unzip_size = (size_t)header.size;
+
+    uint* comp_sizes = (uint*)ALLOC((sizeof(uint) + sizeof(size_t))*header.block_cnt, 0);
+    if (comp_sizes == NULL)
+        return 0;
+    size_t* offsets = (size_t*)(comp_sizes + header.block_cnt);
+    memcpy(comp_sizes, (const uint8*)buffer + sizeof(header), sizeof(uint)*header.block_cnt);
+
+    /* block offsets, and validate them against the buffer size */
+    size_t offset = zip_blocks_tablesize(header.block_cnt);
+    for (uint i = 0; i < header.block_cnt; i++) {
+        offsets[i] = offset;
+        offset += comp_sizes[i];
+    }
+    if (offset > size)  {
+        FREE(comp_sizes);
+        return 0;
+    }
+
+    struct zip_blocks_params params;
+    memset(&params, 0x00, sizeof(params));
+    params.src = (const uint8*)buffer;
+    params.dest = (uint8*)dest_buffer;
+    params.size = unzip_size;
+    params.block_size = header.block_size;
+    params.offsets = offsets;
+    params.comp_sizes = comp_sizes;
+    params.block_cnt = header.block_cnt;
+    zip_blocks_run(zip_blocks_decompress_task, &params);
+
+    FREE(comp_sizes);
+    return params.failed ? 0 : unzip_size;
+}
+
+/*************************************************************************************************/
+static void* zip_stream_alloc(void* opaque, size_t items, size_t size)
+{
+    return A_ALLOC((struct allocator*)opaque, items*size, 0);
+}
+
+static void zip_stream_free(void* opaque, void* address)
+{
+    A_FREE((struct allocator*)opaque, address);
+}
+
+static int zip_stream_init(struct zip_stream* s)
+{
+    memset(&s->s, 0x00, sizeof(mz_stream));
+    s->s.zalloc = zip_stream_alloc;
+    s->s.zfree = zip_stream_free;
+    s->s.opaque = s->alloc;
+
+    if (s->deflate) {
+        return mz_deflateInit2(&s->s, s->level, MZ_DEFLATED, s->window_bits, 9,
+            MZ_DEFAULT_STRATEGY) == MZ_OK;
+    }   else    {
+        return mz_inflateInit2(&s->s, s->window_bits) == MZ_OK;
+    }
+}
+
+static zipstream_t zip_stream_create(struct allocator* alloc, int deflate, int window_bits,
+                                     int level)
+{
+    if (alloc == NULL)
+        alloc = mem_heap();
+
+    struct zip_stream* s = (struct zip_stream*)A_ALLOC(alloc, sizeof(struct zip_stream), 0);
+    if (s == NULL)
+        return NULL;
+    s->alloc = alloc;
+    s->deflate = deflate;
+    s->window_bits = window_bits;
+    s->level = level;
+
+    if (!zip_stream_init(s))    {
+        A_FREE(alloc, s);
+        return NULL;
+    }
+    return s;
+}
+
+static int zip_getlevel(enum compress_mode mode)
+{
+    switch (mode)   {
+        case COMPRESS_NORMAL:   return Z_DEFAULT_COMPRESSION;
+        case COMPRESS_FAST:     return Z_BEST_SPEED;
+        case COMPRESS_BEST:     return Z_BEST_COMPRESSION;
+        case COMPRESS_NONE:     return Z_NO_COMPRESSION;
+        default:                return Z_DEFAULT_COMPRESSION;
+    }
+}
+
+zipstream_t zip_stream_deflate(struct allocator* alloc, enum compress_mode mode)
+{
+    return zip_stream_create(alloc, TRUE, MZ_DEFAULT_WINDOW_BITS, zip_getlevel(mode));
+}
+
+zipstream_t zip_stream_inflate(struct allocator* alloc)
+{
+    return zip_stream_create(alloc, FALSE, MZ_DEFAULT_WINDOW_BITS, 0);
+}
+
+void zip_stream_destroy(zipstream_t s)
+{
+    ASSERT(s);
+    if (s->deflate)
+        mz_deflateEnd(&s->s);
+    else
+        mz_inflateEnd(&s->s);
+    A_FREE(s->alloc, s);
+}
+
+result_t zip_stream_reset(zipstream_t s)
+{
+    if (s->deflate) {
+        return mz_deflateReset(&s->s) == MZ_OK ? RET_OK : RET_FAIL;
+    }   else    {
+        /* miniz doesn't have inflateReset, inflate state is small to re-create */
+        mz_inflateEnd(&s->s);
+        return zip_stream_init(s) ? RET_OK : RET_OUTOFMEMORY;
+    }
+}
+
+enum zip_status zip_stream_process(zipstream_t s, const void* in, INOUT size_t* in_size,
+                                   void* out, INOUT size_t* out_size, int finish)
+{
+    size_t in_avail = *in_size;
+    size_t out_avail = *out_size;
+    const uint8* in_ptr = (const uint8*)in;
+    uint8* out_ptr = (uint8*)out;
+    int r;
+
+    /* miniz works with 32bit sizes, feed large buffers in chunks */
+    do  {
+        uint in_chunk = (uint)(in_avail < STREAM_CHUNK_MAX ? in_avail : STREAM_CHUNK_MAX);
+        uint out_chunk = (uint)(out_avail < STREAM_CHUNK_MAX ? out_avail : STREAM_CHUNK_MAX);
+        s->s.next_in = in_ptr;
+        s->s.avail_in = in_chunk;
+        s->s.next_out = out_ptr;
+        s->s.avail_out = out_chunk;
+
+        if (s->deflate)
+            r = mz_deflate(&s->s, (finish && in_chunk == in_avail) ? MZ_FINISH : MZ_NO_FLUSH);
+        else
+            r = mz_inflate(&s->s, MZ_SYNC_FLUSH);
+
+        size_t in_used = in_chunk - s->s.avail_in;
+        size_t out_used = out_chunk - s->s.avail_out;
+        in_ptr += in_used;
+        in_avail -= in_used;
+        out_ptr += out_used;
+        out_avail -= out_used;
+
+        if (r != MZ_OK || (in_used == 0 && out_used == 0))
+            break;
+    }   while (in_avail > 0 && out_avail > 0);
+
+    *in_size -= in_avail;
+    *out_size -= out_avail;
+
+    if (r == MZ_STREAM_END)
+        return ZIP_STATUS_END;
+    else if (r == MZ_OK || r == MZ_BUF_ERROR)
+        return ZIP_STATUS_OK;   /* buf-error: no progress, needs more input or output space */
+    else
+        return ZIP_STATUS_ERROR;
+}
+
 zip_t zip_open(const char *filepath)
 {
     mz_zip_archive *zip = (mz_zip_archive*)ALLOC(sizeof(mz_zip_archive), 0);
@@ -103,3 +487,120 @@ file_t zip_getfile(zip_t zip, const char *filepath, struct allocator *alloc)
 
     return fio_attachmem(alloc, buff, (size_t)stat.m_uncomp_size, filepath, 0);
 }
+
+/*************************************************************************************************/
+static size_t zip_file_readraw(struct zip_filestream* zf, void* buffer, size_t size)
+{
+    uint64 remain_sz = zf->comp_size - zf->comp_offset;
+    size = remain_sz < size ? (size_t)remain_sz : size;
+    if (size == 0)
+        return 0;
+
+    size_t r = zf->zip->m_pRead(zf->zip->m_pIO_opaque, zf->data_offset + zf->comp_offset, buffer,
+                                size);
+    zf->comp_offset += r;
+    return r;
+}
+
+static size_t zip_file_read(void* param, void* buffer, size_t size)
+{
+    struct zip_filestream* zf = (struct zip_filestream*)param;
+    if (zf->inflater == NULL)
+        return zip_file_readraw(zf, buffer, size);
+
+    size_t read_sz = 0;
+    while (read_sz < size)  {
+        /* refill compressed data buffer */
+        if (zf->buff_offset == zf->buff_size)   {
+            zf->buff_offset = 0;
+            zf->buff_size = zip_file_readraw(zf, zf->buff, FILE_BUFFER_SIZE);
+        }
+
+        size_t in_sz = zf->buff_size - zf->buff_offset;
+        size_t out_sz = size - read_sz;
+        enum zip_status s = zip_stream_process(zf->inflater, zf->buff + zf->buff_offset, &in_sz,
+                                               (uint8*)buffer + read_sz, &out_sz, FALSE);
+        zf->buff_offset += in_sz;
+        read_sz += out_sz;
+
+        if (s != ZIP_STATUS_OK || (in_sz == 0 && out_sz == 0))
+            break;
+    }
+    return read_sz;
+}
+
+static int zip_file_rewind(void* param)
+{
+    struct zip_filestream* zf = (struct zip_filestream*)param;
+    zf->comp_offset = 0;
+    zf->buff_offset = zf->buff_size = 0;
+    return zf->inflater == NULL || IS_OK(zip_stream_reset(zf->inflater));
+}
+
+static void zip_file_close(void* param)
+{
+    struct zip_filestream* zf = (struct zip_filestream*)param;
+    if (zf->inflater != NULL)
+        zip_stream_destroy(zf->inflater);
+    if (zf->buff != NULL)
+        A_FREE(zf->alloc, zf->buff);
+    A_FREE(zf->alloc, zf);
+}
+
+file_t zip_openfile(zip_t zip, const char *filepath, struct allocator *alloc)
+{
+    int idx = mz_zip_reader_locate_file(zip, filepath, NULL, 0);
+    if (idx == -1)
+        return NULL;
+
+    mz_zip_archive_file_stat stat;
+    if (!mz_zip_reader_file_stat(zip, idx, &stat))
+        return NULL;
+    if (stat.m_method != 0 && stat.m_method != MZ_DEFLATED)   {
+        err_printf(__FILE__, __LINE__, "zip open-file failed: unsupported method for '%s'",
+                   filepath);
+        return NULL;
+    }
+
+    /* file data comes after local header and it's variable length fields */
+    uint8 lheader[ZIP_LOCALHEADER_SIZE];
+    if (zip->m_pRead(zip->m_pIO_opaque, stat.m_local_header_ofs, lheader,
+                     ZIP_LOCALHEADER_SIZE) != ZIP_LOCALHEADER_SIZE ||
+        (lheader[0] | (lheader[1]<<8) | (lheader[2]<<16) | ((uint)lheader[3]<<24)) !=
+        ZIP_LOCALHEADER_SIG)
+    {
+        err_printf(__FILE__, __LINE__, "zip open-file failed: invalid header for '%s'", filepath);
+        return NULL;
+    }
+    uint name_len = lheader[26] | (lheader[27]<<8);
+    uint extra_len = lheader[28] | (lheader[29]<<8);
+
+    if (alloc == NULL)
+        alloc = mem_heap();
+
+    struct zip_filestream* zf = (struct zip_filestream*)A_ALLOC(alloc,
+        sizeof(struct zip_filestream), 0);
+    if (zf == NULL)
+        return NULL;
+    memset(zf, 0x00, sizeof(struct zip_filestream));
+    zf->zip = zip;
+    zf->alloc = alloc;
+    zf->data_offset = stat.m_local_header_ofs + ZIP_LOCALHEADER_SIZE + name_len + extra_len;
+    zf->comp_size = stat.m_comp_size;
+
+    if (stat.m_method == MZ_DEFLATED)   {
+        /* zip archive files are raw deflate streams (no zlib header) */
+        zf->inflater = zip_stream_create(alloc, FALSE, -MZ_DEFAULT_WINDOW_BITS, 0);
+        zf->buff = (uint8*)A_ALLOC(alloc, FILE_BUFFER_SIZE, 0);
+        if (zf->inflater == NULL || zf->buff == NULL)   {
+            zip_file_close(zf);
+            return NULL;
+        }
+    }
+
+    file_t f = fio_openstream(filepath, stat.m_uncomp_size, zip_file_read, zip_file_rewind,
+                              zip_file_close, zf);
+    if (f == NULL)
+        zip_file_close(zf);
+    return f;
+}
@@ -37,7 +37,8 @@ static const struct unit_test_desc g_tests[] = {
     {test_mempool, "pool", "Pool allocator"},
     {test_thread, "thread", "Basic threads"},
     {test_taskmgr, "taskmgr", "Task manager"},
-    {test_hashtable, "hashtable_fixed", "Hash tables (fixed)"}
+    {test_hashtable, "hashtable_fixed", "Hash tables (fixed)"},
+    {test_hash, "hash", "Hash functions"}
     /*, {test_efsw, "watcher", "filesystem monitoring"}*/
 };
 
@@ -60,6 +61,8 @@ void cmd_gettest(command_t* cmd, void* param)
         g_testidx = 5;
     }   else if (str_isequal_nocase(cmd->arg, "hashtable")) {
         g_testidx = 6;
+    }   else if (str_isequal_nocase(cmd->arg, "hash"))  {
+        g_testidx = 7;
     }
 }
 
@@ -26,6 +26,7 @@ void test_mempool();
 void test_thread();
 void test_efsw();
 void test_taskmgr();
+void test_hash();
 _EXTERN_ void test_hashtable();
 
 INLINE void fill_buffer(void* buffer, size_t size)
@@ -0,0 +1,178 @@
+/***********************************************************************************
+ * Copyright (c) 2012, Sepehr Taghdisian
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ ***********************************************************************************/
+
+#include "dhcore-test.h"
+#include "dhcore/core.h"
+#include "dhcore/hash.h"
+#include "dhcore/timer.h"
+
+#define HASH_SEED   0x9747b28c
+
+struct hash_known
+{
+    size_t size;
+    uint64 fast64;
+    uint64 fast128[2];
+};
+
+/* known answers for the first 'size' bytes of the pattern buffer, same for SSE and scalar paths
+ * sizes above 1024 (16 stripes) pass through lane scrambling, with and without a partial tail */
+static const struct hash_known g_known[] = {
+    {0, 0x8eb02393015bea2eULL, {0x8eb02393015bea2eULL, 0x53c8d895b829d77aULL}},
+    {1, 0xe9d23831bcac8607ULL, {0xe9d23831bcac8607ULL, 0x333b6b9edc739ca1ULL}},
+    {3, 0xd0ae3a578b2ecbe6ULL, {0xd0ae3a578b2ecbe6ULL, 0x04ebf49b596da40cULL}},
+    {8, 0x3878bf7ccf2f047cULL, {0x3878bf7ccf2f047cULL, 0xe8fcab3821cb879eULL}},
+    {15, 0xbcbd0af3c16c95c6ULL, {0xbcbd0af3c16c95c6ULL, 0x0f95342ba0b00697ULL}},
+    {16, 0xe7bea654d774bde0ULL, {0xe7bea654d774bde0ULL, 0xe2b01493d2d1222aULL}},
+    {31, 0x78b87648e7d5fcffULL, {0x78b87648e7d5fcffULL, 0xb1ca4b06559ac29aULL}},
+    {63, 0x49a0c8e9e6473ec7ULL, {0x49a0c8e9e6473ec7ULL, 0x36c1549292497b3aULL}},
+    {64, 0x78c9f12c06891fdaULL, {0x78c9f12c06891fdaULL, 0xec056ed3d41b3ea3ULL}},
+    {65, 0xb03abc9e50dc0cb0ULL, {0xb03abc9e50dc0cb0ULL, 0x9e3370c8f9f91326ULL}},
+    {127, 0xd61133af2f4be906ULL, {0xd61133af2f4be906ULL, 0xb3bd85acfbb60aa0ULL}},
+    {200, 0x5ada6cfe3e9f0895ULL, {0x5ada6cfe3e9f0895ULL, 0x9a79b46efd78742aULL}},
+    {1000, 0x9a0507d519cccf36ULL, {0x9a0507d519cccf36ULL, 0x84ef8c565a46433fULL}},
+    {1023, 0x051e3a13f968aabdULL, {0x051e3a13f968aabdULL, 0x6740054216126d0bULL}},
+    {1024, 0x13b1b014db96775fULL, {0x13b1b014db96775fULL, 0xaf09887354bedf5fULL}},
+    {1025, 0xe71f30ba66e44608ULL, {0xe71f30ba66e44608ULL, 0x29aad573c4a56fe5ULL}},
+    {1087, 0x78daa7943a84c80dULL, {0x78daa7943a84c80dULL, 0xffe39272e465c042ULL}},
+    {2048, 0x4ee128e45f7523f7ULL, {0x4ee128e45f7523f7ULL, 0xa8426d93c6a6afbeULL}},
+    {2111, 0x7a24270f83e5c542ULL, {0x7a24270f83e5c542ULL, 0x0c6605ba05a64f45ULL}},
+    {3079, 0x604323239fcd226bULL, {0x604323239fcd226bULL, 0x5b2442d6308b72a2ULL}},
+    {4096, 0x06a442fb1fb2ede5ULL, {0x06a442fb1fb2ede5ULL, 0x43d5135d4c9eb833ULL}},
+    {5000, 0x9a2b1d0339cf22b6ULL, {0x9a2b1d0339cf22b6ULL, 0xe176e2bea8e74fc7ULL}},
+    {8191, 0x29b580b90bb7b780ULL, {0x29b580b90bb7b780ULL, 0xc45715336f1bc9a0ULL}}
+};
+
+static void fill_pattern(uint8* buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buffer[i] = (uint8)(i*31 + 7);
+}
+
+/* checks known answers, and that results do not depend on alignment or on bytes after the data */
+static int check_hash()
+{
+    static uint8 buffer[8192];
+    static uint8 shifted[8192 + 16];
+    int fails = 0;
+    fill_pattern(buffer, sizeof(buffer));
+
+    if (hash_murmur32("hello", 5, 0) != 0x248bfa47) {
+        log_print(LOG_TEXT, "murmur32: known answer failed");
+        fails++;
+    }
+
+    hash_t m = hash_murmur128("hello", 5, 0);
+    if (m.h[0] != 0xcbd8a7b341bd9b02ULL || m.h[1] != 0x5b1e906a48ae1d19ULL)  {
+        log_print(LOG_TEXT, "murmur128: known answer failed");
+        fails++;
+    }
+
+    for (uint i = 0; i < sizeof(g_known)/sizeof(struct hash_known); i++)    {
+        const struct hash_known* k = &g_known[i];
+        hash_t h = hash_fast128(buffer, k->size, HASH_SEED);
+
+        /* same data from an unaligned address */
+        uint8* data = shifted + 1 + i%15;
+        memcpy(data, buffer, k->size);
+        hash_t hu = hash_fast128(data, k->size, HASH_SEED);
+
+        if (hash_fast64(buffer, k->size, HASH_SEED) != k->fast64 ||
+            h.h[0] != k->fast128[0] || h.h[1] != k->fast128[1] ||
+            hash_fast64(data, k->size, HASH_SEED) != k->fast64 || !hash_isequal(hu, h))
+        {
+            log_printf(LOG_TEXT, "fast64/fast128: known answer failed (size = %d)", (uint)k->size);
+            fails++;
+        }
+    }
+
+    /* every length up to two stripes and a tail, from all alignments, with garbage after data */
+    for (size_t size = 0; size <= 160; size++)  {
+        uint64 h64 = hash_fast64(buffer, size, HASH_SEED);
+        hash_t h128 = hash_fast128(buffer, size, HASH_SEED);
+        hash_t hm = hash_murmur128(buffer, size, HASH_SEED);
+
+        for (uint offset = 1; offset < 16; offset++)   {
+            memset(shifted, 0xcd, sizeof(shifted));
+            memcpy(shifted + offset, buffer, size);
+            const uint8* data = shifted + offset;
+
+            if (hash_fast64(data, size, HASH_SEED) != h64 ||
+                !hash_isequal(hash_fast128(data, size, HASH_SEED), h128) ||
+                !hash_isequal(hash_murmur128(data, size, HASH_SEED), hm))
+            {
+                log_printf(LOG_TEXT, "unstable hash (size = %d, offset = %d)", (uint)size, offset);
+                fails++;
+                break;
+            }
+        }
+    }
+
+    return fails;
+}
+
+void test_hash()
+{
+    int fails = check_hash();
+    if (fails > 0)
+        log_printf(LOG_TEXT, "%d hash checks failed", fails);
+    else
+        log_print(LOG_TEXT, "hash checks passed.");
+
+
+    /* keep the buffer small enough to stay in cache, so we measure hashing and not memory */
+    const size_t buffer_size = 1024*1024;
+    const uint iter_cnt = 500;
+
+    log_printf(LOG_TEXT, "hashing %d mb buffer %d times...", (uint)(buffer_size/(1024*1024)),
+        iter_cnt);
+    void* buffer = ALLOC(buffer_size, 0);
+    ASSERT(buffer);
+    fill_buffer(buffer, buffer_size);
+
+    hash_t h;
+    float mb = (float)(buffer_size*iter_cnt)/(1024.0f*1024.0f);
+
+    uint64 t1 = timer_querytick();
+    for (uint i = 0; i < iter_cnt; i++)
+        h = hash_murmur128(buffer, buffer_size, i);
+    float tm = (float)timer_calctm(t1, timer_querytick());
+    log_printf(LOG_TEXT, "murmur128: took %f ms (%.1f mb/s), last hash: %llx",
+        tm*1000.0f, mb/tm, (unsigned long long)h.h[0]);
+
+    t1 = timer_querytick();
+    for (uint i = 0; i < iter_cnt; i++)
+        h = hash_fast128(buffer, buffer_size, i);
+    tm = (float)timer_calctm(t1, timer_querytick());
+    log_printf(LOG_TEXT, "fast128: took %f ms (%.1f mb/s), last hash: %llx",
+        tm*1000.0f, mb/tm, (unsigned long long)h.h[0]);
+
+    /* small buffers, where per-call overhead matters */
+    const uint small_cnt = 1000000;
+    uint64 hs = 0;
+    t1 = timer_querytick();
+    for (uint i = 0; i < small_cnt; i++)
+        hs += hash_murmur128((uint8*)buffer + (i & 0xffff), 200, 0).h[0];
+    log_printf(LOG_TEXT, "murmur128 (200 bytes x %d): took %f ms", small_cnt,
+        timer_calctm(t1, timer_querytick())*1000.0f);
+
+    t1 = timer_querytick();
+    for (uint i = 0; i < small_cnt; i++)
+        hs += hash_fast128((uint8*)buffer + (i & 0xffff), 200, 0).h[0];
+    log_printf(LOG_TEXT, "fast128 (200 bytes x %d): took %f ms (%llx)", small_cnt,
+        timer_calctm(t1, timer_querytick())*1000.0f, (unsigned long long)hs);
+
+    FREE(buffer);
+}
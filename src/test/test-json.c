@@ -18,8 +18,87 @@
 #include "dhcore/json.h"
 #include "dhcore/file-io.h"
 
+/* truncated documents must fail without reading past the (non zero-terminated) buffer */
+static const char* g_truncated[] = {
+    "{", "[", "{\"a\"", "{\"a\" ", "{\"a\":", "{\"a\": ", "{\"a\":1", "{\"a\":1 ",
+    "{\"a\":1,", "[1", "[1 ", "[1,", "[1, "
+};
+
+static void test_json_truncated()
+{
+    int fails = 0;
+    for (uint i = 0; i < sizeof(g_truncated)/sizeof(const char*); i++)   {
+        /* exact sized copy, so overreads hit the end of the allocation */
+        size_t len = strlen(g_truncated[i]);
+        char* text = (char*)ALLOC(len, 0);
+        memcpy(text, g_truncated[i], len);
+        json_t j = json_parsebuffer(text, len, mem_heap());
+        if (j != NULL)  {
+            log_printf(LOG_WARNING, "truncated json '%s' is parsed", g_truncated[i]);
+            json_destroy(j);
+            fails++;
+        }
+        FREE(text);
+    }
+    err_clear();
+
+    if (fails == 0)
+        log_print(LOG_TEXT, "truncated json checks passed.");
+    else
+        log_printf(LOG_WARNING, "truncated json checks failed: %d", fails);
+}
+
+/* numbers must be restored exactly from binary documents, including the sign of zero */
+static void test_json_bin()
+{
+    static const uint8 expected[] = {
+        0x94,   /* array of 4 */
+        0xca, 0x80, 0x00, 0x00, 0x00,   /* -0.0 (float32) */
+        0x00,   /* 0 */
+        0xff,   /* -1 */
+        0xca, 0x3f, 0xc0, 0x00, 0x00    /* 1.5 (float32) */
+    };
+    int fails = 0;
+
+    json_t j = json_create_arr();
+    json_additem_toarr(j, json_create_num(-0.0));
+    json_additem_toarr(j, json_create_num(0.0));
+    json_additem_toarr(j, json_create_num(-1.0));
+    json_additem_toarr(j, json_create_num(1.5));
+
+    size_t size;
+    char* buf = json_savetobinbuffer(j, &size);
+    json_destroy(j);
+    if (buf == NULL || size != sizeof(expected) || memcmp(buf, expected, size) != 0)
+        fails++;
+
+    /* parse and write it again, result must be the same */
+    json_t jb = buf != NULL ? json_parsebin(buf, size) : NULL;
+    if (jb != NULL) {
+        size_t size2;
+        char* buf2 = json_savetobinbuffer(jb, &size2);
+        if (buf2 == NULL || size2 != size || memcmp(buf2, buf, size) != 0)
+            fails++;
+        if (buf2 != NULL)
+            json_deletebuffer(buf2);
+        json_destroy(jb);
+    }   else    {
+        fails++;
+    }
+    if (buf != NULL)
+        json_deletebuffer(buf);
+
+    if (fails == 0)
+        log_print(LOG_TEXT, "binary json checks passed.");
+    else
+        log_printf(LOG_WARNING, "binary json checks failed: %d", fails);
+}
+
 void test_json()
 {
+    test_json_truncated();
+    test_json_bin();
+
     file_t f = fio_opendisk("data.json", TRUE);
     if (f != NULL)     {
         json_t j = json_parsefilef(f, mem_heap());
@@ -41,6 +41,7 @@ SOURCES += \
     test-pool.c \
     test-taskmgr.c \
     test-thread.c \
+    test-hash.c \
     test-hashtable.cpp
 
 HEADERS += \